@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+"""
+Benchmark of OpenOCD jtag_esp_remote driver against esp_remote_sim.py server.
+
+Starts the simulated server (unless --host is given to use an already running
+one, e.g. on another machine in the LAN), runs OpenOCD with a generated config
+and reports the rate of short DR scans (latency bound) and the throughput of
+long DR scans (bandwidth bound) for every requested protocol version.
+
+Usage:
+    ./esp_remote_bench.py [--openocd ../../src/openocd] [--proto 1 2] [--scans 2000]
+                          [--bits 32768] [--reps 20] [--host ADDR] [--port 5555]
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+
+CFG_TEMPLATE = """
+adapter driver jtag_esp_remote
+jtag_esp_remote_protocol tcp
+jtag_esp_remote_set_address {host}
+jtag_esp_remote_set_port {port}
+jtag_esp_remote_set_protocol_version {proto}
+adapter speed 20000
+transport select jtag
+jtag newtap sim tap -irlen 5 -expected-id 0x120034e5
+init
+irscan sim.tap 0x10
+set fields {{}}
+for {{set i 0}} {{$i < {fields}}} {{incr i}} {{ lappend fields 32 0x5a5a5a5a }}
+set t [time {{drscan sim.tap 32 0x12345678}} {scans}]
+echo "BENCH short $t"
+set t [time {{drscan sim.tap {{*}}$fields}} {reps}]
+echo "BENCH long $t"
+shutdown
+"""
+
+
+def run_one(args, proto):
+    server = None
+    host = args.host or '127.0.0.1'
+    if not args.host:
+        server = subprocess.Popen([sys.executable, os.path.join(SCRIPT_DIR, 'esp_remote_sim.py'),
+                                   '--port', str(args.port), '--proto', '2', '--once',
+                                   '--dr-len', str(args.bits)],
+                                  stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        # wait for the server to start listening
+        server.stdout.readline()
+    fields = args.bits // 32
+    cfg = CFG_TEMPLATE.format(host=host, port=args.port, proto=proto, scans=args.scans,
+                              fields=fields, reps=args.reps)
+    with tempfile.NamedTemporaryFile('w', suffix='.cfg', delete=False) as f:
+        f.write(cfg)
+        cfg_path = f.name
+    try:
+        start = time.time()
+        out = subprocess.run([args.openocd, '-f', cfg_path], stdout=subprocess.PIPE,
+                             stderr=subprocess.STDOUT, text=True, timeout=600).stdout
+        elapsed = time.time() - start
+    finally:
+        os.unlink(cfg_path)
+        if server:
+            server.wait(timeout=10)
+    res = dict(re.findall(r'BENCH (\w+) (\d+) microseconds per iteration', out))
+    if 'short' not in res or 'long' not in res:
+        print(out)
+        raise RuntimeError('OpenOCD run failed')
+    ver = re.search(r'using protocol v(\d)', out)
+    short_us = int(res['short'])
+    long_us = int(res['long'])
+    print('proto %-4s (v%s): %8.0f scans/s, %8.1f KB/s (%d bits per scan), total %.1f s' %
+          (proto, ver.group(1) if ver else '?', 1e6 / max(short_us, 1),
+           (fields * 4) / 1024 / (max(long_us, 1) / 1e6), fields * 32, elapsed))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='jtag_esp_remote driver benchmark')
+    parser.add_argument('--openocd', default=os.path.join(SCRIPT_DIR, '../../src/openocd'))
+    parser.add_argument('--proto', nargs='+', default=['1', '2'],
+                        help="protocol versions to measure ('auto', 1, 2)")
+    parser.add_argument('--scans', type=int, default=2000, help='number of short scans')
+    parser.add_argument('--bits', type=int, default=32768, help='length of long scans in bits')
+    parser.add_argument('--reps', type=int, default=20, help='number of long scans')
+    parser.add_argument('--host', help='use already running server at this address')
+    parser.add_argument('--port', type=int, default=5555)
+    args = parser.parse_args()
+
+    for proto in args.proto:
+        run_one(args, proto)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,264 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+"""
+Reference server for the TCP mode of OpenOCD jtag_esp_remote adapter driver.
+
+Speaks both v1 (one command per message) and v2 (batched) protocols and drives
+a simulated JTAG TAP instead of real hardware, so the driver can be tested and
+benchmarked without a probe. The TAP implements IDCODE, BYPASS and one user
+data register which returns the value written to it by the previous scan.
+
+Usage:
+    ./esp_remote_sim.py [--host 127.0.0.1] [--port 5555] [--proto 2] [--irlen 5] [--idcode 0x120034e5]
+                        [--dr-ir 0x10] [--dr-len 32] [--once]
+
+OpenOCD side:
+    adapter driver jtag_esp_remote
+    jtag_esp_remote_protocol tcp
+    jtag_esp_remote_set_port 5555
+    adapter speed 20000
+    transport select jtag
+    jtag newtap sim tap -irlen 5 -expected-id 0x120034e5
+"""
+
+import argparse
+import socket
+import struct
+import sys
+
+CMD_RESET = 1
+CMD_SCAN = 2
+CMD_TMS_SEQ = 3
+CMD_SET_CLK = 4
+CMD_VERSION = 5
+CMD_BATCH = 6
+
+# TAP states
+(RESET, IDLE, DRSELECT, DRCAPTURE, DRSHIFT, DREXIT1, DRPAUSE, DREXIT2, DRUPDATE,
+ IRSELECT, IRCAPTURE, IRSHIFT, IREXIT1, IRPAUSE, IREXIT2, IRUPDATE) = range(16)
+
+# next state for TMS=0 and TMS=1
+TAP_NEXT = {
+    RESET: (IDLE, RESET),
+    IDLE: (IDLE, DRSELECT),
+    DRSELECT: (DRCAPTURE, IRSELECT),
+    DRCAPTURE: (DRSHIFT, DREXIT1),
+    DRSHIFT: (DRSHIFT, DREXIT1),
+    DREXIT1: (DRPAUSE, DRUPDATE),
+    DRPAUSE: (DRPAUSE, DREXIT2),
+    DREXIT2: (DRSHIFT, DRUPDATE),
+    DRUPDATE: (IDLE, DRSELECT),
+    IRSELECT: (IRCAPTURE, RESET),
+    IRCAPTURE: (IRSHIFT, IREXIT1),
+    IRSHIFT: (IRSHIFT, IREXIT1),
+    IREXIT1: (IRPAUSE, IRUPDATE),
+    IRPAUSE: (IRPAUSE, IREXIT2),
+    IREXIT2: (IRSHIFT, IRUPDATE),
+    IRUPDATE: (IDLE, DRSELECT),
+}
+
+IR_IDCODE = 0x01
+
+
+class Tap:
+    """Single TAP with IDCODE, BYPASS and one user data register."""
+
+    def __init__(self, irlen, idcode, dr_ir, dr_len):
+        self.irlen = irlen
+        self.idcode = idcode
+        self.dr_ir = dr_ir
+        self.dr_len = dr_len
+        self.dr_value = 0
+        self.clocks = 0
+        self.reset()
+
+    def reset(self):
+        self.state = RESET
+        self.ir = IR_IDCODE
+        self.shift = 0
+        self.shift_len = 0
+
+    def _capture(self):
+        if self.state == IRCAPTURE:
+            self.shift, self.shift_len = 0x1, self.irlen
+        elif self.ir == IR_IDCODE:
+            self.shift, self.shift_len = self.idcode, 32
+        elif self.ir == self.dr_ir:
+            self.shift, self.shift_len = self.dr_value, self.dr_len
+        else:
+            self.shift, self.shift_len = 0, 1
+
+    def _update(self):
+        if self.state == IRUPDATE:
+            self.ir = self.shift
+        elif self.ir == self.dr_ir:
+            self.dr_value = self.shift
+
+    def clock(self, tms, tdi):
+        """One TCK cycle, returns TDO."""
+        self.clocks += 1
+        tdo = 0
+        if self.state in (DRSHIFT, IRSHIFT):
+            tdo = self.shift & 1
+            self.shift = (self.shift >> 1) | (tdi << (self.shift_len - 1))
+        self.state = TAP_NEXT[self.state][tms]
+        if self.state in (DRCAPTURE, IRCAPTURE):
+            self._capture()
+        elif self.state in (DRUPDATE, IRUPDATE):
+            self._update()
+        elif self.state == RESET:
+            self.ir = IR_IDCODE
+        return tdo
+
+    def scan(self, tdi, nbits, flip_tms):
+        """Clocks nbits of TDI (int, LSB first) with TMS=0, TMS=1 on the last bit if flip_tms."""
+        if nbits == 0:
+            return 0
+        head = nbits - 1 if flip_tms else nbits
+        tdo = 0
+        if head > 0:
+            if self.state in (DRSHIFT, IRSHIFT):
+                # the shift register works as a delay line of shift_len bits
+                mask = (1 << self.shift_len) - 1
+                stream = self.shift | ((tdi & ((1 << head) - 1)) << self.shift_len)
+                tdo = stream & ((1 << head) - 1)
+                self.shift = (stream >> head) & mask
+                self.clocks += head
+            else:
+                for i in range(head):
+                    tdo |= self.clock(0, (tdi >> i) & 1) << i
+        if flip_tms:
+            tdo |= self.clock(1, (tdi >> head) & 1) << head
+        return tdo
+
+    def tms_seq(self, tms, nbits):
+        for i in range(nbits):
+            self.clock((tms >> i) & 1, 0)
+
+
+def recv_exact(conn, size):
+    buf = bytearray()
+    while len(buf) < size:
+        chunk = conn.recv(size - len(buf))
+        if not chunk:
+            raise EOFError
+        buf += chunk
+    return bytes(buf)
+
+
+class Server:
+    def __init__(self, tap, proto, verbose=False):
+        self.tap = tap
+        self.proto = proto
+        self.verbose = verbose
+        self.stats = {'cmds': 0, 'batches': 0, 'scans': 0, 'bytes_in': 0, 'bytes_out': 0}
+
+    def exec_cmd(self, func, spec, data):
+        """Executes one v1 command, returns TDO bytes to be sent back."""
+        self.stats['cmds'] += 1
+        if func == CMD_SCAN:
+            nbits = spec & 0xfff
+            read = (spec >> 12) & 1
+            flip_tms = (spec >> 13) & 1
+            self.stats['scans'] += 1
+            tdo = self.tap.scan(int.from_bytes(data, 'little'), nbits, flip_tms)
+            if read:
+                return tdo.to_bytes(len(data), 'little')
+        elif func == CMD_TMS_SEQ:
+            self.tap.tms_seq(int.from_bytes(data, 'little'), spec & 0xfff)
+        elif func == CMD_RESET:
+            if (spec >> 1) & 1:
+                self.tap.reset()
+        elif func == CMD_SET_CLK:
+            if self.verbose:
+                print('clock %d Hz' % struct.unpack('>I', data)[0])
+        else:
+            print('unknown command %d' % func, file=sys.stderr)
+        return b''
+
+    @staticmethod
+    def data_len(func, spec):
+        if func in (CMD_SCAN, CMD_TMS_SEQ):
+            return ((spec & 0xfff) + 7) // 8
+        if func == CMD_SET_CLK:
+            return 4
+        return 0
+
+    def exec_batch(self, payload):
+        tdo = bytearray()
+        pos = 0
+        while pos < len(payload):
+            _, func, spec = struct.unpack_from('<BBH', payload, pos)
+            pos += 4
+            dlen = self.data_len(func, spec)
+            tdo += self.exec_cmd(func, spec, payload[pos:pos + dlen])
+            pos += dlen
+        return bytes(tdo)
+
+    def serve(self, conn):
+        while True:
+            hdr = recv_exact(conn, 4)
+            self.stats['bytes_in'] += 4
+            ver_byte, func, spec = struct.unpack('<BBH', hdr)
+            ver = ver_byte >> 4
+            reply = b''
+            if func == CMD_VERSION:
+                if self.proto >= 2:
+                    reply = struct.pack('<BBH', min(self.proto, 15) << 4, CMD_VERSION, 0)
+            elif func == CMD_BATCH and ver >= 2:
+                size, = struct.unpack('<I', recv_exact(conn, 4))
+                payload = recv_exact(conn, size)
+                self.stats['bytes_in'] += 4 + size
+                self.stats['batches'] += 1
+                tdo = self.exec_batch(payload)
+                reply = struct.pack('<BBHI', 2 << 4, CMD_BATCH, spec, len(tdo)) + tdo
+            else:
+                dlen = self.data_len(func, spec)
+                data = recv_exact(conn, dlen)
+                self.stats['bytes_in'] += dlen
+                reply = self.exec_cmd(func, spec, data)
+            if reply:
+                conn.sendall(reply)
+                self.stats['bytes_out'] += len(reply)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='jtag_esp_remote server with a simulated TAP')
+    parser.add_argument('--host', default='127.0.0.1', help='address to listen on')
+    parser.add_argument('--port', type=int, default=5555)
+    parser.add_argument('--proto', type=int, default=2, choices=(1, 2),
+                        help='highest protocol version to announce')
+    parser.add_argument('--irlen', type=int, default=5)
+    parser.add_argument('--idcode', type=lambda x: int(x, 0), default=0x120034e5)
+    parser.add_argument('--dr-ir', type=lambda x: int(x, 0), default=0x10,
+                        help='instruction selecting the user data register')
+    parser.add_argument('--dr-len', type=int, default=32, help='user data register length in bits')
+    parser.add_argument('--once', action='store_true', help='exit after the first client disconnects')
+    parser.add_argument('-v', '--verbose', action='store_true')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind((args.host, args.port))
+    sock.listen(1)
+    print('listening on port %d, protocol v%d' % (args.port, args.proto), flush=True)
+    while True:
+        conn, addr = sock.accept()
+        conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        tap = Tap(args.irlen, args.idcode, args.dr_ir, args.dr_len)
+        server = Server(tap, args.proto, args.verbose)
+        try:
+            server.serve(conn)
+        except (EOFError, ConnectionResetError):
+            pass
+        conn.close()
+        stats = server.stats
+        stats['clocks'] = tap.clocks
+        print('client %s disconnected: %s' % (addr[0], ' '.join('%s=%d' % kv for kv in stats.items())),
+              flush=True)
+        if args.once:
+            break
+
+
+if __name__ == '__main__':
+    main()
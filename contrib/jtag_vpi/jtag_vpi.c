@@ -0,0 +1,424 @@
+/*
+ * VPI side of the OpenOCD jtag_vpi driver with CMD_BATCH support
+ *
+ * Copyright (C) 2022 Espressif Systems Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sample server for the jtag_vpi driver, to be loaded into a Verilog simulator
+ * together with jtag_vpi.v, which drives the JTAG pins of the simulated design.
+ * The Verilog model calls:
+ *
+ *   $check_for_command(cmd, length, nb_bits, buffer_out)
+ *	Gets the next command. cmd is set to -1 when there is nothing to do.
+ *   $send_result_to_server(length, nb_bits, buffer_in)
+ *	Returns TDO data of a scan command.
+ *
+ * Besides the plain protocol (one command per message and one reply per scan)
+ * it supports CMD_BATCH messages enabled by 'jtag_vpi batch on' in OpenOCD.
+ * The batch is unpacked here into plain commands of at most XFERT_MAX_SIZE
+ * bytes, so the Verilog model does not need to know about batches, and TDO
+ * data of all scans is sent back in one reply when the batch is done.
+ *
+ * With Icarus Verilog:
+ *   iverilog-vpi jtag_vpi.c
+ *   iverilog -o sim jtag_vpi.v <design and testbench files>
+ *   vvp -M. -mjtag_vpi sim +jtag_vpi_port=5555
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <vpi_user.h>
+
+#define XFERT_MAX_SIZE		512
+#define DEFAULT_PORT		5555
+
+#define CMD_RESET		0
+#define CMD_TMS_SEQ		1
+#define CMD_SCAN_CHAIN		2
+#define CMD_SCAN_CHAIN_FLIP_TMS	3
+#define CMD_STOP_SIMU		4
+#define CMD_BATCH		5
+
+#define BATCH_CMD_NO_READ	0x80
+
+/* vpi_cmd as sent over the socket, all fields little endian */
+#define VPI_CMD_SIZE		(4 + 2 * XFERT_MAX_SIZE + 4 + 4)
+#define VPI_CMD_OUT_OFFSET	4
+#define VPI_CMD_IN_OFFSET	(4 + XFERT_MAX_SIZE)
+#define VPI_CMD_LENGTH_OFFSET	(4 + 2 * XFERT_MAX_SIZE)
+#define VPI_CMD_NB_BITS_OFFSET	(8 + 2 * XFERT_MAX_SIZE)
+
+struct cmd {
+	int cmd;
+	int length;
+	int nb_bits;
+	uint8_t buffer[XFERT_MAX_SIZE];
+};
+
+static int listen_fd = -1;
+static int conn_fd = -1;
+
+static struct {
+	bool active;
+	uint8_t *payload;
+	size_t size;
+	/* bytes of payload received for the current batch */
+	size_t length;
+	size_t pos;
+	uint32_t cmds_left;
+	/* sub-command being passed to the model in XFERT_MAX_SIZE chunks */
+	bool pending;
+	uint8_t cmd;
+	uint32_t bits_left;
+	/* TDO data of the current chunk has to be sent back */
+	bool read_current;
+	uint8_t *tdo;
+	size_t tdo_size;
+	size_t tdo_used;
+} batch;
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void close_connection(void)
+{
+	close(conn_fd);
+	conn_fd = -1;
+	batch.active = false;
+	vpi_printf("jtag_vpi: connection closed\n");
+}
+
+static bool read_all(void *buf, size_t len)
+{
+	uint8_t *p = buf;
+	while (len > 0) {
+		ssize_t n = read(conn_fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			close_connection();
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool write_all(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	while (len > 0) {
+		ssize_t n = write(conn_fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			close_connection();
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool send_reply(int cmd, const uint8_t *data, uint32_t length, uint32_t nb_bits)
+{
+	uint8_t msg[VPI_CMD_SIZE] = { 0 };
+
+	put_le32(msg, cmd);
+	if (cmd != CMD_BATCH)
+		memcpy(msg + VPI_CMD_IN_OFFSET, data, length);
+	put_le32(msg + VPI_CMD_LENGTH_OFFSET, length);
+	put_le32(msg + VPI_CMD_NB_BITS_OFFSET, nb_bits);
+	if (!write_all(msg, sizeof(msg)))
+		return false;
+	return cmd != CMD_BATCH || write_all(data, length);
+}
+
+static bool start_server(void)
+{
+	int port = DEFAULT_PORT;
+	s_vpi_vlog_info info;
+	int one = 1;
+
+	if (vpi_get_vlog_info(&info)) {
+		for (int i = 0; i < info.argc; i++) {
+			if (!strncmp(info.argv[i], "+jtag_vpi_port=", 15))
+				port = atoi(info.argv[i] + 15);
+		}
+	}
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		return false;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0) {
+		vpi_printf("jtag_vpi: cannot listen on port %d\n", port);
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	vpi_printf("jtag_vpi: listening on port %d\n", port);
+	return true;
+}
+
+/* Returns true when a message can be read, without blocking the simulation */
+static bool poll_connection(void)
+{
+	struct pollfd pfd = { .events = POLLIN };
+	int one = 1;
+
+	if (listen_fd < 0 && !start_server())
+		return false;
+
+	if (conn_fd < 0) {
+		pfd.fd = listen_fd;
+		if (poll(&pfd, 1, 0) <= 0)
+			return false;
+		conn_fd = accept(listen_fd, NULL, NULL);
+		if (conn_fd < 0)
+			return false;
+		setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		vpi_printf("jtag_vpi: connection accepted\n");
+	}
+
+	pfd.fd = conn_fd;
+	return poll(&pfd, 1, 0) > 0;
+}
+
+static bool batch_start(uint32_t length, uint32_t num_cmds)
+{
+	if (length > batch.size) {
+		uint8_t *p = realloc(batch.payload, length);
+		if (!p)
+			return false;
+		batch.payload = p;
+		batch.size = length;
+	}
+	if (!read_all(batch.payload, length))
+		return false;
+	batch.active = true;
+	batch.length = length;
+	batch.pos = 0;
+	batch.cmds_left = num_cmds;
+	batch.pending = false;
+	batch.tdo_used = 0;
+	return true;
+}
+
+static bool batch_store_tdo(const uint8_t *data, size_t len)
+{
+	if (batch.tdo_used + len > batch.tdo_size) {
+		size_t size = 2 * (batch.tdo_used + len);
+		uint8_t *p = realloc(batch.tdo, size);
+		if (!p)
+			return false;
+		batch.tdo = p;
+		batch.tdo_size = size;
+	}
+	memcpy(batch.tdo + batch.tdo_used, data, len);
+	batch.tdo_used += len;
+	return true;
+}
+
+/* Gets the next chunk of the batch, returns false when the batch is done */
+static bool batch_next(struct cmd *c)
+{
+	if (!batch.pending) {
+		if (batch.cmds_left == 0 || batch.pos + 5 > batch.length)
+			return false;
+		batch.cmd = batch.payload[batch.pos];
+		batch.bits_left = get_le32(batch.payload + batch.pos + 1);
+		batch.pos += 5;
+		batch.cmds_left--;
+		batch.pending = true;
+	}
+
+	uint8_t cmd = batch.cmd & ~BATCH_CMD_NO_READ;
+	uint32_t nb_bits = batch.bits_left;
+	if (nb_bits > XFERT_MAX_SIZE * 8)
+		nb_bits = XFERT_MAX_SIZE * 8;
+	uint32_t nb_bytes = (nb_bits + 7) / 8;
+	if (batch.pos + nb_bytes > batch.length) {
+		vpi_printf("jtag_vpi: truncated batch payload\n");
+		batch.pending = false;
+		return false;
+	}
+
+	/* only the last chunk of a scan leaves the shift state */
+	if (cmd == CMD_SCAN_CHAIN_FLIP_TMS && nb_bits != batch.bits_left)
+		cmd = CMD_SCAN_CHAIN;
+	c->cmd = cmd;
+	c->length = nb_bytes;
+	c->nb_bits = nb_bits;
+	memcpy(c->buffer, batch.payload + batch.pos, nb_bytes);
+	batch.pos += nb_bytes;
+	batch.bits_left -= nb_bits;
+	if (batch.bits_left == 0)
+		batch.pending = false;
+	batch.read_current = (cmd == CMD_SCAN_CHAIN || cmd == CMD_SCAN_CHAIN_FLIP_TMS) &&
+		!(batch.cmd & BATCH_CMD_NO_READ);
+	return true;
+}
+
+static bool get_command(struct cmd *c)
+{
+	uint8_t msg[VPI_CMD_SIZE];
+
+	if (batch.active) {
+		if (batch_next(c))
+			return true;
+		/* all commands of the batch are done, including the result of the last scan */
+		batch.active = false;
+		if (!send_reply(CMD_BATCH, batch.tdo, batch.tdo_used, 0))
+			return false;
+	}
+
+	if (!poll_connection() || !read_all(msg, sizeof(msg)))
+		return false;
+
+	c->cmd = get_le32(msg);
+	c->length = get_le32(msg + VPI_CMD_LENGTH_OFFSET);
+	c->nb_bits = get_le32(msg + VPI_CMD_NB_BITS_OFFSET);
+	if (c->cmd == CMD_BATCH)
+		return batch_start(c->length, c->nb_bits) && get_command(c);
+	if (c->length > XFERT_MAX_SIZE)
+		c->length = XFERT_MAX_SIZE;
+	memcpy(c->buffer, msg + VPI_CMD_OUT_OFFSET, c->length);
+	return true;
+}
+
+static vpiHandle next_arg(vpiHandle args)
+{
+	vpiHandle arg = vpi_scan(args);
+	if (!arg)
+		vpi_printf("jtag_vpi: missing argument\n");
+	return arg;
+}
+
+static void put_int(vpiHandle arg, int val)
+{
+	s_vpi_value value = { .format = vpiIntVal };
+	value.value.integer = val;
+	vpi_put_value(arg, &value, NULL, vpiNoDelay);
+}
+
+static int get_int(vpiHandle arg)
+{
+	s_vpi_value value = { .format = vpiIntVal };
+	vpi_get_value(arg, &value);
+	return value.value.integer;
+}
+
+static PLI_INT32 check_for_command(PLI_BYTE8 *user_data)
+{
+	vpiHandle args = vpi_iterate(vpiArgument, vpi_handle(vpiSysTfCall, NULL));
+	vpiHandle cmd_arg = next_arg(args);
+	vpiHandle length_arg = next_arg(args);
+	vpiHandle nb_bits_arg = next_arg(args);
+	vpiHandle buffer_arg = next_arg(args);
+	struct cmd c;
+
+	if (!buffer_arg)
+		return 0;
+	vpi_free_object(args);
+
+	if (!get_command(&c)) {
+		put_int(cmd_arg, -1);
+		return 0;
+	}
+	for (int i = 0; i < c.length; i++)
+		put_int(vpi_handle_by_index(buffer_arg, i), c.buffer[i]);
+	put_int(length_arg, c.length);
+	put_int(nb_bits_arg, c.nb_bits);
+	put_int(cmd_arg, c.cmd);
+	return 0;
+}
+
+static PLI_INT32 send_result_to_server(PLI_BYTE8 *user_data)
+{
+	vpiHandle args = vpi_iterate(vpiArgument, vpi_handle(vpiSysTfCall, NULL));
+	vpiHandle length_arg = next_arg(args);
+	vpiHandle nb_bits_arg = next_arg(args);
+	vpiHandle buffer_arg = next_arg(args);
+	uint8_t buf[XFERT_MAX_SIZE];
+
+	if (!buffer_arg)
+		return 0;
+	vpi_free_object(args);
+
+	int length = get_int(length_arg);
+	int nb_bits = get_int(nb_bits_arg);
+	if (length > XFERT_MAX_SIZE)
+		length = XFERT_MAX_SIZE;
+	for (int i = 0; i < length; i++)
+		buf[i] = get_int(vpi_handle_by_index(buffer_arg, i));
+
+	if (conn_fd < 0)
+		return 0;
+	if (batch.active) {
+		if (batch.read_current && !batch_store_tdo(buf, length))
+			close_connection();
+		return 0;
+	}
+	send_reply(CMD_SCAN_CHAIN, buf, length, nb_bits);
+	return 0;
+}
+
+static void register_tasks(void)
+{
+	s_vpi_systf_data tf = { .type = vpiSysTask };
+
+	tf.tfname = "$check_for_command";
+	tf.calltf = check_for_command;
+	vpi_register_systf(&tf);
+
+	tf.tfname = "$send_result_to_server";
+	tf.calltf = send_result_to_server;
+	vpi_register_systf(&tf);
+}
+
+void (*vlog_startup_routines[])(void) = {
+	register_tasks,
+	NULL,
+};
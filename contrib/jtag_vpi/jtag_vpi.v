@@ -0,0 +1,115 @@
+/*
+ * Verilog side of the sample jtag_vpi server, see jtag_vpi.c
+ *
+ * Copyright (C) 2022 Espressif Systems Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * Connect tms, tck and tdi to the JTAG TAP of the simulated design and its
+ * tdo output to tdo. Every command received from OpenOCD is clocked out at
+ * TCK_HALF_PERIOD; CMD_BATCH messages are unpacked by jtag_vpi.c, so this
+ * model only sees the plain commands.
+ */
+
+`timescale 1ns / 1ps
+
+module jtag_vpi #(
+	parameter TCK_HALF_PERIOD = 50,
+	parameter CMD_DELAY = 1000
+) (
+	output reg	tms,
+	output reg	tck,
+	output reg	tdi,
+	input		tdo,
+	input		enable,
+	input		init_done
+);
+
+localparam XFERT_MAX_SIZE = 512;
+
+localparam CMD_RESET = 0;
+localparam CMD_TMS_SEQ = 1;
+localparam CMD_SCAN_CHAIN = 2;
+localparam CMD_SCAN_CHAIN_FLIP_TMS = 3;
+localparam CMD_STOP_SIMU = 4;
+
+integer		cmd;
+integer		length;
+integer		nb_bits;
+reg [7:0]	buffer_out [0:XFERT_MAX_SIZE - 1];
+reg [7:0]	buffer_in [0:XFERT_MAX_SIZE - 1];
+integer		i;
+
+initial begin
+	tck = 1'b0;
+	tms = 1'b1;
+	tdi = 1'b0;
+end
+
+initial begin
+	wait (init_done);
+	forever begin
+		#CMD_DELAY;
+		if (enable) begin
+			$check_for_command(cmd, length, nb_bits, buffer_out);
+			case (cmd)
+			CMD_RESET: reset_tap;
+			CMD_TMS_SEQ: do_tms_seq;
+			CMD_SCAN_CHAIN: do_scan_chain(1'b0);
+			CMD_SCAN_CHAIN_FLIP_TMS: do_scan_chain(1'b1);
+			CMD_STOP_SIMU: $finish;
+			default: ;
+			endcase
+		end
+	end
+end
+
+task gen_clk;
+	input integer number;
+	integer j;
+	begin
+		for (j = 0; j < number; j = j + 1) begin
+			#TCK_HALF_PERIOD tck = 1'b1;
+			#TCK_HALF_PERIOD tck = 1'b0;
+		end
+	end
+endtask
+
+task reset_tap;
+	begin
+		tms = 1'b1;
+		gen_clk(5);
+	end
+endtask
+
+task do_tms_seq;
+	begin
+		for (i = 0; i < nb_bits; i = i + 1) begin
+			tms = buffer_out[i / 8][i % 8];
+			gen_clk(1);
+		end
+		tms = 1'b0;
+	end
+endtask
+
+task do_scan_chain;
+	input flip_tms;
+	begin
+		for (i = 0; i < length; i = i + 1)
+			buffer_in[i] = 8'h00;
+		for (i = 0; i < nb_bits; i = i + 1) begin
+			tdi = buffer_out[i / 8][i % 8];
+			tms = flip_tms && (i == nb_bits - 1);
+			#TCK_HALF_PERIOD tck = 1'b1;
+			buffer_in[i / 8][i % 8] = tdo;
+			#TCK_HALF_PERIOD tck = 1'b0;
+		end
+		tms = 1'b0;
+		$send_result_to_server(length, nb_bits, buffer_in);
+	end
+endtask
+
+endmodule
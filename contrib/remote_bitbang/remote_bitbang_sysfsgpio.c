@@ -291,6 +291,38 @@ static void cleanup_all_fds(void)
 	cleanup_fd(srst_fd, srst_gpio);
 }
 
+/*
+ * Run of bits ('J' and 'K' requests): 16-bit little endian bit count followed
+ * by the packed TMS and TDI bits. For 'K' the packed TDO bits are sent back.
+ */
+static void process_bit_run(int read_tdo)
+{
+	unsigned char tms[128], tdi[128], tdo[128];
+	int lo = getchar();
+	int hi = getchar();
+	unsigned int num_bits = (lo & 0xff) | ((hi & 0xff) << 8);
+	unsigned int num_bytes = (num_bits + 7) / 8;
+
+	if (lo == EOF || hi == EOF || num_bytes > sizeof(tms)) {
+		LOG_ERROR("Invalid bit run of %u bits", num_bits);
+		exit(1);
+	}
+	if (fread(tms, 1, num_bytes, stdin) != num_bytes || fread(tdi, 1, num_bytes, stdin) != num_bytes)
+		exit(1);
+	memset(tdo, 0, num_bytes);
+
+	for (unsigned int i = 0; i < num_bits; i++) {
+		int tms_bit = (tms[i / 8] >> (i % 8)) & 1;
+		int tdi_bit = (tdi[i / 8] >> (i % 8)) & 1;
+		sysfsgpio_write(0, tms_bit, tdi_bit);
+		if (read_tdo && sysfsgpio_read() == '1')
+			tdo[i / 8] |= 1 << (i % 8);
+		sysfsgpio_write(1, tms_bit, tdi_bit);
+	}
+	if (read_tdo)
+		fwrite(tdo, 1, num_bytes, stdout);
+}
+
 static void process_remote_protocol(void)
 {
 	int c;
@@ -311,6 +343,8 @@ static void process_remote_protocol(void)
 					(d & 1));
 		} else if (c == 'R')
 			putchar(sysfsgpio_read());
+		else if (c == 'J' || c == 'K') /* Run of bits */
+			process_bit_run(c == 'K');
 		else
 			LOG_ERROR("Unknown command '%c' received", c);
 	}
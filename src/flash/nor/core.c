@@ -110,6 +110,24 @@ int flash_driver_write(struct flash_bank *bank,
 	return retval;
 }
 
+int flash_driver_write_spans(struct flash_bank *bank, uint32_t offset,
+	uint32_t count, const struct flash_write_span *spans,
+	unsigned int num_spans)
+{
+	int retval;
+
+	retval = bank->driver->write_spans(bank, offset, count, spans, num_spans);
+	if (retval != ERROR_OK) {
+		LOG_ERROR(
+			"error writing to flash at address " TARGET_ADDR_FMT
+			" at offset 0x%8.8" PRIx32,
+			bank->base,
+			offset);
+	}
+
+	return retval;
+}
+
 int flash_driver_read(struct flash_bank *bank,
 	uint8_t *buffer, uint32_t offset, uint32_t count)
 {
@@ -733,6 +751,54 @@ static bool flash_write_check_gap(struct flash_bank *bank,
 	return aligned1 + bank->minimal_write_gap < aligned2;
 }
 
+/**
+ * Describe the next @a count bytes of the sorted image sections as spans
+ * pointing into the image, the same way flash_write_unlock_verify() would
+ * copy them into a padded buffer. @a section and @a section_offset are only
+ * advanced on success. Returns ERROR_NOT_IMPLEMENTED if the image data is
+ * not held in host memory.
+ */
+static int flash_write_get_spans(struct image *image, struct imagesection **sections,
+	unsigned int *section, uint32_t *section_offset, const int *padding,
+	uint32_t offset, uint32_t count, struct flash_write_span *spans,
+	unsigned int *num_spans)
+{
+	unsigned int s = *section;
+	uint32_t s_offset = *section_offset;
+	uint32_t idx = 0;
+	unsigned int n = 0;
+
+	while (idx < count) {
+		uint32_t size = count - idx;
+		if (size > sections[s]->size - s_offset)
+			size = sections[s]->size - s_offset;
+		if (size == 0)
+			return ERROR_NOT_IMPLEMENTED;
+
+		const uint8_t *data;
+		int retval = image_section_data(image, sections[s] - image->sections,
+				s_offset, size, &data);
+		if (retval != ERROR_OK)
+			return retval;
+
+		spans[n].offset = offset + idx;
+		spans[n].buffer = data;
+		spans[n].count = size;
+		n++;
+
+		idx += size + padding[s];
+		s_offset += size;
+		if (s_offset >= sections[s]->size) {
+			s++;
+			s_offset = 0;
+		}
+	}
+
+	*section = s;
+	*section_offset = s_offset;
+	*num_spans = n;
+	return ERROR_OK;
+}
 
 int flash_write_unlock_verify(struct target *target, struct image *image,
 	uint32_t *written, bool erase, bool unlock, bool write, bool verify)
@@ -901,59 +967,85 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 			run_size += delta;
 		}
 
-		/* allocate buffer */
-		buffer = malloc(run_size);
-		if (!buffer) {
-			LOG_ERROR("Out of memory for flash bank buffer");
-			retval = ERROR_FAIL;
-			goto done;
-		}
-
-		if (padding_at_start)
-			memset(buffer, c->default_padded_value, padding_at_start);
+		struct flash_write_span *spans = NULL;
+		unsigned int num_spans = 0;
+		buffer = NULL;
 
-		buffer_idx = padding_at_start;
-
-		/* read sections to the buffer */
-		while (buffer_idx < run_size) {
-			size_t size_read;
-
-			size_read = run_size - buffer_idx;
-			if (size_read > sections[section]->size - section_offset)
-				size_read = sections[section]->size - section_offset;
+		if (write && c->driver->write_spans) {
+			/* hand the image data over in place, the driver fills the gaps */
+			spans = malloc(sizeof(*spans) * (section_last - section + 1));
+			if (!spans) {
+				LOG_ERROR("Out of memory for flash write spans");
+				retval = ERROR_FAIL;
+				goto done;
+			}
+			retval = flash_write_get_spans(image, sections, &section, &section_offset,
+					padding, run_address + padding_at_start - c->base,
+					run_size - padding_at_start, spans, &num_spans);
+			if (retval != ERROR_OK) {
+				free(spans);
+				spans = NULL;
+				if (retval != ERROR_NOT_IMPLEMENTED)
+					goto done;
+			}
+		}
 
-			/* KLUDGE!
-			 *
-			 * #¤%#"%¤% we have to figure out the section # from the sorted
-			 * list of pointers to sections to invoke image_read_section()...
-			 */
-			intptr_t diff = (intptr_t)sections[section] - (intptr_t)image->sections;
-			int t_section_num = diff / sizeof(struct imagesection);
-
-			LOG_DEBUG("image_read_section: section = %d, t_section_num = %d, "
-					"section_offset = %"PRIu32", buffer_idx = %"PRIu32", size_read = %zu",
-				section, t_section_num, section_offset,
-				buffer_idx, size_read);
-			retval = image_read_section(image, t_section_num, section_offset,
-					size_read, buffer + buffer_idx, &size_read);
-			if (retval != ERROR_OK || size_read == 0) {
-				free(buffer);
+		if (!spans) {
+			/* allocate buffer */
+			buffer = malloc(run_size);
+			if (!buffer) {
+				LOG_ERROR("Out of memory for flash bank buffer");
+				retval = ERROR_FAIL;
 				goto done;
 			}
 
-			buffer_idx += size_read;
-			section_offset += size_read;
+			if (padding_at_start)
+				memset(buffer, c->default_padded_value, padding_at_start);
+
+			buffer_idx = padding_at_start;
+
+			/* read sections to the buffer */
+			while (buffer_idx < run_size) {
+				size_t size_read;
+
+				size_read = run_size - buffer_idx;
+				if (size_read > sections[section]->size - section_offset)
+					size_read = sections[section]->size - section_offset;
+
+				/* KLUDGE!
+				 *
+				 * #¤%#"%¤% we have to figure out the section # from the sorted
+				 * list of pointers to sections to invoke image_read_section()...
+				 */
+				intptr_t diff = (intptr_t)sections[section] - (intptr_t)image->sections;
+				int t_section_num = diff / sizeof(struct imagesection);
+
+				LOG_DEBUG("image_read_section: section = %d, t_section_num = %d, "
+						"section_offset = %"PRIu32", buffer_idx = %"PRIu32", size_read = %zu",
+					section, t_section_num, section_offset,
+					buffer_idx, size_read);
+				retval = image_read_section(image, t_section_num, section_offset,
+						size_read, buffer + buffer_idx, &size_read);
+				if (retval != ERROR_OK || size_read == 0) {
+					free(buffer);
+					goto done;
+				}
 
-			/* see if we need to pad the section */
-			if (padding[section]) {
-				memset(buffer + buffer_idx, c->default_padded_value, padding[section]);
-				buffer_idx += padding[section];
-			}
+				buffer_idx += size_read;
+				section_offset += size_read;
 
-			if (section_offset >= sections[section]->size) {
-				section++;
-				section_offset = 0;
+				/* see if we need to pad the section */
+				if (padding[section]) {
+					memset(buffer + buffer_idx, c->default_padded_value, padding[section]);
+					buffer_idx += padding[section];
+				}
+
+				if (section_offset >= sections[section]->size) {
+					section++;
+					section_offset = 0;
+				}
 			}
+
 		}
 
 		retval = ERROR_OK;
@@ -971,18 +1063,29 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 		if (retval == ERROR_OK) {
 			if (write) {
 				/* write flash sectors */
-				retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
+				if (spans)
+					retval = flash_driver_write_spans(c, run_address - c->base,
+							run_size, spans, num_spans);
+				else
+					retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
 			}
 		}
 
 		if (retval == ERROR_OK) {
 			if (verify) {
 				/* verify flash sectors */
-				retval = flash_driver_verify(c, buffer, run_address - c->base, run_size);
+				if (spans) {
+					for (unsigned int i = 0; i < num_spans && retval == ERROR_OK; i++)
+						retval = flash_driver_verify(c, spans[i].buffer,
+								spans[i].offset, spans[i].count);
+				} else {
+					retval = flash_driver_verify(c, buffer, run_address - c->base, run_size);
+				}
 			}
 		}
 
 		free(buffer);
+		free(spans);
 
 		if (retval != ERROR_OK) {
 			/* abort operation */
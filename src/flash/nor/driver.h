@@ -24,6 +24,18 @@
 
 struct flash_bank;
 
+/**
+ * Describes one piece of image data passed to flash_driver_s::write_spans.
+ */
+struct flash_write_span {
+	/** The offset into the chip where the data goes. */
+	uint32_t offset;
+	/** The data bytes; they belong to the caller and stay valid for the call. */
+	const uint8_t *buffer;
+	/** The number of bytes. */
+	uint32_t count;
+};
+
 #define __FLASH_BANK_COMMAND(name) \
 		COMMAND_HELPER(name, struct flash_bank *bank)
 
@@ -141,6 +153,27 @@ struct flash_driver {
 	int (*write)(struct flash_bank *bank,
 			const uint8_t *buffer, uint32_t offset, uint32_t count);
 
+	/**
+	 * Program a region of the flash from a list of data spans, instead
+	 * of a single buffer holding the whole region.  The spans are sorted
+	 * by offset, do not overlap and lie inside the region; bytes of the
+	 * region not covered by any span are programmed with
+	 * @c flash_bank::default_padded_value.  This lets the flash core
+	 * hand over sparse images without assembling a padded copy.
+	 *
+	 * If not implemented, set method to NULL and the core falls back
+	 * to flash_driver_s::write.
+	 *
+	 * @param bank The bank to program
+	 * @param offset The offset into the chip of the region to program.
+	 * @param count The size of the region in bytes.
+	 * @param spans The data to write into the region.
+	 * @param num_spans The number of entries in @a spans.
+	 * @returns ERROR_OK if successful; otherwise, an error code.
+	 */
+	int (*write_spans)(struct flash_bank *bank, uint32_t offset, uint32_t count,
+			const struct flash_write_span *spans, unsigned int num_spans);
+
 	/**
 	 * Read data from the flash. Note CPU address will be
 	 * "bank->base + offset", while the physical address is
@@ -119,6 +119,7 @@ struct flash_driver esp32s2_flash = {
 	.erase = esp_flash_erase,
 	.protect = esp_flash_protect,
 	.write = esp_flash_write,
+	.write_spans = esp_flash_write_spans,
 	.read = esp_flash_read,
 	.probe = esp_flash_probe,
 	.auto_probe = esp_flash_auto_probe,
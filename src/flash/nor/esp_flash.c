@@ -91,6 +91,13 @@ struct esp_flash_rw_args {
 
 struct esp_flash_write_state {
 	struct esp_flash_rw_args rw;
+	/* uncompressed data is taken from the spans, gaps are filled with padded_value */
+	const struct flash_write_span *spans;
+	unsigned int num_spans;
+	uint32_t offset;
+	uint8_t padded_value;
+	uint8_t *blk_buf;
+	uint32_t blk_buf_size;
 	uint32_t prev_block_id;
 	struct working_area *target_buf;
 	struct working_area *stub_wargs_area;
@@ -112,11 +119,47 @@ struct esp_flash_bp_op_state {
 	struct esp_flash_bank *esp_info;
 };
 
-static int esp_flash_compress(const uint8_t *in, uint32_t in_len, uint8_t **out, uint32_t *out_len)
+static int esp_flash_deflate(z_stream *strm, const uint8_t *in, uint32_t in_len, int flush,
+	uint8_t **out, size_t *out_size)
+{
+	strm->next_in = (Bytef *)in;
+	strm->avail_in = (uInt)in_len;
+
+	while (true) {
+		if (strm->avail_out == 0) {
+			/* sparse data compresses far better than the initial estimate, grow on demand */
+			size_t new_size = *out_size * 2;
+			uint8_t *new_out = realloc(*out, new_size);
+			if (!new_out) {
+				LOG_ERROR("out buffer allocation failed!");
+				return ERROR_FAIL;
+			}
+			*out = new_out;
+			strm->next_out = new_out + strm->total_out;
+			strm->avail_out = new_size - strm->total_out;
+			*out_size = new_size;
+		}
+		int ret = deflate(strm, flush);
+		if (ret == Z_STREAM_END)
+			return ERROR_OK;
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			LOG_ERROR("deflate error (%d)!", ret);
+			return ERROR_FAIL;
+		}
+		if (flush != Z_FINISH && strm->avail_in == 0 && strm->avail_out != 0)
+			return ERROR_OK;
+	}
+}
+
+/* Compresses the region [offset, offset + count) described by the spans, without assembling it */
+static int esp_flash_compress(const struct flash_write_span *spans, unsigned int num_spans,
+	uint32_t offset, uint32_t count, uint8_t padded_value, uint8_t **out, uint32_t *out_len)
 {
 	z_stream strm;
 	int wbits = -MAX_WBITS;		/*deflate */
 	int level = Z_DEFAULT_COMPRESSION;	/*Z_BEST_SPEED; */
+	uint8_t pad_buf[1024];
+	uint32_t data_len = 0;
 
 	strm.zalloc = Z_NULL;
 	strm.zfree = Z_NULL;
@@ -128,34 +171,53 @@ static int esp_flash_compress(const uint8_t *in, uint32_t in_len, uint8_t **out,
 		return ERROR_FAIL;
 	}
 
-	strm.avail_out = deflateBound(&strm, (uLong)in_len);
+	for (unsigned int i = 0; i < num_spans; i++)
+		data_len += spans[i].count;
+	size_t out_size = deflateBound(&strm, (uLong)data_len);
 
 	/* Some compression methods may need a little more space */
-	strm.avail_out += 100;
+	out_size += 100;
 
-	if (strm.avail_out > INT_MAX) {
+	if (out_size > INT_MAX) {
 		deflateEnd(&strm);
 		return ERROR_FAIL;
 	}
 
-	*out = (uint8_t *)malloc((int)strm.avail_out);
+	*out = malloc(out_size);
 	if (*out == NULL) {
 		LOG_ERROR("out buffer allocation failed!");
-		return ERROR_FAIL;
-	}
-	strm.next_out = *out;
-	strm.next_in = (uint8_t *)in;
-	strm.avail_in = (uInt)in_len;
-
-	/* always compress in one pass - the return value holds the entire
-	 * decompressed data anyway, so there's no reason to do chunked
-	 * decompression */
-	if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
-		free(*out);
 		deflateEnd(&strm);
-		LOG_ERROR("not enough output space");
 		return ERROR_FAIL;
 	}
+	strm.next_out = *out;
+	strm.avail_out = (uInt)out_size;
+	memset(pad_buf, padded_value, sizeof(pad_buf));
+
+	/* feed the spans and the padding between them to the compressor piece by piece */
+	uint32_t pos = offset;
+	uint32_t end = offset + count;
+	unsigned int span = 0;
+	do {
+		const uint8_t *in;
+		uint32_t in_len;
+
+		if (span < num_spans && spans[span].offset <= pos) {
+			in = spans[span].buffer + (pos - spans[span].offset);
+			in_len = spans[span].offset + spans[span].count - pos;
+			span++;
+		} else {
+			uint32_t next = span < num_spans ? spans[span].offset : end;
+			in = pad_buf;
+			in_len = MIN(next - pos, sizeof(pad_buf));
+		}
+		pos += in_len;
+		if (esp_flash_deflate(&strm, in, in_len, pos >= end ? Z_FINISH : Z_NO_FLUSH,
+				out, &out_size) != ERROR_OK) {
+			free(*out);
+			deflateEnd(&strm);
+			return ERROR_FAIL;
+		}
+	} while (pos < end);
 
 	deflateEnd(&strm);
 
@@ -167,7 +229,7 @@ static int esp_flash_compress(const uint8_t *in, uint32_t in_len, uint8_t **out,
 
 	*out_len = strm.total_out;
 
-	LOG_DEBUG("inlen:(%u) outlen:(%u)!", in_len, *out_len);
+	LOG_DEBUG("inlen:(%u) outlen:(%u)!", count, *out_len);
 
 	return ERROR_OK;
 }
@@ -525,6 +587,43 @@ static int esp_flash_rw_do(struct target *target, void *priv)
 	return ERROR_OK;
 }
 
+/* Returns @a len bytes of the region being written starting at @a pos. Points straight
+ * into the span holding them if there is one, otherwise assembles them in blk_buf. */
+static const uint8_t *esp_flash_write_data_get(struct esp_flash_write_state *state,
+	uint32_t pos, uint32_t len)
+{
+	uint32_t addr = state->offset + pos;
+
+	for (unsigned int i = 0; i < state->num_spans; i++) {
+		const struct flash_write_span *span = &state->spans[i];
+		if (span->offset <= addr && addr + len <= span->offset + span->count)
+			return span->buffer + (addr - span->offset);
+	}
+
+	if (state->blk_buf_size < len) {
+		uint8_t *blk_buf = realloc(state->blk_buf, len);
+		if (!blk_buf) {
+			LOG_ERROR("Failed to alloc flash data block buffer!");
+			return NULL;
+		}
+		state->blk_buf = blk_buf;
+		state->blk_buf_size = len;
+	}
+	memset(state->blk_buf, state->padded_value, len);
+	for (unsigned int i = 0; i < state->num_spans; i++) {
+		const struct flash_write_span *span = &state->spans[i];
+		if (span->offset >= addr + len)
+			break;
+		if (span->offset + span->count <= addr)
+			continue;
+		uint32_t start = MAX(span->offset, addr);
+		uint32_t end = MIN(span->offset + span->count, addr + len);
+		memcpy(state->blk_buf + (start - addr), span->buffer + (start - span->offset),
+			end - start);
+	}
+	return state->blk_buf;
+}
+
 static int esp_flash_write_xfer(struct target *target, uint32_t block_id, uint32_t len, void *priv)
 {
 	struct esp_flash_write_state *state = (struct esp_flash_write_state *)priv;
@@ -558,9 +657,17 @@ static int esp_flash_write_xfer(struct target *target, uint32_t block_id, uint32
 		state->rw.apptrace->usr_block_max_size_get(target) ?
 		state->rw.count -
 		state->rw.total_count : state->rw.apptrace->usr_block_max_size_get(target);
+	const uint8_t *data;
+	if (state->rw.buffer) {
+		data = state->rw.buffer + state->rw.total_count;
+	} else {
+		data = esp_flash_write_data_get(state, state->rw.total_count, wr_sz);
+		if (!data)
+			return ERROR_FAIL;
+	}
 	retval = state->rw.apptrace->usr_block_write(target,
 		block_id,
-		state->rw.buffer + state->rw.total_count,
+		data,
 		wr_sz);
 	if (retval != ERROR_OK) {
 		LOG_ERROR("Failed to write apptrace data (%d)!", retval);
@@ -672,6 +779,18 @@ int esp_flash_apptrace_info_restore(struct target *target,
 
 int esp_flash_write(struct flash_bank *bank, const uint8_t *buffer,
 	uint32_t offset, uint32_t count)
+{
+	struct flash_write_span span = {
+		.offset = offset,
+		.buffer = buffer,
+		.count = count,
+	};
+
+	return esp_flash_write_spans(bank, offset, count, &span, 1);
+}
+
+int esp_flash_write_spans(struct flash_bank *bank, uint32_t offset, uint32_t count,
+	const struct flash_write_span *spans, unsigned int num_spans)
 {
 	struct esp_flash_bank *esp_info = bank->driver_priv;
 	struct algorithm_run_data run;
@@ -716,7 +835,8 @@ int esp_flash_write(struct flash_bank *bank, const uint8_t *buffer,
 	if (esp_info->compression) {
 		struct duration bench;
 		duration_start(&bench);
-		if (esp_flash_compress(buffer, count, &compressed_buff,
+		if (esp_flash_compress(spans, num_spans, offset, count,
+				bank->default_padded_value, &compressed_buff,
 				&compressed_len) != ERROR_OK) {
 			LOG_ERROR("Compression failed!");
 			image_close(&run.image.image);
@@ -738,8 +858,12 @@ int esp_flash_write(struct flash_bank *bank, const uint8_t *buffer,
 	run.usr_func_init = (algorithm_usr_func_init_t)esp_flash_write_state_init;
 	run.usr_func_done = (algorithm_usr_func_done_t)esp_flash_write_state_cleanup;
 	memset(&wr_state, 0, sizeof(struct esp_flash_write_state));
-	wr_state.rw.buffer = esp_info->compression ? compressed_buff : (uint8_t *)buffer;
+	wr_state.rw.buffer = compressed_buff;
 	wr_state.rw.count = esp_info->compression ? compressed_len : count;
+	wr_state.spans = spans;
+	wr_state.num_spans = num_spans;
+	wr_state.offset = offset;
+	wr_state.padded_value = bank->default_padded_value;
 	wr_state.rw.xfer = esp_flash_write_xfer;
 	wr_state.rw.apptrace = esp_info->apptrace_hw;
 	wr_state.prev_block_id = (uint32_t)-1;
@@ -765,6 +889,7 @@ int esp_flash_write(struct flash_bank *bank, const uint8_t *buffer,
 	image_close(&run.image.image);
 	if (compressed_buff)
 		free(compressed_buff);
+	free(wr_state.blk_buf);
 	esp_flash_apptrace_info_restore(bank->target, esp_info, old_addr);
 	if (ret != ERROR_OK) {
 		LOG_ERROR("Failed to run flasher stub (%d)!", ret);
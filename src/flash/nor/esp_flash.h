@@ -24,6 +24,7 @@
 #include <target/espressif/esp_algorithm.h>
 #include <target/breakpoints.h>
 #include <flash/nor/core.h>
+#include <flash/nor/driver.h>
 
 struct esp_flash_apptrace_hw {
 	int (*info_init)(struct target *target,
@@ -120,6 +121,8 @@ int esp_flash_blank_check(struct flash_bank *bank);
 int esp_flash_erase(struct flash_bank *bank, unsigned int first, unsigned int last);
 int esp_flash_write(struct flash_bank *bank, const uint8_t *buffer,
 	uint32_t offset, uint32_t count);
+int esp_flash_write_spans(struct flash_bank *bank, uint32_t offset, uint32_t count,
+	const struct flash_write_span *spans, unsigned int num_spans);
 int esp_flash_read(struct flash_bank *bank, uint8_t *buffer,
 	uint32_t offset, uint32_t count);
 int esp_flash_probe(struct flash_bank *bank);
@@ -43,6 +43,9 @@ int flash_driver_protect(struct flash_bank *bank, int set, unsigned int first,
 		unsigned int last);
 int flash_driver_write(struct flash_bank *bank,
 		const uint8_t *buffer, uint32_t offset, uint32_t count);
+int flash_driver_write_spans(struct flash_bank *bank, uint32_t offset,
+		uint32_t count, const struct flash_write_span *spans,
+		unsigned int num_spans);
 int flash_driver_read(struct flash_bank *bank,
 		uint8_t *buffer, uint32_t offset, uint32_t count);
 int flash_driver_verify(struct flash_bank *bank,
@@ -16,6 +16,7 @@
 #include "minidriver.h"
 #include "interface.h"
 #include "interfaces.h"
+#include "capture.h"
 #include <transport/transport.h>
 
 #ifdef HAVE_STRINGS_H
@@ -121,6 +122,8 @@ int adapter_quit(void)
 			LOG_ERROR("failed: %d", result);
 	}
 
+	jtag_capture_stop();
+
 	free(adapter_config.serial);
 	free(adapter_config.usb_location);
 
@@ -0,0 +1,494 @@
+/***************************************************************************
+ *   Binary capture of executed JTAG queues                                *
+ *   Copyright (C) 2022 Espressif Systems Ltd.                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include <helper/replacements.h>
+#include <helper/binarybuffer.h>
+#include "jtag.h"
+#include "capture.h"
+
+/* Records are built in memory and written with a single fwrite() */
+struct jtag_capture_buf {
+	uint8_t *data;
+	size_t size;
+	size_t used;
+};
+
+static struct {
+	FILE *file;
+	char *filename;
+	struct jtag_capture_buf rec;
+	struct timeval start;
+} jtag_capture;
+
+struct jtag_capture_reader {
+	FILE *file;
+	struct jtag_capture_buf rec;
+	/* number of replayed queues, for diagnostics */
+	unsigned long queues;
+};
+
+/* Position in the record being parsed */
+struct jtag_capture_cursor {
+	const uint8_t *pos;
+	const uint8_t *end;
+};
+
+static uint8_t *jtag_capture_buf_reserve(struct jtag_capture_buf *buf, size_t len)
+{
+	if (buf->used + len > buf->size) {
+		size_t size = MAX(buf->size * 2, buf->used + len);
+		size = MAX(size, 4096);
+		uint8_t *data = realloc(buf->data, size);
+		if (!data)
+			return NULL;
+		buf->data = data;
+		buf->size = size;
+	}
+	uint8_t *p = buf->data + buf->used;
+	buf->used += len;
+	return p;
+}
+
+static void jtag_capture_buf_free(struct jtag_capture_buf *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+	buf->size = 0;
+	buf->used = 0;
+}
+
+int jtag_capture_start(const char *filename)
+{
+	jtag_capture_stop();
+
+	jtag_capture.file = fopen(filename, "wb");
+	if (!jtag_capture.file) {
+		LOG_ERROR("Failed to open JTAG capture file '%s'", filename);
+		return ERROR_FAIL;
+	}
+	/* queues are written as whole records, so a large stdio buffer saves syscalls */
+	setvbuf(jtag_capture.file, NULL, _IOFBF, 256 * 1024);
+
+	uint8_t hdr[JTAG_CAPTURE_HDR_SIZE] = JTAG_CAPTURE_MAGIC;
+	h_u32_to_le(hdr + 8, JTAG_CAPTURE_VERSION);
+	if (fwrite(hdr, 1, sizeof(hdr), jtag_capture.file) != sizeof(hdr)) {
+		LOG_ERROR("Failed to write JTAG capture file '%s'", filename);
+		fclose(jtag_capture.file);
+		jtag_capture.file = NULL;
+		return ERROR_FAIL;
+	}
+	jtag_capture.filename = strdup(filename);
+	gettimeofday(&jtag_capture.start, NULL);
+	LOG_INFO("JTAG capture to '%s' started", filename);
+	return ERROR_OK;
+}
+
+void jtag_capture_stop(void)
+{
+	if (!jtag_capture.file)
+		return;
+	if (fclose(jtag_capture.file) != 0)
+		LOG_ERROR("Failed to write JTAG capture file '%s'", jtag_capture.filename);
+	else
+		LOG_INFO("JTAG capture to '%s' stopped", jtag_capture.filename);
+	jtag_capture.file = NULL;
+	free(jtag_capture.filename);
+	jtag_capture.filename = NULL;
+	jtag_capture_buf_free(&jtag_capture.rec);
+}
+
+bool jtag_capture_is_active(void)
+{
+	return jtag_capture.file;
+}
+
+const char *jtag_capture_filename(void)
+{
+	return jtag_capture.filename;
+}
+
+uint64_t jtag_capture_time_us(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (uint64_t)(now.tv_sec - jtag_capture.start.tv_sec) * 1000000 +
+		now.tv_usec - jtag_capture.start.tv_usec;
+}
+
+static bool jtag_capture_put_u8(struct jtag_capture_buf *buf, uint8_t val)
+{
+	uint8_t *p = jtag_capture_buf_reserve(buf, 1);
+	if (!p)
+		return false;
+	*p = val;
+	return true;
+}
+
+static bool jtag_capture_put_u32(struct jtag_capture_buf *buf, uint32_t val)
+{
+	uint8_t *p = jtag_capture_buf_reserve(buf, 4);
+	if (!p)
+		return false;
+	h_u32_to_le(p, val);
+	return true;
+}
+
+static bool jtag_capture_put_bits(struct jtag_capture_buf *buf, const uint8_t *bits, unsigned int num_bits)
+{
+	uint8_t *p = jtag_capture_buf_reserve(buf, DIV_ROUND_UP(num_bits, 8));
+	if (!p)
+		return false;
+	buf_cpy(bits, p, num_bits);
+	return true;
+}
+
+static bool jtag_capture_put_cmd(struct jtag_capture_buf *buf, const struct jtag_command *cmd)
+{
+	bool ok = jtag_capture_put_u8(buf, cmd->type);
+
+	switch (cmd->type) {
+	case JTAG_SCAN:
+		ok = ok && jtag_capture_put_u8(buf, cmd->cmd.scan->ir_scan);
+		ok = ok && jtag_capture_put_u8(buf, cmd->cmd.scan->end_state);
+		ok = ok && jtag_capture_put_u32(buf, cmd->cmd.scan->num_fields);
+		for (int i = 0; ok && i < cmd->cmd.scan->num_fields; i++) {
+			const struct scan_field *field = cmd->cmd.scan->fields + i;
+			uint8_t flags = (field->out_value ? JTAG_CAPTURE_FIELD_OUT : 0) |
+				(field->in_value ? JTAG_CAPTURE_FIELD_IN : 0);
+			ok = jtag_capture_put_u32(buf, field->num_bits) && jtag_capture_put_u8(buf, flags);
+			if (ok && field->out_value)
+				ok = jtag_capture_put_bits(buf, field->out_value, field->num_bits);
+			if (ok && field->in_value)
+				ok = jtag_capture_put_bits(buf, field->in_value, field->num_bits);
+		}
+		break;
+	case JTAG_TLR_RESET:
+		ok = ok && jtag_capture_put_u8(buf, cmd->cmd.statemove->end_state);
+		break;
+	case JTAG_RUNTEST:
+		ok = ok && jtag_capture_put_u32(buf, cmd->cmd.runtest->num_cycles);
+		ok = ok && jtag_capture_put_u8(buf, cmd->cmd.runtest->end_state);
+		break;
+	case JTAG_RESET:
+		ok = ok && jtag_capture_put_u8(buf, cmd->cmd.reset->trst);
+		ok = ok && jtag_capture_put_u8(buf, cmd->cmd.reset->srst);
+		break;
+	case JTAG_PATHMOVE:
+		ok = ok && jtag_capture_put_u32(buf, cmd->cmd.pathmove->num_states);
+		for (int i = 0; ok && i < cmd->cmd.pathmove->num_states; i++)
+			ok = jtag_capture_put_u8(buf, cmd->cmd.pathmove->path[i]);
+		break;
+	case JTAG_SLEEP:
+		ok = ok && jtag_capture_put_u32(buf, cmd->cmd.sleep->us);
+		break;
+	case JTAG_STABLECLOCKS:
+		ok = ok && jtag_capture_put_u32(buf, cmd->cmd.stableclocks->num_cycles);
+		break;
+	case JTAG_TMS:
+		ok = ok && jtag_capture_put_u32(buf, cmd->cmd.tms->num_bits);
+		ok = ok && jtag_capture_put_bits(buf, cmd->cmd.tms->bits, cmd->cmd.tms->num_bits);
+		break;
+	}
+	return ok;
+}
+
+void jtag_capture_queue(const struct jtag_command *cmd_queue, int result,
+	uint64_t start_us, uint64_t end_us)
+{
+	struct jtag_capture_buf *buf = &jtag_capture.rec;
+
+	if (!jtag_capture.file || !cmd_queue)
+		return;
+
+	buf->used = 0;
+	uint8_t *hdr = jtag_capture_buf_reserve(buf, JTAG_CAPTURE_REC_HDR_SIZE + JTAG_CAPTURE_QUEUE_HDR_SIZE);
+	if (!hdr)
+		goto _alloc_error;
+	hdr[0] = JTAG_CAPTURE_REC_QUEUE;
+	h_u64_to_le(hdr + JTAG_CAPTURE_REC_HDR_SIZE, start_us);
+	h_u32_to_le(hdr + JTAG_CAPTURE_REC_HDR_SIZE + 8, MIN(end_us - start_us, UINT32_MAX));
+	h_u32_to_le(hdr + JTAG_CAPTURE_REC_HDR_SIZE + 12, result);
+
+	uint32_t num_cmds = 0;
+	for (const struct jtag_command *cmd = cmd_queue; cmd; cmd = cmd->next, num_cmds++) {
+		if (!jtag_capture_put_cmd(buf, cmd))
+			goto _alloc_error;
+	}
+	/* buffer could be reallocated */
+	hdr = buf->data;
+	h_u32_to_le(hdr + JTAG_CAPTURE_REC_HDR_SIZE + 16, num_cmds);
+	h_u32_to_le(hdr + 1, buf->used - JTAG_CAPTURE_REC_HDR_SIZE);
+
+	if (fwrite(buf->data, 1, buf->used, jtag_capture.file) != buf->used) {
+		LOG_ERROR("Failed to write JTAG capture file '%s', capture stopped", jtag_capture.filename);
+		jtag_capture_stop();
+	}
+	return;
+
+_alloc_error:
+	LOG_ERROR("Failed to alloc memory for JTAG capture record, capture stopped");
+	jtag_capture_stop();
+}
+
+struct jtag_capture_reader *jtag_capture_reader_open(const char *filename)
+{
+	struct jtag_capture_reader *reader = calloc(1, sizeof(*reader));
+	if (!reader) {
+		LOG_ERROR("Failed to alloc memory for JTAG capture reader");
+		return NULL;
+	}
+	reader->file = fopen(filename, "rb");
+	if (!reader->file) {
+		LOG_ERROR("Failed to open JTAG capture file '%s'", filename);
+		free(reader);
+		return NULL;
+	}
+	uint8_t hdr[JTAG_CAPTURE_HDR_SIZE];
+	if (fread(hdr, 1, sizeof(hdr), reader->file) != sizeof(hdr) ||
+		memcmp(hdr, JTAG_CAPTURE_MAGIC, sizeof(JTAG_CAPTURE_MAGIC)) != 0) {
+		LOG_ERROR("'%s' is not a JTAG capture file", filename);
+		jtag_capture_reader_close(reader);
+		return NULL;
+	}
+	if (le_to_h_u32(hdr + 8) != JTAG_CAPTURE_VERSION) {
+		LOG_ERROR("Unsupported JTAG capture version %" PRIu32, le_to_h_u32(hdr + 8));
+		jtag_capture_reader_close(reader);
+		return NULL;
+	}
+	return reader;
+}
+
+void jtag_capture_reader_close(struct jtag_capture_reader *reader)
+{
+	if (!reader)
+		return;
+	if (reader->file)
+		fclose(reader->file);
+	jtag_capture_buf_free(&reader->rec);
+	free(reader);
+}
+
+/* Reads the next queue record, skipping records of unknown types */
+static int jtag_capture_read_queue(struct jtag_capture_reader *reader)
+{
+	uint8_t hdr[JTAG_CAPTURE_REC_HDR_SIZE];
+
+	do {
+		if (fread(hdr, 1, sizeof(hdr), reader->file) != sizeof(hdr)) {
+			LOG_ERROR("JTAG replay: end of capture after %lu queues", reader->queues);
+			return ERROR_FAIL;
+		}
+		reader->rec.used = 0;
+		uint32_t len = le_to_h_u32(hdr + 1);
+		uint8_t *p = jtag_capture_buf_reserve(&reader->rec, len);
+		if (!p) {
+			LOG_ERROR("Failed to alloc memory for JTAG capture record");
+			return ERROR_FAIL;
+		}
+		if (fread(p, 1, len, reader->file) != len) {
+			LOG_ERROR("JTAG replay: truncated capture after %lu queues", reader->queues);
+			return ERROR_FAIL;
+		}
+	} while (hdr[0] != JTAG_CAPTURE_REC_QUEUE);
+
+	return ERROR_OK;
+}
+
+static const uint8_t *jtag_capture_get(struct jtag_capture_cursor *cur, size_t len)
+{
+	if ((size_t)(cur->end - cur->pos) < len)
+		return NULL;
+	const uint8_t *p = cur->pos;
+	cur->pos += len;
+	return p;
+}
+
+static bool jtag_capture_get_u8(struct jtag_capture_cursor *cur, uint8_t *val)
+{
+	const uint8_t *p = jtag_capture_get(cur, 1);
+	if (!p)
+		return false;
+	*val = *p;
+	return true;
+}
+
+static bool jtag_capture_get_u32(struct jtag_capture_cursor *cur, uint32_t *val)
+{
+	const uint8_t *p = jtag_capture_get(cur, 4);
+	if (!p)
+		return false;
+	*val = le_to_h_u32(p);
+	return true;
+}
+
+/* Matches the command against the capture, returns description of the mismatch or NULL */
+static const char *jtag_capture_replay_cmd(struct jtag_capture_cursor *cur,
+	struct jtag_command *cmd, bool verify_out)
+{
+	uint8_t type, u8_val, u8_val2;
+	uint32_t u32_val;
+	const uint8_t *data;
+
+	if (!jtag_capture_get_u8(cur, &type))
+		return "truncated record";
+	if (type != cmd->type)
+		return "command type";
+
+	switch (cmd->type) {
+	case JTAG_SCAN:
+		if (!jtag_capture_get_u8(cur, &u8_val) || !jtag_capture_get_u8(cur, &u8_val2) ||
+			!jtag_capture_get_u32(cur, &u32_val))
+			return "truncated record";
+		if (u8_val != cmd->cmd.scan->ir_scan || u8_val2 != cmd->cmd.scan->end_state ||
+			u32_val != (uint32_t)cmd->cmd.scan->num_fields)
+			return "scan type, end state or number of fields";
+		for (int i = 0; i < cmd->cmd.scan->num_fields; i++) {
+			struct scan_field *field = cmd->cmd.scan->fields + i;
+			size_t num_bytes = DIV_ROUND_UP(field->num_bits, 8);
+			if (!jtag_capture_get_u32(cur, &u32_val) || !jtag_capture_get_u8(cur, &u8_val))
+				return "truncated record";
+			if (u32_val != (uint32_t)field->num_bits)
+				return "field length";
+			if (u8_val & JTAG_CAPTURE_FIELD_OUT) {
+				data = jtag_capture_get(cur, num_bytes);
+				if (!data)
+					return "truncated record";
+				if (verify_out && field->out_value && buf_cmp(data, field->out_value, field->num_bits))
+					return "out data";
+			}
+			if (u8_val & JTAG_CAPTURE_FIELD_IN) {
+				data = jtag_capture_get(cur, num_bytes);
+				if (!data)
+					return "truncated record";
+				if (field->in_value)
+					buf_cpy(data, field->in_value, field->num_bits);
+			} else if (field->in_value) {
+				return "in data not captured";
+			}
+		}
+		break;
+	case JTAG_TLR_RESET:
+		if (!jtag_capture_get_u8(cur, &u8_val))
+			return "truncated record";
+		if (u8_val != cmd->cmd.statemove->end_state)
+			return "end state";
+		break;
+	case JTAG_RUNTEST:
+		if (!jtag_capture_get_u32(cur, &u32_val) || !jtag_capture_get_u8(cur, &u8_val))
+			return "truncated record";
+		if (u32_val != (uint32_t)cmd->cmd.runtest->num_cycles || u8_val != cmd->cmd.runtest->end_state)
+			return "number of cycles or end state";
+		break;
+	case JTAG_RESET:
+		if (!jtag_capture_get_u8(cur, &u8_val) || !jtag_capture_get_u8(cur, &u8_val2))
+			return "truncated record";
+		if ((int8_t)u8_val != cmd->cmd.reset->trst || (int8_t)u8_val2 != cmd->cmd.reset->srst)
+			return "reset signals";
+		break;
+	case JTAG_PATHMOVE:
+		if (!jtag_capture_get_u32(cur, &u32_val))
+			return "truncated record";
+		if (u32_val != (uint32_t)cmd->cmd.pathmove->num_states)
+			return "number of states";
+		data = jtag_capture_get(cur, u32_val);
+		if (!data)
+			return "truncated record";
+		for (uint32_t i = 0; i < u32_val; i++) {
+			if (data[i] != cmd->cmd.pathmove->path[i])
+				return "path";
+		}
+		break;
+	case JTAG_SLEEP:
+		if (!jtag_capture_get_u32(cur, &u32_val))
+			return "truncated record";
+		if (u32_val != cmd->cmd.sleep->us)
+			return "sleep time";
+		break;
+	case JTAG_STABLECLOCKS:
+		if (!jtag_capture_get_u32(cur, &u32_val))
+			return "truncated record";
+		if (u32_val != (uint32_t)cmd->cmd.stableclocks->num_cycles)
+			return "number of cycles";
+		break;
+	case JTAG_TMS:
+		if (!jtag_capture_get_u32(cur, &u32_val))
+			return "truncated record";
+		if (u32_val != cmd->cmd.tms->num_bits)
+			return "number of bits";
+		data = jtag_capture_get(cur, DIV_ROUND_UP(u32_val, 8));
+		if (!data)
+			return "truncated record";
+		if (buf_cmp(data, cmd->cmd.tms->bits, u32_val))
+			return "TMS bits";
+		break;
+	}
+	return NULL;
+}
+
+static void jtag_capture_replay_poll_hint(void)
+{
+	/* timer driven polling interleaves its queues differently at replay speed */
+	if (jtag_poll_get_enabled())
+		LOG_INFO("JTAG replay: background polling is enabled, run 'poll off' after 'init' "
+			"both when capturing and when replaying");
+}
+
+int jtag_capture_replay_queue(struct jtag_capture_reader *reader,
+	struct jtag_command *cmd_queue, bool verify_out, int *result)
+{
+	int retval = jtag_capture_read_queue(reader);
+	if (retval != ERROR_OK)
+		return retval;
+
+	struct jtag_capture_cursor cur = {
+		.pos = reader->rec.data,
+		.end = reader->rec.data + reader->rec.used,
+	};
+	const uint8_t *hdr = jtag_capture_get(&cur, JTAG_CAPTURE_QUEUE_HDR_SIZE);
+	if (!hdr) {
+		LOG_ERROR("JTAG replay: queue %lu: truncated record", reader->queues);
+		return ERROR_FAIL;
+	}
+	*result = (int32_t)le_to_h_u32(hdr + 12);
+	uint32_t num_cmds = le_to_h_u32(hdr + 16);
+
+	uint32_t i = 0;
+	for (struct jtag_command *cmd = cmd_queue; cmd; cmd = cmd->next, i++) {
+		const char *mismatch = i < num_cmds ? jtag_capture_replay_cmd(&cur, cmd, verify_out) :
+			"number of commands";
+		if (mismatch) {
+			LOG_ERROR("JTAG replay: queue %lu command %" PRIu32 " does not match capture: %s",
+				reader->queues, i, mismatch);
+			jtag_capture_replay_poll_hint();
+			return ERROR_FAIL;
+		}
+	}
+	if (i != num_cmds) {
+		LOG_ERROR("JTAG replay: queue %lu has %" PRIu32 " commands, captured %" PRIu32,
+			reader->queues, i, num_cmds);
+		jtag_capture_replay_poll_hint();
+		return ERROR_FAIL;
+	}
+	reader->queues++;
+	return ERROR_OK;
+}
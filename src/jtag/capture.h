@@ -0,0 +1,82 @@
+/***************************************************************************
+ *   Binary capture of executed JTAG queues                                *
+ *   Copyright (C) 2022 Espressif Systems Ltd.                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_JTAG_CAPTURE_H
+#define OPENOCD_JTAG_CAPTURE_H
+
+#include <jtag/commands.h>
+
+/*
+ * Capture file format, all numbers are little endian:
+ *
+ * header:	"OCDJCAP\0", u32 version
+ * record:	u8 type, u32 payload length, payload
+ *
+ * JTAG_CAPTURE_REC_QUEUE payload describes one executed queue:
+ *		u64 start time (us since capture start), u32 duration (us), i32 result,
+ *		u32 number of commands, commands
+ * command:	u8 jtag_command_type, then
+ *		JTAG_SCAN:		u8 ir_scan, u8 end_state, u32 num_fields,
+ *					fields: u32 num_bits, u8 flags, [out bytes], [in bytes]
+ *		JTAG_TLR_RESET:		u8 end_state
+ *		JTAG_RUNTEST:		u32 num_cycles, u8 end_state
+ *		JTAG_RESET:		i8 trst, i8 srst
+ *		JTAG_PATHMOVE:		u32 num_states, u8 states[num_states]
+ *		JTAG_SLEEP:		u32 us
+ *		JTAG_STABLECLOCKS:	u32 num_cycles
+ *		JTAG_TMS:		u32 num_bits, bits
+ */
+#define JTAG_CAPTURE_MAGIC		"OCDJCAP"
+#define JTAG_CAPTURE_VERSION		1
+#define JTAG_CAPTURE_HDR_SIZE		12
+#define JTAG_CAPTURE_REC_HDR_SIZE	5
+#define JTAG_CAPTURE_QUEUE_HDR_SIZE	20
+
+#define JTAG_CAPTURE_REC_QUEUE		1
+
+#define JTAG_CAPTURE_FIELD_OUT		0x01
+#define JTAG_CAPTURE_FIELD_IN		0x02
+
+int jtag_capture_start(const char *filename);
+void jtag_capture_stop(void);
+bool jtag_capture_is_active(void);
+const char *jtag_capture_filename(void);
+/** Returns time in us since the capture start, used to timestamp queues. */
+uint64_t jtag_capture_time_us(void);
+/** Writes record for the queue executed between start_us and end_us with the result. */
+void jtag_capture_queue(const struct jtag_command *cmd_queue, int result,
+	uint64_t start_us, uint64_t end_us);
+
+struct jtag_capture_reader;
+
+struct jtag_capture_reader *jtag_capture_reader_open(const char *filename);
+void jtag_capture_reader_close(struct jtag_capture_reader *reader);
+/**
+ * Answers the queue from the next recorded queue of the capture: fills in_value
+ * of the scan fields with the captured data and returns the captured result.
+ *
+ * @param reader The capture being replayed.
+ * @param cmd_queue The queue to execute.
+ * @param verify_out Compare out data of the scans with the captured ones.
+ * @param result Result of the captured queue.
+ * @returns ERROR_OK when the queue matches the capture, error code otherwise.
+ */
+int jtag_capture_replay_queue(struct jtag_capture_reader *reader,
+	struct jtag_command *cmd_queue, bool verify_out, int *result);
+
+#endif /* OPENOCD_JTAG_CAPTURE_H */
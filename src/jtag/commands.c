@@ -37,13 +37,20 @@
 struct cmd_queue_page {
 	struct cmd_queue_page *next;
 	void *address;
+	size_t size;
 	size_t used;
 };
 
 #define CMD_QUEUE_PAGE_SIZE (1024 * 1024)
+/* Pages are kept after the queue is flushed to avoid allocating them again for the next one.
+ * This is the number of bytes kept, pages above the limit are freed. */
+static size_t cmd_queue_keep_size = CMD_QUEUE_PAGE_SIZE;
 static struct cmd_queue_page *cmd_queue_pages;
+/* page which allocations are currently made from, retained pages follow it */
 static struct cmd_queue_page *cmd_queue_pages_tail;
 
+static struct jtag_queue_stats cmd_queue_stats;
+
 struct jtag_command *jtag_command_queue;
 static struct jtag_command **next_command_pointer = &jtag_command_queue;
 
@@ -114,19 +121,20 @@ void *cmd_queue_alloc(size_t size)
 
 	if (*p_page) {
 		p_page = &cmd_queue_pages_tail;
-		if (CMD_QUEUE_PAGE_SIZE - (*p_page)->used < size)
+		if ((*p_page)->size - (*p_page)->used < size)
 			p_page = &((*p_page)->next);
 	}
 
-	if (!*p_page) {
-		*p_page = malloc(sizeof(struct cmd_queue_page));
-		(*p_page)->used = 0;
-		size_t alloc_size = (size < CMD_QUEUE_PAGE_SIZE) ?
-					CMD_QUEUE_PAGE_SIZE : size;
-		(*p_page)->address = malloc(alloc_size);
-		(*p_page)->next = NULL;
-		cmd_queue_pages_tail = *p_page;
+	if (!*p_page || (*p_page)->size < size) {
+		/* no retained page which is large enough, insert a new one */
+		struct cmd_queue_page *page = malloc(sizeof(struct cmd_queue_page));
+		page->used = 0;
+		page->size = (size < CMD_QUEUE_PAGE_SIZE) ? CMD_QUEUE_PAGE_SIZE : size;
+		page->address = malloc(page->size);
+		page->next = *p_page;
+		*p_page = page;
 	}
+	cmd_queue_pages_tail = *p_page;
 
 	offset = (*p_page)->used;
 	(*p_page)->used += size;
@@ -135,29 +143,89 @@ void *cmd_queue_alloc(size_t size)
 	return t + offset;
 }
 
+/* Resets the used pages for reuse, frees the ones above the retention limit or larger than usual */
 static void cmd_queue_free(void)
 {
-	struct cmd_queue_page *page = cmd_queue_pages;
-
-	while (page) {
-		struct cmd_queue_page *last = page;
+	struct cmd_queue_page **p_page = &cmd_queue_pages;
+	size_t kept = 0;
+
+	while (*p_page) {
+		struct cmd_queue_page *page = *p_page;
+		if (page->size == CMD_QUEUE_PAGE_SIZE && kept + page->size <= cmd_queue_keep_size) {
+			kept += page->size;
+			page->used = 0;
+			p_page = &page->next;
+			continue;
+		}
+		*p_page = page->next;
 		free(page->address);
-		page = page->next;
-		free(last);
+		free(page);
 	}
 
-	cmd_queue_pages = NULL;
-	cmd_queue_pages_tail = NULL;
+	cmd_queue_pages_tail = cmd_queue_pages;
+}
+
+static void cmd_queue_update_stats(void)
+{
+	struct jtag_queue_stats *stats = &cmd_queue_stats;
+	struct jtag_queue_flush_stats last = { 0 };
+
+	for (struct cmd_queue_page *page = cmd_queue_pages; page; page = page->next)
+		last.bytes += page->used;
+
+	for (struct jtag_command *cmd = jtag_command_queue; cmd; cmd = cmd->next) {
+		last.commands++;
+		if ((unsigned int)cmd->type < ARRAY_SIZE(stats->type_commands))
+			stats->type_commands[cmd->type]++;
+		if (cmd->type == JTAG_SCAN) {
+			last.fields += cmd->cmd.scan->num_fields;
+			last.bits += jtag_scan_size(cmd->cmd.scan);
+		}
+	}
+	if (last.commands == 0 && last.bytes == 0)
+		return;
+
+	stats->flushes++;
+	stats->last = last;
+	stats->total.commands += last.commands;
+	stats->total.fields += last.fields;
+	stats->total.bits += last.bits;
+	stats->total.bytes += last.bytes;
+	stats->max.commands = MAX(stats->max.commands, last.commands);
+	stats->max.fields = MAX(stats->max.fields, last.fields);
+	stats->max.bits = MAX(stats->max.bits, last.bits);
+	stats->max.bytes = MAX(stats->max.bytes, last.bytes);
 }
 
 void jtag_command_queue_reset(void)
 {
+	cmd_queue_update_stats();
 	cmd_queue_free();
 
 	jtag_command_queue = NULL;
 	next_command_pointer = &jtag_command_queue;
 }
 
+const struct jtag_queue_stats *jtag_command_queue_get_stats(void)
+{
+	return &cmd_queue_stats;
+}
+
+void jtag_command_queue_clear_stats(void)
+{
+	memset(&cmd_queue_stats, 0, sizeof(cmd_queue_stats));
+}
+
+void jtag_command_queue_set_keep_size(size_t size)
+{
+	cmd_queue_keep_size = size;
+}
+
+size_t jtag_command_queue_get_keep_size(void)
+{
+	return cmd_queue_keep_size;
+}
+
 /**
  * Copy a struct scan_field for insertion into the queue.
  *
@@ -168,6 +168,32 @@ void *cmd_queue_alloc(size_t size);
 void jtag_queue_command(struct jtag_command *cmd);
 void jtag_command_queue_reset(void);
 
+/** Volume of the JTAG queue between two resets of it. */
+struct jtag_queue_flush_stats {
+	uint64_t commands;
+	/** number of scan fields in all JTAG_SCAN commands */
+	uint64_t fields;
+	/** number of bits in all JTAG_SCAN commands */
+	uint64_t bits;
+	/** memory allocated via cmd_queue_alloc() */
+	uint64_t bytes;
+};
+
+struct jtag_queue_stats {
+	uint64_t flushes;
+	/** number of commands of every jtag_command_type */
+	uint64_t type_commands[JTAG_TMS + 1];
+	struct jtag_queue_flush_stats last;
+	struct jtag_queue_flush_stats max;
+	struct jtag_queue_flush_stats total;
+};
+
+const struct jtag_queue_stats *jtag_command_queue_get_stats(void);
+void jtag_command_queue_clear_stats(void);
+/** Sets max size of memory kept for the next queue after the current one is flushed. */
+void jtag_command_queue_set_keep_size(size_t size);
+size_t jtag_command_queue_get_keep_size(void);
+
 void jtag_scan_field_clone(struct scan_field *dst, const struct scan_field *src);
 enum scan_type jtag_scan_type(const struct scan_command *cmd);
 int jtag_scan_size(const struct scan_command *cmd);
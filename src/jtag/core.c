@@ -34,6 +34,7 @@
 #include "jtag.h"
 #include "swd.h"
 #include "interface.h"
+#include "capture.h"
 #include <transport/transport.h>
 #include <helper/jep106.h>
 #include "helper/system.h"
@@ -590,6 +591,351 @@ void jtag_add_runtest(int num_cycles, tap_state_t state)
 }
 
 
+uint8_t jtag_scan_template_var[1];
+
+/* Alignment of the blocks in the commands image, same as the one of cmd_queue_alloc() */
+#define JTAG_SCAN_TEMPLATE_ALIGN	sizeof(uint64_t)
+
+/* Pointer stored in the commands image which points to another part of the image */
+struct jtag_scan_template_reloc {
+	size_t ptr_offset;
+	size_t target_offset;
+};
+
+/* Field with variable out_value */
+struct jtag_scan_template_out {
+	size_t data_offset;
+	size_t num_bytes;
+};
+
+/* IR field updating cur_instr of the TAP when queued */
+struct jtag_scan_template_ir {
+	struct jtag_tap *tap;
+	size_t field_offset;
+};
+
+struct jtag_scan_template {
+	/* image of the commands with pointers relative to the image start */
+	uint8_t *image;
+	size_t image_size;
+	size_t *cmds;
+	unsigned int num_cmds;
+	struct jtag_scan_template_reloc *relocs;
+	unsigned int num_relocs;
+	struct jtag_scan_template_out *outs;
+	unsigned int num_outs;
+	/* offsets of the fields with variable in_value */
+	size_t *ins;
+	unsigned int num_ins;
+	struct jtag_scan_template_ir *irs;
+	unsigned int num_irs;
+	/* enabled TAPs at the time of template creation */
+	struct jtag_tap **taps;
+	unsigned int num_taps;
+	/* bypass state of the TAPs before and after the template */
+	bool *bypass_start;
+	bool *bypass;
+	/* DR scan recorded before the first IR scan depends on the initial bypass state */
+	bool depends_on_bypass;
+	bool has_ir_scan;
+	tap_state_t end_state;
+	int error;
+};
+
+static void *jtag_scan_template_grow(struct jtag_scan_template *tmpl, void *array,
+	unsigned int count, size_t elem_size)
+{
+	void *p = realloc(array, (count + 1) * elem_size);
+	if (!p) {
+		LOG_ERROR("Failed to alloc memory for scan template!");
+		tmpl->error = ERROR_FAIL;
+		return array;
+	}
+	return p;
+}
+
+/* Returns offset of the new zeroed block in the image or 0 on error (offset 0 is never
+ * returned on success because every block is preceded by a jtag_command) */
+static size_t jtag_scan_template_alloc(struct jtag_scan_template *tmpl, size_t size)
+{
+	size_t offset = tmpl->image_size;
+	size_t new_size = offset + DIV_ROUND_UP(size, JTAG_SCAN_TEMPLATE_ALIGN) * JTAG_SCAN_TEMPLATE_ALIGN;
+	uint8_t *p = realloc(tmpl->image, new_size);
+	if (!p) {
+		LOG_ERROR("Failed to alloc memory for scan template!");
+		tmpl->error = ERROR_FAIL;
+		return 0;
+	}
+	memset(p + offset, 0, new_size - offset);
+	tmpl->image = p;
+	tmpl->image_size = new_size;
+	return offset;
+}
+
+static void jtag_scan_template_add_reloc(struct jtag_scan_template *tmpl, size_t ptr_offset,
+	size_t target_offset)
+{
+	tmpl->relocs = jtag_scan_template_grow(tmpl, tmpl->relocs, tmpl->num_relocs, sizeof(*tmpl->relocs));
+	if (tmpl->error != ERROR_OK)
+		return;
+	tmpl->relocs[tmpl->num_relocs].ptr_offset = ptr_offset;
+	tmpl->relocs[tmpl->num_relocs].target_offset = target_offset;
+	tmpl->num_relocs++;
+}
+
+static size_t jtag_scan_template_add_cmd(struct jtag_scan_template *tmpl, enum jtag_command_type type,
+	size_t cmd_size)
+{
+	size_t cmd_offset = jtag_scan_template_alloc(tmpl, sizeof(struct jtag_command));
+	size_t data_offset = jtag_scan_template_alloc(tmpl, cmd_size);
+	tmpl->cmds = jtag_scan_template_grow(tmpl, tmpl->cmds, tmpl->num_cmds, sizeof(*tmpl->cmds));
+	if (tmpl->error != ERROR_OK)
+		return 0;
+	tmpl->cmds[tmpl->num_cmds++] = cmd_offset;
+	((struct jtag_command *)(tmpl->image + cmd_offset))->type = type;
+	/* all members of jtag_command_container are pointers at offset 0 */
+	jtag_scan_template_add_reloc(tmpl, cmd_offset + offsetof(struct jtag_command, cmd), data_offset);
+	return data_offset;
+}
+
+/* Adds scan command, returns offset of its fields array */
+static size_t jtag_scan_template_add_scan(struct jtag_scan_template *tmpl, bool ir_scan,
+	int num_fields, tap_state_t endstate)
+{
+	size_t scan_offset = jtag_scan_template_add_cmd(tmpl, JTAG_SCAN, sizeof(struct scan_command));
+	size_t fields_offset = jtag_scan_template_alloc(tmpl, num_fields * sizeof(struct scan_field));
+	if (tmpl->error != ERROR_OK)
+		return 0;
+	struct scan_command *scan = (struct scan_command *)(tmpl->image + scan_offset);
+	scan->ir_scan = ir_scan;
+	scan->num_fields = num_fields;
+	scan->end_state = endstate;
+	jtag_scan_template_add_reloc(tmpl, scan_offset + offsetof(struct scan_command, fields), fields_offset);
+	tmpl->end_state = endstate;
+	return fields_offset;
+}
+
+/* Fills the field at field_offset. If out_value is NULL and out_ones is set, the field
+ * scans out ones, same as jtag_add_ir_scan() does for TAPs in bypass. */
+static void jtag_scan_template_set_field(struct jtag_scan_template *tmpl, size_t field_offset,
+	unsigned int num_bits, const uint8_t *out_value, bool out_ones, uint8_t *in_value)
+{
+	size_t num_bytes = DIV_ROUND_UP(num_bits, 8);
+
+	if (out_value || out_ones) {
+		size_t data_offset = jtag_scan_template_alloc(tmpl, num_bytes);
+		if (tmpl->error != ERROR_OK)
+			return;
+		if (out_value == JTAG_SCAN_TEMPLATE_VAR) {
+			tmpl->outs = jtag_scan_template_grow(tmpl, tmpl->outs, tmpl->num_outs, sizeof(*tmpl->outs));
+			if (tmpl->error != ERROR_OK)
+				return;
+			tmpl->outs[tmpl->num_outs].data_offset = data_offset;
+			tmpl->outs[tmpl->num_outs].num_bytes = num_bytes;
+			tmpl->num_outs++;
+		} else if (out_value) {
+			buf_cpy(out_value, tmpl->image + data_offset, num_bits);
+		} else {
+			buf_set_ones(tmpl->image + data_offset, num_bits);
+		}
+		jtag_scan_template_add_reloc(tmpl, field_offset + offsetof(struct scan_field, out_value), data_offset);
+	}
+	if (in_value == JTAG_SCAN_TEMPLATE_VAR) {
+		tmpl->ins = jtag_scan_template_grow(tmpl, tmpl->ins, tmpl->num_ins, sizeof(*tmpl->ins));
+		if (tmpl->error != ERROR_OK)
+			return;
+		tmpl->ins[tmpl->num_ins++] = field_offset;
+		in_value = NULL;
+	}
+	if (tmpl->error != ERROR_OK)
+		return;
+	struct scan_field *field = (struct scan_field *)(tmpl->image + field_offset);
+	field->num_bits = num_bits;
+	field->in_value = in_value;
+}
+
+struct jtag_scan_template *jtag_scan_template_new(void)
+{
+	struct jtag_scan_template *tmpl = calloc(1, sizeof(*tmpl));
+	if (!tmpl) {
+		LOG_ERROR("Failed to alloc memory for scan template!");
+		return NULL;
+	}
+	tmpl->num_taps = jtag_tap_count_enabled();
+	tmpl->end_state = TAP_IDLE;
+	if (tmpl->num_taps > 0) {
+		tmpl->taps = calloc(tmpl->num_taps, sizeof(*tmpl->taps));
+		tmpl->bypass_start = calloc(tmpl->num_taps, sizeof(*tmpl->bypass_start));
+		tmpl->bypass = calloc(tmpl->num_taps, sizeof(*tmpl->bypass));
+		if (!tmpl->taps || !tmpl->bypass_start || !tmpl->bypass) {
+			LOG_ERROR("Failed to alloc memory for scan template!");
+			jtag_scan_template_free(tmpl);
+			return NULL;
+		}
+	}
+	unsigned int i = 0;
+	for (struct jtag_tap *tap = jtag_tap_next_enabled(NULL); tap; tap = jtag_tap_next_enabled(tap), i++) {
+		tmpl->taps[i] = tap;
+		tmpl->bypass_start[i] = tap->bypass;
+		tmpl->bypass[i] = tap->bypass;
+	}
+	return tmpl;
+}
+
+void jtag_scan_template_free(struct jtag_scan_template *tmpl)
+{
+	if (!tmpl)
+		return;
+	free(tmpl->image);
+	free(tmpl->cmds);
+	free(tmpl->relocs);
+	free(tmpl->outs);
+	free(tmpl->ins);
+	free(tmpl->irs);
+	free(tmpl->taps);
+	free(tmpl->bypass_start);
+	free(tmpl->bypass);
+	free(tmpl);
+}
+
+int jtag_scan_template_add_ir_scan(struct jtag_scan_template *tmpl, struct jtag_tap *active,
+		const struct scan_field *field, tap_state_t endstate)
+{
+	assert(endstate != TAP_RESET);
+
+	size_t fields_offset = jtag_scan_template_add_scan(tmpl, true, tmpl->num_taps, endstate);
+	for (unsigned int i = 0; i < tmpl->num_taps && tmpl->error == ERROR_OK; i++) {
+		struct jtag_tap *tap = tmpl->taps[i];
+		size_t field_offset = fields_offset + i * sizeof(struct scan_field);
+
+		if (tap == active) {
+			tmpl->bypass[i] = false;
+			jtag_scan_template_set_field(tmpl, field_offset, tap->ir_length,
+				field->out_value, false, field->in_value);
+		} else {
+			/* if a TAP isn't listed, set it to BYPASS */
+			tmpl->bypass[i] = true;
+			jtag_scan_template_set_field(tmpl, field_offset, tap->ir_length, NULL, true, NULL);
+		}
+		tmpl->irs = jtag_scan_template_grow(tmpl, tmpl->irs, tmpl->num_irs, sizeof(*tmpl->irs));
+		if (tmpl->error != ERROR_OK)
+			break;
+		tmpl->irs[tmpl->num_irs].tap = tap;
+		tmpl->irs[tmpl->num_irs].field_offset = field_offset;
+		tmpl->num_irs++;
+	}
+	tmpl->has_ir_scan = true;
+	return tmpl->error;
+}
+
+int jtag_scan_template_add_dr_scan(struct jtag_scan_template *tmpl, struct jtag_tap *active,
+		int num_fields, const struct scan_field *fields, tap_state_t endstate)
+{
+	assert(endstate != TAP_RESET);
+
+	int total_fields = 0;
+	for (unsigned int i = 0; i < tmpl->num_taps; i++) {
+		if (tmpl->bypass[i]) {
+			total_fields++;
+		} else if (tmpl->taps[i] == active) {
+			total_fields += num_fields;
+		} else {
+			LOG_ERROR("TAP %s is not in bypass in scan template for %s",
+				tmpl->taps[i]->dotted_name, active->dotted_name);
+			tmpl->error = ERROR_FAIL;
+			return tmpl->error;
+		}
+	}
+	if (!tmpl->has_ir_scan)
+		tmpl->depends_on_bypass = true;
+
+	size_t field_offset = jtag_scan_template_add_scan(tmpl, false, total_fields, endstate);
+	for (unsigned int i = 0; i < tmpl->num_taps && tmpl->error == ERROR_OK; i++) {
+		if (!tmpl->bypass[i]) {
+			for (int j = 0; j < num_fields && tmpl->error == ERROR_OK; j++) {
+				jtag_scan_template_set_field(tmpl, field_offset, fields[j].num_bits,
+					fields[j].out_value, false, fields[j].in_value);
+				field_offset += sizeof(struct scan_field);
+			}
+		} else {
+			/* program the scan field to 1 bit length, and ignore it's value */
+			jtag_scan_template_set_field(tmpl, field_offset, 1, NULL, false, NULL);
+			field_offset += sizeof(struct scan_field);
+		}
+	}
+	return tmpl->error;
+}
+
+int jtag_scan_template_add_runtest(struct jtag_scan_template *tmpl, int num_cycles,
+		tap_state_t endstate)
+{
+	size_t offset = jtag_scan_template_add_cmd(tmpl, JTAG_RUNTEST, sizeof(struct runtest_command));
+	if (tmpl->error != ERROR_OK)
+		return tmpl->error;
+	struct runtest_command *runtest = (struct runtest_command *)(tmpl->image + offset);
+	runtest->num_cycles = num_cycles;
+	runtest->end_state = endstate;
+	tmpl->end_state = endstate;
+	return ERROR_OK;
+}
+
+void jtag_add_scan_template(const struct jtag_scan_template *tmpl,
+		const uint8_t * const *out_values, uint8_t * const *in_values)
+{
+	if (tmpl->error != ERROR_OK) {
+		jtag_set_error(tmpl->error);
+		return;
+	}
+	if (tmpl->num_cmds == 0)
+		return;
+
+	if (jtag_tap_count_enabled() != tmpl->num_taps) {
+		LOG_ERROR("Scan chain changed since scan template was recorded");
+		jtag_set_error(ERROR_FAIL);
+		return;
+	}
+	if (tmpl->depends_on_bypass) {
+		for (unsigned int i = 0; i < tmpl->num_taps; i++) {
+			if (tmpl->taps[i]->bypass != tmpl->bypass_start[i]) {
+				LOG_ERROR("TAP %s bypass state changed since scan template was recorded",
+					tmpl->taps[i]->dotted_name);
+				jtag_set_error(ERROR_FAIL);
+				return;
+			}
+		}
+	}
+
+	jtag_prelude(tmpl->end_state);
+
+	uint8_t *image = cmd_queue_alloc(tmpl->image_size);
+	memcpy(image, tmpl->image, tmpl->image_size);
+	for (unsigned int i = 0; i < tmpl->num_relocs; i++) {
+		void *target = image + tmpl->relocs[i].target_offset;
+		memcpy(image + tmpl->relocs[i].ptr_offset, &target, sizeof(target));
+	}
+	for (unsigned int i = 0; i < tmpl->num_outs; i++) {
+		uint8_t *data = image + tmpl->outs[i].data_offset;
+		if (out_values[i])
+			memcpy(data, out_values[i], tmpl->outs[i].num_bytes);
+	}
+	for (unsigned int i = 0; i < tmpl->num_ins; i++)
+		((struct scan_field *)(image + tmpl->ins[i]))->in_value = in_values[i];
+
+	for (unsigned int i = 0; i < tmpl->num_irs; i++) {
+		struct jtag_tap *tap = tmpl->irs[i].tap;
+		struct scan_field *field = (struct scan_field *)(image + tmpl->irs[i].field_offset);
+		buf_cpy(field->out_value, tap->cur_instr, tap->ir_length);
+	}
+	if (tmpl->has_ir_scan) {
+		for (unsigned int i = 0; i < tmpl->num_taps; i++)
+			tmpl->taps[i]->bypass = tmpl->bypass[i];
+	}
+
+	for (unsigned int i = 0; i < tmpl->num_cmds; i++)
+		jtag_queue_command((struct jtag_command *)(image + tmpl->cmds[i]));
+}
+
+
 void jtag_add_clocks(int num_cycles)
 {
 	if (!tap_is_state_stable(cmd_queue_cur_state)) {
@@ -945,8 +1291,15 @@ int default_interface_jtag_execute_queue(void)
 			return ERROR_OK;
 	}
 
+	uint64_t capture_start = 0;
+	if (jtag_capture_is_active())
+		capture_start = jtag_capture_time_us();
+
 	int result = adapter_driver->jtag_ops->execute_queue();
 
+	if (jtag_capture_is_active())
+		jtag_capture_queue(jtag_command_queue, result, capture_start, jtag_capture_time_us());
+
 	struct jtag_command *cmd = jtag_command_queue;
 	while (debug_level >= LOG_LVL_DEBUG_IO && cmd) {
 		switch (cmd->type) {
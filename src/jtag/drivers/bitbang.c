@@ -71,6 +71,90 @@ static void bitbang_end_state(tap_state_t state)
 	tap_set_end_state(state);
 }
 
+/* Stores TDO samples buffered by the interface to bits first..first+count-1 of tdo */
+static int bitbang_read_samples(uint8_t *tdo, unsigned int first, unsigned int count)
+{
+	for (unsigned int i = first; i < first + count; i++) {
+		switch (bitbang_interface->read_sample()) {
+			case BB_LOW:
+				tdo[i / 8] &= ~(1 << (i % 8));
+				break;
+			case BB_HIGH:
+				tdo[i / 8] |= 1 << (i % 8);
+				break;
+			default:
+				return ERROR_FAIL;
+		}
+	}
+	return ERROR_OK;
+}
+
+/**
+ * Clocks num_bits bits: bit i of tms and tdi is set with TCK low, TDO is
+ * sampled into bit i of tdo and TCK is set high. NULL tms or tdi stand for
+ * all zeros, NULL tdo for not sampling. tdo may be the same buffer as tdi.
+ * Uses the scan_bits() callback of the interface if implemented, otherwise
+ * works a byte of the buffers at a time over write() and sample()/read().
+ */
+static int bitbang_clock_bits(const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo, unsigned int num_bits)
+{
+	if (bitbang_interface->scan_bits)
+		return bitbang_interface->scan_bits(tms, tdi, tdo, num_bits);
+
+	size_t buffered = 0;
+	for (unsigned int byte = 0; byte < DIV_ROUND_UP(num_bits, 8); byte++) {
+		unsigned int bits = MIN(num_bits - byte * 8, 8);
+		uint8_t tms_byte = tms ? tms[byte] : 0;
+		uint8_t tdi_byte = tdi ? tdi[byte] : 0;
+		uint8_t tdo_byte = 0;
+
+		for (unsigned int i = 0; i < bits; i++) {
+			int tms_bit = (tms_byte >> i) & 1;
+			int tdi_bit = (tdi_byte >> i) & 1;
+
+			if (bitbang_interface->write(0, tms_bit, tdi_bit) != ERROR_OK)
+				return ERROR_FAIL;
+
+			if (tdo) {
+				if (bitbang_interface->buf_size) {
+					if (bitbang_interface->sample() != ERROR_OK)
+						return ERROR_FAIL;
+					buffered++;
+				} else {
+					switch (bitbang_interface->read()) {
+						case BB_LOW:
+							break;
+						case BB_HIGH:
+							tdo_byte |= 1 << i;
+							break;
+						default:
+							return ERROR_FAIL;
+					}
+				}
+			}
+
+			if (bitbang_interface->write(1, tms_bit, tdi_bit) != ERROR_OK)
+				return ERROR_FAIL;
+
+			if (buffered == bitbang_interface->buf_size && buffered) {
+				unsigned int bit = byte * 8 + i;
+				if (bitbang_read_samples(tdo, bit + 1 - buffered, buffered) != ERROR_OK)
+					return ERROR_FAIL;
+				buffered = 0;
+			}
+		}
+
+		if (tdo && !bitbang_interface->buf_size) {
+			uint8_t mask = 0xff >> (8 - bits);
+			tdo[byte] = (tdo[byte] & ~mask) | tdo_byte;
+		}
+	}
+
+	if (buffered)
+		return bitbang_read_samples(tdo, num_bits - buffered, buffered);
+	return ERROR_OK;
+}
+
 static int bitbang_state_move(int skip)
 {
 	int i = 0, tms = 0;
@@ -154,8 +238,6 @@ static int bitbang_path_move(struct pathmove_command *cmd)
 
 static int bitbang_runtest(int num_cycles)
 {
-	int i;
-
 	tap_state_t saved_end_state = tap_get_end_state();
 
 	/* only do a state_move when we're not already in IDLE */
@@ -166,12 +248,8 @@ static int bitbang_runtest(int num_cycles)
 	}
 
 	/* execute num_cycles */
-	for (i = 0; i < num_cycles; i++) {
-		if (bitbang_interface->write(0, 0, 0) != ERROR_OK)
-			return ERROR_FAIL;
-		if (bitbang_interface->write(1, 0, 0) != ERROR_OK)
-			return ERROR_FAIL;
-	}
+	if (num_cycles > 0 && bitbang_clock_bits(NULL, NULL, NULL, num_cycles) != ERROR_OK)
+		return ERROR_FAIL;
 	if (bitbang_interface->write(CLOCK_IDLE(), 0, 0) != ERROR_OK)
 		return ERROR_FAIL;
 
@@ -204,7 +282,10 @@ static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 		unsigned scan_size)
 {
 	tap_state_t saved_end_state = tap_get_end_state();
-	unsigned bit_cnt;
+
+	/* nothing to shift, and no last bit to leave the shift state on */
+	if (scan_size == 0)
+		return ERROR_OK;
 
 	if (!((!ir_scan &&
 			(tap_get_state() == TAP_DRSHIFT)) ||
@@ -219,64 +300,23 @@ static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 		bitbang_end_state(saved_end_state);
 	}
 
-	size_t buffered = 0;
-	for (bit_cnt = 0; bit_cnt < scan_size; bit_cnt++) {
-		int tms = (bit_cnt == scan_size-1) ? 1 : 0;
-		int tdi;
-		int bytec = bit_cnt/8;
-		int bcval = 1 << (bit_cnt % 8);
-
-		/* if we're just reading the scan, but don't care about the output
-		 * default to outputting 'low', this also makes valgrind traces more readable,
-		 * as it removes the dependency on an uninitialised value
-		 */
-		tdi = 0;
-		if ((type != SCAN_IN) && (buffer[bytec] & bcval))
-			tdi = 1;
-
-		if (bitbang_interface->write(0, tms, tdi) != ERROR_OK)
-			return ERROR_FAIL;
-
-		if (type != SCAN_OUT) {
-			if (bitbang_interface->buf_size) {
-				if (bitbang_interface->sample() != ERROR_OK)
-					return ERROR_FAIL;
-				buffered++;
-			} else {
-				switch (bitbang_interface->read()) {
-					case BB_LOW:
-						buffer[bytec] &= ~bcval;
-						break;
-					case BB_HIGH:
-						buffer[bytec] |= bcval;
-						break;
-					default:
-						return ERROR_FAIL;
-				}
-			}
-		}
-
-		if (bitbang_interface->write(1, tms, tdi) != ERROR_OK)
-			return ERROR_FAIL;
-
-		if (type != SCAN_OUT && bitbang_interface->buf_size &&
-				(buffered == bitbang_interface->buf_size ||
-				 bit_cnt == scan_size - 1)) {
-			for (unsigned i = bit_cnt + 1 - buffered; i <= bit_cnt; i++) {
-				switch (bitbang_interface->read_sample()) {
-					case BB_LOW:
-						buffer[i/8] &= ~(1 << (i % 8));
-						break;
-					case BB_HIGH:
-						buffer[i/8] |= 1 << (i % 8);
-						break;
-					default:
-						return ERROR_FAIL;
-				}
-			}
-			buffered = 0;
-		}
+	/* TMS is set on the last bit to leave the shift state */
+	uint8_t *tms = calloc(DIV_ROUND_UP(scan_size, 8), 1);
+	if (!tms) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
 	}
+	tms[(scan_size - 1) / 8] = 1 << ((scan_size - 1) % 8);
+
+	/* if we're just reading the scan, but don't care about the output
+	 * default to outputting 'low', this also makes valgrind traces more readable,
+	 * as it removes the dependency on an uninitialised value
+	 */
+	int retval = bitbang_clock_bits(tms, type != SCAN_IN ? buffer : NULL,
+		type != SCAN_OUT ? buffer : NULL, scan_size);
+	free(tms);
+	if (retval != ERROR_OK)
+		return retval;
 
 	if (tap_get_state() != tap_get_end_state()) {
 		/* we *KNOW* the above loop transitioned out of
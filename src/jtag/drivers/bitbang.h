@@ -54,6 +54,14 @@ struct bitbang_interface {
 	/** Set TCK, TMS, and TDI to the given values. */
 	int (*write)(int tck, int tms, int tdi);
 
+	/** Clock a run of bits (optional). For every bit i, TMS and TDI are set to
+	 * bit i of tms and tdi with TCK low, TDO is sampled into bit i of tdo and
+	 * TCK is set high. tms and tdi may be NULL for all zeros, tdo may be NULL
+	 * if TDO is not needed or the same buffer as tdi. Bit buffers are packed
+	 * LSB first. When implemented, it is used instead of write() and sample()
+	 * or read() for scans and run-test cycles. */
+	int (*scan_bits)(const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo, unsigned int num_bits);
+
 	/** Blink led (optional). */
 	int (*blink)(int on);
 
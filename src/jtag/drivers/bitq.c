@@ -26,6 +26,9 @@
 
 struct bitq_interface *bitq_interface; /* low level bit queue interface */
 
+/* max number of bits passed to bitq_interface->out_bits() at once, must be multiple of 8 */
+#define BITQ_OUT_BITS_BLOCK 1024
+
 /* state of input queue */
 struct bitq_state {
 	struct jtag_command *cmd; /* command currently processed */
@@ -168,7 +171,20 @@ static void bitq_scan_field(struct scan_field *field, int do_pause)
 	else
 		tdo_req = 0;
 
-	if (!field->out_value) {
+	if (bitq_interface->out_bits) {
+		/* let the interface encode all bits but the last one in blocks, input queue is checked after
+		 * every block, so the interface does not need to buffer more TDO data than for a block */
+		for (bit_cnt = 0; bit_cnt < field->num_bits - 1; bit_cnt += BITQ_OUT_BITS_BLOCK) {
+			int num_bits = MIN(field->num_bits - 1 - bit_cnt, BITQ_OUT_BITS_BLOCK);
+			bitq_interface->out_bits(field->out_value ? field->out_value + bit_cnt / 8 : NULL,
+				num_bits, tdo_req);
+			if (bitq_interface->in_rdy())
+				bitq_in_proc();
+		}
+		bit_cnt = field->num_bits - 1;
+		int tdi = field->out_value ? (field->out_value[bit_cnt / 8] >> (bit_cnt % 8)) & 1 : 0;
+		bitq_io(do_pause, tdi, tdo_req);
+	} else if (!field->out_value) {
 		/* just send zeros and request data from TDO */
 		for (bit_cnt = field->num_bits; bit_cnt > 1; bit_cnt--)
 			bitq_io(0, 0, tdo_req);
@@ -24,6 +24,9 @@
 struct bitq_interface {
 	/* function to enqueueing low level IO requests */
 	int (*out)(int tms, int tdi, int tdo_req);
+	/* optional function to enqueue `num_bits` clocks with TMS low at once, TDI values are taken
+	 * from `tdi` buffer LSB first, NULL means all zeros */
+	int (*out_bits)(const uint8_t *tdi, int num_bits, int tdo_req);
 	int (*flush)(void);
 
 	int (*sleep)(unsigned long us);
@@ -25,6 +25,7 @@
 #include <jtag/interface.h>
 #include <helper/time_support.h>
 #include <helper/bits.h>
+#include <helper/binarybuffer.h>
 #include "bitq.h"
 #include "libusb_helper.h"
 
@@ -163,6 +164,8 @@ struct jtag_proto_caps_speed_apb {
 #define VEND_JTAG_SETIO_SRST    BIT(4)
 
 #define CMD_CLK(cap, tdi, tms) ((cap ? BIT(2) : 0) | (tms ? BIT(1) : 0) | (tdi ? BIT(0) : 0))
+/* Only clock commands with capture bit set return TDO data */
+#define CMD_IS_CAPTURE(cmd) (((cmd) & 0xC) == 0x4)
 #define CMD_RST(srst)   (0x8 | (srst ? BIT(0) : 0))
 #define CMD_FLUSH       0xA
 #define CMD_RSVD        0xB
@@ -171,6 +174,8 @@ struct jtag_proto_caps_speed_apb {
 /* The internal repeats register is 10 bits, which means we can have 5 repeat commands in a
  *row at max. This translates to ('b1111111111+1=)1024 reps max. */
 #define CMD_REP_MAX_REPS 1024
+/* Max length of command stream for a command with repeats */
+#define CMD_REP_MAX_NIBBLES 6
 
 /* Currently we only support one USB device. */
 #define USB_CONFIGURATION 0
@@ -181,12 +186,20 @@ struct jtag_proto_caps_speed_apb {
 /* Out data can be buffered for longer without issues (as long as the in buffer does not overflow),
  * so we'll use an out buffer that is much larger than the out ep size. */
 #define OUT_BUF_SZ (OUT_EP_SZ * 32)
+/* Number of OUT buffers which can be submitted to libusb at the same time. While one of them is being
+ * filled by the bitq interface, the others are transferred to the device. */
+#define OUT_XFER_CT 4
 /* The in buffer cannot be larger than the device can offer, though. */
 #define IN_BUF_SZ 64
 
 /* Because a series of out commands can lead to a multitude of IN_BUF_SZ-sized in packets
- *to be read, we have multiple buffers to store those before the bitq interface reads them out. */
-#define IN_BUF_CT 8
+ * to be read, we have multiple buffers to store those before the bitq interface reads them out.
+ * Every buffer is backed by its own IN transfer. The device stops processing OUT data when it has
+ * hw_in_fifo_len packets which were not read yet, so IN transfers must stay in flight while we wait
+ * for free OUT buffer. The ring is sized for OUT buffers where every command nibble captures one bit,
+ * but a repeated command can capture up to CMD_REP_MAX_REPS bits, so when the ring is full the bits
+ * of the finished buffers are moved aside into a growing spill buffer (see esp_usb_jtag_in_spill()). */
+#define IN_BUF_CT (OUT_XFER_CT * OUT_BUF_SZ * 2 / 8 / IN_BUF_SZ + 1)
 
 /*
  * comment from libusb:
@@ -196,19 +209,35 @@ struct jtag_proto_caps_speed_apb {
 
 #define ESP_USB_INTERFACE       1
 
+struct esp_usb_jtag_out_xfer {
+	struct libusb_transfer *xfer;
+	uint8_t buf[OUT_BUF_SZ];
+	int in_bits;				/* number of bits the commands in buf will return */
+	bool busy;				/* submitted and not completed yet */
+};
+
 /* Private data */
 struct esp_usb_jtag {
 	struct libusb_device_handle *usb_device;
 	int base_speed_khz;
 	int div_min;
 	int div_max;
-	uint8_t out_buf[OUT_BUF_SZ];
-	int out_buf_pos_nibbles;			/* write position in out_buf */
+	struct esp_usb_jtag_out_xfer out_xfers[OUT_XFER_CT];
+	int cur_out_xfer;			/* OUT buffer being filled */
+	int out_xfers_busy;
+	int out_buf_pos_nibbles;		/* write position in the current out buffer */
 
 	uint8_t in_buf[IN_BUF_CT][IN_BUF_SZ];
+	struct libusb_transfer *in_xfers[IN_BUF_CT];
+	bool in_buf_busy[IN_BUF_CT];		/* IN transfer for the buffer is in flight */
 	int in_buf_size_bits[IN_BUF_CT];	/* size in bits of the data stored in an in_buf */
 	int cur_in_buf_rd, cur_in_buf_wr;	/* read/write index */
+	int in_bufs_used;			/* buffers which are in flight or not read out yet */
+	int in_xfers_busy;
 	int in_buf_pos_bits;				/* which bit in the in buf needs to be returned to bitq next */
+	uint8_t *in_spill;			/* bits moved out of the ring, returned before the ring data */
+	int in_spill_size;			/* allocated size of in_spill in bytes */
+	int in_spill_rd_bits, in_spill_wr_bits;	/* read/write position in in_spill */
 
 	unsigned int read_ep;
 	unsigned int write_ep;
@@ -216,8 +245,10 @@ struct esp_usb_jtag {
 	int prev_cmd;			/* previous command, stored here for RLEing. */
 	int prev_cmd_repct;		/* Amount of repetitions of that command we have seen until now */
 
-	/* This is the total number of in bits we need to read, including in unsent commands */
-	int pending_in_bits;
+	/* This is the number of in bits which are still expected for the commands already sent */
+	int in_flight_bits;
+	bool out_xfer_failed;
+	bool in_xfer_failed;
 	FILE *logfile;			/* If non-NULL, we log communication traces here. */
 
 	int hw_in_fifo_len;
@@ -246,6 +277,7 @@ const char *cmds_string[] = { "000", "001", "010", "011", "100", "101", "110", "
 
 static int esp_usb_jtag_init(void);
 static int esp_usb_jtag_quit(void);
+static int esp_usb_jtag_handle_events(void);
 
 static void log_cmds(uint8_t *buf, int ct, int wr)
 {
@@ -270,8 +302,8 @@ static void log_resp(uint8_t *buf, int ct, int recvd)
 		"Read %d of %d bytes (%d (%d bits) were pending): %s\n",
 		recvd,
 		ct,
-		(priv->pending_in_bits + 7) / 8,
-		priv->pending_in_bits,
+		(priv->in_flight_bits + 7) / 8,
+		priv->in_flight_bits,
 		recvd != ct ? "***ERROR***" : "");
 #ifdef LOG_REPLAYABLE
 	fprintf(priv->logfile, "%cr %02X\n", recvd == 0 ? 'X' : ':', ct);
@@ -367,143 +399,351 @@ static int esp_usb_jtag_revive_device(struct libusb_device_handle *usb_device)
 	return ERROR_OK;
 }
 
-/* Try to receive from USB endpoint into the current priv->in_buf */
-static int esp_usb_jtag_recv_buf(void)
+/* USB transfer backend. The encoder benchmark replaces it with a simulated device. */
+struct esp_usb_jtag_xfer_ops {
+	int (*submit)(struct libusb_transfer *xfer);
+	int (*cancel)(struct libusb_transfer *xfer);
+	int (*handle_events)(void);		/* blocks until at least one transfer completes */
+};
+
+static int esp_usb_jtag_libusb_submit(struct libusb_transfer *xfer)
+{
+	return libusb_submit_transfer(xfer);
+}
+
+static int esp_usb_jtag_libusb_cancel(struct libusb_transfer *xfer)
+{
+	return libusb_cancel_transfer(xfer);
+}
+
+static int esp_usb_jtag_libusb_handle_events(void)
+{
+	return jtag_libusb_handle_events_completed(NULL);
+}
+
+static const struct esp_usb_jtag_xfer_ops esp_usb_jtag_libusb_ops = {
+	.submit = esp_usb_jtag_libusb_submit,
+	.cancel = esp_usb_jtag_libusb_cancel,
+	.handle_events = esp_usb_jtag_libusb_handle_events,
+};
+
+static const struct esp_usb_jtag_xfer_ops *xfer_ops = &esp_usb_jtag_libusb_ops;
+
+/* Called by libusb when IN transfer completes. Transfers on the same endpoint complete in the order
+ * they were submitted, so the ring is filled sequentially. */
+static void LIBUSB_CALL esp_usb_jtag_in_cb(struct libusb_transfer *xfer)
 {
-	if (priv->in_buf_size_bits[priv->cur_in_buf_wr] != 0) {
-		LOG_ERROR("esp_usb_jtag: IN buffer overflow! (%d, size %d)",
-			priv->cur_in_buf_wr,
-			priv->in_buf_size_bits[priv->cur_in_buf_wr]);
+	int idx = (int)(intptr_t)xfer->user_data;
+
+	if (priv->logfile)
+		log_resp(priv->in_buf[idx], xfer->length, xfer->actual_length);
+	if (xfer->status == LIBUSB_TRANSFER_COMPLETED && xfer->actual_length == 0) {
+		/* Sometimes the hardware returns 0 bytes instead of NAKking the transaction. Ignore this. */
+		if (xfer_ops->submit(xfer) == LIBUSB_SUCCESS)
+			return;
 	}
+	priv->in_buf_busy[idx] = false;
+	priv->in_xfers_busy--;
+	if (xfer->status != LIBUSB_TRANSFER_COMPLETED || xfer->actual_length == 0) {
+		if (xfer->status != LIBUSB_TRANSFER_CANCELLED)
+			LOG_ERROR("esp_usb_jtag: IN transfer failed (%d)!", xfer->status);
+		priv->in_xfer_failed = true;
+		return;
+	}
+	if (xfer->actual_length != IN_BUF_SZ) {
+		/* Short packet, the device has sent everything it had on flush */
+		LOG_DEBUG_IO("esp_usb_jtag: usb received only %d out of %d bytes.", xfer->actual_length, IN_BUF_SZ);
+	}
+	/* Adjust the amount of bits we still expect to read from the USB device after this. */
+	int bits_in_buf = priv->in_flight_bits;	/* initially assume we read everything that was pending */
+	if (bits_in_buf > xfer->actual_length * 8)
+		bits_in_buf = xfer->actual_length * 8;	/* ...but correct that if that was not the case. */
+	priv->in_flight_bits -= bits_in_buf;
+	priv->in_buf_size_bits[idx] = bits_in_buf;
+	LOG_DEBUG_IO("esp_usb_jtag: In ep: received %d bytes; %d bytes (%d bits) left.", xfer->actual_length,
+		(priv->in_flight_bits + 7) / 8, priv->in_flight_bits);
+}
 
-	int recvd = 0, ct = (priv->pending_in_bits + 7) / 8;
-	if (ct > IN_BUF_SZ)
-		ct = IN_BUF_SZ;
-	if (ct == 0) {
-		/* Note that the adapters IN EP specifically does *not* usually generate 0-byte in
-		 * packets if there has been no data since the last flush.
-		 * As such, we don't need (and shouldn't) try to read it. */
-		return ERROR_OK;
+/* Called by libusb when OUT transfer completes */
+static void LIBUSB_CALL esp_usb_jtag_out_cb(struct libusb_transfer *xfer)
+{
+	struct esp_usb_jtag_out_xfer *out = xfer->user_data;
+
+	out->busy = false;
+	priv->out_xfers_busy--;
+	LOG_DEBUG_IO("esp_usb_jtag: sent %d bytes.", xfer->actual_length);
+	if (priv->logfile)
+		log_cmds(out->buf, xfer->length, xfer->actual_length);
+	if (xfer->status != LIBUSB_TRANSFER_COMPLETED || xfer->actual_length != xfer->length) {
+		if (xfer->status != LIBUSB_TRANSFER_CANCELLED)
+			LOG_ERROR("esp_usb_jtag: OUT transfer failed (%d), sent %d out of %d bytes!",
+				xfer->status, xfer->actual_length, xfer->length);
+		priv->out_xfer_failed = true;
 	}
+}
 
-	priv->in_buf_size_bits[priv->cur_in_buf_wr] = 0;
-	while (recvd < ct) {
-		int ret, tr;
-		ret = jtag_libusb_bulk_read(priv->usb_device,
-			priv->read_ep,
-			(char *)priv->in_buf[priv->cur_in_buf_wr] + recvd,
-			ct,
-			LIBUSB_TIMEOUT_MS,	/*ms*/
-			&tr);
-		if (priv->logfile)
-			log_resp(priv->in_buf[priv->cur_in_buf_wr], ct, tr);
-		if (ret != ERROR_OK || tr == 0) {
-			/* Sometimes the hardware returns 0 bytes instead of NAKking the transaction. Ignore this. */
+/* Moves the unread bits of the oldest ring buffer, which must be completed, to the spill buffer and
+ * frees the buffer. */
+static int esp_usb_jtag_in_spill(void)
+{
+	int idx = priv->cur_in_buf_rd;
+	int bits = priv->in_buf_size_bits[idx] - priv->in_buf_pos_bits;
+	int size = DIV_ROUND_UP(priv->in_spill_wr_bits + bits, 8);
+
+	if (size > priv->in_spill_size) {
+		int new_size = MAX(size, 2 * priv->in_spill_size);
+		uint8_t *spill = realloc(priv->in_spill, new_size);
+		if (!spill) {
+			LOG_ERROR("esp_usb_jtag: failed to alloc IN spill buffer!");
 			return ERROR_FAIL;
 		}
+		priv->in_spill = spill;
+		priv->in_spill_size = new_size;
+	}
+	bit_copy(priv->in_spill, priv->in_spill_wr_bits, priv->in_buf[idx], priv->in_buf_pos_bits, bits);
+	priv->in_spill_wr_bits += bits;
+	priv->in_buf_pos_bits = 0;
+	priv->in_buf_size_bits[idx] = 0;
+	priv->in_bufs_used--;
+	priv->cur_in_buf_rd++;
+	if (priv->cur_in_buf_rd == IN_BUF_CT)
+		priv->cur_in_buf_rd = 0;
+	return ERROR_OK;
+}
 
-		if (tr != ct) {
-			/* Huh, short read? */
-			LOG_DEBUG("esp_usb_jtag: usb received only %d out of %d bytes.", tr, ct);
+/* Submits IN transfers into the free ring buffers, so that there are enough of them to receive
+ * all the bits expected for the commands sent. Every transfer can receive one full size packet. */
+static int esp_usb_jtag_recv_buf(void)
+{
+	while (priv->in_xfers_busy * IN_BUF_SZ * 8 < priv->in_flight_bits) {
+		int idx = priv->cur_in_buf_wr;
+		if (priv->in_bufs_used == IN_BUF_CT) {
+			/* bitq reads the ring only between its commands, so wait for the oldest buffer and move
+			 * its bits aside. The transfer completes, as more bits than the busy transfers can
+			 * receive are in flight. */
+			while (priv->in_buf_busy[priv->cur_in_buf_rd]) {
+				int ret = esp_usb_jtag_handle_events();
+				if (ret != ERROR_OK)
+					return ret;
+			}
+			int ret = esp_usb_jtag_in_spill();
+			if (ret != ERROR_OK)
+				return ret;
+			continue;
+		}
+		priv->in_buf_size_bits[idx] = 0;
+		libusb_fill_bulk_transfer(priv->in_xfers[idx], priv->usb_device, priv->read_ep,
+			priv->in_buf[idx], IN_BUF_SZ, esp_usb_jtag_in_cb, (void *)(intptr_t)idx,
+			LIBUSB_TIMEOUT_MS);
+		int ret = xfer_ops->submit(priv->in_xfers[idx]);
+		if (ret != LIBUSB_SUCCESS) {
+			LOG_ERROR("esp_usb_jtag: failed to submit IN transfer (%s)!", libusb_error_name(ret));
+			priv->in_xfer_failed = true;
+			return ERROR_FAIL;
 		}
-		/* Adjust the amount of bits we still expect to read from the USB device after this. */
-		int bits_in_buf = priv->pending_in_bits;			/* initially assume we read
-										* everything that was pending */
-		if (bits_in_buf > tr * 8)
-			bits_in_buf = tr * 8;	/* ...but correct that if that was not the case. */
-		priv->pending_in_bits -= bits_in_buf;
-		priv->in_buf_size_bits[priv->cur_in_buf_wr] += bits_in_buf;
-		recvd += tr;
-	}
-	/* next in buffer for the next time. */
-	priv->cur_in_buf_wr++;
-	if (priv->cur_in_buf_wr == IN_BUF_CT)
-		priv->cur_in_buf_wr = 0;
-	LOG_DEBUG_IO("esp_usb_jtag: In ep: received %d bytes; %d bytes (%d bits) left.", recvd,
-		(priv->pending_in_bits + 7) / 8, priv->pending_in_bits);
+		priv->in_buf_busy[idx] = true;
+		priv->in_xfers_busy++;
+		priv->in_bufs_used++;
+		/* next in buffer for the next time. */
+		priv->cur_in_buf_wr++;
+		if (priv->cur_in_buf_wr == IN_BUF_CT)
+			priv->cur_in_buf_wr = 0;
+	}
 	return ERROR_OK;
 }
 
-/* Sends priv->out_buf to the USB device. */
-static int esp_usb_jtag_send_buf(void)
+/* Waits for all transfers in flight to be cancelled or completed and returns the queues into the
+ * initial state. */
+static void esp_usb_jtag_xfers_abort(void)
 {
-	int ct = priv->out_buf_pos_nibbles / 2;
-	int written = 0;
-
-	while (written < ct) {
-		int tr = 0, ret = jtag_libusb_bulk_write(priv->usb_device,
-			priv->write_ep,
-			(char *)priv->out_buf + written,
-			ct - written,
-			LIBUSB_TIMEOUT_MS,	/*ms*/
-			&tr);
-		LOG_DEBUG_IO("esp_usb_jtag: sent %d bytes.", tr);
-		if (priv->logfile)
-			log_cmds(priv->out_buf, ct, tr);
-		if (written + tr != ct) {
-			LOG_DEBUG("esp_usb_jtag: usb sent only %d out of %d bytes.",
-				written + tr,
-				ct);
+	for (int i = 0; i < OUT_XFER_CT; i++) {
+		if (priv->out_xfers[i].busy)
+			xfer_ops->cancel(priv->out_xfers[i].xfer);
+	}
+	for (int i = 0; i < IN_BUF_CT; i++) {
+		if (priv->in_buf_busy[i])
+			xfer_ops->cancel(priv->in_xfers[i]);
+	}
+	while (priv->out_xfers_busy > 0 || priv->in_xfers_busy > 0) {
+		int ret = xfer_ops->handle_events();
+		if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+			LOG_ERROR("esp_usb_jtag: failed to cancel transfers (%s)!", libusb_error_name(ret));
+			break;
 		}
-		if (ret != ERROR_OK) {
+	}
+	for (int i = 0; i < OUT_XFER_CT; i++)
+		priv->out_xfers[i].in_bits = 0;
+	memset(priv->in_buf_size_bits, 0, sizeof(priv->in_buf_size_bits));
+	priv->out_buf_pos_nibbles = 0;
+	priv->cur_in_buf_rd = 0;
+	priv->cur_in_buf_wr = 0;
+	priv->in_bufs_used = 0;
+	priv->in_buf_pos_bits = 0;
+	priv->in_spill_rd_bits = 0;
+	priv->in_spill_wr_bits = 0;
+	priv->in_flight_bits = 0;
+	priv->prev_cmd_repct = 0;
+	priv->out_xfer_failed = false;
+	priv->in_xfer_failed = false;
+}
+
+static int esp_usb_jtag_xfers_alloc(void)
+{
+	for (int i = 0; i < OUT_XFER_CT; i++) {
+		priv->out_xfers[i].xfer = libusb_alloc_transfer(0);
+		if (!priv->out_xfers[i].xfer)
+			return ERROR_FAIL;
+	}
+	for (int i = 0; i < IN_BUF_CT; i++) {
+		priv->in_xfers[i] = libusb_alloc_transfer(0);
+		if (!priv->in_xfers[i])
+			return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
+
+static void esp_usb_jtag_xfers_free(void)
+{
+	for (int i = 0; i < OUT_XFER_CT; i++) {
+		libusb_free_transfer(priv->out_xfers[i].xfer);
+		priv->out_xfers[i].xfer = NULL;
+	}
+	for (int i = 0; i < IN_BUF_CT; i++) {
+		libusb_free_transfer(priv->in_xfers[i]);
+		priv->in_xfers[i] = NULL;
+	}
+}
+
+/* Processes libusb events, i.e. transfer completions. Blocks until at least one event happens. */
+static int esp_usb_jtag_handle_events(void)
+{
+	int ret = xfer_ops->handle_events();
+	if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+		LOG_ERROR("esp_usb_jtag: failed to handle USB events (%s)!", libusb_error_name(ret));
+		priv->in_xfer_failed = true;
+	}
+	if (priv->out_xfer_failed || priv->in_xfer_failed) {
+		bool revive = priv->out_xfer_failed;
+		esp_usb_jtag_xfers_abort();
+		if (revive) {
 			int reset_ret = esp_usb_jtag_revive_device(priv->usb_device);
 			if (reset_ret != ERROR_OK)
 				LOG_ERROR("esp_usb_jtag: failed to revive USB device!");
-			return ret;
 		}
-		written += tr;
+		return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
+
+/* Submits the current out buffer to the USB device and switches to the next one. Does not wait for the
+ * transfer to complete unless all OUT buffers are in flight. */
+static int esp_usb_jtag_send_buf(void)
+{
+	struct esp_usb_jtag_out_xfer *out = &priv->out_xfers[priv->cur_out_xfer];
+	int ct = priv->out_buf_pos_nibbles / 2;
+
+	if (ct == 0)
+		return ERROR_OK;
+
+	libusb_fill_bulk_transfer(out->xfer, priv->usb_device, priv->write_ep, out->buf, ct,
+		esp_usb_jtag_out_cb, out, LIBUSB_TIMEOUT_MS);
+	int ret = xfer_ops->submit(out->xfer);
+	if (ret != LIBUSB_SUCCESS) {
+		LOG_ERROR("esp_usb_jtag: failed to submit OUT transfer (%s)!", libusb_error_name(ret));
+		esp_usb_jtag_xfers_abort();
+		int reset_ret = esp_usb_jtag_revive_device(priv->usb_device);
+		if (reset_ret != ERROR_OK)
+			LOG_ERROR("esp_usb_jtag: failed to revive USB device!");
+		return ERROR_FAIL;
 	}
+	out->busy = true;
+	priv->out_xfers_busy++;
+	priv->in_flight_bits += out->in_bits;
 	priv->out_buf_pos_nibbles = 0;
+	LOG_DEBUG_IO("esp_usb_jtag: queued %d bytes, %d bits expected.", ct, priv->in_flight_bits);
 
-	/* If there's more than a bufferful of data queuing up in the jtag adapters IN endpoint, empty
-	 * all but one buffer. */
-	while (priv->pending_in_bits > (IN_BUF_SZ + priv->hw_in_fifo_len - 1) * 8)
-		esp_usb_jtag_recv_buf();
+	/* IN transfers must be in flight before we wait for anything, otherwise the device will stall
+	 * as soon as its IN FIFO gets full. */
+	ret = esp_usb_jtag_recv_buf();
+	if (ret != ERROR_OK) {
+		esp_usb_jtag_xfers_abort();
+		return ret;
+	}
 
+	priv->cur_out_xfer++;
+	if (priv->cur_out_xfer == OUT_XFER_CT)
+		priv->cur_out_xfer = 0;
+	out = &priv->out_xfers[priv->cur_out_xfer];
+	while (out->busy) {
+		ret = esp_usb_jtag_handle_events();
+		if (ret != ERROR_OK)
+			return ret;
+	}
+	out->in_bits = 0;
 	return ERROR_OK;
 }
 
+/* Adds `len` commands packed into `cmds` (the first one in bits 0..3) to the current out buffer.
+ * The caller must make sure they fit into the buffer without sending it. */
+static inline void esp_usb_jtag_nibbles_put(uint32_t cmds, int len, int in_bits)
+{
+	struct esp_usb_jtag_out_xfer *out = &priv->out_xfers[priv->cur_out_xfer];
+
+	for (int k = 0; k < len; k++, cmds >>= 4) {
+		if ((priv->out_buf_pos_nibbles & 1) == 0)
+			out->buf[priv->out_buf_pos_nibbles / 2] = (cmds & 0xF) << 4;
+		else
+			out->buf[priv->out_buf_pos_nibbles / 2] |= cmds & 0xF;
+		priv->out_buf_pos_nibbles++;
+	}
+	out->in_bits += in_bits;
+}
+
 /* Simply adds a command to the buffer. Is called by the RLE encoding mechanism.
- *Also sends the intermediate buffer if there's enough to go into one USB packet. */
-static int esp_usb_jtag_command_add_raw(int cmd)
+ * `in_bits` is the number of TDO bits the command will return.
+ * Also sends the buffer if it is full. */
+static int esp_usb_jtag_command_add_raw(int cmd, int in_bits)
 {
-	int ret;
+	struct esp_usb_jtag_out_xfer *out = &priv->out_xfers[priv->cur_out_xfer];
 
 	if ((priv->out_buf_pos_nibbles & 1) == 0)
-		priv->out_buf[priv->out_buf_pos_nibbles / 2] = (cmd << 4);
+		out->buf[priv->out_buf_pos_nibbles / 2] = (cmd << 4);
 	else
-		priv->out_buf[priv->out_buf_pos_nibbles / 2] |= cmd;
+		out->buf[priv->out_buf_pos_nibbles / 2] |= cmd;
 	priv->out_buf_pos_nibbles++;
+	out->in_bits += in_bits;
 
-	if (priv->out_buf_pos_nibbles == OUT_BUF_SZ * 2) {
-		ret = esp_usb_jtag_send_buf();
-		if (ret != ERROR_OK)
-			return ret;
-	}
-	if (priv->out_buf_pos_nibbles % (OUT_EP_SZ * 2) == 0) {
-		if (priv->pending_in_bits > (IN_BUF_SZ + priv->hw_in_fifo_len - 1) * 8) {
-			ret = esp_usb_jtag_send_buf();
-			if (ret != ERROR_OK)
-				return ret;
-		}
-	}
+	if (priv->out_buf_pos_nibbles == OUT_BUF_SZ * 2)
+		return esp_usb_jtag_send_buf();
 	return ERROR_OK;
 }
 
 /* Writes a command stream equivalent to writing `cmd` `ct` times. */
 static int esp_usb_jtag_write_rlestream(int cmd, int ct)
 {
+	int cap = CMD_IS_CAPTURE(cmd) ? 1 : 0;
+
 	/* Special case: stacking flush commands does not make sense (and may not make the hardware
 	 * very happy) */
 	if (cmd == CMD_FLUSH)
 		ct = 1;
+	if (priv->out_buf_pos_nibbles + CMD_REP_MAX_NIBBLES < OUT_BUF_SZ * 2) {
+		/* fast path, the buffer will not be sent in the middle of the stream */
+		uint32_t cmds = cmd;
+		int len = 1;
+		for (int rep = ct - 1; rep > 0; rep >>= 2)
+			cmds |= (uint32_t)CMD_REP(rep & 3) << (4 * len++);
+		esp_usb_jtag_nibbles_put(cmds, len, cap * ct);
+		return ERROR_OK;
+	}
 	/* Output previous command and repeat commands */
-	int ret = esp_usb_jtag_command_add_raw(cmd);
+	int ret = esp_usb_jtag_command_add_raw(cmd, cap);
 	if (ret != ERROR_OK)
 		return ret;
 	ct--;	/* as the previous line already executes the command one time */
-	while (ct > 0) {
-		ret = esp_usb_jtag_command_add_raw(CMD_REP(ct & 3));
+	for (int shift = 0; ct > 0; shift += 2) {
+		/* every repeat command adds the next 2 bits of the repeat counter */
+		ret = esp_usb_jtag_command_add_raw(CMD_REP(ct & 3), cap * ((ct & 3) << shift));
 		if (ret != ERROR_OK)
 			return ret;
 		ct >>= 2;
@@ -511,7 +751,6 @@ static int esp_usb_jtag_write_rlestream(int cmd, int ct)
 	return ERROR_OK;
 }
 
-
 /* Adds a command to the buffer of things to be sent. Transparently handles RLE compression using
  * the CMD_REP_x commands */
 static int esp_usb_jtag_command_add(int cmd)
@@ -535,11 +774,140 @@ static int esp_usb_jtag_command_add(int cmd)
 /* Called by bitq interface to output a bit on tdi and perhaps read a bit from tdo */
 static int esp_usb_jtag_out(int tms, int tdi, int tdo_req)
 {
-	int ret = esp_usb_jtag_command_add(CMD_CLK(tdo_req, tdi, tms));
-	if (ret != ERROR_OK)
-		return ret;
-	if (tdo_req)
-		priv->pending_in_bits++;
+	return esp_usb_jtag_command_add(CMD_CLK(tdo_req, tdi, tms));
+}
+
+/* Same as calling esp_usb_jtag_command_add() `ct` times */
+static int esp_usb_jtag_command_add_n(int cmd, int ct)
+{
+	while (ct > 0) {
+		if (cmd != priv->prev_cmd || priv->prev_cmd_repct == CMD_REP_MAX_REPS) {
+			if (priv->prev_cmd_repct) {
+				int ret = esp_usb_jtag_write_rlestream(priv->prev_cmd, priv->prev_cmd_repct);
+				if (ret != ERROR_OK)
+					return ret;
+			}
+			priv->prev_cmd = cmd;
+			priv->prev_cmd_repct = 0;
+		}
+		int n = MIN(ct, CMD_REP_MAX_REPS - priv->prev_cmd_repct);
+		priv->prev_cmd_repct += n;
+		ct -= n;
+	}
+	return ERROR_OK;
+}
+
+/* Lookup tables for converting TDI bytes to clock commands. Runs of equal bits at the start and at the end
+ * of byte can be merged with the neighbour bytes, so they are passed to the RLE encoder. Runs in the middle of
+ * byte are bounded by different bits, so they are RLE encoded in advance. */
+struct esp_usb_jtag_byte_enc {
+	uint32_t mid_cmds;	/* encoded middle runs, the first command is in bits 0..3 */
+	uint8_t mid_len;	/* number of commands in mid_cmds */
+	uint8_t mid_bits;	/* number of bits in the middle runs */
+	uint8_t lead;		/* number of equal bits at the start of byte */
+	uint8_t trail;		/* number of equal bits at the end of byte */
+};
+
+static struct esp_usb_jtag_byte_enc esp_usb_jtag_enc_lut[2][256];
+static bool esp_usb_jtag_enc_lut_ready;
+
+static void esp_usb_jtag_enc_lut_init(void)
+{
+	if (esp_usb_jtag_enc_lut_ready)
+		return;
+	for (int cap = 0; cap < 2; cap++) {
+		for (int b = 0; b < 256; b++) {
+			struct esp_usb_jtag_byte_enc *enc = &esp_usb_jtag_enc_lut[cap][b];
+			memset(enc, 0, sizeof(*enc));
+			for (enc->lead = 1; enc->lead < 8; enc->lead++) {
+				if (((b >> enc->lead) & 1) != (b & 1))
+					break;
+			}
+			if (enc->lead == 8)
+				continue;
+			for (enc->trail = 1; enc->trail < 8; enc->trail++) {
+				if (((b >> (7 - enc->trail)) & 1) != ((b >> 7) & 1))
+					break;
+			}
+			enc->mid_bits = 8 - enc->lead - enc->trail;
+			for (int i = enc->lead; i < 8 - enc->trail;) {
+				int bit = (b >> i) & 1;
+				int ct = 0;
+				while (i < 8 - enc->trail && ((b >> i) & 1) == bit) {
+					ct++;
+					i++;
+				}
+				/* the same as esp_usb_jtag_write_rlestream() does */
+				enc->mid_cmds |= (uint32_t)CMD_CLK(cap, bit, 0) << (4 * enc->mid_len++);
+				for (ct--; ct > 0; ct >>= 2)
+					enc->mid_cmds |= (uint32_t)CMD_REP(ct & 3) << (4 * enc->mid_len++);
+			}
+		}
+	}
+	esp_usb_jtag_enc_lut_ready = true;
+}
+
+/* Called by bitq interface to output a block of bits with TMS low. TDI bytes are converted via lookup
+ * tables, so RLE encoder is called only for runs crossing byte boundaries. */
+static int esp_usb_jtag_out_bits(const uint8_t *tdi, int num_bits, int tdo_req)
+{
+	int cap = tdo_req ? 1 : 0;
+	int ret;
+
+	if (!tdi)
+		return esp_usb_jtag_command_add_n(CMD_CLK(cap, 0, 0), num_bits);
+
+	const struct esp_usb_jtag_byte_enc *lut = esp_usb_jtag_enc_lut[cap];
+	int nbytes = num_bits / 8;
+	for (int i = 0; i < nbytes; i++) {
+		const struct esp_usb_jtag_byte_enc *enc = &lut[tdi[i]];
+		int first_cmd = CMD_CLK(cap, tdi[i] & 1, 0);
+		if (enc->lead == 8) {
+			ret = esp_usb_jtag_command_add_n(first_cmd, 8);
+			if (ret != ERROR_OK)
+				return ret;
+			continue;
+		}
+		ret = esp_usb_jtag_command_add_n(first_cmd, enc->lead);
+		if (ret != ERROR_OK)
+			return ret;
+		if (enc->mid_len) {
+			ret = esp_usb_jtag_write_rlestream(priv->prev_cmd, priv->prev_cmd_repct);
+			if (ret != ERROR_OK)
+				return ret;
+			priv->prev_cmd_repct = 0;
+			if (priv->out_buf_pos_nibbles + enc->mid_len < OUT_BUF_SZ * 2) {
+				/* fast path, no need to send the buffer */
+				esp_usb_jtag_nibbles_put(enc->mid_cmds, enc->mid_len, cap * enc->mid_bits);
+			} else {
+				/* in_bits are accounted per nibble, so that they go to the right buffer */
+				uint32_t cmds = enc->mid_cmds;
+				int prev = 0, shift = 0;
+				for (int k = 0; k < enc->mid_len; k++, cmds >>= 4) {
+					int cmd = cmds & 0xF;
+					int bits = 1;
+					if (cmd >= CMD_REP(0)) {
+						bits = (cmd - CMD_REP(0)) << shift;
+						shift += 2;
+					} else {
+						prev = cmd;
+						shift = 0;
+					}
+					ret = esp_usb_jtag_command_add_raw(cmd, CMD_IS_CAPTURE(prev) ? bits : 0);
+					if (ret != ERROR_OK)
+						return ret;
+				}
+			}
+		}
+		ret = esp_usb_jtag_command_add_n(CMD_CLK(cap, tdi[i] >> 7, 0), enc->trail);
+		if (ret != ERROR_OK)
+			return ret;
+	}
+	for (int i = nbytes * 8; i < num_bits; i++) {
+		ret = esp_usb_jtag_command_add(CMD_CLK(cap, (tdi[i / 8] >> (i % 8)) & 1, 0));
+		if (ret != ERROR_OK)
+			return ret;
+	}
 	return ERROR_OK;
 }
 
@@ -555,13 +923,13 @@ static int esp_usb_jtag_flush(void)
 	}
 	priv->prev_cmd_repct = 0;
 	/* Flush in buffer */
-	ret = esp_usb_jtag_command_add_raw(CMD_FLUSH);
+	ret = esp_usb_jtag_command_add_raw(CMD_FLUSH, 0);
 	if (ret != ERROR_OK)
 		return ret;
 	/* Make sure we have an even amount of commands, as we can't write a nibble by itself. */
 	if (priv->out_buf_pos_nibbles & 1) {
 		/*If not, pad with an extra FLUSH */
-		ret = esp_usb_jtag_command_add_raw(CMD_FLUSH);
+		ret = esp_usb_jtag_command_add_raw(CMD_FLUSH, 0);
 		if (ret != ERROR_OK)
 			return ret;
 	}
@@ -571,9 +939,18 @@ static int esp_usb_jtag_flush(void)
 	if (ret != ERROR_OK)
 		return ret;
 
-	/* Immediately fetch the response bits. */
-	while (priv->pending_in_bits > 0)
-		esp_usb_jtag_recv_buf();
+	/* Wait for all the commands to be sent and the response bits to arrive. */
+	while (priv->out_xfers_busy > 0 || priv->in_flight_bits > 0) {
+		ret = esp_usb_jtag_handle_events();
+		if (ret != ERROR_OK)
+			return ret;
+		/* short packets can make more IN transfers necessary */
+		ret = esp_usb_jtag_recv_buf();
+		if (ret != ERROR_OK) {
+			esp_usb_jtag_xfers_abort();
+			return ret;
+		}
+	}
 
 	return ERROR_OK;
 }
@@ -599,7 +976,7 @@ static int esp_usb_jtag_reset(int trst, int srst)
 /* Called by bitq to see if the IN data already is returned to the host. */
 static int esp_usb_jtag_in_rdy(void)
 {
-	/* We read all bits in the flush() routine, so if we're here, we have bits or are at EOF. */
+	/* Bits are returned as soon as the IN transfers complete, in() tells when there is no more data. */
 	return 1;
 }
 
@@ -610,8 +987,25 @@ static int esp_usb_jtag_in(void)
 		LOG_ERROR("esp_usb_jtag: Eeek! bitq asked us for in data while not ready!");
 		return -1;
 	}
-	if (priv->cur_in_buf_rd == priv->cur_in_buf_wr &&
-		priv->in_buf_size_bits[priv->cur_in_buf_rd] == 0)
+	/* Bits moved out of the ring are the oldest ones */
+	if (priv->in_spill_rd_bits < priv->in_spill_wr_bits) {
+		int r = (priv->in_spill[priv->in_spill_rd_bits / 8] & BIT(priv->in_spill_rd_bits & 7)) ? 1 : 0;
+		priv->in_spill_rd_bits++;
+		if (priv->in_spill_rd_bits == priv->in_spill_wr_bits) {
+			priv->in_spill_rd_bits = 0;
+			priv->in_spill_wr_bits = 0;
+		}
+		return r;
+	}
+	/* Skip buffers which got no data bits */
+	while (priv->in_bufs_used > 0 && !priv->in_buf_busy[priv->cur_in_buf_rd] &&
+		priv->in_buf_size_bits[priv->cur_in_buf_rd] == 0) {
+		priv->in_bufs_used--;
+		priv->cur_in_buf_rd++;
+		if (priv->cur_in_buf_rd == IN_BUF_CT)
+			priv->cur_in_buf_rd = 0;
+	}
+	if (priv->in_bufs_used == 0 || priv->in_buf_busy[priv->cur_in_buf_rd])
 		return -1;
 
 	/* Extract the bit */
@@ -623,6 +1017,7 @@ static int esp_usb_jtag_in(void)
 		/* No more bits in this buffer; mark as re-usable and move to next buffer. */
 		priv->in_buf_pos_bits = 0;
 		priv->in_buf_size_bits[priv->cur_in_buf_rd] = 0;/*indicate it is free again */
+		priv->in_bufs_used--;
 		priv->cur_in_buf_rd++;
 		if (priv->cur_in_buf_rd == IN_BUF_CT)
 			priv->cur_in_buf_rd = 0;
@@ -637,8 +1032,10 @@ static int esp_usb_jtag_init(void)
 	const uint16_t vids[] = { esp_usb_vid, 0 };		/* must be null terminated */
 	const uint16_t pids[] = { esp_usb_pid, 0 };		/* must be null terminated */
 
+	esp_usb_jtag_enc_lut_init();
 	bitq_interface = &priv->bitq_interface;
 	bitq_interface->out = esp_usb_jtag_out;
+	bitq_interface->out_bits = esp_usb_jtag_out_bits;
 	bitq_interface->flush = esp_usb_jtag_flush;
 	bitq_interface->sleep = esp_usb_jtag_sleep;
 	bitq_interface->reset = esp_usb_jtag_reset;
@@ -673,6 +1070,11 @@ static int esp_usb_jtag_init(void)
 		goto out;
 	}
 
+	if (esp_usb_jtag_xfers_alloc() != ERROR_OK) {
+		LOG_ERROR("esp_usb_jtag: failed to alloc USB transfers!");
+		goto out;
+	}
+
 	char jtag_caps_desc[256];
 	r = jtag_libusb_control_transfer(priv->usb_device,
 		LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_STANDARD | LIBUSB_RECIPIENT_DEVICE,
@@ -744,6 +1146,7 @@ static int esp_usb_jtag_init(void)
 out:
 	free((void *)esp_usb_jtag_serial);
 	esp_usb_jtag_serial = NULL;
+	esp_usb_jtag_xfers_free();
 	if (priv->usb_device)
 		jtag_libusb_close(priv->usb_device);
 	bitq_interface = NULL;
@@ -757,6 +1160,11 @@ static int esp_usb_jtag_quit(void)
 	esp_usb_jtag_serial = NULL;
 	if (!priv->usb_device)
 		return ERROR_OK;
+	esp_usb_jtag_xfers_abort();
+	esp_usb_jtag_xfers_free();
+	free(priv->in_spill);
+	priv->in_spill = NULL;
+	priv->in_spill_size = 0;
 	jtag_libusb_close(priv->usb_device);
 	bitq_cleanup();
 	bitq_interface = NULL;
@@ -914,6 +1322,265 @@ COMMAND_HANDLER(esp_usb_jtag_chip_id)
 	return ERROR_OK;
 }
 
+#ifdef ESP_USB_JTAG_ENCODER_BENCH
+/* Encoder benchmark, only built in test builds with -DESP_USB_JTAG_ENCODER_BENCH. Encoded commands are
+ * not sent to the USB device, but to a simulated one, which decodes them, compares them with the source
+ * data and returns pseudo-random TDO bits for the captured ones, so the benchmark does not need hardware.
+ * It uses the driver state, so it only runs before the adapter is initialized. */
+static struct {
+	const uint8_t *data;	/* TDI data, NULL for zeros */
+	int nbits;
+	int cap;
+	int bit_pos;		/* position of the next expected bit in data */
+	int last_cmd;		/* last clock command, target of repeat commands */
+	int rep_shift;
+	size_t bytes;
+	int errors;
+	int tdo_bits;		/* TDO bits captured by the device */
+	int tdo_sent;		/* TDO bits sent in IN packets */
+	int tdo_flushed;	/* TDO bits captured before the last flush command */
+	struct libusb_transfer *xfers[OUT_XFER_CT + IN_BUF_CT];	/* submitted transfers */
+	int xfers_ct;
+} esp_usb_jtag_bench;
+
+/* Bits are read in blocks of the same size as bitq writes them */
+#define ESP_USB_JTAG_BENCH_BLOCK 1024
+
+static int esp_usb_jtag_bench_tdo(uint32_t pos)
+{
+	return ((pos * 0x9E3779B1u) >> 31) & 1;
+}
+
+static void esp_usb_jtag_bench_check(int cmd, int ct)
+{
+	const uint8_t *data = esp_usb_jtag_bench.data;
+
+	for (int i = 0; i < ct; i++) {
+		int pos = esp_usb_jtag_bench.bit_pos++;
+		if (pos >= esp_usb_jtag_bench.nbits) {
+			esp_usb_jtag_bench.errors++;
+			return;
+		}
+		int tdi = data ? (data[pos / 8] >> (pos % 8)) & 1 : 0;
+		if (cmd != (int)CMD_CLK(esp_usb_jtag_bench.cap, tdi, 0))
+			esp_usb_jtag_bench.errors++;
+	}
+	if (CMD_IS_CAPTURE(cmd))
+		esp_usb_jtag_bench.tdo_bits += ct;
+}
+
+static void esp_usb_jtag_bench_sink(const uint8_t *buf, int ct)
+{
+	esp_usb_jtag_bench.bytes += ct;
+	for (int n = 0; n < ct * 2; n++) {
+		int c = (n & 1) ? (buf[n / 2] & 0xf) : (buf[n / 2] >> 4);
+		if ((c & 0x8) == 0) {	/* clock command */
+			esp_usb_jtag_bench_check(c, 1);
+			esp_usb_jtag_bench.last_cmd = c;
+			esp_usb_jtag_bench.rep_shift = 0;
+		} else if (c >= CMD_REP(0)) {
+			if (esp_usb_jtag_bench.last_cmd < 0) {
+				esp_usb_jtag_bench.errors++;
+				continue;
+			}
+			esp_usb_jtag_bench_check(esp_usb_jtag_bench.last_cmd,
+				(c - CMD_REP(0)) << esp_usb_jtag_bench.rep_shift);
+			esp_usb_jtag_bench.rep_shift += 2;
+		} else {
+			if (c == CMD_FLUSH)
+				esp_usb_jtag_bench.tdo_flushed = esp_usb_jtag_bench.tdo_bits;
+			esp_usb_jtag_bench.last_cmd = -1;
+			esp_usb_jtag_bench.rep_shift = 0;
+		}
+	}
+}
+
+/* Fills the IN transfer with the next packet the device has, if any. Full packets are sent as soon
+ * as there are enough bits for them, the rest is sent as a short packet on flush. */
+static bool esp_usb_jtag_bench_in_packet(struct libusb_transfer *xfer)
+{
+	int bits = esp_usb_jtag_bench.tdo_bits - esp_usb_jtag_bench.tdo_sent;
+
+	if (bits >= IN_BUF_SZ * 8)
+		bits = IN_BUF_SZ * 8;
+	else if (esp_usb_jtag_bench.tdo_flushed > esp_usb_jtag_bench.tdo_sent)
+		bits = esp_usb_jtag_bench.tdo_flushed - esp_usb_jtag_bench.tdo_sent;
+	else
+		return false;
+	memset(xfer->buffer, 0, IN_BUF_SZ);
+	for (int i = 0; i < bits; i++) {
+		if (esp_usb_jtag_bench_tdo(esp_usb_jtag_bench.tdo_sent + i))
+			xfer->buffer[i / 8] |= BIT(i % 8);
+	}
+	esp_usb_jtag_bench.tdo_sent += bits;
+	xfer->actual_length = DIV_ROUND_UP(bits, 8);
+	return true;
+}
+
+/* The simulated device processes OUT data as soon as it is submitted and does not stall on full IN FIFO */
+static int esp_usb_jtag_bench_submit(struct libusb_transfer *xfer)
+{
+	if (esp_usb_jtag_bench.xfers_ct == ARRAY_SIZE(esp_usb_jtag_bench.xfers))
+		return LIBUSB_ERROR_BUSY;
+	xfer->status = LIBUSB_TRANSFER_COMPLETED;
+	xfer->actual_length = 0;
+	if (xfer->callback == esp_usb_jtag_out_cb) {
+		esp_usb_jtag_bench_sink(xfer->buffer, xfer->length);
+		xfer->actual_length = xfer->length;
+	}
+	esp_usb_jtag_bench.xfers[esp_usb_jtag_bench.xfers_ct++] = xfer;
+	return LIBUSB_SUCCESS;
+}
+
+static int esp_usb_jtag_bench_cancel(struct libusb_transfer *xfer)
+{
+	xfer->status = LIBUSB_TRANSFER_CANCELLED;
+	xfer->actual_length = 0;
+	return LIBUSB_SUCCESS;
+}
+
+static int esp_usb_jtag_bench_handle_events(void)
+{
+	struct libusb_transfer *done[ARRAY_SIZE(esp_usb_jtag_bench.xfers)];
+	int done_ct = 0, left_ct = 0;
+	bool in_stalled = false;
+
+	for (int i = 0; i < esp_usb_jtag_bench.xfers_ct; i++) {
+		struct libusb_transfer *xfer = esp_usb_jtag_bench.xfers[i];
+		bool complete = true;
+		if (xfer->status == LIBUSB_TRANSFER_COMPLETED && xfer->callback == esp_usb_jtag_in_cb) {
+			/* IN transfers complete in order */
+			complete = !in_stalled && esp_usb_jtag_bench_in_packet(xfer);
+			in_stalled = !complete;
+		}
+		if (complete)
+			done[done_ct++] = xfer;
+		else
+			esp_usb_jtag_bench.xfers[left_ct++] = xfer;
+	}
+	esp_usb_jtag_bench.xfers_ct = left_ct;
+	/* nothing to wait for, real libusb would block forever */
+	if (done_ct == 0)
+		return LIBUSB_ERROR_TIMEOUT;
+	for (int i = 0; i < done_ct; i++)
+		done[i]->callback(done[i]);
+	return LIBUSB_SUCCESS;
+}
+
+static const struct esp_usb_jtag_xfer_ops esp_usb_jtag_bench_ops = {
+	.submit = esp_usb_jtag_bench_submit,
+	.cancel = esp_usb_jtag_bench_cancel,
+	.handle_events = esp_usb_jtag_bench_handle_events,
+};
+
+/* Reads the TDO bits available so far like bitq does and checks them */
+static void esp_usb_jtag_bench_read(int *tdo_pos)
+{
+	for (int r = esp_usb_jtag_in(); r >= 0; r = esp_usb_jtag_in()) {
+		if (r != esp_usb_jtag_bench_tdo((*tdo_pos)++))
+			esp_usb_jtag_bench.errors++;
+	}
+}
+
+COMMAND_HANDLER(esp_usb_jtag_encoder_bench_cmd)
+{
+	unsigned int kbits = 1024;
+	int ret = ERROR_OK;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], kbits);
+	if (kbits == 0 || kbits > 64 * 1024)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	if (priv->usb_device) {
+		command_print(CMD, "Encoder benchmark can not run while the adapter is in use!");
+		return ERROR_FAIL;
+	}
+
+	int nbits = kbits * 1024;
+	uint8_t *data = malloc(nbits / 8 + 1);
+	if (!data || esp_usb_jtag_xfers_alloc() != ERROR_OK) {
+		ret = ERROR_FAIL;
+		goto out;
+	}
+	/* Mix of zeroed, filled and random data blocks, similar to what is seen in memory and flash images */
+	uint32_t seed = 0x12345678;
+	for (int i = 0; i < nbits / 8; i += 64) {
+		seed = seed * 1103515245 + 12345;
+		int type = (seed >> 16) & 3;
+		for (int k = i; k < i + 64 && k < nbits / 8; k++) {
+			seed = seed * 1103515245 + 12345;
+			data[k] = type == 0 ? 0x00 : type == 1 ? 0xFF : (seed >> 16) & 0xFF;
+		}
+	}
+
+	esp_usb_jtag_enc_lut_init();
+	xfer_ops = &esp_usb_jtag_bench_ops;
+	esp_usb_jtag_bench.nbits = nbits;
+	/* per-bit and block writes and captures, then a long zero TDI capture, which RLE encodes into
+	 * a few commands returning much more bits than the IN ring holds */
+	for (int mode = 0; mode < 5 && ret == ERROR_OK; mode++) {
+		bool zero_read = mode == 4;
+		bool block = (mode & 1) || zero_read;
+		struct duration bench;
+		int tdo_pos = 0;
+
+		esp_usb_jtag_bench.data = zero_read ? NULL : data;
+		esp_usb_jtag_bench.cap = zero_read ? 1 : mode >> 1;
+		esp_usb_jtag_bench.bit_pos = 0;
+		esp_usb_jtag_bench.last_cmd = -1;
+		esp_usb_jtag_bench.rep_shift = 0;
+		esp_usb_jtag_bench.bytes = 0;
+		esp_usb_jtag_bench.errors = 0;
+		esp_usb_jtag_bench.tdo_bits = 0;
+		esp_usb_jtag_bench.tdo_sent = 0;
+		esp_usb_jtag_bench.tdo_flushed = 0;
+		priv->prev_cmd = 0;
+		priv->prev_cmd_repct = 0;
+
+		duration_start(&bench);
+		if (block) {
+			for (int i = 0; i < nbits && ret == ERROR_OK; i += ESP_USB_JTAG_BENCH_BLOCK) {
+				ret = esp_usb_jtag_out_bits(zero_read ? NULL : data + i / 8,
+					MIN(nbits - i, ESP_USB_JTAG_BENCH_BLOCK), esp_usb_jtag_bench.cap);
+				esp_usb_jtag_bench_read(&tdo_pos);
+			}
+		} else {
+			for (int i = 0; i < nbits && ret == ERROR_OK; i++) {
+				ret = esp_usb_jtag_out(0, (data[i / 8] >> (i % 8)) & 1, esp_usb_jtag_bench.cap);
+				esp_usb_jtag_bench_read(&tdo_pos);
+			}
+		}
+		if (ret == ERROR_OK)
+			ret = esp_usb_jtag_flush();
+		esp_usb_jtag_bench_read(&tdo_pos);
+		duration_measure(&bench);
+		if (ret != ERROR_OK)
+			break;
+
+		if (esp_usb_jtag_bench.bit_pos != nbits || tdo_pos != esp_usb_jtag_bench.cap * nbits)
+			esp_usb_jtag_bench.errors++;
+		command_print(CMD, "%-9s %s: %d bits -> %zu bytes in %.3f ms, %.1f Mbit/s%s",
+			zero_read ? "zero" : block ? "block" : "per-bit", esp_usb_jtag_bench.cap ? "capture" : "write",
+			nbits, esp_usb_jtag_bench.bytes, duration_elapsed(&bench) * 1000,
+			nbits / duration_elapsed(&bench) / 1000000, esp_usb_jtag_bench.errors ? ", MISMATCH!" : "");
+		if (esp_usb_jtag_bench.errors)
+			ret = ERROR_FAIL;
+	}
+	esp_usb_jtag_xfers_abort();
+	xfer_ops = &esp_usb_jtag_libusb_ops;
+
+out:
+	esp_usb_jtag_xfers_free();
+	free(priv->in_spill);
+	priv->in_spill = NULL;
+	priv->in_spill_size = 0;
+	free(data);
+	return ret;
+}
+#endif /* ESP_USB_JTAG_ENCODER_BENCH */
+
 static const struct command_registration esp_usb_jtag_subcommands[] = {
 	{
 		.name = "tdo",
@@ -957,6 +1624,15 @@ static const struct command_registration esp_usb_jtag_subcommands[] = {
 		.help = "set chip_id to transfer to the bridge",
 		.usage = "chip_id",
 	},
+#ifdef ESP_USB_JTAG_ENCODER_BENCH
+	{
+		.name = "encoder_bench",
+		.handler = &esp_usb_jtag_encoder_bench_cmd,
+		.mode = COMMAND_CONFIG,
+		.help = "Measure speed of JTAG commands encoder, does not need hardware",
+		.usage = "[kbits]",
+	},
+#endif
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -40,7 +40,8 @@
 #define NO_TAP_SHIFT    0
 #define TAP_SHIFT       1
 
-#define XFERT_MAX_SIZE          512
+/* max scan chunk in bytes, every chunk but the last one must have whole number of bytes */
+#define XFERT_MAX_SIZE          (MAX_BITS / 8)
 
 #define DEFAULT_SERVER_PORT     5555
 #define DEFAULT_SERVER_ADDRESS  "127.0.0.1"
@@ -55,12 +56,15 @@ struct esp_remote_cmd {
 	uint16_t reserved : 4;
 	uint16_t ver : 4;
 		#define ESP_REMOTE_CMD_VER_1    1
+		#define ESP_REMOTE_CMD_VER_2    2
 
 	uint16_t function : 8;
 		#define ESP_REMOTE_CMD_RESET    1
 		#define ESP_REMOTE_CMD_SCAN     2
 		#define ESP_REMOTE_CMD_TMS_SEQ  3
 		#define ESP_REMOTE_CMD_SET_CLK  4
+		#define ESP_REMOTE_CMD_VERSION  5	/* v2 */
+		#define ESP_REMOTE_CMD_BATCH    6	/* v2 */
 	union {
 		uint16_t function_specific;
 		struct {
@@ -79,6 +83,9 @@ struct esp_remote_cmd {
 			uint16_t bits : 12;
 			uint16_t reserved : 4;
 		} tms_seq;
+		struct {
+			uint16_t seq;
+		} batch;
 	};
 	uint32_t data[0];
 };
@@ -86,14 +93,54 @@ struct esp_remote_cmd {
 #define ESP_REMOTE_CMD_DECL(var, func, data_len) \
 	const size_t var ## _len = (sizeof(struct esp_remote_cmd) + data_len + 3) / 4; \
 	uint32_t var ## _storage[var ## _len]; \
-	memset(var ## _storage, 0, var ## _len); \
+	memset(var ## _storage, 0, sizeof(var ## _storage)); \
 	struct esp_remote_cmd *var = (struct esp_remote_cmd *)var ## _storage; \
 	var->ver = ESP_REMOTE_CMD_VER_1; \
 	var->function = func
 
+/* Protocol v2.
+ * Server announces v2 support by replying to ESP_REMOTE_CMD_VERSION command sent with `ver` set to 2
+ * with the same header having `ver` set to the highest version it supports. v1 servers do not reply.
+ * v2 server still accepts v1 commands, but the whole JTAG queue is sent in large batches:
+ *   header(ver=2, function=ESP_REMOTE_CMD_BATCH, batch.seq), u32 LE payload length,
+ *   payload: sequence of v1 RESET/SCAN/TMS_SEQ/SET_CLK commands (header and data, no padding).
+ * Server replies to every batch with
+ *   header(ver=2, function=ESP_REMOTE_CMD_BATCH, batch.seq), u32 LE TDO data length,
+ *   TDO data: concatenated data of all SCAN commands with read flag set, in the order of commands.
+ * Several batches can be sent before reading replies to the previous ones. */
+#define ESP_REMOTE_BATCH_HDR_SZ         (sizeof(struct esp_remote_cmd) + 4)
+#define ESP_REMOTE_BATCH_MAX_SIZE       (8 * 1024)
+/* Replies are never larger than requests, so keep at most this number of batches in flight to be
+ * sure that replies fit into socket buffers and the server never blocks on sending them. */
+#define ESP_REMOTE_BATCH_MAX_INFLIGHT   4
+#define ESP_REMOTE_VER_PROBE_TIMEOUT    500	/* ms */
+
+struct esp_remote_batch {
+	/* batch being built, the first ESP_REMOTE_BATCH_HDR_SZ bytes are reserved for the frame header */
+	uint8_t *tx_buf;
+	size_t tx_len;
+	/* number of TDO bytes which the server will reply with for the batch being built */
+	size_t tx_read_bytes;
+	/* sequence number of the batch being built */
+	uint16_t seq;
+	/* batches which were sent, but replies for them have not been received yet */
+	size_t inflight_read_bytes[ESP_REMOTE_BATCH_MAX_INFLIGHT];
+	unsigned int inflight_head;
+	unsigned int inflight;
+	/* TDO data received for the whole JTAG queue */
+	uint8_t *rx_buf;
+	size_t rx_size;
+	size_t rx_len;
+	size_t rx_pos;
+};
+
+typedef int (*jtag_esp_remote_write_t)(const void *buf, size_t size);
+typedef int (*jtag_esp_remote_read_t)(void *buf, size_t size);
 typedef int (*jtag_esp_remote_send_cmd_t)(struct esp_remote_cmd *);
 typedef int (*jtag_esp_remote_receive_cmd_t)(struct esp_remote_cmd *);
 
+static jtag_esp_remote_write_t jtag_esp_remote_write;
+static jtag_esp_remote_read_t jtag_esp_remote_read;
 static jtag_esp_remote_send_cmd_t jtag_esp_remote_send_cmd = NULL;
 static jtag_esp_remote_receive_cmd_t jtag_esp_remote_receive_cmd = NULL;
 
@@ -116,6 +163,11 @@ static struct libusb_device_handle *usb_device = NULL;
 
 static int s_read_bits_queued = 0;
 
+/* requested protocol version, 0 - detect */
+static int s_proto_ver_req;
+static int s_proto_ver = ESP_REMOTE_CMD_VER_1;
+static struct esp_remote_batch s_batch;
+
 /* Returns the variable-length data size, in bytes, based on the command header */
 static inline size_t cmd_data_len_bytes(const struct esp_remote_cmd *cmd)
 {
@@ -129,29 +181,33 @@ static inline size_t cmd_data_len_bytes(const struct esp_remote_cmd *cmd)
 		return 0;
 }
 
-static int jtag_esp_remote_send_cmd_tcp(struct esp_remote_cmd *cmd)
+static int jtag_esp_remote_write_tcp(const void *buf, size_t size)
 {
-	const size_t data_len = cmd_data_len_bytes(cmd);
-	const size_t size = sizeof(struct esp_remote_cmd) + data_len;
-	const size_t retval = write_socket(sockfd, cmd, size);
-	if (retval != size)
-		return ERROR_FAIL;
+	const uint8_t *p = buf;
+
+	while (size > 0) {
+		int ret = write_socket(sockfd, p, size);
+		if (ret <= 0) {
+			LOG_ERROR("jtag_esp_remote: failed to send %zu bytes (%d)", size, ret);
+			return ERROR_FAIL;
+		}
+		p += ret;
+		size -= ret;
+	}
 	return ERROR_OK;
 }
 
-static int jtag_esp_remote_send_cmd_usb(struct esp_remote_cmd *cmd)
+static int jtag_esp_remote_write_usb(const void *buf, size_t size)
 {
-	const size_t data_len = cmd_data_len_bytes(cmd);
-	const int size = sizeof(struct esp_remote_cmd) + data_len;
 	int tr, ret = jtag_libusb_bulk_write(usb_device,
 		USB_OUT_EP,
-		(char *)cmd,
+		(char *)buf,
 		size,
 		1000 /*ms*/,
 		&tr);
 	if (ret != ERROR_OK)
 		return ERROR_FAIL;
-	if (tr != size) {
+	if ((size_t)tr != size) {
 		LOG_ERROR("jtag_esp_remote: usb sent only %d out of %d bytes.",
 			(int)tr,
 			(int)size);
@@ -160,18 +216,24 @@ static int jtag_esp_remote_send_cmd_usb(struct esp_remote_cmd *cmd)
 	return ERROR_OK;
 }
 
-static int jtag_esp_remote_receive_cmd_tcp(struct esp_remote_cmd *cmd)
+static int jtag_esp_remote_read_tcp(void *buf, size_t size)
 {
-	const size_t data_len = cmd_data_len_bytes(cmd);
-	const size_t ret_val = read_socket(sockfd, cmd->data, data_len);
-	if (ret_val != data_len)
-		return ERROR_FAIL;
+	uint8_t *p = buf;
+
+	while (size > 0) {
+		int ret = read_socket(sockfd, p, size);
+		if (ret <= 0) {
+			LOG_ERROR("jtag_esp_remote: failed to receive %zu bytes (%d)", size, ret);
+			return ERROR_FAIL;
+		}
+		p += ret;
+		size -= ret;
+	}
 	return ERROR_OK;
 }
 
-static int jtag_esp_remote_receive_cmd_usb(struct esp_remote_cmd *cmd)
+static int jtag_esp_remote_read_usb(void *buf, size_t data_len)
 {
-	size_t data_len = cmd_data_len_bytes(cmd);
 	if (usb_device) {
 		if (data_len != 0) {
 			/* Need to keep an internal buffer because libusb can read the same amount
@@ -184,7 +246,7 @@ static int jtag_esp_remote_receive_cmd_usb(struct esp_remote_cmd *cmd)
 				if (internal_buffer_occupied > 0) {
 					const size_t t =
 						MIN(data_len - i, internal_buffer_occupied);
-					memcpy(((char *)cmd->data) + i, internal_buffer, t);
+					memcpy(((char *)buf) + i, internal_buffer, t);
 					memmove(internal_buffer,
 						internal_buffer + t,
 						internal_buffer_occupied - t);
@@ -214,6 +276,135 @@ static int jtag_esp_remote_receive_cmd_usb(struct esp_remote_cmd *cmd)
 	return ERROR_OK;
 }
 
+static int jtag_esp_remote_send_cmd_direct(struct esp_remote_cmd *cmd)
+{
+	return jtag_esp_remote_write(cmd, sizeof(struct esp_remote_cmd) + cmd_data_len_bytes(cmd));
+}
+
+static int jtag_esp_remote_receive_cmd_direct(struct esp_remote_cmd *cmd)
+{
+	return jtag_esp_remote_read(cmd->data, cmd_data_len_bytes(cmd));
+}
+
+static void jtag_esp_remote_batch_reset(void)
+{
+	s_batch.tx_len = ESP_REMOTE_BATCH_HDR_SZ;
+	s_batch.tx_read_bytes = 0;
+	s_batch.inflight = 0;
+	s_batch.inflight_head = 0;
+	s_batch.rx_len = 0;
+	s_batch.rx_pos = 0;
+}
+
+/* Receives reply to the oldest batch in flight and appends its TDO data to the RX buffer */
+static int jtag_esp_remote_batch_receive(void)
+{
+	uint32_t hdr_storage[ESP_REMOTE_BATCH_HDR_SZ / 4];
+	struct esp_remote_cmd *hdr = (struct esp_remote_cmd *)hdr_storage;
+	const uint16_t seq = s_batch.seq - s_batch.inflight;
+	const size_t expected = s_batch.inflight_read_bytes[s_batch.inflight_head];
+
+	assert(s_batch.inflight > 0);
+
+	int retval = jtag_esp_remote_read(hdr_storage, ESP_REMOTE_BATCH_HDR_SZ);
+	if (retval != ERROR_OK)
+		return retval;
+	uint32_t len = le_to_h_u32((uint8_t *)hdr_storage + sizeof(struct esp_remote_cmd));
+	if (hdr->ver != ESP_REMOTE_CMD_VER_2 || hdr->function != ESP_REMOTE_CMD_BATCH ||
+		hdr->batch.seq != seq || len != expected) {
+		LOG_ERROR("jtag_esp_remote: unexpected batch reply (ver %d, func %d, seq %d/%d, len %u/%zu)",
+			hdr->ver, hdr->function, hdr->batch.seq, seq, len, expected);
+		return ERROR_FAIL;
+	}
+	if (s_batch.rx_len + len > s_batch.rx_size) {
+		size_t sz = MAX(s_batch.rx_size * 2, s_batch.rx_len + len);
+		uint8_t *p = realloc(s_batch.rx_buf, sz);
+		if (!p) {
+			LOG_ERROR("jtag_esp_remote: failed to alloc RX buffer (%zu bytes)", sz);
+			return ERROR_FAIL;
+		}
+		s_batch.rx_buf = p;
+		s_batch.rx_size = sz;
+	}
+	retval = jtag_esp_remote_read(s_batch.rx_buf + s_batch.rx_len, len);
+	if (retval != ERROR_OK)
+		return retval;
+	s_batch.rx_len += len;
+	s_batch.inflight_head = (s_batch.inflight_head + 1) % ESP_REMOTE_BATCH_MAX_INFLIGHT;
+	s_batch.inflight--;
+	return ERROR_OK;
+}
+
+/* Sends the batch being built without waiting for the reply */
+static int jtag_esp_remote_batch_flush(void)
+{
+	if (s_batch.tx_len == ESP_REMOTE_BATCH_HDR_SZ)
+		return ERROR_OK;
+
+	if (s_batch.inflight == ESP_REMOTE_BATCH_MAX_INFLIGHT) {
+		int retval = jtag_esp_remote_batch_receive();
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	struct esp_remote_cmd *hdr = (struct esp_remote_cmd *)s_batch.tx_buf;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->ver = ESP_REMOTE_CMD_VER_2;
+	hdr->function = ESP_REMOTE_CMD_BATCH;
+	hdr->batch.seq = s_batch.seq;
+	h_u32_to_le(s_batch.tx_buf + sizeof(*hdr), s_batch.tx_len - ESP_REMOTE_BATCH_HDR_SZ);
+
+	int retval = jtag_esp_remote_write(s_batch.tx_buf, s_batch.tx_len);
+	if (retval != ERROR_OK)
+		return retval;
+
+	unsigned int idx = (s_batch.inflight_head + s_batch.inflight) % ESP_REMOTE_BATCH_MAX_INFLIGHT;
+	s_batch.inflight_read_bytes[idx] = s_batch.tx_read_bytes;
+	s_batch.inflight++;
+	s_batch.seq++;
+	s_batch.tx_len = ESP_REMOTE_BATCH_HDR_SZ;
+	s_batch.tx_read_bytes = 0;
+	return ERROR_OK;
+}
+
+static int jtag_esp_remote_send_cmd_batch(struct esp_remote_cmd *cmd)
+{
+	const size_t data_len = cmd_data_len_bytes(cmd);
+	const size_t size = sizeof(struct esp_remote_cmd) + data_len;
+
+	if (s_batch.tx_len + size > ESP_REMOTE_BATCH_MAX_SIZE) {
+		int retval = jtag_esp_remote_batch_flush();
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	memcpy(s_batch.tx_buf + s_batch.tx_len, cmd, size);
+	s_batch.tx_len += size;
+	if (cmd->function == ESP_REMOTE_CMD_SCAN && cmd->scan.read)
+		s_batch.tx_read_bytes += data_len;
+	return ERROR_OK;
+}
+
+static int jtag_esp_remote_receive_cmd_batch(struct esp_remote_cmd *cmd)
+{
+	const size_t data_len = cmd_data_len_bytes(cmd);
+
+	if (s_batch.rx_len - s_batch.rx_pos < data_len) {
+		LOG_ERROR("jtag_esp_remote: no TDO data for scan (%zu bytes)", data_len);
+		return ERROR_FAIL;
+	}
+	memcpy(cmd->data, s_batch.rx_buf + s_batch.rx_pos, data_len);
+	s_batch.rx_pos += data_len;
+	return ERROR_OK;
+}
+
+/* Sends all queued commands to the server, does nothing for v1 protocol */
+static int jtag_esp_remote_flush(void)
+{
+	if (s_proto_ver < ESP_REMOTE_CMD_VER_2)
+		return ERROR_OK;
+	return jtag_esp_remote_batch_flush();
+}
+
 /**
  * jtag_esp_remote_reset - ask to reset the JTAG device
  * @trst: 1 if TRST is to be asserted
@@ -348,20 +539,28 @@ static int jtag_esp_remote_queue_tdi_xfer(uint8_t *bits, int nb_bits, int tap_sh
 
 static int jtag_esp_remote_get_tdi_xfer_result(uint8_t *bits, int nb_bits)
 {
-	int nb_bytes = DIV_ROUND_UP(nb_bits, 8);
-	ESP_REMOTE_CMD_DECL(cmd, ESP_REMOTE_CMD_SCAN, nb_bytes);
-	cmd->scan.bits = nb_bits;
-	memset(cmd->data, 0xcc, nb_bytes);
+	ESP_REMOTE_CMD_DECL(cmd, ESP_REMOTE_CMD_SCAN, XFERT_MAX_SIZE);
 
-	int retval = jtag_esp_remote_receive_cmd(cmd);
-	if (retval != ERROR_OK)
-		return retval;
+	/* read data in the same chunks as they were queued by jtag_esp_remote_queue_tdi() */
+	while (nb_bits > 0) {
+		int chunk_bits = MIN(nb_bits, XFERT_MAX_SIZE * 8);
+		int chunk_bytes = DIV_ROUND_UP(chunk_bits, 8);
+		cmd->scan.bits = chunk_bits;
+		memset(cmd->data, 0xcc, chunk_bytes);
 
-	if (bits)
-		memcpy(bits, cmd->data, nb_bytes);
+		int retval = jtag_esp_remote_receive_cmd(cmd);
+		if (retval != ERROR_OK)
+			return retval;
 
-	assert(s_read_bits_queued >= nb_bits);
-	s_read_bits_queued -= nb_bits;
+		if (bits) {
+			memcpy(bits, cmd->data, chunk_bytes);
+			bits += chunk_bytes;
+		}
+
+		assert(s_read_bits_queued >= chunk_bits);
+		s_read_bits_queued -= chunk_bits;
+		nb_bits -= chunk_bits;
+	}
 
 	return ERROR_OK;
 }
@@ -492,6 +691,8 @@ jtag_esp_remote_scan_read_exit:
 	return retval;
 }
 
+static int jtag_esp_remote_stableclocks(int cycles);
+
 static int jtag_esp_remote_runtest(int cycles, tap_state_t end_state)
 {
 	int retval;
@@ -500,8 +701,10 @@ static int jtag_esp_remote_runtest(int cycles, tap_state_t end_state)
 	if (retval != ERROR_OK)
 		return retval;
 
-	for (int i = 0; i < cycles; i++)
-		jtag_esp_remote_clock_tms(0);
+	/* send all cycles at once instead of one TMS command per clock */
+	retval = jtag_esp_remote_stableclocks(cycles);
+	if (retval != ERROR_OK)
+		return retval;
 
 	return jtag_esp_remote_state_move(end_state);
 }
@@ -564,6 +767,8 @@ static int jtag_esp_remote_execute_queue(void)
 			retval = jtag_esp_remote_tms(cmd->cmd.tms);
 			break;
 		case JTAG_SLEEP:
+			/* commands before the sleep must reach the target before it starts */
+			retval = jtag_esp_remote_flush();
 			jtag_sleep(cmd->cmd.sleep->us);
 			break;
 		case JTAG_SCAN:
@@ -577,6 +782,13 @@ static int jtag_esp_remote_execute_queue(void)
 		}
 	}
 
+	if (retval == ERROR_OK && s_proto_ver >= ESP_REMOTE_CMD_VER_2) {
+		/* send the last batch and collect TDO data for the whole queue */
+		retval = jtag_esp_remote_batch_flush();
+		while (retval == ERROR_OK && s_batch.inflight > 0)
+			retval = jtag_esp_remote_batch_receive();
+	}
+
 	if (read_size > 0) {
 		for (cmd = jtag_command_queue; retval == ERROR_OK && cmd != NULL;
 			cmd = cmd->next) {
@@ -584,14 +796,24 @@ static int jtag_esp_remote_execute_queue(void)
 				retval = jtag_esp_remote_scan_read(cmd->cmd.scan);
 		}
 	}
+	if (retval != ERROR_OK)
+		s_read_bits_queued = 0;
 	assert(s_read_bits_queued == 0);
+	if (s_proto_ver >= ESP_REMOTE_CMD_VER_2)
+		jtag_esp_remote_batch_reset();
 
 	return retval;
 }
-static int jtag_esp_remote_init_tcp(void)
+static void jtag_esp_remote_set_nodelay(void)
 {
 	int flag = 1;
 
+	if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int)) < 0)
+		LOG_WARNING("jtag_esp_remote: cannot set sock option 'TCP_NODELAY', errno: %s", strerror(errno));
+}
+
+static int jtag_esp_remote_init_tcp(void)
+{
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
 	if (sockfd < 0) {
 		LOG_ERROR("Could not create socket");
@@ -620,7 +842,7 @@ static int jtag_esp_remote_init_tcp(void)
 		/* This increases performance dramatically for local
 		 * connections, which is the most likely arrangement
 		 * for a ESP remote connection. */
-		setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
+		jtag_esp_remote_set_nodelay();
 	}
 
 	LOG_INFO("Connection to %s : %u succeed", server_address, server_port);
@@ -648,21 +870,117 @@ static int jtag_esp_remote_init_usb(void)
 	return ERROR_OK;
 }
 
+/* Waits for the reply to the version request, returns false if the server did not reply in time */
+static bool jtag_esp_remote_wait_reply(int timeout_ms)
+{
+	if (esp_remote_protocol != ESP_REMOTE_TCP)
+		return true;	/* USB reads time out by themselves */
+
+	fd_set rfds;
+	struct timeval tv = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_usec = (timeout_ms % 1000) * 1000
+	};
+	FD_ZERO(&rfds);
+	FD_SET(sockfd, &rfds);
+	return socket_select(sockfd + 1, &rfds, NULL, NULL, &tv) > 0;
+}
+
+/* Asks the server for the highest supported protocol version, v1 servers do not reply at all */
+static int jtag_esp_remote_query_version(int *ver)
+{
+	ESP_REMOTE_CMD_DECL(cmd, ESP_REMOTE_CMD_VERSION, 0);
+	cmd->ver = ESP_REMOTE_CMD_VER_2;
+	int retval = jtag_esp_remote_write(cmd, sizeof(*cmd));
+	if (retval != ERROR_OK)
+		return retval;
+
+	*ver = ESP_REMOTE_CMD_VER_1;
+	memset(cmd, 0, sizeof(*cmd));
+	if (!jtag_esp_remote_wait_reply(ESP_REMOTE_VER_PROBE_TIMEOUT) ||
+		jtag_esp_remote_read(cmd, sizeof(*cmd)) != ERROR_OK ||
+		cmd->function != ESP_REMOTE_CMD_VERSION) {
+		LOG_DEBUG("jtag_esp_remote: no reply to version request");
+		if (esp_remote_protocol != ESP_REMOTE_TCP)
+			return ERROR_OK;
+		/* A slow server may still reply after the timeout and that reply would be taken
+		 * for the data of the next command, so continue on a fresh connection. */
+		close(sockfd);
+		return jtag_esp_remote_init_tcp();
+	}
+	*ver = cmd->ver;
+	return ERROR_OK;
+}
+
+static int jtag_esp_remote_negotiate_version(void)
+{
+	int ver = ESP_REMOTE_CMD_VER_1;
+
+	s_proto_ver = ESP_REMOTE_CMD_VER_1;
+	/* known USB servers speak v1 only, so do not wait for timeout there unless v2 is requested */
+	if (s_proto_ver_req == ESP_REMOTE_CMD_VER_1 ||
+		(s_proto_ver_req == 0 && esp_remote_protocol == ESP_REMOTE_USB))
+		goto _exit;
+
+	int retval = jtag_esp_remote_query_version(&ver);
+	if (retval != ERROR_OK)
+		return retval;
+	if (ver < ESP_REMOTE_CMD_VER_2) {
+		if (s_proto_ver_req == ESP_REMOTE_CMD_VER_2) {
+			LOG_ERROR("jtag_esp_remote: server does not support protocol v2");
+			return ERROR_FAIL;
+		}
+		goto _exit;
+	}
+
+	s_batch.tx_buf = malloc(ESP_REMOTE_BATCH_MAX_SIZE);
+	if (!s_batch.tx_buf) {
+		LOG_ERROR("jtag_esp_remote: failed to alloc batch buffer");
+		return ERROR_FAIL;
+	}
+	s_batch.seq = 0;
+	jtag_esp_remote_batch_reset();
+	s_proto_ver = ESP_REMOTE_CMD_VER_2;
+	jtag_esp_remote_send_cmd = jtag_esp_remote_send_cmd_batch;
+	jtag_esp_remote_receive_cmd = jtag_esp_remote_receive_cmd_batch;
+	if (esp_remote_protocol == ESP_REMOTE_TCP) {
+		/* batches are large, and small ones must not be delayed while waiting for ACKs */
+		jtag_esp_remote_set_nodelay();
+	}
+
+_exit:
+	LOG_INFO("jtag_esp_remote: using protocol v%d", s_proto_ver);
+	return ERROR_OK;
+}
+
 static int jtag_esp_remote_init(void)
 {
+	int r = ERROR_FAIL;
+
+	jtag_esp_remote_send_cmd = jtag_esp_remote_send_cmd_direct;
+	jtag_esp_remote_receive_cmd = jtag_esp_remote_receive_cmd_direct;
+
 	if (esp_remote_protocol == ESP_REMOTE_USB) {
-		int r = jtag_esp_remote_init_usb();
+		r = jtag_esp_remote_init_usb();
 		/*Note: if we succeed, usb_device is also non-NULL. */
-		if (r != ERROR_JTAG_INVALID_INTERFACE)
-			return r;
+		if (r == ERROR_JTAG_INVALID_INTERFACE)
+			return ERROR_FAIL;
 	} else if (esp_remote_protocol == ESP_REMOTE_TCP) {
-		return jtag_esp_remote_init_tcp();
+		r = jtag_esp_remote_init_tcp();
 	}
-	return ERROR_FAIL;
+	if (r != ERROR_OK)
+		return r;
+	return jtag_esp_remote_negotiate_version();
 }
 
 static int jtag_esp_remote_quit(void)
 {
+	free(s_batch.tx_buf);
+	s_batch.tx_buf = NULL;
+	free(s_batch.rx_buf);
+	s_batch.rx_buf = NULL;
+	s_batch.rx_size = 0;
+
 	if (usb_device) {
 		libusb_release_interface(usb_device, USB_INTERFACE);
 		jtag_libusb_close(usb_device);
@@ -713,7 +1031,11 @@ static int jtag_esp_remote_jtag_speed(int speed)
 
 	memcpy(cmd->data, &speed_buff, sizeof(speed_buff));
 
-	return jtag_esp_remote_send_cmd(cmd);
+	int retval = jtag_esp_remote_send_cmd(cmd);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return jtag_esp_remote_flush();
 }
 
 COMMAND_HANDLER(jtag_esp_remote_protocol)
@@ -721,15 +1043,15 @@ COMMAND_HANDLER(jtag_esp_remote_protocol)
 	if (CMD_ARGC > 0) {
 		if (strcmp(CMD_ARGV[0], "usb") == 0) {
 			esp_remote_protocol = ESP_REMOTE_USB;
-			jtag_esp_remote_send_cmd = jtag_esp_remote_send_cmd_usb;
-			jtag_esp_remote_receive_cmd = jtag_esp_remote_receive_cmd_usb;
+			jtag_esp_remote_write = jtag_esp_remote_write_usb;
+			jtag_esp_remote_read = jtag_esp_remote_read_usb;
 			LOG_INFO("USB protocol set for esp remote");
 			return ERROR_OK;
 		}
 		if (strcmp(CMD_ARGV[0], "tcp") == 0) {
 			esp_remote_protocol = ESP_REMOTE_TCP;
-			jtag_esp_remote_send_cmd = jtag_esp_remote_send_cmd_tcp;
-			jtag_esp_remote_receive_cmd = jtag_esp_remote_receive_cmd_tcp;
+			jtag_esp_remote_write = jtag_esp_remote_write_tcp;
+			jtag_esp_remote_read = jtag_esp_remote_read_tcp;
 			if (!server_address)
 				server_address = strdup(DEFAULT_SERVER_ADDRESS);
 			LOG_INFO("TCP protocol set for esp remote");
@@ -798,6 +1120,24 @@ COMMAND_HANDLER(jtag_esp_remote_set_address)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(jtag_esp_remote_set_protocol_version)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (strcmp(CMD_ARGV[0], "auto") == 0) {
+		s_proto_ver_req = 0;
+	} else {
+		COMMAND_PARSE_NUMBER(int, CMD_ARGV[0], s_proto_ver_req);
+		if (s_proto_ver_req != ESP_REMOTE_CMD_VER_1 && s_proto_ver_req != ESP_REMOTE_CMD_VER_2) {
+			LOG_ERROR("Unsupported protocol version %d", s_proto_ver_req);
+			s_proto_ver_req = 0;
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+	}
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_esp_remote_command_handlers[] = {
 	{
 		.name = "jtag_esp_remote_protocol",
@@ -827,6 +1167,13 @@ static const struct command_registration jtag_esp_remote_command_handlers[] = {
 		.help = "set the address of the ESP remote TCP server",
 		.usage = "description_string",
 	},
+	{
+		.name = "jtag_esp_remote_set_protocol_version",
+		.handler = &jtag_esp_remote_set_protocol_version,
+		.mode = COMMAND_CONFIG,
+		.help = "set ESP remote protocol version, 'auto' uses v2 (batched) if TCP server supports it",
+		.usage = "('auto'|1|2)",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
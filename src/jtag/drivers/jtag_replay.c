@@ -0,0 +1,167 @@
+/***************************************************************************
+ *   JTAG adapter replaying a binary capture of JTAG traffic               *
+ *   Copyright (C) 2022 Espressif Systems Ltd.                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/*
+ * Answers every executed queue with the data recorded by 'jtag_capture', so
+ * target-layer code can be debugged and benchmarked without hardware. The
+ * queues must match the capture: OpenOCD has to be started with the same
+ * configuration and the same commands have to be issued in the same order.
+ * Background polling runs off a timer, so its queues land at different places
+ * at replay speed: both sessions have to run 'poll off' right after 'init'.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jtag/interface.h>
+#include <jtag/capture.h>
+
+static char *jtag_replay_filename;
+static bool jtag_replay_verify_out = true;
+static struct jtag_capture_reader *jtag_replay_reader;
+
+static int jtag_replay_execute_queue(void)
+{
+	int result;
+
+	if (!jtag_command_queue)
+		return ERROR_OK;
+
+	int retval = jtag_capture_replay_queue(jtag_replay_reader, jtag_command_queue,
+		jtag_replay_verify_out, &result);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return result;
+}
+
+static int jtag_replay_init(void)
+{
+	if (!jtag_replay_filename) {
+		LOG_ERROR("JTAG replay: capture file is not set, use 'jtag_replay file'");
+		return ERROR_FAIL;
+	}
+	jtag_replay_reader = jtag_capture_reader_open(jtag_replay_filename);
+	if (!jtag_replay_reader)
+		return ERROR_FAIL;
+	LOG_INFO("JTAG replay from '%s'", jtag_replay_filename);
+	return ERROR_OK;
+}
+
+static int jtag_replay_quit(void)
+{
+	jtag_capture_reader_close(jtag_replay_reader);
+	jtag_replay_reader = NULL;
+	free(jtag_replay_filename);
+	jtag_replay_filename = NULL;
+	return ERROR_OK;
+}
+
+static int jtag_replay_reset(int trst, int srst)
+{
+	return ERROR_OK;
+}
+
+static int jtag_replay_speed(int speed)
+{
+	return ERROR_OK;
+}
+
+static int jtag_replay_khz(int khz, int *jtag_speed)
+{
+	*jtag_speed = khz;
+	return ERROR_OK;
+}
+
+static int jtag_replay_speed_div(int speed, int *khz)
+{
+	*khz = speed;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(jtag_replay_handle_file_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	free(jtag_replay_filename);
+	jtag_replay_filename = strdup(CMD_ARGV[0]);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(jtag_replay_handle_verify_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], jtag_replay_verify_out);
+	command_print(CMD, "%s", jtag_replay_verify_out ? "on" : "off");
+	return ERROR_OK;
+}
+
+static const struct command_registration jtag_replay_subcommand_handlers[] = {
+	{
+		.name = "file",
+		.handler = jtag_replay_handle_file_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Set the capture file written by 'jtag_capture' to replay.",
+		.usage = "filename",
+	},
+	{
+		.name = "verify",
+		.handler = jtag_replay_handle_verify_command,
+		.mode = COMMAND_ANY,
+		.help = "Enable or disable comparing data scanned out with the captured data. "
+			"Enabled by default.",
+		.usage = "['on'|'off']",
+	},
+	COMMAND_REGISTRATION_DONE,
+};
+
+static const struct command_registration jtag_replay_command_handlers[] = {
+	{
+		.name = "jtag_replay",
+		.mode = COMMAND_ANY,
+		.help = "perform jtag_replay management",
+		.chain = jtag_replay_subcommand_handlers,
+		.usage = "",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static struct jtag_interface jtag_replay_interface = {
+	.supported = DEBUG_CAP_TMS_SEQ,
+	.execute_queue = &jtag_replay_execute_queue,
+};
+
+struct adapter_driver jtag_replay_adapter_driver = {
+	.name = "jtag_replay",
+	.transports = jtag_only,
+	.commands = jtag_replay_command_handlers,
+
+	.init = &jtag_replay_init,
+	.quit = &jtag_replay_quit,
+	.reset = &jtag_replay_reset,
+	.speed = &jtag_replay_speed,
+	.khz = &jtag_replay_khz,
+	.speed_div = &jtag_replay_speed_div,
+
+	.jtag_ops = &jtag_replay_interface,
+};
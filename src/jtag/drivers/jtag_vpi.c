@@ -48,6 +48,12 @@
 #define CMD_SCAN_CHAIN		2
 #define CMD_SCAN_CHAIN_FLIP_TMS	3
 #define CMD_STOP_SIMU		4
+#define CMD_BATCH		5
+
+/* In a batch, flag of scan sub-command whose TDO data is not sent back */
+#define BATCH_CMD_NO_READ	0x80
+/* Batch is sent when its payload grows over this size */
+#define BATCH_MAX_SIZE		(64 * 1024)
 
 /* jtag_vpi server port and address to connect to */
 static int server_port = DEFAULT_SERVER_PORT;
@@ -56,6 +62,43 @@ static char *server_address;
 /* Send CMD_STOP_SIMU to server when OpenOCD exits? */
 static bool stop_sim_on_exit;
 
+/* Send the queue in CMD_BATCH messages? */
+static bool batch_mode;
+
+/*
+ * Commands of the queue collected into one CMD_BATCH message. The message is
+ * a vpi_cmd with length set to the payload size and nb_bits to the number of
+ * sub-commands, followed by the payload: for every sub-command u8 cmd
+ * (optionally or-ed with BATCH_CMD_NO_READ), u32 nb_bits and the data bytes.
+ * The reply is a vpi_cmd with length set to the size of TDO data of all scans
+ * followed by the data.
+ */
+struct jtag_vpi_batch_read {
+	/* destination of TDO data, NULL if not needed */
+	uint8_t *bits;
+	int nb_bits;
+};
+
+struct jtag_vpi_batch_scan {
+	struct scan_command *cmd;
+	uint8_t *buf;
+};
+
+static struct {
+	uint8_t *payload;
+	size_t payload_size;
+	size_t payload_used;
+	uint32_t num_cmds;
+	size_t read_bytes;
+	struct jtag_vpi_batch_read *reads;
+	unsigned int num_reads;
+	unsigned int max_reads;
+	/* scans waiting for the reply to be processed by jtag_read_buffer() */
+	struct jtag_vpi_batch_scan *scans;
+	unsigned int num_scans;
+	unsigned int max_scans;
+} vpi_batch;
+
 static int sockfd;
 static struct sockaddr_in serv_addr;
 
@@ -206,6 +249,167 @@ static int jtag_vpi_receive_cmd(struct vpi_cmd *vpi)
 	return ERROR_OK;
 }
 
+static int jtag_vpi_write_all(const uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		int retval = write_socket(sockfd, buf, len);
+		if (retval < 0) {
+#ifdef _WIN32
+			if (WSAGetLastError() == WSAEINTR)
+				continue;
+#else
+			if (errno == EINTR)
+				continue;
+#endif
+			log_socket_error("jtag_vpi xmit");
+			return ERROR_FAIL;
+		}
+		buf += retval;
+		len -= retval;
+	}
+	return ERROR_OK;
+}
+
+static int jtag_vpi_read_all(uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		int retval = read_socket(sockfd, buf, len);
+		if (retval < 0) {
+#ifdef _WIN32
+			if (WSAGetLastError() == WSAEINTR)
+				continue;
+#else
+			if (errno == EINTR)
+				continue;
+#endif
+			log_socket_error("jtag_vpi recv");
+			return ERROR_FAIL;
+		} else if (retval == 0) {
+			LOG_ERROR("Connection prematurely closed by jtag_vpi server.");
+			return ERROR_FAIL;
+		}
+		buf += retval;
+		len -= retval;
+	}
+	return ERROR_OK;
+}
+
+static void *jtag_vpi_batch_grow(void *array, unsigned int *max, unsigned int count, size_t elem_size)
+{
+	if (count < *max)
+		return array;
+	unsigned int new_max = MAX(*max * 2, 64);
+	void *p = realloc(array, new_max * elem_size);
+	if (p)
+		*max = new_max;
+	return p;
+}
+
+/**
+ * jtag_vpi_batch_add - append a sub-command to the batch
+ * @param cmd command
+ * @param bits data to send (or NULL to send ones)
+ * @param nb_bits number of bits
+ * @param read_bits where to store the received TDO data of a scan (or NULL)
+ */
+static int jtag_vpi_batch_add(int cmd, const uint8_t *bits, int nb_bits, uint8_t *read_bits)
+{
+	int nb_bytes = DIV_ROUND_UP(nb_bits, 8);
+	bool scan = cmd == CMD_SCAN_CHAIN || cmd == CMD_SCAN_CHAIN_FLIP_TMS;
+	size_t size = vpi_batch.payload_used + 5 + nb_bytes;
+
+	if (size > vpi_batch.payload_size) {
+		size_t new_size = MAX(size, MAX(vpi_batch.payload_size * 2, 4096));
+		uint8_t *p = realloc(vpi_batch.payload, new_size);
+		if (!p) {
+			LOG_ERROR("jtag_vpi: out of memory");
+			return ERROR_FAIL;
+		}
+		vpi_batch.payload = p;
+		vpi_batch.payload_size = new_size;
+	}
+	if (scan) {
+		struct jtag_vpi_batch_read *reads = jtag_vpi_batch_grow(vpi_batch.reads,
+				&vpi_batch.max_reads, vpi_batch.num_reads, sizeof(*reads));
+		if (!reads) {
+			LOG_ERROR("jtag_vpi: out of memory");
+			return ERROR_FAIL;
+		}
+		vpi_batch.reads = reads;
+	}
+
+	uint8_t *p = vpi_batch.payload + vpi_batch.payload_used;
+	p[0] = cmd | ((scan && !read_bits) ? BATCH_CMD_NO_READ : 0);
+	h_u32_to_le(p + 1, nb_bits);
+	if (bits)
+		memcpy(p + 5, bits, nb_bytes);
+	else
+		memset(p + 5, 0xff, nb_bytes);
+	vpi_batch.payload_used = size;
+	vpi_batch.num_cmds++;
+
+	if (scan && read_bits) {
+		vpi_batch.reads[vpi_batch.num_reads].bits = read_bits;
+		vpi_batch.reads[vpi_batch.num_reads].nb_bits = nb_bits;
+		vpi_batch.num_reads++;
+		vpi_batch.read_bytes += nb_bytes;
+	}
+	return ERROR_OK;
+}
+
+/**
+ * jtag_vpi_batch_flush - send the batch, wait for the reply and complete the scans
+ */
+static int jtag_vpi_batch_flush(void)
+{
+	struct vpi_cmd vpi;
+	int retval = ERROR_OK;
+
+	if (vpi_batch.num_cmds == 0)
+		return ERROR_OK;
+
+	memset(&vpi, 0, sizeof(struct vpi_cmd));
+	vpi.cmd = CMD_BATCH;
+	vpi.length = vpi_batch.payload_used;
+	vpi.nb_bits = vpi_batch.num_cmds;
+	retval = jtag_vpi_send_cmd(&vpi);
+	if (retval == ERROR_OK)
+		retval = jtag_vpi_write_all(vpi_batch.payload, vpi_batch.payload_used);
+	if (retval == ERROR_OK)
+		retval = jtag_vpi_receive_cmd(&vpi);
+	if (retval == ERROR_OK && (vpi.cmd != CMD_BATCH || vpi.length != vpi_batch.read_bytes)) {
+		LOG_ERROR("jtag_vpi: unexpected batch reply: cmd=%s, length=%" PRIu32 " (expected %zu)",
+			jtag_vpi_cmd_to_str(vpi.cmd), vpi.length, vpi_batch.read_bytes);
+		retval = ERROR_FAIL;
+	}
+	for (unsigned int i = 0; retval == ERROR_OK && i < vpi_batch.num_reads; i++) {
+		struct jtag_vpi_batch_read *read = &vpi_batch.reads[i];
+		retval = jtag_vpi_read_all(read->bits, DIV_ROUND_UP(read->nb_bits, 8));
+	}
+
+	for (unsigned int i = 0; i < vpi_batch.num_scans; i++) {
+		struct jtag_vpi_batch_scan *scan = &vpi_batch.scans[i];
+		if (retval == ERROR_OK)
+			retval = jtag_read_buffer(scan->buf, scan->cmd);
+		free(scan->buf);
+	}
+
+	vpi_batch.payload_used = 0;
+	vpi_batch.num_cmds = 0;
+	vpi_batch.read_bytes = 0;
+	vpi_batch.num_reads = 0;
+	vpi_batch.num_scans = 0;
+	return retval;
+}
+
+static void jtag_vpi_batch_free(void)
+{
+	free(vpi_batch.payload);
+	free(vpi_batch.reads);
+	free(vpi_batch.scans);
+	memset(&vpi_batch, 0, sizeof(vpi_batch));
+}
+
 /**
  * jtag_vpi_reset - ask to reset the JTAG device
  * @param trst 1 if TRST is to be asserted
@@ -216,6 +420,9 @@ static int jtag_vpi_reset(int trst, int srst)
 	struct vpi_cmd vpi;
 	memset(&vpi, 0, sizeof(struct vpi_cmd));
 
+	if (batch_mode)
+		return jtag_vpi_batch_add(CMD_RESET, NULL, 0, NULL);
+
 	vpi.cmd = CMD_RESET;
 	vpi.length = 0;
 	return jtag_vpi_send_cmd(&vpi);
@@ -237,6 +444,9 @@ static int jtag_vpi_tms_seq(const uint8_t *bits, int nb_bits)
 	struct vpi_cmd vpi;
 	int nb_bytes;
 
+	if (batch_mode)
+		return jtag_vpi_batch_add(CMD_TMS_SEQ, bits, nb_bits, NULL);
+
 	memset(&vpi, 0, sizeof(struct vpi_cmd));
 	nb_bytes = DIV_ROUND_UP(nb_bits, 8);
 
@@ -345,12 +555,18 @@ static int jtag_vpi_queue_tdi_xfer(uint8_t *bits, int nb_bits, int tap_shift)
  * @param bits bits to be queued on TDI (or NULL if 0 are to be queued)
  * @param nb_bits number of bits
  * @param tap_shift
+ * @param read_tdo TDO data is needed, only batched scans can skip it
  */
-static int jtag_vpi_queue_tdi(uint8_t *bits, int nb_bits, int tap_shift)
+static int jtag_vpi_queue_tdi(uint8_t *bits, int nb_bits, int tap_shift, bool read_tdo)
 {
 	int nb_xfer = DIV_ROUND_UP(nb_bits, XFERT_MAX_SIZE * 8);
 	int retval;
 
+	/* the server splits long scans of a batch by itself */
+	if (batch_mode)
+		return jtag_vpi_batch_add(tap_shift ? CMD_SCAN_CHAIN_FLIP_TMS : CMD_SCAN_CHAIN,
+			bits, nb_bits, read_tdo ? bits : NULL);
+
 	while (nb_xfer) {
 		if (nb_xfer ==  1) {
 			retval = jtag_vpi_queue_tdi_xfer(bits, nb_bits, tap_shift);
@@ -397,6 +613,7 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 {
 	int scan_bits;
 	uint8_t *buf = NULL;
+	bool read_tdo = jtag_scan_type(cmd) != SCAN_OUT;
 	int retval = ERROR_OK;
 
 	scan_bits = jtag_build_buffer(cmd, &buf);
@@ -412,11 +629,11 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 	}
 
 	if (cmd->end_state == TAP_DRSHIFT) {
-		retval = jtag_vpi_queue_tdi(buf, scan_bits, NO_TAP_SHIFT);
+		retval = jtag_vpi_queue_tdi(buf, scan_bits, NO_TAP_SHIFT, read_tdo);
 		if (retval != ERROR_OK)
 			return retval;
 	} else {
-		retval = jtag_vpi_queue_tdi(buf, scan_bits, TAP_SHIFT);
+		retval = jtag_vpi_queue_tdi(buf, scan_bits, TAP_SHIFT, read_tdo);
 		if (retval != ERROR_OK)
 			return retval;
 	}
@@ -436,11 +653,26 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 			tap_set_state(TAP_DRPAUSE);
 	}
 
-	retval = jtag_read_buffer(buf, cmd);
-	if (retval != ERROR_OK)
-		return retval;
+	if (batch_mode) {
+		/* the buffer is read when the reply to the batch arrives */
+		struct jtag_vpi_batch_scan *scans = jtag_vpi_batch_grow(vpi_batch.scans,
+				&vpi_batch.max_scans, vpi_batch.num_scans, sizeof(*scans));
+		if (!scans) {
+			LOG_ERROR("jtag_vpi: out of memory");
+			free(buf);
+			return ERROR_FAIL;
+		}
+		vpi_batch.scans = scans;
+		vpi_batch.scans[vpi_batch.num_scans].cmd = cmd;
+		vpi_batch.scans[vpi_batch.num_scans].buf = buf;
+		vpi_batch.num_scans++;
+	} else {
+		retval = jtag_read_buffer(buf, cmd);
+		if (retval != ERROR_OK)
+			return retval;
 
-	free(buf);
+		free(buf);
+	}
 
 	if (cmd->end_state != TAP_DRSHIFT) {
 		retval = jtag_vpi_state_move(cmd->end_state);
@@ -459,7 +691,7 @@ static int jtag_vpi_runtest(int cycles, tap_state_t state)
 	if (retval != ERROR_OK)
 		return retval;
 
-	retval = jtag_vpi_queue_tdi(NULL, cycles, NO_TAP_SHIFT);
+	retval = jtag_vpi_queue_tdi(NULL, cycles, NO_TAP_SHIFT, false);
 	if (retval != ERROR_OK)
 		return retval;
 
@@ -519,6 +751,7 @@ static int jtag_vpi_execute_queue(void)
 			retval = jtag_vpi_tms(cmd->cmd.tms);
 			break;
 		case JTAG_SLEEP:
+			retval = jtag_vpi_batch_flush();
 			jtag_sleep(cmd->cmd.sleep->us);
 			break;
 		case JTAG_SCAN:
@@ -530,8 +763,14 @@ static int jtag_vpi_execute_queue(void)
 			retval = ERROR_FAIL;
 			break;
 		}
+		if (retval == ERROR_OK && vpi_batch.payload_used > BATCH_MAX_SIZE)
+			retval = jtag_vpi_batch_flush();
 	}
 
+	int flush_retval = jtag_vpi_batch_flush();
+	if (retval == ERROR_OK)
+		retval = flush_retval;
+
 	return retval;
 }
 
@@ -599,6 +838,7 @@ static int jtag_vpi_quit(void)
 		log_socket_error("jtag_vpi");
 	}
 	free(server_address);
+	jtag_vpi_batch_free();
 	return ERROR_OK;
 }
 
@@ -641,6 +881,17 @@ COMMAND_HANDLER(jtag_vpi_stop_sim_on_exit_handler)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(jtag_vpi_batch_handler)
+{
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command \"jtag_vpi batch\" expects 1 argument (on|off)");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	COMMAND_PARSE_ON_OFF(CMD_ARGV[0], batch_mode);
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_vpi_subcommand_handlers[] = {
 	{
 		.name = "set_port",
@@ -664,6 +915,14 @@ static const struct command_registration jtag_vpi_subcommand_handlers[] = {
 			"before OpenOCD exits (default: off)",
 		.usage = "<on|off>",
 	},
+	{
+		.name = "batch",
+		.handler = &jtag_vpi_batch_handler,
+		.mode = COMMAND_CONFIG,
+		.help = "Configure if the whole JTAG queue is sent in one message "
+			"(CMD_BATCH), the server has to support it (default: off)",
+		.usage = "<on|off>",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
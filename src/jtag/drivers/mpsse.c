@@ -62,6 +62,32 @@
 #define SIO_RESET_PURGE_RX 1
 #define SIO_RESET_PURGE_TX 2
 
+/* Context needed by the callbacks */
+struct transfer_result {
+	struct mpsse_inflight *xfer;
+	bool done;
+	unsigned transferred;
+};
+
+/* Command buffer submitted to the device. The next one is filled while this one is in flight. */
+struct mpsse_inflight {
+	bool busy;
+	uint8_t *write_buffer;
+	unsigned write_count;
+	uint8_t *read_buffer;
+	unsigned read_count;
+	uint8_t *read_chunk;
+	struct bit_copy_queue read_queue;
+	struct libusb_transfer *write_transfer;
+	struct libusb_transfer *read_transfer;
+	struct transfer_result write_result;
+	struct transfer_result read_result;
+	/* libusb_submit_transfer() failure, already reported */
+	int retval;
+	/* dropped by mpsse_inflight_cancel(), missing data are expected */
+	bool cancelled;
+};
+
 struct mpsse_ctx {
 	struct libusb_context *usb_ctx;
 	struct libusb_device_handle *usb_dev;
@@ -82,6 +108,7 @@ struct mpsse_ctx {
 	uint8_t *read_chunk;
 	unsigned read_chunk_size;
 	struct bit_copy_queue read_queue;
+	struct mpsse_inflight inflight;
 	int retval;
 };
 
@@ -328,19 +355,24 @@ struct mpsse_ctx *mpsse_open(const uint16_t *vid, const uint16_t *pid, const cha
 		return 0;
 
 	bit_copy_queue_init(&ctx->read_queue);
+	bit_copy_queue_init(&ctx->inflight.read_queue);
 	ctx->read_chunk_size = 16384;
 	ctx->read_size = 16384;
 	ctx->write_size = 16384;
 	ctx->read_chunk = malloc(ctx->read_chunk_size);
 	ctx->read_buffer = malloc(ctx->read_size);
+	ctx->inflight.read_chunk = malloc(ctx->read_chunk_size);
+	ctx->inflight.read_buffer = malloc(ctx->read_size);
 
 	/* Use calloc to make valgrind happy: buffer_write() sets payload
 	 * on bit basis, so some bits can be left uninitialized in write_buffer.
 	 * Although this is perfectly ok with MPSSE, valgrind reports
 	 * Syscall param ioctl(USBDEVFS_SUBMITURB).buffer points to uninitialised byte(s) */
 	ctx->write_buffer = calloc(1, ctx->write_size);
+	ctx->inflight.write_buffer = calloc(1, ctx->write_size);
 
-	if (!ctx->read_chunk || !ctx->read_buffer || !ctx->write_buffer)
+	if (!ctx->read_chunk || !ctx->read_buffer || !ctx->write_buffer ||
+		!ctx->inflight.read_chunk || !ctx->inflight.read_buffer || !ctx->inflight.write_buffer)
 		goto error;
 
 	ctx->interface = channel;
@@ -398,8 +430,11 @@ error:
 	return 0;
 }
 
+static void mpsse_inflight_cancel(struct mpsse_ctx *ctx);
+
 void mpsse_close(struct mpsse_ctx *ctx)
 {
+	mpsse_inflight_cancel(ctx);
 	if (ctx->usb_dev)
 		libusb_close(ctx->usb_dev);
 	if (ctx->usb_ctx)
@@ -409,6 +444,9 @@ void mpsse_close(struct mpsse_ctx *ctx)
 	free(ctx->write_buffer);
 	free(ctx->read_buffer);
 	free(ctx->read_chunk);
+	free(ctx->inflight.write_buffer);
+	free(ctx->inflight.read_buffer);
+	free(ctx->inflight.read_chunk);
 	free(ctx);
 }
 
@@ -421,6 +459,7 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 {
 	int err;
 	LOG_DEBUG("-");
+	mpsse_inflight_cancel(ctx);
 	ctx->write_count = 0;
 	ctx->read_count = 0;
 	ctx->retval = ERROR_OK;
@@ -440,6 +479,8 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 	}
 }
 
+static int mpsse_flush_async(struct mpsse_ctx *ctx);
+
 static unsigned buffer_write_space(struct mpsse_ctx *ctx)
 {
 	/* Reserve one byte for SEND_IMMEDIATE */
@@ -512,7 +553,7 @@ void mpsse_clock_data(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_of
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) + (length < 8) < (out || (!out && !in) ? 4 : 3)
 				|| (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			ctx->retval = mpsse_flush_async(ctx);
 
 		if (length < 8) {
 			/* Transfer remaining bits in bit mode */
@@ -586,7 +627,7 @@ void mpsse_clock_tms_cs(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_
 	while (length > 0) {
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) < 3 || (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			ctx->retval = mpsse_flush_async(ctx);
 
 		/* Byte transfer */
 		unsigned this_bits = length;
@@ -629,7 +670,7 @@ void mpsse_set_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t d
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_async(ctx);
 
 	buffer_write_byte(ctx, 0x80);
 	buffer_write_byte(ctx, data);
@@ -646,7 +687,7 @@ void mpsse_set_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_async(ctx);
 
 	buffer_write_byte(ctx, 0x82);
 	buffer_write_byte(ctx, data);
@@ -663,7 +704,7 @@ void mpsse_read_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_async(ctx);
 
 	buffer_write_byte(ctx, 0x81);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -679,7 +720,7 @@ void mpsse_read_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_async(ctx);
 
 	buffer_write_byte(ctx, 0x83);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -694,7 +735,7 @@ static void single_byte_boolean_helper(struct mpsse_ctx *ctx, bool var, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_async(ctx);
 
 	buffer_write_byte(ctx, var ? val_if_true : val_if_false);
 }
@@ -715,7 +756,7 @@ void mpsse_set_divisor(struct mpsse_ctx *ctx, uint16_t divisor)
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_async(ctx);
 
 	buffer_write_byte(ctx, 0x86);
 	buffer_write_byte(ctx, divisor & 0xff);
@@ -775,17 +816,12 @@ int mpsse_set_frequency(struct mpsse_ctx *ctx, int frequency)
 	return frequency;
 }
 
-/* Context needed by the callbacks */
-struct transfer_result {
-	struct mpsse_ctx *ctx;
-	bool done;
-	unsigned transferred;
-};
 
 static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 {
 	struct transfer_result *res = transfer->user_data;
-	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_inflight *xfer = res->xfer;
+	struct mpsse_ctx *ctx = container_of(xfer, struct mpsse_ctx, inflight);
 
 	unsigned packet_size = ctx->max_packet_size;
 
@@ -799,97 +835,62 @@ static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 		unsigned this_size = packet_size - 2;
 		if (this_size > chunk_remains - 2)
 			this_size = chunk_remains - 2;
-		if (this_size > ctx->read_count - res->transferred)
-			this_size = ctx->read_count - res->transferred;
-		memcpy(ctx->read_buffer + res->transferred,
-			ctx->read_chunk + packet_size * i + 2,
+		if (this_size > xfer->read_count - res->transferred)
+			this_size = xfer->read_count - res->transferred;
+		memcpy(xfer->read_buffer + res->transferred,
+			xfer->read_chunk + packet_size * i + 2,
 			this_size);
 		res->transferred += this_size;
 		chunk_remains -= this_size + 2;
-		if (res->transferred == ctx->read_count) {
+		if (res->transferred == xfer->read_count) {
 			res->done = true;
 			break;
 		}
 	}
 
 	LOG_DEBUG_IO("raw chunk %d, transferred %d of %d", transfer->actual_length, res->transferred,
-		ctx->read_count);
+		xfer->read_count);
 
 	if (!res->done)
-		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
+		if (transfer->status == LIBUSB_TRANSFER_CANCELLED ||
+			libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
 			res->done = true;
 }
 
 static LIBUSB_CALL void write_cb(struct libusb_transfer *transfer)
 {
 	struct transfer_result *res = transfer->user_data;
-	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_inflight *xfer = res->xfer;
 
 	res->transferred += transfer->actual_length;
 
-	LOG_DEBUG_IO("transferred %d of %d", res->transferred, ctx->write_count);
+	LOG_DEBUG_IO("transferred %d of %d", res->transferred, xfer->write_count);
 
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
-	if (res->transferred == ctx->write_count)
+	if (res->transferred == xfer->write_count || transfer->status == LIBUSB_TRANSFER_CANCELLED)
 		res->done = true;
 	else {
-		transfer->length = ctx->write_count - res->transferred;
-		transfer->buffer = ctx->write_buffer + res->transferred;
+		transfer->length = xfer->write_count - res->transferred;
+		transfer->buffer = xfer->write_buffer + res->transferred;
 		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
 			res->done = true;
 	}
 }
 
-int mpsse_flush(struct mpsse_ctx *ctx)
+/* Waits for the buffer in flight to complete and scatters its read data to the destinations */
+static int mpsse_inflight_wait(struct mpsse_ctx *ctx)
 {
-	int retval = ctx->retval;
-
-	if (retval != ERROR_OK) {
-		LOG_DEBUG_IO("Ignoring flush due to previous error");
-		assert(ctx->write_count == 0 && ctx->read_count == 0);
-		ctx->retval = ERROR_OK;
-		return retval;
-	}
-
-	LOG_DEBUG_IO("write %d%s, read %d", ctx->write_count, ctx->read_count ? "+1" : "",
-			ctx->read_count);
-	assert(ctx->write_count > 0 || ctx->read_count == 0); /* No read data without write data */
+	struct mpsse_inflight *xfer = &ctx->inflight;
+	int retval = LIBUSB_SUCCESS;
 
-	if (ctx->write_count == 0)
-		return retval;
-
-	struct libusb_transfer *read_transfer = 0;
-	struct transfer_result read_result = { .ctx = ctx, .done = true };
-	if (ctx->read_count) {
-		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
-		read_result.done = false;
-		/* delay read transaction to ensure the FTDI chip can support us with data
-		   immediately after processing the MPSSE commands in the write transaction */
-	}
-
-	struct transfer_result write_result = { .ctx = ctx, .done = false };
-	struct libusb_transfer *write_transfer = libusb_alloc_transfer(0);
-	libusb_fill_bulk_transfer(write_transfer, ctx->usb_dev, ctx->out_ep, ctx->write_buffer,
-		ctx->write_count, write_cb, &write_result, ctx->usb_write_timeout);
-	retval = libusb_submit_transfer(write_transfer);
-	if (retval != LIBUSB_SUCCESS)
-		goto error_check;
-
-	if (ctx->read_count) {
-		read_transfer = libusb_alloc_transfer(0);
-		libusb_fill_bulk_transfer(read_transfer, ctx->usb_dev, ctx->in_ep, ctx->read_chunk,
-			ctx->read_chunk_size, read_cb, &read_result,
-			ctx->usb_read_timeout);
-		retval = libusb_submit_transfer(read_transfer);
-		if (retval != LIBUSB_SUCCESS)
-			goto error_check;
-	}
+	if (!xfer->busy)
+		return ERROR_OK;
 
 	/* Polling loop, more or less taken from libftdi */
 	int64_t start = timeval_ms();
 	int64_t warn_after = 2000;
-	while (!write_result.done || !read_result.done) {
+	while (retval == LIBUSB_SUCCESS && (!xfer->write_result.done || !xfer->read_result.done)) {
 		struct timeval timeout_usb;
 
 		timeout_usb.tv_sec = 1;
@@ -901,10 +902,10 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 			break;
 
 		if (retval != LIBUSB_SUCCESS) {
-			libusb_cancel_transfer(write_transfer);
-			if (read_transfer)
-				libusb_cancel_transfer(read_transfer);
-			while (!write_result.done || !read_result.done) {
+			libusb_cancel_transfer(xfer->write_transfer);
+			if (xfer->read_transfer)
+				libusb_cancel_transfer(xfer->read_transfer);
+			while (!xfer->write_result.done || !xfer->read_result.done) {
 				retval = libusb_handle_events_timeout_completed(ctx->usb_ctx,
 								&timeout_usb, NULL);
 				if (retval != LIBUSB_SUCCESS)
@@ -920,37 +921,153 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 		}
 	}
 
-error_check:
 	if (retval != LIBUSB_SUCCESS) {
 		LOG_ERROR("libusb_handle_events() failed with %s", libusb_error_name(retval));
 		retval = ERROR_FAIL;
-	} else if (write_result.transferred < ctx->write_count) {
+	} else if (xfer->retval != LIBUSB_SUCCESS || xfer->cancelled) {
+		retval = ERROR_FAIL;
+	} else if (xfer->write_result.transferred < xfer->write_count) {
 		LOG_ERROR("ftdi device did not accept all data: %d, tried %d",
-			write_result.transferred,
-			ctx->write_count);
+			xfer->write_result.transferred,
+			xfer->write_count);
 		retval = ERROR_FAIL;
-	} else if (read_result.transferred < ctx->read_count) {
+	} else if (xfer->read_result.transferred < xfer->read_count) {
 		LOG_ERROR("ftdi device did not return all data: %d, expected %d",
-			read_result.transferred,
-			ctx->read_count);
+			xfer->read_result.transferred,
+			xfer->read_count);
 		retval = ERROR_FAIL;
-	} else if (ctx->read_count) {
-		ctx->write_count = 0;
-		ctx->read_count = 0;
-		bit_copy_execute(&ctx->read_queue);
-		retval = ERROR_OK;
 	} else {
-		ctx->write_count = 0;
-		bit_copy_discard(&ctx->read_queue);
+		bit_copy_execute(&xfer->read_queue);
 		retval = ERROR_OK;
 	}
 
-	if (retval != ERROR_OK)
+	bit_copy_discard(&xfer->read_queue);
+	libusb_free_transfer(xfer->write_transfer);
+	if (xfer->read_transfer)
+		libusb_free_transfer(xfer->read_transfer);
+	xfer->write_transfer = NULL;
+	xfer->read_transfer = NULL;
+	xfer->busy = false;
+
+	return retval;
+}
+
+/* Drops the buffer in flight, used on errors and when closing the device */
+static void mpsse_inflight_cancel(struct mpsse_ctx *ctx)
+{
+	struct mpsse_inflight *xfer = &ctx->inflight;
+
+	if (!xfer->busy)
+		return;
+	if (!xfer->write_result.done)
+		libusb_cancel_transfer(xfer->write_transfer);
+	if (!xfer->read_result.done)
+		libusb_cancel_transfer(xfer->read_transfer);
+	/* read data of the cancelled buffer must not be delivered */
+	bit_copy_discard(&xfer->read_queue);
+	xfer->cancelled = true;
+	mpsse_inflight_wait(ctx);
+}
+
+/* Hands the current buffer over to the device and returns without waiting for its completion.
+ * The buffer previously in flight is completed first, so at most one buffer is submitted
+ * at any time and read data are always scattered in order. */
+static int mpsse_submit(struct mpsse_ctx *ctx)
+{
+	struct mpsse_inflight *xfer = &ctx->inflight;
+	int retval = mpsse_inflight_wait(ctx);
+
+	if (retval != ERROR_OK) {
 		mpsse_purge(ctx);
+		return retval;
+	}
 
-	libusb_free_transfer(write_transfer);
-	if (read_transfer)
-		libusb_free_transfer(read_transfer);
+	LOG_DEBUG_IO("write %d%s, read %d", ctx->write_count, ctx->read_count ? "+1" : "",
+			ctx->read_count);
+	assert(ctx->write_count > 0 || ctx->read_count == 0); /* No read data without write data */
+
+	if (ctx->write_count == 0)
+		return ERROR_OK;
+
+	if (ctx->read_count)
+		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
+
+	/* Swap the buffers, so the current one can be filled while this one is in flight */
+	uint8_t *tmp = xfer->write_buffer;
+	xfer->write_buffer = ctx->write_buffer;
+	ctx->write_buffer = tmp;
+	tmp = xfer->read_buffer;
+	xfer->read_buffer = ctx->read_buffer;
+	ctx->read_buffer = tmp;
+	tmp = xfer->read_chunk;
+	xfer->read_chunk = ctx->read_chunk;
+	ctx->read_chunk = tmp;
+	list_splice_init(&ctx->read_queue.list, &xfer->read_queue.list);
+	xfer->write_count = ctx->write_count;
+	xfer->read_count = ctx->read_count;
+	ctx->write_count = 0;
+	ctx->read_count = 0;
+
+	xfer->busy = true;
+	xfer->cancelled = false;
+	xfer->write_result = (struct transfer_result){ .xfer = xfer, .done = false };
+	xfer->read_result = (struct transfer_result){ .xfer = xfer, .done = xfer->read_count == 0 };
+	xfer->write_transfer = libusb_alloc_transfer(0);
+	libusb_fill_bulk_transfer(xfer->write_transfer, ctx->usb_dev, ctx->out_ep, xfer->write_buffer,
+		xfer->write_count, write_cb, &xfer->write_result, ctx->usb_write_timeout);
+	xfer->retval = libusb_submit_transfer(xfer->write_transfer);
+	if (xfer->retval != LIBUSB_SUCCESS) {
+		/* failed by mpsse_inflight_wait() */
+		LOG_ERROR("libusb_submit_transfer() failed with %s", libusb_error_name(xfer->retval));
+		xfer->write_result.done = true;
+		xfer->read_result.done = true;
+		return ERROR_OK;
+	}
+
+	if (xfer->read_count) {
+		/* delay read transaction to ensure the FTDI chip can support us with data
+		   immediately after processing the MPSSE commands in the write transaction */
+		xfer->read_transfer = libusb_alloc_transfer(0);
+		libusb_fill_bulk_transfer(xfer->read_transfer, ctx->usb_dev, ctx->in_ep, xfer->read_chunk,
+			ctx->read_chunk_size, read_cb, &xfer->read_result,
+			ctx->usb_read_timeout);
+		xfer->retval = libusb_submit_transfer(xfer->read_transfer);
+		if (xfer->retval != LIBUSB_SUCCESS) {
+			/* the write is in flight, so it is waited for and failed by mpsse_inflight_wait() */
+			LOG_ERROR("libusb_submit_transfer() failed with %s", libusb_error_name(xfer->retval));
+			xfer->read_result.done = true;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+/* Used when the command buffer is full: the device executes it while the next one is filled */
+static int mpsse_flush_async(struct mpsse_ctx *ctx)
+{
+	int retval = ctx->retval;
+
+	if (retval != ERROR_OK) {
+		LOG_DEBUG_IO("Ignoring flush due to previous error");
+		assert(ctx->write_count == 0 && ctx->read_count == 0);
+		ctx->retval = ERROR_OK;
+		return retval;
+	}
+
+	return mpsse_submit(ctx);
+}
+
+int mpsse_flush(struct mpsse_ctx *ctx)
+{
+	int retval = mpsse_flush_async(ctx);
+	if (retval != ERROR_OK) {
+		mpsse_inflight_cancel(ctx);
+		return retval;
+	}
+
+	retval = mpsse_inflight_wait(ctx);
+	if (retval != ERROR_OK)
+		mpsse_purge(ctx);
 
 	return retval;
 }
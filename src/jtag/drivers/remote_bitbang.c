@@ -33,8 +33,14 @@
 /* arbitrary limit on host name length: */
 #define REMOTE_BITBANG_HOST_MAX 255
 
+/* Bits per 'J'/'K' message, a message has to fit in the send buffer */
+#define REMOTE_BITBANG_RUN_MAX_BITS 1024
+/* Number of 'K' messages sent before reading back their TDO data */
+#define REMOTE_BITBANG_RUN_MAX_PENDING 8
+
 static char *remote_bitbang_host;
 static char *remote_bitbang_port;
+static bool remote_bitbang_use_bit_runs;
 
 static int remote_bitbang_fd;
 static uint8_t remote_bitbang_send_buf[512];
@@ -159,6 +165,36 @@ static int remote_bitbang_queue(int c, flush_bool_t flush)
 	return ERROR_OK;
 }
 
+static int remote_bitbang_queue_buf(const uint8_t *buf, unsigned int len)
+{
+	if (remote_bitbang_send_buf_used + len > ARRAY_SIZE(remote_bitbang_send_buf)) {
+		if (remote_bitbang_flush() != ERROR_OK)
+			return ERROR_FAIL;
+	}
+	memcpy(remote_bitbang_send_buf + remote_bitbang_send_buf_used, buf, len);
+	remote_bitbang_send_buf_used += len;
+	return ERROR_OK;
+}
+
+/* Reads len bytes of raw response data, blocking until all of them arrive */
+static int remote_bitbang_read_buf(uint8_t *buf, unsigned int len)
+{
+	for (unsigned int i = 0; i < len; i++) {
+		if (remote_bitbang_recv_buf_empty()) {
+			if (remote_bitbang_fill_buf(BLOCK) != ERROR_OK)
+				return ERROR_FAIL;
+			if (remote_bitbang_recv_buf_empty()) {
+				LOG_ERROR("remote_bitbang: connection closed");
+				return ERROR_FAIL;
+			}
+		}
+		buf[i] = remote_bitbang_recv_buf[remote_bitbang_recv_buf_start];
+		remote_bitbang_recv_buf_start =
+			(remote_bitbang_recv_buf_start + 1) % sizeof(remote_bitbang_recv_buf);
+	}
+	return ERROR_OK;
+}
+
 static int remote_bitbang_quit(void)
 {
 	if (remote_bitbang_queue('Q', FLUSH_SEND_BUF) == ERROR_FAIL)
@@ -217,6 +253,55 @@ static int remote_bitbang_write(int tck, int tms, int tdi)
 	return remote_bitbang_queue(c, NO_FLUSH);
 }
 
+/* Sends the run in 'J' (no TDO) or 'K' (TDO returned) messages of up to
+ * REMOTE_BITBANG_RUN_MAX_BITS bits: 16-bit little endian bit count followed
+ * by packed TMS and TDI bits. TDO of several 'K' messages is read back at once. */
+static int remote_bitbang_scan_bits(const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo,
+	unsigned int num_bits)
+{
+	uint8_t msg[3 + 2 * REMOTE_BITBANG_RUN_MAX_BITS / 8];
+	unsigned int pending_start = 0;
+	unsigned int pending = 0;
+
+	for (unsigned int offset = 0; offset < num_bits; offset += REMOTE_BITBANG_RUN_MAX_BITS) {
+		unsigned int bits = MIN(num_bits - offset, REMOTE_BITBANG_RUN_MAX_BITS);
+		unsigned int bytes = DIV_ROUND_UP(bits, 8);
+
+		msg[0] = tdo ? 'K' : 'J';
+		h_u16_to_le(msg + 1, bits);
+		if (tms)
+			memcpy(msg + 3, tms + offset / 8, bytes);
+		else
+			memset(msg + 3, 0, bytes);
+		if (tdi)
+			memcpy(msg + 3 + bytes, tdi + offset / 8, bytes);
+		else
+			memset(msg + 3 + bytes, 0, bytes);
+		if (remote_bitbang_queue_buf(msg, 3 + 2 * bytes) != ERROR_OK)
+			return ERROR_FAIL;
+
+		if (!tdo)
+			continue;
+		if (pending++ == 0)
+			pending_start = offset;
+		if (pending == REMOTE_BITBANG_RUN_MAX_PENDING || offset + bits == num_bits) {
+			/* runs start at byte boundary, so TDO data of all pending messages is contiguous */
+			unsigned int pending_bits = offset + bits - pending_start;
+			unsigned int last = pending_start / 8 + DIV_ROUND_UP(pending_bits, 8) - 1;
+			uint8_t last_byte = tdo[last];
+			if (remote_bitbang_read_buf(tdo + pending_start / 8, DIV_ROUND_UP(pending_bits, 8)) != ERROR_OK)
+				return ERROR_FAIL;
+			/* keep the bits beyond the run untouched */
+			if (pending_bits % 8) {
+				uint8_t mask = 0xff >> (8 - pending_bits % 8);
+				tdo[last] = (tdo[last] & mask) | (last_byte & ~mask);
+			}
+			pending = 0;
+		}
+	}
+	return ERROR_OK;
+}
+
 static int remote_bitbang_reset(int trst, int srst)
 {
 	char c = 'r' + ((trst ? 0x2 : 0x0) | (srst ? 0x1 : 0x0));
@@ -318,6 +403,7 @@ static int remote_bitbang_init_unix(void)
 
 static int remote_bitbang_init(void)
 {
+	remote_bitbang_bitbang.scan_bits = remote_bitbang_use_bit_runs ? &remote_bitbang_scan_bits : NULL;
 	bitbang_interface = &remote_bitbang_bitbang;
 
 	remote_bitbang_recv_buf_start = 0;
@@ -360,6 +446,14 @@ COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_host_command)
 	return ERROR_COMMAND_SYNTAX_ERROR;
 }
 
+COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_bit_runs_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	COMMAND_PARSE_ON_OFF(CMD_ARGV[0], remote_bitbang_use_bit_runs);
+	return ERROR_OK;
+}
+
 static const struct command_registration remote_bitbang_subcommand_handlers[] = {
 	{
 		.name = "port",
@@ -377,6 +471,14 @@ static const struct command_registration remote_bitbang_subcommand_handlers[] =
 			"  if port is 0 or unset, this is the name of the unix socket to use.",
 		.usage = "host_name",
 	},
+	{
+		.name = "bit_runs",
+		.handler = remote_bitbang_handle_remote_bitbang_bit_runs_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Send scans and run-test cycles as packed runs of bits ('J' and 'K' "
+			"requests). The remote process has to support them.",
+		.usage = "('on'|'off')",
+	},
 	COMMAND_REGISTRATION_DONE,
 };
 
@@ -159,6 +159,9 @@ extern struct adapter_driver am335xgpio_adapter_driver;
 #if BUILD_ESP_REMOTE
 extern struct adapter_driver esp_remote_adapter_driver;
 #endif
+#if BUILD_JTAG_REPLAY
+extern struct adapter_driver jtag_replay_adapter_driver;
+#endif
 
 /**
  * The list of built-in JTAG interfaces, containing entries for those
@@ -281,6 +284,9 @@ struct adapter_driver *adapter_drivers[] = {
 #endif
 #if BUILD_ESP_REMOTE
 		&esp_remote_adapter_driver,
+#endif
+#if BUILD_JTAG_REPLAY
+		&jtag_replay_adapter_driver,
 #endif
 		NULL,
 	};
@@ -468,6 +468,45 @@ int jtag_add_statemove(tap_state_t goal_state);
  */
 void jtag_add_runtest(int num_cycles, tap_state_t endstate);
 
+/**
+ * Marks out_value or in_value of a scan field recorded into a scan template
+ * as variable: the actual buffer is supplied every time the template is queued.
+ */
+extern uint8_t jtag_scan_template_var[];
+#define JTAG_SCAN_TEMPLATE_VAR jtag_scan_template_var
+
+/**
+ * A sequence of scans (and run-test cycles) recorded once and queued many times.
+ *
+ * Recording does everything jtag_add_ir_scan() and jtag_add_dr_scan() do to
+ * build the queued commands (bypass fields, copies of constant out values), so
+ * queueing the template costs one allocation and a copy of the commands image,
+ * plus a copy of the variable out values. IR scans are not verified against
+ * the expected capture value. The template is valid as long as the scan chain
+ * configuration does not change.
+ */
+struct jtag_scan_template;
+
+struct jtag_scan_template *jtag_scan_template_new(void);
+void jtag_scan_template_free(struct jtag_scan_template *tmpl);
+int jtag_scan_template_add_ir_scan(struct jtag_scan_template *tmpl, struct jtag_tap *active,
+		const struct scan_field *field, tap_state_t endstate);
+int jtag_scan_template_add_dr_scan(struct jtag_scan_template *tmpl, struct jtag_tap *active,
+		int num_fields, const struct scan_field *fields, tap_state_t endstate);
+int jtag_scan_template_add_runtest(struct jtag_scan_template *tmpl, int num_cycles,
+		tap_state_t endstate);
+/**
+ * Queues the commands recorded in the template.
+ *
+ * @param tmpl The template.
+ * @param out_values Buffers for fields with JTAG_SCAN_TEMPLATE_VAR out_value, in the order
+ *	of recording. NULL entries scan out zeros.
+ * @param in_values Buffers for fields with JTAG_SCAN_TEMPLATE_VAR in_value, in the order
+ *	of recording.
+ */
+void jtag_add_scan_template(const struct jtag_scan_template *tmpl,
+		const uint8_t * const *out_values, uint8_t * const *in_values);
+
 /**
  * A reset of the TAP state machine can be requested.
  *
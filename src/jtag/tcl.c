@@ -37,6 +37,7 @@
 #include "interface.h"
 #include "interfaces.h"
 #include "tcl.h"
+#include "capture.h"
 
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -1237,6 +1238,83 @@ COMMAND_HANDLER(handle_jtag_flush_queue_sleep)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_jtag_queue_stats)
+{
+	static const char * const type_names[] = {
+		[JTAG_SCAN] = "scan",
+		[JTAG_TLR_RESET] = "tlr_reset",
+		[JTAG_RUNTEST] = "runtest",
+		[JTAG_RESET] = "reset",
+		[JTAG_PATHMOVE] = "pathmove",
+		[JTAG_SLEEP] = "sleep",
+		[JTAG_STABLECLOCKS] = "stableclocks",
+		[JTAG_TMS] = "tms",
+	};
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "clear") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		jtag_command_queue_clear_stats();
+		return ERROR_OK;
+	}
+
+	const struct jtag_queue_stats *stats = jtag_command_queue_get_stats();
+	const struct jtag_queue_flush_stats *s[] = { &stats->last, &stats->max, &stats->total };
+	const char *names[] = { "last", "max", "total" };
+	uint64_t flushes = MAX(stats->flushes, 1);
+
+	command_print(CMD, "flushes: %" PRIu64, stats->flushes);
+	command_print(CMD, "%-8s %12s %12s %14s %14s", "", "commands", "fields", "bits", "bytes");
+	for (unsigned int i = 0; i < ARRAY_SIZE(s); i++)
+		command_print(CMD, "%-8s %12" PRIu64 " %12" PRIu64 " %14" PRIu64 " %14" PRIu64,
+			names[i], s[i]->commands, s[i]->fields, s[i]->bits, s[i]->bytes);
+	command_print(CMD, "%-8s %12" PRIu64 " %12" PRIu64 " %14" PRIu64 " %14" PRIu64, "average",
+		stats->total.commands / flushes, stats->total.fields / flushes,
+		stats->total.bits / flushes, stats->total.bytes / flushes);
+	for (unsigned int i = 0; i < ARRAY_SIZE(type_names); i++) {
+		if (type_names[i] && stats->type_commands[i])
+			command_print(CMD, "%s commands: %" PRIu64, type_names[i], stats->type_commands[i]);
+	}
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_jtag_queue_keep_size)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned int kbytes;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], kbytes);
+		jtag_command_queue_set_keep_size((size_t)kbytes * 1024);
+	}
+	command_print(CMD, "%zu KB", jtag_command_queue_get_keep_size() / 1024);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_jtag_capture)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "off") == 0)
+			jtag_capture_stop();
+		else if (jtag_capture_start(CMD_ARGV[0]) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+	if (jtag_capture_is_active())
+		command_print(CMD, "capturing to '%s'", jtag_capture_filename());
+	else
+		command_print(CMD, "off");
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_wait_srst_deassert)
 {
 	if (CMD_ARGC != 1)
@@ -1282,6 +1360,30 @@ static const struct command_registration jtag_command_handlers[] = {
 			"to test performance or change in behavior. Default 0ms.",
 		.usage = "[sleep in ms]",
 	},
+	{
+		.name = "jtag_queue_stats",
+		.handler = handle_jtag_queue_stats,
+		.mode = COMMAND_ANY,
+		.help = "Display number of commands, scan fields, scan bits and bytes of memory "
+			"in the JTAG queue per flush, or clear the counters.",
+		.usage = "['clear']",
+	},
+	{
+		.name = "jtag_queue_keep_size",
+		.handler = handle_jtag_queue_keep_size,
+		.mode = COMMAND_ANY,
+		.help = "Set or display amount of JTAG queue memory kept for reuse after "
+			"the queue is flushed. Default 1024 KB.",
+		.usage = "[kbytes]",
+	},
+	{
+		.name = "jtag_capture",
+		.handler = handle_jtag_capture,
+		.mode = COMMAND_ANY,
+		.help = "Start capturing executed JTAG queues to a binary file, "
+			"stop capturing with 'off' or display the capture state.",
+		.usage = "[filename|'off']",
+	},
 	{
 		.name = "jtag_rclk",
 		.handler = handle_jtag_rclk_command,
@@ -239,16 +239,19 @@ static const struct xtensa_config esp32_xtensa_cfg = {
 				.base = ESP32_EXTRAM_DATA_LOW,
 				.size = ESP32_EXTRAM_DATA_HIGH - ESP32_EXTRAM_DATA_LOW,
 				.access = XT_MEM_ACCESS_READ | XT_MEM_ACCESS_WRITE,
+				.attrs = XT_MEM_ATTR_EXT,
 			},
 			{
 				.base = ESP32_DR_REG_LOW,
 				.size = ESP32_DR_REG_HIGH - ESP32_DR_REG_LOW,
 				.access = XT_MEM_ACCESS_READ | XT_MEM_ACCESS_WRITE,
+				.attrs = XT_MEM_ATTR_IO,
 			},
 			{
 				.base = ESP32_SYS_RAM_LOW,
 				.size = ESP32_SYS_RAM_HIGH - ESP32_SYS_RAM_LOW,
 				.access = XT_MEM_ACCESS_READ | XT_MEM_ACCESS_WRITE,
+				.attrs = XT_MEM_ATTR_IO,
 			},
 		}
 	},
@@ -792,6 +795,7 @@ struct target_type esp32_target = {
 	.write_buffer = xtensa_write_buffer,
 
 	.checksum_memory = xtensa_checksum_memory,
+	.profiling = xtensa_profiling,
 
 	.get_gdb_arch = xtensa_get_gdb_arch,
 	.get_gdb_reg_list = xtensa_get_gdb_reg_list,
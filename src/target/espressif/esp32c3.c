@@ -52,6 +52,15 @@
 #define ESP32C3_GPIO_BASE                       0x60004000
 #define ESP32C3_GPIO_STRAP_REG_OFF              0x0038
 #define ESP32C3_GPIO_STRAP_REG                  (ESP32C3_GPIO_BASE + ESP32C3_GPIO_STRAP_REG_OFF)
+
+#define ESP32C3_ASSIST_DEBUG_BASE               0x600CE000
+#define ESP32C3_ASSIST_DEBUG_RCD_EN_OFF         0x0044
+#define ESP32C3_ASSIST_DEBUG_RCD_PDEBUGPC_OFF   0x0048
+#define ESP32C3_ASSIST_DEBUG_RCD_EN_REG         (ESP32C3_ASSIST_DEBUG_BASE + ESP32C3_ASSIST_DEBUG_RCD_EN_OFF)
+#define ESP32C3_ASSIST_DEBUG_RCD_PDEBUGPC_REG   (ESP32C3_ASSIST_DEBUG_BASE + ESP32C3_ASSIST_DEBUG_RCD_PDEBUGPC_OFF)
+#define ESP32C3_ASSIST_DEBUG_RCD_RECORDEN       BIT(0)
+#define ESP32C3_ASSIST_DEBUG_RCD_PDEBUGEN       BIT(1)
+
 #define IS_1XXX(v)                              (((v) & 0x08) == 0x08)
 #define ESP32C3_IS_FLASH_BOOT(_r_)              IS_1XXX(_r_)
 #define ESP32C3_FLASH_BOOT_MODE                 0x08
@@ -226,6 +235,10 @@ static int esp32c3_init_target(struct command_context *cmd_ctx,
 	if (ret != ERROR_OK)
 		return ret;
 
+	esp32c3->esp_riscv.pc_sample_reg = ESP32C3_ASSIST_DEBUG_RCD_PDEBUGPC_REG;
+	esp32c3->esp_riscv.pc_sample_en_reg = ESP32C3_ASSIST_DEBUG_RCD_EN_REG;
+	esp32c3->esp_riscv.pc_sample_en_mask = ESP32C3_ASSIST_DEBUG_RCD_RECORDEN | ESP32C3_ASSIST_DEBUG_RCD_PDEBUGEN;
+
 	ret = target_register_event_callback(esp32c3_handle_target_event, target);
 	if (ret != ERROR_OK)
 		return ret;
@@ -420,6 +433,8 @@ struct target_type esp32c3_target = {
 
 	.checksum_memory = esp_riscv_checksum_memory,
 
+	.profiling = esp_riscv_profiling,
+
 	.get_gdb_arch = esp_riscv_get_gdb_arch,
 	.get_gdb_reg_list = esp_riscv_get_gdb_reg_list,
 	.get_gdb_reg_list_noread = esp_riscv_get_gdb_reg_list_noread,
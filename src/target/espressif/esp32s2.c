@@ -245,16 +245,19 @@ static const struct xtensa_config esp32s2_xtensa_cfg = {
 				.base = ESP32_S2_EXTRAM_DATA_LOW,
 				.size = ESP32_S2_EXTRAM_DATA_HIGH - ESP32_S2_EXTRAM_DATA_LOW,
 				.access = XT_MEM_ACCESS_READ | XT_MEM_ACCESS_WRITE,
+				.attrs = XT_MEM_ATTR_EXT,
 			},
 			{
 				.base = ESP32_S2_DR_REG_LOW,
 				.size = ESP32_S2_DR_REG_HIGH - ESP32_S2_DR_REG_LOW,
 				.access = XT_MEM_ACCESS_READ | XT_MEM_ACCESS_WRITE,
+				.attrs = XT_MEM_ATTR_IO,
 			},
 			{
 				.base = ESP32_S2_SYS_RAM_LOW,
 				.size = ESP32_S2_SYS_RAM_HIGH - ESP32_S2_SYS_RAM_LOW,
 				.access = XT_MEM_ACCESS_READ | XT_MEM_ACCESS_WRITE,
+				.attrs = XT_MEM_ATTR_IO,
 			},
 		}
 	},
@@ -779,6 +782,7 @@ struct target_type esp32s2_target = {
 	.write_buffer = xtensa_write_buffer,
 
 	.checksum_memory = xtensa_checksum_memory,
+	.profiling = xtensa_profiling,
 
 	.get_gdb_arch = xtensa_get_gdb_arch,
 	.get_gdb_reg_list = xtensa_get_gdb_reg_list,
@@ -197,6 +197,19 @@ static const struct xtensa_user_reg_desc esp32s3_user_regs[ESP32_S3_NUM_REGS - X
 static int esp32s3_fetch_user_regs(struct target *target);
 static int esp32s3_queue_write_dirty_user_regs(struct target *target);
 
+/* External RAM is not in the memory map of the core, only core dumps include it */
+static const struct xtensa_local_mem_config esp32s3_coredump_extram = {
+	.count = 1,
+	.regions = {
+		{
+			.base = ESP32_S3_EXTRAM_DATA_LOW,
+			.size = ESP32_S3_EXTRAM_DATA_HIGH - ESP32_S3_EXTRAM_DATA_LOW,
+			.access = XT_MEM_ACCESS_READ | XT_MEM_ACCESS_WRITE,
+			.attrs = XT_MEM_ATTR_EXT,
+		},
+	}
+};
+
 static const struct xtensa_config esp32s3_xtensa_cfg = {
 	.density = true,
 	.aregs_num = XT_AREGS_NUM_MAX,
@@ -279,6 +292,7 @@ static const struct xtensa_config esp32s3_xtensa_cfg = {
 				.base = ESP32_S3_SYS_RAM_LOW,
 				.size = ESP32_S3_SYS_RAM_HIGH - ESP32_S3_SYS_RAM_LOW,
 				.access = XT_MEM_ACCESS_READ | XT_MEM_ACCESS_WRITE,
+				.attrs = XT_MEM_ATTR_IO,
 			},
 		}
 	},
@@ -675,6 +689,7 @@ static int esp32s3_target_create(struct target *target, Jim_Interp *interp)
 		free(esp32s3);
 		return ret;
 	}
+	esp32s3->esp_xtensa_smp.esp_xtensa.coredump_extram = &esp32s3_coredump_extram;
 
 	/*Assume running target. If different, the first poll will fix this. */
 	target->state = TARGET_RUNNING;
@@ -732,6 +747,7 @@ struct target_type esp32s3_target = {
 	.write_buffer = xtensa_write_buffer,
 
 	.checksum_memory = xtensa_checksum_memory,
+	.profiling = xtensa_profiling,
 
 	.get_gdb_arch = xtensa_get_gdb_arch,
 	.get_gdb_reg_list = xtensa_get_gdb_reg_list,
@@ -26,6 +26,7 @@
 #include <target/target_type.h>
 #include <target/smp.h>
 #include <target/semihosting_common.h>
+#include <helper/time_support.h>
 
 #include "esp_semihosting.h"
 
@@ -545,6 +546,59 @@ int esp_riscv_read_memory(struct target *target, target_addr_t address,
 	return riscv_target.read_memory(target, address, size, count, buffer);
 }
 
+/* Writes 'len' bytes using accesses of 'word_size' only. Just partially written words at the
+ * start and the end are read and patched, aligned words in between are written from 'buffer'. */
+static int esp_riscv_write_memory_aligned(struct target *target, target_addr_t address,
+	uint32_t word_size, uint32_t len, const uint8_t *buffer)
+{
+	target_addr_t start_al = address & ~(target_addr_t)(word_size - 1);
+	target_addr_t end = address + len;
+	target_addr_t end_al = (end + word_size - 1) & ~(target_addr_t)(word_size - 1);
+	uint32_t head_len = 0, tail_len = 0;
+	int ret = ERROR_OK;
+
+	if (len == 0)
+		return ERROR_OK;
+
+	if (address != start_al || end_al - start_al == word_size)
+		head_len = MIN(len, word_size - (address - start_al));
+	if (end != end_al && end_al - word_size >= address + head_len)
+		tail_len = end - (end_al - word_size);
+
+	uint8_t *words = NULL;
+	if (head_len || tail_len) {
+		words = malloc(2 * word_size);
+		if (!words) {
+			LOG_ERROR("Failed to alloc memory for partial words!");
+			return ERROR_FAIL;
+		}
+	}
+	uint8_t *head = words;
+	uint8_t *tail = words + word_size;
+
+	/* read both partial words before writing anything */
+	if (head_len)
+		ret = riscv_target.read_memory(target, start_al, word_size, 1, head);
+	if (ret == ERROR_OK && tail_len)
+		ret = riscv_target.read_memory(target, end_al - word_size, word_size, 1, tail);
+
+	if (ret == ERROR_OK && head_len) {
+		memcpy(head + (address - start_al), buffer, head_len);
+		ret = riscv_target.write_memory(target, start_al, word_size, 1, head);
+	}
+	uint32_t middle_len = len - head_len - tail_len;
+	if (ret == ERROR_OK && middle_len)
+		ret = riscv_target.write_memory(target, address + head_len, word_size,
+			middle_len / word_size, buffer + head_len);
+	if (ret == ERROR_OK && tail_len) {
+		memcpy(tail, buffer + len - tail_len, tail_len);
+		ret = riscv_target.write_memory(target, end_al - word_size, word_size, 1, tail);
+	}
+
+	free(words);
+	return ret;
+}
+
 int esp_riscv_write_memory(struct target *target, target_addr_t address,
 	uint32_t size, uint32_t count, const uint8_t *buffer)
 {
@@ -555,26 +609,7 @@ int esp_riscv_write_memory(struct target *target, target_addr_t address,
 	if (size < sba_access_size) {
 		LOG_DEBUG("Use %d-bit access: size: %d\tcount:%d\tstart address: 0x%08"
 			TARGET_PRIxADDR, sba_access_size * 8, size, count, address);
-		target_addr_t al_addr = address & ~(sba_access_size - 1);
-		uint32_t al_len = (size * count) + address - al_addr;
-		uint32_t al_cnt = (al_len + sba_access_size - 1) & ~(sba_access_size - 1);
-		uint8_t al_buf[al_cnt];
-		int ret = riscv_target.read_memory(target,
-			al_addr,
-			sba_access_size,
-			al_cnt / sba_access_size,
-			al_buf);
-		if (ret == ERROR_OK) {
-			memcpy(&al_buf[address & (sba_access_size - 1)],
-				buffer,
-				size * count);
-			ret = riscv_target.write_memory(target,
-				address,
-				sba_access_size,
-				al_cnt / sba_access_size,
-				al_buf);
-		}
-		return ret;
+		return esp_riscv_write_memory_aligned(target, address, sba_access_size, size * count, buffer);
 	}
 	return riscv_target.write_memory(target, address, size, count, buffer);
 }
@@ -614,11 +649,22 @@ int esp_riscv_deassert_reset(struct target *target)
 	return riscv_target.deassert_reset(target);
 }
 
+/* Generic RISC-V implementation can not be used because esp_riscv_run_algorithm() needs arch_info */
 int esp_riscv_checksum_memory(struct target *target,
 	target_addr_t address, uint32_t count,
 	uint32_t *checksum)
 {
-	return riscv_target.checksum_memory(target, address, count, checksum);
+	struct esp_riscv_algorithm *ainfo = calloc(1, sizeof(struct esp_riscv_algorithm));
+	if (!ainfo) {
+		LOG_ERROR("Failed to alloc memory for algorithm info!");
+		return ERROR_FAIL;
+	}
+	/* backup all regs */
+	ainfo->max_saved_reg = GDB_REGNO_COUNT - 1;
+
+	int retval = riscv_run_checksum_algorithm(target, address, count, checksum, ainfo);
+	free(ainfo);
+	return retval;
 }
 
 int esp_riscv_get_gdb_reg_list_noread(struct target *target,
@@ -661,6 +707,89 @@ int esp_riscv_hit_watchpoint(struct target *target, struct watchpoint **hit_watc
 	return riscv_target.hit_watchpoint(target, hit_watchpoint);
 }
 
+/* Samples the PC through the chip's PC recording register using non-incrementing system bus reads,
+ * so the core keeps running. Every read takes one DMI batch of samples, plus the few JTAG queue
+ * executions needed to set up the system bus and check its status. */
+int esp_riscv_profiling(struct target *target, uint32_t *samples,
+	uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+{
+	struct esp_riscv_common *esp_riscv = target_to_esp_riscv(target);
+	struct timeval timeout, now;
+	uint32_t sample_count = 0;
+	uint32_t en_reg_val;
+	RISCV_INFO(r);
+
+	if (esp_riscv->pc_sample_reg == 0 || !r->read_memory) {
+		LOG_TARGET_INFO(target, "PC sampling not supported on this chip.");
+		return target_profiling_default(target, samples, max_num_samples, num_samples, seconds);
+	}
+
+	int res = target_read_u32(target, esp_riscv->pc_sample_en_reg, &en_reg_val);
+	if (res != ERROR_OK) {
+		LOG_TARGET_ERROR(target, "Failed to read PC recording config (%d)!", res);
+		return res;
+	}
+	res = target_write_u32(target, esp_riscv->pc_sample_en_reg, en_reg_val | esp_riscv->pc_sample_en_mask);
+	if (res != ERROR_OK) {
+		LOG_TARGET_ERROR(target, "Failed to enable PC recording (%d)!", res);
+		return res;
+	}
+
+	/* Make sure the target is running */
+	res = target_poll(target);
+	if (res == ERROR_OK && target->state == TARGET_HALTED)
+		res = target_resume(target, 1, 0, 0, 0);
+	if (res != ERROR_OK) {
+		LOG_TARGET_ERROR(target, "Error while resuming target");
+		goto _restore;
+	}
+
+	gettimeofday(&timeout, NULL);
+	timeval_add_time(&timeout, seconds, 0);
+
+	LOG_TARGET_INFO(target, "Starting RISC-V profiling. Sampling PC as fast as we can...");
+
+	while (sample_count < max_num_samples) {
+		/* Stop if the core has been halted e.g. by breakpoint */
+		if (esp_riscv_core_is_halted(target)) {
+			LOG_TARGET_INFO(target, "Core halted, profiling stopped.");
+			break;
+		}
+
+		/* The batch size of the debug module changes with the busy delays */
+		uint32_t batch_size = r->sba_read_batch_words ?
+			r->sba_read_batch_words(target) : ESP_RISCV_PROFILING_BATCH_SIZE;
+		if (batch_size > max_num_samples - sample_count)
+			batch_size = max_num_samples - sample_count;
+		uint8_t *buf = (uint8_t *)&samples[sample_count];
+		res = riscv_select_current_hart(target);
+		if (res == ERROR_OK)
+			res = r->read_memory(target, esp_riscv->pc_sample_reg, 4, batch_size, buf, 0);
+		if (res != ERROR_OK) {
+			LOG_TARGET_ERROR(target, "Error while sampling PC (%d)!", res);
+			break;
+		}
+		for (uint32_t i = 0; i < batch_size; i++)
+			samples[sample_count + i] = target_buffer_get_u32(target, buf + 4 * i);
+		sample_count += batch_size;
+
+		gettimeofday(&now, NULL);
+		if (timeval_compare(&now, &timeout) > 0)
+			break;
+	}
+	LOG_TARGET_INFO(target, "Profiling completed. %" PRIu32 " samples.", sample_count);
+
+_restore:
+	*num_samples = sample_count;
+	int ret = target_write_u32(target, esp_riscv->pc_sample_en_reg, en_reg_val);
+	if (ret != ERROR_OK) {
+		LOG_TARGET_ERROR(target, "Failed to restore PC recording config (%d)!", ret);
+		if (res == ERROR_OK)
+			res = ret;
+	}
+	return res;
+}
+
 unsigned int esp_riscv_address_bits(struct target *target)
 {
 	return riscv_target.address_bits(target);
@@ -30,6 +30,7 @@
 #define set_field(reg, mask, val) (((reg) & ~(mask)) | (((val) * ((mask) & ~((mask) << 1))) & (mask)))
 #define ESP_RISCV_TARGET_BP_NUM         8
 #define ESP_RISCV_TARGET_WP_NUM         8
+#define ESP_RISCV_PROFILING_BATCH_SIZE  1024
 
 struct esp_riscv_common {
 	/* should be first, will be accessed by riscv generic code */
@@ -40,6 +41,10 @@ struct esp_riscv_common {
 	struct esp_semihost_ops *semi_ops;
 	target_addr_t target_bp_addr[ESP_RISCV_TARGET_BP_NUM];
 	target_addr_t target_wp_addr[ESP_RISCV_TARGET_WP_NUM];
+	/* PC recording register used by profiler, 0 if not available */
+	target_addr_t pc_sample_reg;
+	target_addr_t pc_sample_en_reg;
+	uint32_t pc_sample_en_mask;
 };
 
 static inline struct esp_riscv_common *target_to_esp_riscv(const struct target *target)
@@ -101,6 +106,8 @@ int esp_riscv_deassert_reset(struct target *target);
 int esp_riscv_checksum_memory(struct target *target,
 	target_addr_t address, uint32_t count,
 	uint32_t *checksum);
+int esp_riscv_profiling(struct target *target, uint32_t *samples,
+	uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds);
 int esp_riscv_get_gdb_reg_list_noread(struct target *target,
 	struct reg **reg_list[], int *reg_list_size,
 	enum target_register_class reg_class);
@@ -147,6 +147,55 @@ int esp_riscv_apptrace_data_len_read(struct target *target,
 	return esp_riscv_apptrace_ctrl_reg_read(target, block_id, len, NULL);
 }
 
+/* Reads the block and ACKs it in one JTAG queue.
+ * Returns ERROR_NOT_IMPLEMENTED when the block has to be read and ACKed separately. */
+static int esp_riscv_apptrace_data_read_ack(struct target *target,
+	uint32_t size,
+	uint8_t *buffer,
+	uint32_t block_id)
+{
+	struct esp_riscv_common *esp_riscv = target_to_esp_riscv(target);
+	int blk_idx = block_id % 2 ? 0 : 1;
+	uint32_t ctrl = RISCV_APPTRACE_HOST_CONNECT | RISCV_APPTRACE_BLOCK_ID(block_id) |
+		RISCV_APPTRACE_BLOCK_LEN(0);
+	uint32_t words = DIV_ROUND_UP(size, 4);
+	uint8_t *data = buffer;
+	uint32_t readback;
+
+	if (size % 4) {
+		data = malloc(words * 4);
+		if (!data) {
+			LOG_ERROR("Failed to alloc memory for trace block!");
+			return ERROR_FAIL;
+		}
+	}
+	int res = esp_riscv->riscv.sba_read_write_u32(target,
+		esp_riscv->apptrace.mem_blocks[blk_idx].start,
+		words,
+		data,
+		esp_riscv->apptrace.ctrl_addr,
+		ctrl,
+		&readback);
+	/* The readback is not kept for the next poll. It is taken right after the ACK, before the
+	 * target has filled the other block, so it would always report no data. */
+	if (res != ERROR_OK && res != ERROR_NOT_IMPLEMENTED) {
+		/* The ACK is written only after the whole block was read. If the target
+		 * got it, the block is in the buffer, otherwise it has to be read again. */
+		res = target_read_u32(target, esp_riscv->apptrace.ctrl_addr, &readback);
+		if (res == ERROR_OK && RISCV_APPTRACE_BLOCK_ID_GET(readback) == block_id &&
+			RISCV_APPTRACE_BLOCK_LEN_GET(readback) != 0) {
+			LOG_DEBUG("Failed to read and ACK block %d at once, retry", block_id);
+			res = ERROR_NOT_IMPLEMENTED;
+		}
+	}
+	if (data != buffer) {
+		if (res == ERROR_OK)
+			memcpy(buffer, data, size);
+		free(data);
+	}
+	return res;
+}
+
 int esp_riscv_apptrace_data_read(struct target *target,
 	uint32_t size,
 	uint8_t *buffer,
@@ -156,6 +205,13 @@ int esp_riscv_apptrace_data_read(struct target *target,
 	struct esp_riscv_common *esp_riscv = target_to_esp_riscv(target);
 	int blk_idx = block_id % 2 ? 0 : 1;
 
+	if (ack && esp_riscv->riscv.sba_read_write_u32) {
+		int res = esp_riscv_apptrace_data_read_ack(target, size, buffer, block_id);
+		/* ERROR_NOT_IMPLEMENTED: not supported or not done, use separate accesses */
+		if (res != ERROR_NOT_IMPLEMENTED)
+			return res;
+	}
+
 	int res = target_read_buffer(target,
 		esp_riscv->apptrace.mem_blocks[blk_idx].start,
 		size,
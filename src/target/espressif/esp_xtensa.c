@@ -25,9 +25,11 @@
 #include <stdint.h>
 #include <target/smp.h>
 #include <target/xtensa/xtensa_algorithm.h>
+#include <target/xtensa/xtensa_perfmon.h>
 #include "esp_xtensa.h"
 #include "esp_xtensa_apptrace.h"
 #include "esp_xtensa_semihosting.h"
+#include "esp_xtensa_coredump.h"
 #include <target/register.h>
 
 #define ESP_XTENSA_DBGSTUBS_UPDATE_DATA_ENTRY(_e_) \
@@ -104,6 +106,39 @@ int esp_xtensa_handle_target_event(struct target *target, enum target_event even
 	return ERROR_OK;
 }
 
+static int esp_xtensa_perfmon_sink_open(const char *dest, void **priv)
+{
+	struct esp32_apptrace_dest *apptrace_dest = calloc(1, sizeof(*apptrace_dest));
+	if (!apptrace_dest)
+		return ERROR_FAIL;
+	if (esp32_apptrace_dest_init(apptrace_dest, &dest, 1) != 1) {
+		free(apptrace_dest);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	*priv = apptrace_dest;
+	return ERROR_OK;
+}
+
+static int esp_xtensa_perfmon_sink_write(void *priv, const uint8_t *data, uint32_t size)
+{
+	struct esp32_apptrace_dest *apptrace_dest = priv;
+
+	return apptrace_dest->write(apptrace_dest->priv, (uint8_t *)data, size);
+}
+
+static void esp_xtensa_perfmon_sink_close(void *priv)
+{
+	esp32_apptrace_dest_cleanup(priv, 1);
+	free(priv);
+}
+
+/* Performance counters samples go to apptrace destinations: file:// or tcp:// */
+static const struct xtensa_perfmon_sink esp_xtensa_perfmon_sink = {
+	.open = esp_xtensa_perfmon_sink_open,
+	.write = esp_xtensa_perfmon_sink_write,
+	.close = esp_xtensa_perfmon_sink_close,
+};
+
 int esp_xtensa_init_arch_info(struct target *target,
 	struct esp_xtensa_common *esp_xtensa,
 	const struct xtensa_config *xtensa_cfg,
@@ -119,6 +154,7 @@ int esp_xtensa_init_arch_info(struct target *target,
 		return ret;
 	esp_xtensa->semihost.ops = (struct esp_semihost_ops *)semihost_ops;
 	esp_xtensa->apptrace.hw = &esp_xtensa_apptrace_hw;
+	esp_xtensa->xtensa.perfmon_sink = &esp_xtensa_perfmon_sink;
 	return ERROR_OK;
 }
 
@@ -263,5 +299,8 @@ const struct command_registration esp_command_handlers[] = {
 			"DEPRECATED! use arm semihosting_basedir",
 		.usage = "dir",
 	},
+	{
+		.chain = esp_xtensa_coredump_command_handlers,
+	},
 	COMMAND_REGISTRATION_DONE
 };
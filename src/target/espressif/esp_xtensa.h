@@ -32,6 +32,8 @@ struct esp_xtensa_common {
 	struct esp_common esp;
 	struct esp_semihost_data semihost;
 	struct esp_xtensa_apptrace_info apptrace;
+	/* External RAM dumped by 'esp coredump' in addition to the core's data memory, may be NULL */
+	const struct xtensa_local_mem_config *coredump_extram;
 };
 
 static inline struct esp_xtensa_common *target_to_esp_xtensa(struct target *target)
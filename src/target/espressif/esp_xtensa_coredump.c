@@ -0,0 +1,454 @@
+/***************************************************************************
+ *   ELF core dump of halted Espressif Xtensa target                       *
+ *   Copyright (C) 2022 Espressif Systems Ltd.                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/fileio.h>
+#include <helper/time_support.h>
+#include <rtos/rtos.h>
+#include <target/register.h>
+#include <target/smp.h>
+#include <target/xtensa/xtensa.h>
+#include "esp_xtensa.h"
+#include "esp_xtensa_coredump.h"
+
+/* Core file is written in the format produced by ESP-IDF core dump component, so it can be loaded by
+ * xtensa GDB and espcoredump.py. All ELF structures are serialized manually because <elf.h> is optional. */
+#define ESP_COREDUMP_EHDR_SZ            52
+#define ESP_COREDUMP_PHDR_SZ            32
+#define ESP_COREDUMP_ET_CORE            4
+#define ESP_COREDUMP_EM_XTENSA          94
+#define ESP_COREDUMP_PT_LOAD            1
+#define ESP_COREDUMP_PT_NOTE            4
+#define ESP_COREDUMP_PF_X               0x1
+#define ESP_COREDUMP_PF_W               0x2
+#define ESP_COREDUMP_PF_R               0x4
+#define ESP_COREDUMP_NT_PRSTATUS        1
+#define ESP_COREDUMP_SIGTRAP            5
+
+/* elf_prstatus: header (signal info, pids and times), xtensa_elf_gregset_t and pr_fpvalid */
+#define ESP_COREDUMP_PRSTATUS_HDR_SZ    72
+#define ESP_COREDUMP_PRSTATUS_CURSIG    12
+#define ESP_COREDUMP_PRSTATUS_PID       24
+#define ESP_COREDUMP_GREGS_NUM          128
+#define ESP_COREDUMP_PRSTATUS_SZ        (ESP_COREDUMP_PRSTATUS_HDR_SZ + ESP_COREDUMP_GREGS_NUM * 4 + 4)
+/* note header (namesz, descsz, type) and "CORE" name padded to 4 bytes */
+#define ESP_COREDUMP_NOTE_SZ            (12 + 8 + ESP_COREDUMP_PRSTATUS_SZ)
+
+/* xtensa_elf_gregset_t layout */
+#define ESP_COREDUMP_GREG_PC            0
+#define ESP_COREDUMP_GREG_PS            1
+#define ESP_COREDUMP_GREG_LBEG          2
+#define ESP_COREDUMP_GREG_LEND          3
+#define ESP_COREDUMP_GREG_LCOUNT        4
+#define ESP_COREDUMP_GREG_SAR           5
+#define ESP_COREDUMP_GREG_WINDOWSTART   6
+#define ESP_COREDUMP_GREG_WINDOWBASE    7
+#define ESP_COREDUMP_GREG_THREADPTR     8
+#define ESP_COREDUMP_GREG_AR0           64
+
+#define ESP_COREDUMP_REGIONS_MAX        (2 * XT_LOCAL_MEM_REGIONS_NUM_MAX)
+/* Chunk size is a trade-off between memory usage and overhead of JTAG queue flushes */
+#define ESP_COREDUMP_CHUNK_SZ           (256 * 1024)
+
+struct esp_coredump_region {
+	uint32_t base;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t offset;
+	/* number of bytes which were actually read from target */
+	uint32_t filesz;
+};
+
+struct esp_coredump {
+	struct esp_coredump_region regions[ESP_COREDUMP_REGIONS_MAX];
+	unsigned int regions_num;
+	uint8_t *notes;
+	unsigned int notes_num;
+	unsigned int notes_max;
+};
+
+static int esp_coredump_greg_idx(enum xtensa_reg_id reg_idx)
+{
+	switch (reg_idx) {
+	case XT_REG_IDX_PC:
+		return ESP_COREDUMP_GREG_PC;
+	case XT_REG_IDX_PS:
+		return ESP_COREDUMP_GREG_PS;
+	case XT_REG_IDX_LBEG:
+		return ESP_COREDUMP_GREG_LBEG;
+	case XT_REG_IDX_LEND:
+		return ESP_COREDUMP_GREG_LEND;
+	case XT_REG_IDX_LCOUNT:
+		return ESP_COREDUMP_GREG_LCOUNT;
+	case XT_REG_IDX_SAR:
+		return ESP_COREDUMP_GREG_SAR;
+	case XT_REG_IDX_WINDOWSTART:
+		return ESP_COREDUMP_GREG_WINDOWSTART;
+	case XT_REG_IDX_WINDOWBASE:
+		return ESP_COREDUMP_GREG_WINDOWBASE;
+	case XT_REG_IDX_THREADPTR:
+		return ESP_COREDUMP_GREG_THREADPTR;
+	default:
+		if (reg_idx >= XT_REG_IDX_AR0 && reg_idx <= XT_REG_IDX_AR63)
+			return ESP_COREDUMP_GREG_AR0 + (reg_idx - XT_REG_IDX_AR0);
+		break;
+	}
+	return -1;
+}
+
+static uint8_t *esp_coredump_note_alloc(struct esp_coredump *cd)
+{
+	if (cd->notes_num == cd->notes_max) {
+		unsigned int new_max = cd->notes_max ? 2 * cd->notes_max : 8;
+		uint8_t *new_notes = realloc(cd->notes, new_max * ESP_COREDUMP_NOTE_SZ);
+		if (!new_notes)
+			return NULL;
+		cd->notes = new_notes;
+		cd->notes_max = new_max;
+	}
+	uint8_t *note = cd->notes + cd->notes_num++ * ESP_COREDUMP_NOTE_SZ;
+	memset(note, 0, ESP_COREDUMP_NOTE_SZ);
+	h_u32_to_le(note, 5);	/* strlen("CORE") + 1 */
+	h_u32_to_le(note + 4, ESP_COREDUMP_PRSTATUS_SZ);
+	h_u32_to_le(note + 8, ESP_COREDUMP_NT_PRSTATUS);
+	memcpy(note + 12, "CORE", 4);
+	return note;
+}
+
+static void esp_coredump_note_set_reg(uint8_t *note, enum xtensa_reg_id reg_idx, uint32_t val)
+{
+	int greg = esp_coredump_greg_idx(reg_idx);
+	if (greg < 0)
+		return;
+	h_u32_to_le(note + 20 + ESP_COREDUMP_PRSTATUS_HDR_SZ + greg * 4, val);
+}
+
+static void esp_coredump_note_set_info(uint8_t *note, uint32_t pid, uint16_t sig)
+{
+	uint8_t *prstatus = note + 20;
+	h_u16_to_le(prstatus + ESP_COREDUMP_PRSTATUS_CURSIG, sig);
+	h_u32_to_le(prstatus + ESP_COREDUMP_PRSTATUS_PID, pid);
+	/* ESP-IDF stores task handle in pr_pid, pr_ppid is unused */
+}
+
+static int esp_coredump_add_core_note(struct esp_coredump *cd, struct target *target, uint32_t pid)
+{
+	struct xtensa *xtensa = target_to_xtensa(target);
+	uint8_t *note = esp_coredump_note_alloc(cd);
+	if (!note) {
+		LOG_ERROR("Failed to alloc memory for core dump note!");
+		return ERROR_FAIL;
+	}
+	esp_coredump_note_set_info(note, pid, ESP_COREDUMP_SIGTRAP);
+	for (unsigned int i = 0; i < xtensa->core_cache->num_regs; i++) {
+		if (!xtensa->core_cache->reg_list[i].exist || esp_coredump_greg_idx(i) < 0)
+			continue;
+		esp_coredump_note_set_reg(note, i, xtensa_reg_get(target, i));
+	}
+	return ERROR_OK;
+}
+
+static int esp_coredump_add_thread_note(struct esp_coredump *cd, struct target *target,
+	threadid_t thread_id, bool current)
+{
+	struct xtensa *xtensa = target_to_xtensa(target);
+	struct rtos_reg *reg_list = NULL;
+	int num_regs = 0;
+
+	int res = target->rtos->type->get_thread_reg_list(target->rtos, thread_id, &reg_list, &num_regs);
+	if (res != ERROR_OK) {
+		LOG_TARGET_WARNING(target, "Failed to get registers of thread 0x%" PRIx64 "!", thread_id);
+		/* dump the rest of threads */
+		return ERROR_OK;
+	}
+	uint8_t *note = esp_coredump_note_alloc(cd);
+	if (!note) {
+		LOG_ERROR("Failed to alloc memory for core dump note!");
+		free(reg_list);
+		return ERROR_FAIL;
+	}
+	esp_coredump_note_set_info(note, (uint32_t)thread_id, current ? ESP_COREDUMP_SIGTRAP : 0);
+	/* Threads restored from stack frame have registers of the current window only in AR0..AR15 */
+	esp_coredump_note_set_reg(note, XT_REG_IDX_WINDOWSTART, 1);
+	for (int i = 0; i < num_regs; i++) {
+		/* RTOS reports GDB register numbers */
+		if (reg_list[i].number >= xtensa->regs_num)
+			continue;
+		enum xtensa_reg_id reg_idx = xtensa->core_config->gdb_regs_mapping[reg_list[i].number];
+		esp_coredump_note_set_reg(note, reg_idx, buf_get_u32(reg_list[i].value, 0, 32));
+	}
+	free(reg_list);
+	return ERROR_OK;
+}
+
+static int esp_coredump_add_notes(struct esp_coredump *cd, struct target *target)
+{
+	struct rtos *rtos = target->rtos;
+
+	if (rtos && rtos->type) {
+		rtos_update_threads(target);
+		if (rtos->thread_count > 0 && rtos->thread_details) {
+			/* GDB selects the thread from the first note as the current one */
+			for (int i = 0; i < rtos->thread_count; i++) {
+				if (rtos->thread_details[i].threadid != rtos->current_thread)
+					continue;
+				int res = esp_coredump_add_thread_note(cd, target, rtos->thread_details[i].threadid, true);
+				if (res != ERROR_OK)
+					return res;
+			}
+			for (int i = 0; i < rtos->thread_count; i++) {
+				if (rtos->thread_details[i].threadid == rtos->current_thread)
+					continue;
+				int res = esp_coredump_add_thread_note(cd, target, rtos->thread_details[i].threadid, false);
+				if (res != ERROR_OK)
+					return res;
+			}
+			if (cd->notes_num > 0)
+				return ERROR_OK;
+			LOG_TARGET_WARNING(target, "No RTOS threads info, dump cores state.");
+		}
+	}
+
+	/* no RTOS, dump state of every core as separate thread */
+	if (target->smp) {
+		struct target_list *head;
+		uint32_t pid = 1;
+		/* current core goes first */
+		int res = esp_coredump_add_core_note(cd, target, pid++);
+		if (res != ERROR_OK)
+			return res;
+		foreach_smp_target(head, target->smp_targets) {
+			if (head->target == target)
+				continue;
+			res = esp_coredump_add_core_note(cd, head->target, pid++);
+			if (res != ERROR_OK)
+				return res;
+		}
+		return ERROR_OK;
+	}
+	return esp_coredump_add_core_note(cd, target, 1);
+}
+
+static void esp_coredump_add_regions(struct esp_coredump *cd, const struct xtensa_local_mem_config *mem,
+	uint32_t flags, bool extram)
+{
+	for (unsigned int i = 0; i < mem->count; i++) {
+		const struct xtensa_local_mem_region_config *reg = &mem->regions[i];
+		if (reg->attrs & XT_MEM_ATTR_IO)
+			continue;
+		if ((reg->attrs & XT_MEM_ATTR_EXT) && !extram)
+			continue;
+		bool overlaps = false;
+		for (unsigned int k = 0; k < cd->regions_num; k++) {
+			if (reg->base < cd->regions[k].base + cd->regions[k].size &&
+				cd->regions[k].base < reg->base + reg->size) {
+				overlaps = true;
+				break;
+			}
+		}
+		if (overlaps || cd->regions_num == ESP_COREDUMP_REGIONS_MAX) {
+			LOG_DEBUG("Skip region " TARGET_ADDR_FMT " (%u bytes)", reg->base, reg->size);
+			continue;
+		}
+		cd->regions[cd->regions_num].base = reg->base;
+		cd->regions[cd->regions_num].size = reg->size;
+		cd->regions[cd->regions_num].flags = flags;
+		cd->regions_num++;
+	}
+}
+
+static int esp_coredump_write_headers(struct esp_coredump *cd, struct fileio *fileio)
+{
+	unsigned int phnum = 1 + cd->regions_num;
+	size_t hdrs_sz = ESP_COREDUMP_EHDR_SZ + phnum * ESP_COREDUMP_PHDR_SZ;
+	size_t written;
+
+	uint8_t *hdrs = calloc(1, hdrs_sz);
+	if (!hdrs) {
+		LOG_ERROR("Failed to alloc memory for core dump headers!");
+		return ERROR_FAIL;
+	}
+	uint8_t *p = hdrs;
+	p[0] = 0x7f;
+	memcpy(p + 1, "ELF", 3);
+	p[4] = 1;	/* ELFCLASS32 */
+	p[5] = 1;	/* ELFDATA2LSB */
+	p[6] = 1;	/* EV_CURRENT */
+	h_u16_to_le(p + 16, ESP_COREDUMP_ET_CORE);
+	h_u16_to_le(p + 18, ESP_COREDUMP_EM_XTENSA);
+	h_u32_to_le(p + 20, 1);	/* EV_CURRENT */
+	h_u32_to_le(p + 28, ESP_COREDUMP_EHDR_SZ);
+	h_u16_to_le(p + 40, ESP_COREDUMP_EHDR_SZ);
+	h_u16_to_le(p + 42, ESP_COREDUMP_PHDR_SZ);
+	h_u16_to_le(p + 44, phnum);
+
+	p += ESP_COREDUMP_EHDR_SZ;
+	h_u32_to_le(p, ESP_COREDUMP_PT_NOTE);
+	h_u32_to_le(p + 4, hdrs_sz);
+	h_u32_to_le(p + 16, cd->notes_num * ESP_COREDUMP_NOTE_SZ);
+	h_u32_to_le(p + 28, 4);
+	for (unsigned int i = 0; i < cd->regions_num; i++) {
+		p += ESP_COREDUMP_PHDR_SZ;
+		h_u32_to_le(p, ESP_COREDUMP_PT_LOAD);
+		h_u32_to_le(p + 4, cd->regions[i].offset);
+		h_u32_to_le(p + 8, cd->regions[i].base);
+		h_u32_to_le(p + 12, cd->regions[i].base);
+		h_u32_to_le(p + 16, cd->regions[i].filesz);
+		h_u32_to_le(p + 20, cd->regions[i].size);
+		h_u32_to_le(p + 24, cd->regions[i].flags);
+		h_u32_to_le(p + 28, 4);
+	}
+
+	int res = fileio_seek(fileio, 0);
+	if (res == ERROR_OK)
+		res = fileio_write(fileio, hdrs_sz, hdrs, &written);
+	free(hdrs);
+	return res;
+}
+
+/* Streams memory regions to the file in big chunks. Unreadable tail of region (e.g. absent external RAM)
+ * is excluded from the file, but the whole region is still described by program header. */
+static int esp_coredump_write_regions(struct esp_coredump *cd, struct target *target,
+	struct fileio *fileio, size_t offset)
+{
+	size_t written;
+	uint8_t *buf = malloc(ESP_COREDUMP_CHUNK_SZ);
+	if (!buf) {
+		LOG_ERROR("Failed to alloc memory for core dump buffer!");
+		return ERROR_FAIL;
+	}
+
+	int res = ERROR_OK;
+	for (unsigned int i = 0; i < cd->regions_num && res == ERROR_OK; i++) {
+		struct esp_coredump_region *r = &cd->regions[i];
+		r->offset = offset;
+		r->filesz = 0;
+		while (r->filesz < r->size) {
+			uint32_t chunk_sz = MIN(r->size - r->filesz, ESP_COREDUMP_CHUNK_SZ);
+			if (target_read_buffer(target, r->base + r->filesz, chunk_sz, buf) != ERROR_OK) {
+				LOG_TARGET_WARNING(target, "Failed to read memory at 0x%" PRIx32 ", region truncated!",
+					r->base + r->filesz);
+				break;
+			}
+			res = fileio_write(fileio, chunk_sz, buf, &written);
+			if (res != ERROR_OK)
+				break;
+			r->filesz += chunk_sz;
+		}
+		offset += r->filesz;
+		LOG_DEBUG("Dumped region 0x%" PRIx32 " (%" PRIu32 "/%" PRIu32 " bytes)", r->base, r->filesz, r->size);
+	}
+	free(buf);
+	return res;
+}
+
+COMMAND_HANDLER(esp_xtensa_cmd_coredump)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct xtensa *xtensa = target_to_xtensa(target);
+	struct esp_xtensa_common *esp_xtensa = target_to_esp_xtensa(target);
+	struct esp_coredump cd;
+	struct fileio *fileio;
+	struct duration bench;
+	size_t written;
+	bool extram = true;
+
+	if (CMD_ARGC < 1 || CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 2) {
+		if (strcmp(CMD_ARGV[1], "noextram") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		extram = false;
+	}
+
+	if (target->smp) {
+		struct target_list *head;
+		foreach_smp_target(head, target->smp_targets) {
+			if (head->target->state != TARGET_HALTED) {
+				command_print(CMD, "Target %s not halted!", target_name(head->target));
+				return ERROR_TARGET_NOT_HALTED;
+			}
+		}
+	} else if (target->state != TARGET_HALTED) {
+		command_print(CMD, "Target not halted!");
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	memset(&cd, 0, sizeof(cd));
+	esp_coredump_add_regions(&cd, &xtensa->core_config->dram, ESP_COREDUMP_PF_R | ESP_COREDUMP_PF_W, extram);
+	esp_coredump_add_regions(&cd, &xtensa->core_config->iram,
+		ESP_COREDUMP_PF_R | ESP_COREDUMP_PF_W | ESP_COREDUMP_PF_X, extram);
+	esp_coredump_add_regions(&cd, &xtensa->core_config->uram, ESP_COREDUMP_PF_R | ESP_COREDUMP_PF_W, extram);
+	if (esp_xtensa->coredump_extram)
+		esp_coredump_add_regions(&cd, esp_xtensa->coredump_extram, ESP_COREDUMP_PF_R | ESP_COREDUMP_PF_W, extram);
+
+	int res = esp_coredump_add_notes(&cd, target);
+	if (res != ERROR_OK)
+		goto _free_notes;
+
+	res = fileio_open(&fileio, CMD_ARGV[0], FILEIO_WRITE, FILEIO_BINARY);
+	if (res != ERROR_OK)
+		goto _free_notes;
+
+	duration_start(&bench);
+
+	size_t offset = ESP_COREDUMP_EHDR_SZ + (1 + cd.regions_num) * ESP_COREDUMP_PHDR_SZ;
+	res = fileio_seek(fileio, offset);
+	if (res != ERROR_OK)
+		goto _close;
+	res = fileio_write(fileio, cd.notes_num * ESP_COREDUMP_NOTE_SZ, cd.notes, &written);
+	if (res != ERROR_OK)
+		goto _close;
+	offset += cd.notes_num * ESP_COREDUMP_NOTE_SZ;
+	res = esp_coredump_write_regions(&cd, target, fileio, offset);
+	if (res != ERROR_OK)
+		goto _close;
+	/* program headers are known only after all regions have been read */
+	res = esp_coredump_write_headers(&cd, fileio);
+	if (res != ERROR_OK)
+		goto _close;
+
+	if (duration_measure(&bench) == ERROR_OK) {
+		size_t mem_sz = 0;
+		for (unsigned int i = 0; i < cd.regions_num; i++)
+			mem_sz += cd.regions[i].filesz;
+		command_print(CMD, "dumped %u threads and %zu bytes of memory in %fs (%0.3f KiB/s)",
+			cd.notes_num, mem_sz, duration_elapsed(&bench), duration_kbps(&bench, mem_sz));
+	}
+
+_close:
+	if (fileio_close(fileio) != ERROR_OK && res == ERROR_OK)
+		res = ERROR_FAIL;
+_free_notes:
+	free(cd.notes);
+	return res;
+}
+
+const struct command_registration esp_xtensa_coredump_command_handlers[] = {
+	{
+		.name = "coredump",
+		.handler = esp_xtensa_cmd_coredump,
+		.mode = COMMAND_EXEC,
+		.help = "Save ELF core file of the halted target including RTOS threads state.",
+		.usage = "outfile [noextram]",
+	},
+	COMMAND_REGISTRATION_DONE
+};
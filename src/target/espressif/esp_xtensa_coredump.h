@@ -0,0 +1,26 @@
+/***************************************************************************
+ *   ELF core dump of halted Espressif Xtensa target                       *
+ *   Copyright (C) 2022 Espressif Systems Ltd.                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_ESP_XTENSA_COREDUMP_H
+#define OPENOCD_TARGET_ESP_XTENSA_COREDUMP_H
+
+#include <helper/command.h>
+
+extern const struct command_registration esp_xtensa_coredump_command_handlers[];
+
+#endif	/* OPENOCD_TARGET_ESP_XTENSA_COREDUMP_H */
@@ -26,8 +26,11 @@
 #include "assert.h"
 #include "rtos/rtos.h"
 #include <target/smp.h>
+#include <target/xtensa/xtensa_trax.h>
+#include <target/xtensa/xtensa_perfmon.h>
 #include "esp_xtensa_smp.h"
 #include "esp_xtensa_semihosting.h"
+#include "esp_xtensa_coredump.h"
 
 /*
 Multiprocessor stuff common:
@@ -767,6 +770,15 @@ COMMAND_HANDLER(esp_xtensa_smp_cmd_perfmon_dump)
 		target_to_xtensa(target));
 }
 
+COMMAND_HANDLER(esp_xtensa_smp_cmd_perfmon_sample)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	/* single sampler covers all SMP cores */
+	return CALL_COMMAND_HANDLER(xtensa_cmd_perfmon_sample_do, target,
+		target_to_xtensa(target)->perfmon_sink);
+}
+
 COMMAND_HANDLER(esp_xtensa_smp_cmd_tracestart)
 {
 	struct target *target = get_current_target(CMD_CTX);
@@ -837,6 +849,21 @@ COMMAND_HANDLER(esp_xtensa_smp_cmd_tracedump)
 		target_to_xtensa(target), CMD_ARGV[0]);
 }
 
+COMMAND_HANDLER(esp_xtensa_smp_cmd_tracestream)
+{
+	/* single stream covers all SMP cores */
+	return CALL_COMMAND_HANDLER(xtensa_cmd_tracestream_do, get_current_target(CMD_CTX));
+}
+
+COMMAND_HANDLER(esp_xtensa_smp_cmd_tracedecode)
+{
+	if (CMD_ARGC < 2 || CMD_ARGC > 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	return CALL_COMMAND_HANDLER(xtensa_cmd_tracedecode_do,
+		CMD_ARGV[0], CMD_ARGV[1], CMD_ARGC == 3 ? CMD_ARGV[2] : NULL);
+}
+
 COMMAND_HANDLER(esp_xtensa_smp_cmd_semihost_basedir)
 {
 	struct target *target = get_current_target(CMD_CTX);
@@ -893,6 +920,14 @@ const struct command_registration esp_xtensa_smp_xtensa_command_handlers[] = {
 			"Dump performance counter value. If no argument specified, dumps all counters.",
 		.usage = "[counter_id]",
 	},
+	{
+		.name = "perfmon_sample",
+		.handler = esp_xtensa_smp_cmd_perfmon_sample,
+		.mode = COMMAND_EXEC,
+		.help =
+			"Periodically sample enabled performance counters of all cores to a file or TCP socket.",
+		.usage = "start <file://outfile|tcp://host:port> [period_ms] [csv|bin] | stop | status",
+	},
 	{
 		.name = "tracestart",
 		.handler = esp_xtensa_smp_cmd_tracestart,
@@ -915,6 +950,22 @@ const struct command_registration esp_xtensa_smp_xtensa_command_handlers[] = {
 		.help = "Tracing: Dump trace memory to a files. One file per core.",
 		.usage = "<outfile1> <outfile2>",
 	},
+	{
+		.name = "tracestream",
+		.handler = esp_xtensa_smp_cmd_tracestream,
+		.mode = COMMAND_EXEC,
+		.help =
+			"Tracing: Continuously drain trace memory of all cores to a file while target is running.",
+		.usage = "start <outfile> [poll_period_ms] | stop | status",
+	},
+	{
+		.name = "tracedecode",
+		.handler = esp_xtensa_smp_cmd_tracedecode,
+		.mode = COMMAND_ANY,
+		.help =
+			"Tracing: Decode trace data written by tracestream or tracedump into hot blocks histogram and optionally into executed PC ranges.",
+		.usage = "<infile> <histfile> [rangesfile]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -927,6 +978,9 @@ const struct command_registration esp_xtensa_smp_esp_command_handlers[] = {
 			"DEPRECATED! use arm semihosting_basedir",
 		.usage = "dir",
 	},
+	{
+		.chain = esp_xtensa_coredump_command_handlers,
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -330,6 +330,25 @@ static int image_ihex_buffer_complete_inner(struct image *image,
 	}
 }
 
+/* Text records are parsed into a buffer of half the file size. Sections lie
+ * back to back in it, so give back the tail the records did not fill. */
+static void image_buffer_trim(struct image *image, uint8_t **buffer)
+{
+	size_t used = 0;
+	for (unsigned int i = 0; i < image->num_sections; i++)
+		used += image->sections[i].size;
+
+	uint8_t *trimmed = realloc(*buffer, used ? used : 1);
+	if (!trimmed)
+		return;
+
+	*buffer = trimmed;
+	for (unsigned int i = 0; i < image->num_sections; i++) {
+		image->sections[i].private = trimmed;
+		trimmed += image->sections[i].size;
+	}
+}
+
 /**
  * Allocate memory dynamically instead of on the stack. This
  * is important w/embedded hosts.
@@ -350,6 +369,8 @@ static int image_ihex_buffer_complete(struct image *image)
 	int retval;
 
 	retval = image_ihex_buffer_complete_inner(image, lpsz_line, section);
+	if (retval == ERROR_OK)
+		image_buffer_trim(image, &((struct image_ihex *)image->type_private)->buffer);
 
 	free(section);
 	free(lpsz_line);
@@ -653,6 +674,14 @@ static int image_elf_read_headers(struct image *image)
 	}
 }
 
+/* Bytes at file_offset of a mapped ELF file, NULL if not mapped or out of bounds */
+static const uint8_t *image_elf_mapped(struct image_elf *elf, uint64_t file_offset, uint64_t size)
+{
+	if (!elf->data || file_offset > elf->size || size > elf->size - file_offset)
+		return NULL;
+	return elf->data + file_offset;
+}
+
 static int image_elf32_read_section(struct image *image,
 	int section,
 	target_addr_t offset,
@@ -676,15 +705,20 @@ static int image_elf32_read_section(struct image *image,
 		LOG_DEBUG("read elf: size = 0x%zx at 0x%" TARGET_PRIxADDR "", read_size,
 			field32(elf, segment->p_offset) + offset);
 		/* read initialized area of the segment */
-		retval = fileio_seek(elf->fileio, field32(elf, segment->p_offset) + offset);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("cannot find ELF segment content, seek failed");
-			return retval;
-		}
-		retval = fileio_read(elf->fileio, read_size, buffer, &really_read);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("cannot read ELF segment content, read failed");
-			return retval;
+		const uint8_t *data = image_elf_mapped(elf, field32(elf, segment->p_offset) + offset, read_size);
+		if (data) {
+			memcpy(buffer, data, read_size);
+		} else {
+			retval = fileio_seek(elf->fileio, field32(elf, segment->p_offset) + offset);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("cannot find ELF segment content, seek failed");
+				return retval;
+			}
+			retval = fileio_read(elf->fileio, read_size, buffer, &really_read);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("cannot read ELF segment content, read failed");
+				return retval;
+			}
 		}
 		size -= read_size;
 		*size_read += read_size;
@@ -719,15 +753,20 @@ static int image_elf64_read_section(struct image *image,
 		LOG_DEBUG("read elf: size = 0x%zx at 0x%" TARGET_PRIxADDR "", read_size,
 			field64(elf, segment->p_offset) + offset);
 		/* read initialized area of the segment */
-		retval = fileio_seek(elf->fileio, field64(elf, segment->p_offset) + offset);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("cannot find ELF segment content, seek failed");
-			return retval;
-		}
-		retval = fileio_read(elf->fileio, read_size, buffer, &really_read);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("cannot read ELF segment content, read failed");
-			return retval;
+		const uint8_t *data = image_elf_mapped(elf, field64(elf, segment->p_offset) + offset, read_size);
+		if (data) {
+			memcpy(buffer, data, read_size);
+		} else {
+			retval = fileio_seek(elf->fileio, field64(elf, segment->p_offset) + offset);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("cannot find ELF segment content, seek failed");
+				return retval;
+			}
+			retval = fileio_read(elf->fileio, read_size, buffer, &really_read);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("cannot read ELF segment content, read failed");
+				return retval;
+			}
 		}
 		size -= read_size;
 		*size_read += read_size;
@@ -950,6 +989,8 @@ static int image_mot_buffer_complete(struct image *image)
 	int retval;
 
 	retval = image_mot_buffer_complete_inner(image, lpsz_line, section);
+	if (retval == ERROR_OK)
+		image_buffer_trim(image, &((struct image_mot *)image->type_private)->buffer);
 
 	free(section);
 	free(lpsz_line);
@@ -979,6 +1020,8 @@ int image_open(struct image *image, const char *url, const char *type_string)
 			fileio_close(image_binary->fileio);
 			return retval;
 		}
+		if (fileio_map(image_binary->fileio, &image_binary->data) != ERROR_OK)
+			image_binary->data = NULL;
 
 		image->num_sections = 1;
 		image->sections = malloc(sizeof(struct imagesection));
@@ -1009,6 +1052,9 @@ int image_open(struct image *image, const char *url, const char *type_string)
 		retval = fileio_open(&image_elf->fileio, url, FILEIO_READ, FILEIO_BINARY);
 		if (retval != ERROR_OK)
 			return retval;
+		fileio_size(image_elf->fileio, &image_elf->size);
+		if (fileio_map(image_elf->fileio, &image_elf->data) != ERROR_OK)
+			image_elf->data = NULL;
 
 		retval = image_elf_read_headers(image);
 		if (retval != ERROR_OK) {
@@ -1099,6 +1145,12 @@ int image_read_section(struct image *image,
 		if (section != 0)
 			return ERROR_COMMAND_SYNTAX_ERROR;
 
+		if (image_binary->data) {
+			memcpy(buffer, image_binary->data + offset, size);
+			*size_read = size;
+			return ERROR_OK;
+		}
+
 		/* seek to offset */
 		retval = fileio_seek(image_binary->fileio, offset);
 		if (retval != ERROR_OK)
@@ -1168,6 +1220,48 @@ int image_read_section(struct image *image,
 	return ERROR_OK;
 }
 
+/**
+ * Points @a data at @a size bytes of a section without copying them. Works
+ * for images held in host memory: mapped binary and ELF files, and parsed
+ * text formats. Returns ERROR_NOT_IMPLEMENTED otherwise, in which case
+ * image_read_section() has to be used.
+ */
+int image_section_data(struct image *image,
+	int section,
+	target_addr_t offset,
+	uint32_t size,
+	const uint8_t **data)
+{
+	if (offset + size > image->sections[section].size)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (image->type == IMAGE_BINARY) {
+		struct image_binary *image_binary = image->type_private;
+
+		if (!image_binary->data)
+			return ERROR_NOT_IMPLEMENTED;
+		*data = image_binary->data + offset;
+	} else if (image->type == IMAGE_ELF) {
+		struct image_elf *elf = image->type_private;
+		uint64_t file_offset;
+
+		if (elf->is_64_bit)
+			file_offset = field64(elf, ((Elf64_Phdr *)image->sections[section].private)->p_offset);
+		else
+			file_offset = field32(elf, ((Elf32_Phdr *)image->sections[section].private)->p_offset);
+		*data = image_elf_mapped(elf, file_offset + offset, size);
+		if (!*data)
+			return ERROR_NOT_IMPLEMENTED;
+	} else if (image->type == IMAGE_IHEX || image->type == IMAGE_SRECORD ||
+			image->type == IMAGE_BUILDER) {
+		*data = (uint8_t *)image->sections[section].private + offset;
+	} else {
+		return ERROR_NOT_IMPLEMENTED;
+	}
+
+	return ERROR_OK;
+}
+
 int image_add_section(struct image *image, target_addr_t base, uint32_t size, uint64_t flags, uint8_t const *data)
 {
 	struct imagesection *section;
@@ -1262,36 +1356,68 @@ void image_close(struct image *image)
 	image->sections = NULL;
 }
 
-int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
+/* crc32_table[k][i] is the CRC of byte i followed by k zero bytes, so eight
+ * bytes can be folded into the CRC with eight independent lookups. */
+static uint32_t crc32_table[8][256];
+
+static void image_checksum_init_tables(void)
 {
-	uint32_t crc = 0xffffffff;
-	LOG_DEBUG("Calculating checksum");
+	static bool first_init;
+	if (first_init)
+		return;
+
+	/* Initialize the CRC table and the decoding table.  */
+	unsigned int i, j, c;
+	for (i = 0; i < 256; i++) {
+		/* as per gdb */
+		for (c = i << 24, j = 8; j > 0; --j)
+			c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
+		crc32_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32_table[j][i] = (crc32_table[j - 1][i] << 8) ^
+				crc32_table[0][crc32_table[j - 1][i] >> 24];
 
-	static uint32_t crc32_table[256];
+	first_init = true;
+}
 
-	static bool first_init;
-	if (!first_init) {
-		/* Initialize the CRC table and the decoding table.  */
-		unsigned int i, j, c;
-		for (i = 0; i < 256; i++) {
-			/* as per gdb */
-			for (c = i << 24, j = 8; j > 0; --j)
-				c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
-			crc32_table[i] = c;
-		}
+static uint32_t image_checksum_update_bytewise(uint32_t crc, const uint8_t *buffer, uint32_t nbytes)
+{
+	while (nbytes--) {
+		/* as per gdb */
+		crc = (crc << 8) ^ crc32_table[0][((crc >> 24) ^ *buffer++) & 255];
+	}
+	return crc;
+}
 
-		first_init = true;
+static uint32_t image_checksum_update(uint32_t crc, const uint8_t *buffer, uint32_t nbytes)
+{
+	for (; nbytes >= 8; nbytes -= 8, buffer += 8) {
+		uint32_t hi = crc ^ be_to_h_u32(buffer);
+		uint32_t lo = be_to_h_u32(buffer + 4);
+		crc = crc32_table[7][hi >> 24] ^ crc32_table[6][(hi >> 16) & 255] ^
+			crc32_table[5][(hi >> 8) & 255] ^ crc32_table[4][hi & 255] ^
+			crc32_table[3][lo >> 24] ^ crc32_table[2][(lo >> 16) & 255] ^
+			crc32_table[1][(lo >> 8) & 255] ^ crc32_table[0][lo & 255];
 	}
+	return image_checksum_update_bytewise(crc, buffer, nbytes);
+}
+
+int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
+{
+	uint32_t crc = 0xffffffff;
+	LOG_DEBUG("Calculating checksum");
+
+	image_checksum_init_tables();
 
 	while (nbytes > 0) {
-		int run = nbytes;
+		uint32_t run = nbytes;
 		if (run > 32768)
 			run = 32768;
 		nbytes -= run;
-		while (run--) {
-			/* as per gdb */
-			crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *buffer++) & 255];
-		}
+		crc = image_checksum_update(crc, buffer, run);
+		buffer += run;
 		keep_alive();
 	}
 
@@ -1300,3 +1426,10 @@ int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *c
 	*checksum = crc;
 	return ERROR_OK;
 }
+
+int image_calculate_checksum_bytewise(const uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
+{
+	image_checksum_init_tables();
+	*checksum = image_checksum_update_bytewise(0xffffffff, buffer, nbytes);
+	return ERROR_OK;
+}
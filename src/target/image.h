@@ -71,6 +71,7 @@ struct image {
 
 struct image_binary {
 	struct fileio *fileio;
+	const uint8_t *data;	/* mapped file, NULL if not mapped */
 };
 
 struct image_ihex {
@@ -86,6 +87,8 @@ struct image_memory {
 
 struct image_elf {
 	struct fileio *fileio;
+	const uint8_t *data;	/* mapped file, NULL if not mapped */
+	size_t size;
 	bool is_64_bit;
 	union {
 		Elf32_Ehdr *header32;
@@ -107,6 +110,8 @@ struct image_mot {
 int image_open(struct image *image, const char *url, const char *type_string);
 int image_read_section(struct image *image, int section, target_addr_t offset,
 		uint32_t size, uint8_t *buffer, size_t *size_read);
+int image_section_data(struct image *image, int section, target_addr_t offset,
+		uint32_t size, const uint8_t **data);
 void image_close(struct image *image);
 
 int image_add_section(struct image *image, target_addr_t base, uint32_t size,
@@ -114,6 +119,9 @@ int image_add_section(struct image *image, target_addr_t base, uint32_t size,
 
 int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes,
 		uint32_t *checksum);
+/* Same CRC as image_calculate_checksum(), one byte at a time. Reference for self tests. */
+int image_calculate_checksum_bytewise(const uint8_t *buffer, uint32_t nbytes,
+		uint32_t *checksum);
 
 #define ERROR_IMAGE_FORMAT_ERROR	(-1400)
 #define ERROR_IMAGE_TYPE_UNKNOWN	(-1401)
@@ -85,7 +85,42 @@ bool riscv_batch_full(struct riscv_batch *batch)
 	return batch->used_scans > (batch->allocated_scans - 4);
 }
 
-int riscv_batch_run(struct riscv_batch *batch)
+/* All DMI scans have the same shape, so record them once per target and substitute
+ * only the data. Returns NULL if the template can't be recorded. */
+static struct jtag_scan_template *riscv_batch_template(struct riscv_batch *batch)
+{
+	struct target *target = batch->target;
+	RISCV_INFO(r);
+	unsigned int num_bits = batch->fields[0].num_bits;
+
+	if (r->batch_tmpl && r->batch_tmpl_bits == num_bits && r->batch_tmpl_idle == batch->idle_count)
+		return r->batch_tmpl;
+
+	jtag_scan_template_free(r->batch_tmpl);
+	r->batch_tmpl = jtag_scan_template_new();
+	if (!r->batch_tmpl)
+		return NULL;
+
+	struct scan_field field = {
+		.num_bits = num_bits,
+		.out_value = JTAG_SCAN_TEMPLATE_VAR,
+		.in_value = JTAG_SCAN_TEMPLATE_VAR,
+	};
+	int retval = jtag_scan_template_add_dr_scan(r->batch_tmpl, target->tap, 1, &field, TAP_IDLE);
+	if (retval == ERROR_OK && batch->idle_count > 0)
+		retval = jtag_scan_template_add_runtest(r->batch_tmpl, batch->idle_count, TAP_IDLE);
+	if (retval != ERROR_OK) {
+		LOG_DEBUG("Failed to record DMI scan template, queueing scans one by one.");
+		jtag_scan_template_free(r->batch_tmpl);
+		r->batch_tmpl = NULL;
+		return NULL;
+	}
+	r->batch_tmpl_bits = num_bits;
+	r->batch_tmpl_idle = batch->idle_count;
+	return r->batch_tmpl;
+}
+
+int riscv_batch_queue(struct riscv_batch *batch)
 {
 	if (batch->used_scans == 0) {
 		LOG_DEBUG("Ignoring empty batch.");
@@ -94,16 +129,32 @@ int riscv_batch_run(struct riscv_batch *batch)
 
 	riscv_batch_add_nop(batch);
 
+	struct jtag_scan_template *tmpl = NULL;
+	if (bscan_tunnel_ir_width == 0)
+		tmpl = riscv_batch_template(batch);
+
 	for (size_t i = 0; i < batch->used_scans; ++i) {
-		if (bscan_tunnel_ir_width != 0)
+		if (bscan_tunnel_ir_width != 0) {
 			riscv_add_bscan_tunneled_scan(batch->target, batch->fields+i, batch->bscan_ctxt+i);
-		else
+		} else if (tmpl && batch->fields[i].num_bits == batch->fields[0].num_bits) {
+			jtag_add_scan_template(tmpl, &batch->fields[i].out_value, &batch->fields[i].in_value);
+			continue;
+		} else {
 			jtag_add_dr_scan(batch->target->tap, 1, batch->fields + i, TAP_IDLE);
+		}
 
 		if (batch->idle_count > 0)
 			jtag_add_runtest(batch->idle_count, TAP_IDLE);
 	}
 
+	return ERROR_OK;
+}
+
+int riscv_batch_wait(struct riscv_batch *batch)
+{
+	if (batch->used_scans == 0)
+		return ERROR_OK;
+
 	keep_alive();
 
 	if (jtag_execute_queue() != ERROR_OK) {
@@ -125,6 +176,14 @@ int riscv_batch_run(struct riscv_batch *batch)
 	return ERROR_OK;
 }
 
+int riscv_batch_run(struct riscv_batch *batch)
+{
+	int result = riscv_batch_queue(batch);
+	if (result != ERROR_OK)
+		return result;
+	return riscv_batch_wait(batch);
+}
+
 void riscv_batch_add_dmi_write(struct riscv_batch *batch, unsigned address, uint64_t data)
 {
 	assert(batch->used_scans < batch->allocated_scans);
@@ -58,6 +58,14 @@ bool riscv_batch_full(struct riscv_batch *batch);
 /* Executes this scan batch. */
 int riscv_batch_run(struct riscv_batch *batch);
 
+/* riscv_batch_run() in two steps. riscv_batch_queue() only adds the scans to
+ * the JTAG queue, so the next batch can be queued behind them.
+ * riscv_batch_wait() executes whatever is in the JTAG queue and makes the
+ * results of the batch available. It must be called once for every queued
+ * batch, in the order they were queued. */
+int riscv_batch_queue(struct riscv_batch *batch);
+int riscv_batch_wait(struct riscv_batch *batch);
+
 /* Adds a DMI write to this batch. */
 void riscv_batch_add_dmi_write(struct riscv_batch *batch, unsigned address, uint64_t data);
 
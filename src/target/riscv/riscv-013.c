@@ -44,6 +44,7 @@ static int riscv013_halt_go(struct target *target);
 static int riscv013_resume_go(struct target *target);
 static int riscv013_step_current_hart(struct target *target);
 static int riscv013_on_halt(struct target *target);
+static int riscv013_prefetch_registers(struct target *target);
 static int riscv013_on_step(struct target *target);
 static int riscv013_resume_prep(struct target *target);
 static bool riscv013_is_halted(struct target *target);
@@ -65,6 +66,9 @@ static int read_memory(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, uint8_t *buffer, uint32_t increment);
 static int write_memory(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, const uint8_t *buffer);
+static int sba_read_write_u32(struct target *target, target_addr_t read_address,
+		uint32_t count, uint8_t *buffer, target_addr_t write_address,
+		uint32_t value, uint32_t *readback);
 static int riscv013_test_sba_config_reg(struct target *target, target_addr_t legal_address,
 		uint32_t num_words, target_addr_t illegal_address, bool run_sbbusyerror_test);
 void write_memory_sba_simple(struct target *target, target_addr_t addr, uint32_t *write_data,
@@ -160,6 +164,29 @@ typedef struct {
 	struct target *target;
 } target_list_t;
 
+/* Scans without busy before a lower busy delay is tried first, and the limit
+ * this interval backs off to when lower delays keep failing. */
+#define RISCV013_DELAY_PROBE_SCANS		1024
+#define RISCV013_DELAY_PROBE_SCANS_MAX	(1024 * 1024)
+
+struct riscv013_delay_tuner {
+	/* Scans done since the delay was last changed. */
+	unsigned int clean_scans;
+	/* Number of clean scans after which the delay is lowered. */
+	unsigned int probe_interval;
+	/* The delay was lowered and no busy has been seen since. */
+	bool probing;
+};
+
+/* TCK cycles a memory transfer batch should take. This keeps batches about as
+ * long as a full adapter transfer: whole USB bulk transfers for FTDI and
+ * ESP USB-JTAG, regardless of how long the scans are. */
+#define RISCV013_BATCH_TCK_BUDGET	32768
+#define RISCV013_BATCH_MIN_SCANS	16
+#define RISCV013_BATCH_MAX_SCANS	1024
+/* TCK cycles of TAP state moves around each DMI scan */
+#define RISCV013_SCAN_TMS_CYCLES	6
+
 typedef struct {
 	/* The indexed used to address this hart in its DM. */
 	unsigned index;
@@ -197,12 +224,22 @@ typedef struct {
 	 * go low. */
 	unsigned int ac_busy_delay;
 
+	/* Lower dmi_busy_delay and ac_busy_delay again when the target has not
+	 * been busy for a while. */
+	struct riscv013_delay_tuner dmi_busy_tuner, ac_busy_tuner;
+
+	/* Number of scans in memory transfer batches. It is halved when a batch
+	 * runs into busy and grows back while batches succeed, up to the number of
+	 * scans which fills RISCV013_BATCH_TCK_BUDGET. */
+	unsigned int batch_scans;
+
 	bool abstract_read_csr_supported;
 	bool abstract_write_csr_supported;
 	bool abstract_read_fpr_supported;
 	bool abstract_write_fpr_supported;
 
 	yes_no_maybe_t has_aampostincrement;
+	yes_no_maybe_t has_aarpostincrement;
 
 	/* When a function returns some error due to a failure indicated by the
 	 * target in cmderr, the caller can look here to see what that error was.
@@ -453,9 +490,83 @@ static uint32_t dtmcontrol_scan(struct target *target, uint32_t out)
 	return in;
 }
 
+static void delay_tuner_init(struct riscv013_delay_tuner *tuner)
+{
+	tuner->clean_scans = 0;
+	tuner->probe_interval = RISCV013_DELAY_PROBE_SCANS;
+	tuner->probing = false;
+}
+
+static void delay_tuner_busy(struct riscv013_delay_tuner *tuner)
+{
+	/* The lowered delay is too short, try lowering it less often. */
+	if (tuner->probing && tuner->probe_interval < RISCV013_DELAY_PROBE_SCANS_MAX)
+		tuner->probe_interval *= 2;
+	tuner->probing = false;
+	tuner->clean_scans = 0;
+}
+
+/* Returns the delay to use after 'scans' more scans without busy. */
+static unsigned int delay_tuner_clean(struct riscv013_delay_tuner *tuner,
+		unsigned int delay, unsigned int scans)
+{
+	if (delay == 0)
+		return 0;
+	tuner->clean_scans += scans;
+	if (tuner->clean_scans < tuner->probe_interval)
+		return delay;
+	/* The last lowered delay works, try the next one sooner. */
+	if (tuner->probing && tuner->probe_interval > RISCV013_DELAY_PROBE_SCANS)
+		tuner->probe_interval /= 2;
+	tuner->probing = true;
+	tuner->clean_scans = 0;
+	return delay - (delay / 8 + 1);
+}
+
+/* Called after 'scans' scans did not see the target busy. */
+static void busy_delays_clean(const struct target *target, unsigned int scans)
+{
+	RISCV013_INFO(info);
+
+	unsigned int dmi_busy_delay = delay_tuner_clean(&info->dmi_busy_tuner,
+			info->dmi_busy_delay, scans);
+	unsigned int ac_busy_delay = delay_tuner_clean(&info->ac_busy_tuner,
+			info->ac_busy_delay, scans);
+	if (dmi_busy_delay != info->dmi_busy_delay || ac_busy_delay != info->ac_busy_delay) {
+		info->dmi_busy_delay = dmi_busy_delay;
+		info->ac_busy_delay = ac_busy_delay;
+		LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d",
+				info->dtmcs_idle, info->dmi_busy_delay,
+				info->ac_busy_delay);
+	}
+}
+
+/**
+ * Return the number of scans to allocate for a memory transfer batch, which
+ * idles 'idle' cycles after each scan.
+ */
+static unsigned int riscv013_batch_scans(struct target *target, unsigned int idle)
+{
+	RISCV013_INFO(info);
+
+	unsigned int scan_cycles = info->abits + DTM_DMI_OP_LENGTH + DTM_DMI_DATA_LENGTH +
+		RISCV013_SCAN_TMS_CYCLES + idle;
+	unsigned int max_scans = RISCV013_BATCH_TCK_BUDGET / scan_cycles;
+	max_scans = MAX(max_scans, RISCV013_BATCH_MIN_SCANS);
+	return MIN(info->batch_scans, max_scans);
+}
+
+static unsigned int sba_read_batch_words(struct target *target)
+{
+	RISCV013_INFO(info);
+	return riscv013_batch_scans(target, info->dmi_busy_delay + info->bus_master_read_delay);
+}
+
 static void increase_dmi_busy_delay(struct target *target)
 {
 	riscv013_info_t *info = get_info(target);
+	delay_tuner_busy(&info->dmi_busy_tuner);
+	info->batch_scans = MAX(info->batch_scans / 2, RISCV013_BATCH_MIN_SCANS);
 	info->dmi_busy_delay += info->dmi_busy_delay / 10 + 1;
 	LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d",
 			info->dtmcs_idle, info->dmi_busy_delay,
@@ -654,6 +765,7 @@ static int dmi_op_timeout(struct target *target, uint32_t *data_in,
 		}
 	}
 
+	busy_delays_clean(target, ensure_success ? 2 : 1);
 	return ERROR_OK;
 }
 
@@ -726,6 +838,8 @@ int dmstatus_read(struct target *target, uint32_t *dmstatus,
 static void increase_ac_busy_delay(struct target *target)
 {
 	riscv013_info_t *info = get_info(target);
+	delay_tuner_busy(&info->ac_busy_tuner);
+	info->batch_scans = MAX(info->batch_scans / 2, RISCV013_BATCH_MIN_SCANS);
 	info->ac_busy_delay += info->ac_busy_delay / 10 + 1;
 	LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d",
 			info->dtmcs_idle, info->dmi_busy_delay,
@@ -1908,6 +2022,14 @@ COMMAND_HELPER(riscv013_print_info, struct target *target)
 	riscv_print_info_line(CMD, "dm", "sbaccess16", get_field(info->sbcs, DM_SBCS_SBACCESS16));
 	riscv_print_info_line(CMD, "dm", "sbaccess8", get_field(info->sbcs, DM_SBCS_SBACCESS8));
 
+	/* Values tuned at run time. */
+	riscv_print_info_line(CMD, "tuning", "batch_scans", riscv013_batch_scans(target,
+			info->dmi_busy_delay + info->ac_busy_delay));
+	riscv_print_info_line(CMD, "tuning", "dmi_busy_delay", info->dmi_busy_delay);
+	riscv_print_info_line(CMD, "tuning", "ac_busy_delay", info->ac_busy_delay);
+	riscv_print_info_line(CMD, "tuning", "bus_master_read_delay", info->bus_master_read_delay);
+	riscv_print_info_line(CMD, "tuning", "bus_master_write_delay", info->bus_master_write_delay);
+
 	uint32_t dmstatus;
 	if (dmstatus_read(target, &dmstatus, false) == ERROR_OK)
 		riscv_print_info_line(CMD, "dm", "authenticated", get_field(dmstatus, DM_DMSTATUS_AUTHENTICATED));
@@ -2101,7 +2223,7 @@ static int sb_write_address(struct target *target, target_addr_t address,
 				  false, ensure_success);
 }
 
-static int batch_run(const struct target *target, struct riscv_batch *batch)
+static int batch_queue(const struct target *target, struct riscv_batch *batch)
 {
 	RISCV013_INFO(info);
 	RISCV_INFO(r);
@@ -2113,7 +2235,30 @@ static int batch_run(const struct target *target, struct riscv_batch *batch)
 			info->ac_busy_delay = 0;
 		}
 	}
-	return riscv_batch_run(batch);
+	return riscv_batch_queue(batch);
+}
+
+static int batch_wait(const struct target *target, struct riscv_batch *batch)
+{
+	return riscv_batch_wait(batch);
+}
+
+/* Called by the users of batch_run() and batch_wait() once they checked that
+ * 'scans' scans of the batch did not see the target busy. */
+static void batch_clean(const struct target *target, unsigned int scans)
+{
+	RISCV013_INFO(info);
+	busy_delays_clean(target, scans);
+	info->batch_scans = MIN(info->batch_scans + info->batch_scans / 8 + 1,
+			RISCV013_BATCH_MAX_SCANS);
+}
+
+static int batch_run(const struct target *target, struct riscv_batch *batch)
+{
+	int result = batch_queue(target, batch);
+	if (result != ERROR_OK)
+		return result;
+	return batch_wait(target, batch);
 }
 
 static int sba_supports_access(struct target *target, unsigned int size_bytes)
@@ -2248,6 +2393,8 @@ static int sample_memory_bus_v1(struct target *target,
 			riscv_batch_free(batch);
 			return ERROR_FAIL;
 		}
+		if (riscv_batch_get_dmi_read_op(batch, sbcs_key) == DMI_STATUS_SUCCESS)
+			batch_clean(target, batch->used_scans);
 
 		unsigned int read = 0;
 		for (unsigned int n = 0; n < repeat; n++) {
@@ -2298,6 +2445,7 @@ static int init_target(struct command_context *cmd_ctx,
 	generic_info->resume_go = &riscv013_resume_go;
 	generic_info->step_current_hart = &riscv013_step_current_hart;
 	generic_info->on_halt = &riscv013_on_halt;
+	generic_info->prefetch_registers = &riscv013_prefetch_registers;
 	generic_info->resume_prep = &riscv013_resume_prep;
 	generic_info->halt_prep = &riscv013_halt_prep;
 	generic_info->halt_go = &riscv013_halt_go;
@@ -2325,6 +2473,8 @@ static int init_target(struct command_context *cmd_ctx,
 			return ERROR_FAIL;
 	}
 	generic_info->sample_memory = sample_memory;
+	generic_info->sba_read_write_u32 = sba_read_write_u32;
+	generic_info->sba_read_batch_words = sba_read_batch_words;
 	riscv013_info_t *info = get_info(target);
 
 	info->progbufsize = -1;
@@ -2333,6 +2483,9 @@ static int init_target(struct command_context *cmd_ctx,
 	info->bus_master_read_delay = 0;
 	info->bus_master_write_delay = 0;
 	info->ac_busy_delay = 0;
+	delay_tuner_init(&info->dmi_busy_tuner);
+	delay_tuner_init(&info->ac_busy_tuner);
+	info->batch_scans = RISCV_BATCH_ALLOC_SIZE;
 
 	/* Assume all these abstract commands are supported until we learn
 	 * otherwise.
@@ -2345,6 +2498,7 @@ static int init_target(struct command_context *cmd_ctx,
 	info->abstract_write_fpr_supported = true;
 
 	info->has_aampostincrement = YNM_MAYBE;
+	info->has_aarpostincrement = YNM_MAYBE;
 
 	return ERROR_OK;
 }
@@ -2686,6 +2840,101 @@ static int read_memory_bus_v0(struct target *target, target_addr_t address,
 	return ERROR_OK;
 }
 
+/**
+ * Read words [start, end) of a system bus read which already runs with
+ * sbreadondata set: each read of sbdata0 returns the current word and starts
+ * reading the next one. The reads are done in batches, and the next batch is
+ * always queued behind the one being collected. Both go out in one JTAG flush,
+ * so adapters which send commands while still filling the queue keep the wire
+ * busy while the next batch is encoded.
+ *
+ * @param next Set to the index of the first word which was not read. It is
+ * less than 'end' when DMI was busy and the read has to be started again.
+ */
+static int read_memory_bus_v1_stream(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t start, uint32_t end, uint8_t *buffer, uint32_t *next)
+{
+	RISCV013_INFO(info);
+	static const int sbdata[4] = {DM_SBDATA0, DM_SBDATA1, DM_SBDATA2, DM_SBDATA3};
+	assert(size <= 16);
+	const unsigned int reads_per_word = (size + 3) / 4;
+	const unsigned int idle = info->dmi_busy_delay + info->bus_master_read_delay;
+	struct riscv_batch *batch[2] = {NULL, NULL};
+	uint32_t batch_start[2], batch_end[2];
+	uint32_t queued = start;
+	unsigned int cur = 0;
+	int result = ERROR_OK;
+
+	*next = start;
+	while (*next < end) {
+		/* Queue the current batch, if not done yet, and the one after it. */
+		for (unsigned int n = 0; n < 2 && queued < end; n++) {
+			unsigned int b = cur ^ n;
+			if (batch[b])
+				continue;
+			batch[b] = riscv_batch_alloc(target, riscv013_batch_scans(target, idle), idle);
+			if (!batch[b]) {
+				result = ERROR_FAIL;
+				goto out;
+			}
+			batch_start[b] = queued;
+			while (queued < end && riscv_batch_available_scans(batch[b]) >= reads_per_word) {
+				for (int j = reads_per_word - 1; j >= 0; j--)
+					riscv_batch_add_dmi_read(batch[b], sbdata[j]);
+				queued++;
+			}
+			batch_end[b] = queued;
+			result = batch_queue(target, batch[b]);
+			if (result != ERROR_OK)
+				goto out;
+		}
+
+		result = batch_wait(target, batch[cur]);
+		if (result != ERROR_OK)
+			goto out;
+
+		size_t key = 0;
+		for (uint32_t i = batch_start[cur]; i < batch_end[cur]; i++) {
+			for (int j = reads_per_word - 1; j >= 0; j--) {
+				dmi_status_t status = riscv_batch_get_dmi_read_op(batch[cur], key);
+				if (status == DMI_STATUS_BUSY) {
+					/* The rest of this batch and the one behind it were ignored. */
+					increase_dmi_busy_delay(target);
+					goto out;
+				} else if (status != DMI_STATUS_SUCCESS) {
+					LOG_ERROR("Failed to read memory at " TARGET_ADDR_FMT "; status=%d",
+							address + i * size + j * 4, status);
+					result = ERROR_FAIL;
+					goto out;
+				}
+				uint32_t value = riscv_batch_get_dmi_read_data(batch[cur], key++);
+				buf_set_u32(buffer + i * size + j * 4, 0, 8 * MIN(size, 4), value);
+				log_memory_access(address + i * size + j * 4, value, MIN(size, 4), true);
+			}
+			*next = i + 1;
+		}
+		batch_clean(target, batch[cur]->used_scans);
+
+		riscv_batch_free(batch[cur]);
+		batch[cur] = NULL;
+		cur ^= 1;
+	}
+
+out:
+	/* The results of a batch left queued behind the current one are not
+	 * needed any more, but its scans must leave the JTAG queue before it is
+	 * freed. */
+	if (batch[0] || batch[1]) {
+		int retval = jtag_execute_queue();
+		if (retval != ERROR_OK && result == ERROR_OK)
+			result = retval;
+		for (unsigned int b = 0; b < 2; b++)
+			if (batch[b])
+				riscv_batch_free(batch[b]);
+	}
+	return result;
+}
+
 /**
  * Read the requested memory using the system bus interface.
  */
@@ -2700,6 +2949,7 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 	RISCV013_INFO(info);
 	target_addr_t next_address = address;
 	target_addr_t end_address = address + count * size;
+	unsigned int busy_restarts = 0;
 
 	while (next_address < end_address) {
 		uint32_t sbcs_write = set_field(0, DM_SBCS_SBREADONADDR, 1);
@@ -2711,8 +2961,9 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 		if (dmi_write(target, DM_SBCS, sbcs_write) != ERROR_OK)
 			return ERROR_FAIL;
 
-		/* This address write will trigger the first read. */
-		if (sb_write_address(target, next_address, true) != ERROR_OK)
+		/* This address write will trigger the first read. With increment 0
+		 * next_address only tracks the position in the buffer. */
+		if (sb_write_address(target, increment ? next_address : address, true) != ERROR_OK)
 			return ERROR_FAIL;
 
 		if (info->bus_master_read_delay) {
@@ -2726,57 +2977,26 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 		/* First value has been read, and is waiting for us to issue a DMI read
 		 * to get it. */
 
-		static int sbdata[4] = {DM_SBDATA0, DM_SBDATA1, DM_SBDATA2, DM_SBDATA3};
-		assert(size <= 16);
-		target_addr_t next_read = address - 1;
-		for (uint32_t i = (next_address - address) / size; i < count - 1; i++) {
-			for (int j = (size - 1) / 4; j >= 0; j--) {
-				uint32_t value;
-				unsigned attempt = 0;
-				while (1) {
-					if (attempt++ > 100) {
-						LOG_ERROR("DMI keeps being busy in while reading memory just past " TARGET_ADDR_FMT,
-								  next_read);
-						return ERROR_FAIL;
-					}
-					keep_alive();
-					dmi_status_t status = dmi_scan(target, NULL, &value,
-												   DMI_OP_READ, sbdata[j], 0, false);
-					if (status == DMI_STATUS_BUSY)
-						increase_dmi_busy_delay(target);
-					else if (status == DMI_STATUS_SUCCESS)
-						break;
-					else
-						return ERROR_FAIL;
-				}
-				if (next_read != address - 1) {
-					buf_set_u32(buffer + next_read - address, 0, 8 * MIN(size, 4), value);
-					log_memory_access(next_read, value, MIN(size, 4), true);
-				}
-				next_read = address + i * size + j * 4;
-			}
-		}
-
 		uint32_t sbcs_read = 0;
 		if (count > 1) {
-			uint32_t value;
-			unsigned attempt = 0;
-			while (1) {
-				if (attempt++ > 100) {
+			uint32_t next_index;
+			if (read_memory_bus_v1_stream(target, address, size,
+					(next_address - address) / size, count - 1, buffer,
+					&next_index) != ERROR_OK)
+				return ERROR_FAIL;
+
+			if (next_index < count - 1) {
+				/* DMI was busy, start again from the first word not read. */
+				if (busy_restarts++ > 100) {
 					LOG_ERROR("DMI keeps being busy in while reading memory just past " TARGET_ADDR_FMT,
-								next_read);
+							address + next_index * size);
 					return ERROR_FAIL;
 				}
-				dmi_status_t status = dmi_scan(target, NULL, &value, DMI_OP_NOP, 0, 0, false);
-				if (status == DMI_STATUS_BUSY)
-					increase_dmi_busy_delay(target);
-				else if (status == DMI_STATUS_SUCCESS)
-					break;
-				else
+				if (read_sbcs_nonbusy(target, &sbcs_read) != ERROR_OK)
 					return ERROR_FAIL;
+				next_address = address + next_index * size;
+				continue;
 			}
-			buf_set_u32(buffer + next_read - address, 0, 8 * MIN(size, 4), value);
-			log_memory_access(next_read, value, MIN(size, 4), true);
 
 			/* "Writes to sbcs while sbbusy is high result in undefined behavior.
 			 * A debugger must not write to sbcs until it reads sbbusy as 0." */
@@ -2823,6 +3043,192 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 	return ERROR_OK;
 }
 
+/* Batches queued into one JTAG queue execution, each one sized by the batch
+ * tuner. */
+struct sba_batches {
+	struct target *target;
+	struct riscv_batch **list;
+	unsigned int count;
+	unsigned int max_count;
+	unsigned int scans;
+	unsigned int idle;
+};
+
+/* Returns the batch to add the next scan to, NULL if it can't be allocated. */
+static struct riscv_batch *sba_batches_next(struct sba_batches *batches)
+{
+	if (batches->count > 0 && !riscv_batch_full(batches->list[batches->count - 1]))
+		return batches->list[batches->count - 1];
+	if (batches->count == batches->max_count)
+		return NULL;
+	struct riscv_batch *batch = riscv_batch_alloc(batches->target, batches->scans, batches->idle);
+	if (batch)
+		batches->list[batches->count++] = batch;
+	return batch;
+}
+
+static int sba_batches_write(struct sba_batches *batches, unsigned int address, uint32_t data)
+{
+	struct riscv_batch *batch = sba_batches_next(batches);
+	if (!batch)
+		return ERROR_FAIL;
+	riscv_batch_add_dmi_write(batch, address, data);
+	return ERROR_OK;
+}
+
+static int sba_batches_read(struct sba_batches *batches, unsigned int address)
+{
+	struct riscv_batch *batch = sba_batches_next(batches);
+	if (!batch)
+		return ERROR_FAIL;
+	riscv_batch_add_dmi_read(batch, address);
+	return ERROR_OK;
+}
+
+static int sba_read_write_u32(struct target *target, target_addr_t read_address,
+		uint32_t count, uint8_t *buffer, target_addr_t write_address,
+		uint32_t value, uint32_t *readback)
+{
+	RISCV013_INFO(info);
+
+	if (count == 0 || get_field(info->sbcs, DM_SBCS_SBVERSION) != 1 ||
+			!get_field(info->sbcs, DM_SBCS_SBACCESS32) ||
+			(read_address & 3) || (write_address & 3))
+		return ERROR_NOT_IMPLEMENTED;
+
+	bool wide = get_field(info->sbcs, DM_SBCS_SBASIZE) > 32;
+	uint32_t sbcs_read = set_field(sb_sbaccess(4), DM_SBCS_SBREADONADDR, 1);
+	/* The words, sbcs before it is written again, sbcs after the last word, the
+	 * readback and sbcs after the write. */
+	uint32_t reads = count + 4;
+	struct sba_batches batches = {
+		.target = target,
+		.idle = info->dmi_busy_delay +
+			MAX(info->bus_master_read_delay, info->bus_master_write_delay),
+	};
+	batches.scans = riscv013_batch_scans(target, batches.idle);
+	/* Besides the reads: up to 2 sbcs, 5 address and 1 data writes */
+	batches.max_count = DIV_ROUND_UP(reads + 8, batches.scans) + 1;
+	batches.list = calloc(batches.max_count, sizeof(*batches.list));
+	uint32_t *data = malloc(reads * sizeof(*data));
+	dmi_status_t status = DMI_STATUS_SUCCESS;
+	uint32_t poll_sbcs = 0, read_sbcs = 0, write_sbcs = 0, sbcs_now;
+	int result = ERROR_FAIL;
+
+	if (!batches.list || !data)
+		goto out;
+
+	/* All of it is queued before the JTAG queue is executed once. The DM starts
+	 * no bus access while sberror or sbbusyerror is set, so a failed read also
+	 * stops the write. */
+	select_dmi(target);
+	if (count > 1) {
+		/* Stream all words but the last one in. Every read of sbdata0 starts
+		 * reading the next word. */
+		uint32_t sbcs_stream = set_field(sbcs_read, DM_SBCS_SBAUTOINCREMENT, 1);
+		sbcs_stream = set_field(sbcs_stream, DM_SBCS_SBREADONDATA, 1);
+		result = sba_batches_write(&batches, DM_SBCS, sbcs_stream);
+	} else {
+		result = sba_batches_write(&batches, DM_SBCS, sbcs_read);
+	}
+	if (result == ERROR_OK && wide)
+		result = sba_batches_write(&batches, DM_SBADDRESS1, read_address >> 32);
+	if (result == ERROR_OK)
+		result = sba_batches_write(&batches, DM_SBADDRESS0, read_address);
+	for (uint32_t i = 0; result == ERROR_OK && i + 1 < count; i++)
+		result = sba_batches_read(&batches, DM_SBDATA0);
+	if (result == ERROR_OK && count > 1) {
+		/* sbcs must not be written while sbbusy is set. The idle cycles after the
+		 * last read give the bus access time to finish, and sbcs is read before
+		 * the write to check that it did. */
+		result = sba_batches_read(&batches, DM_SBCS);
+		if (result == ERROR_OK)
+			result = sba_batches_write(&batches, DM_SBCS, sbcs_read);
+	}
+
+	/* The last word is taken without starting another read. sbreadonaddr stays
+	 * set, so setting the write address also reads it before the write. */
+	if (result == ERROR_OK)
+		result = sba_batches_read(&batches, DM_SBDATA0);
+	if (result == ERROR_OK)
+		result = sba_batches_read(&batches, DM_SBCS);
+	if (result == ERROR_OK && wide)
+		result = sba_batches_write(&batches, DM_SBADDRESS1, write_address >> 32);
+	if (result == ERROR_OK)
+		result = sba_batches_write(&batches, DM_SBADDRESS0, write_address);
+	if (result == ERROR_OK)
+		result = sba_batches_write(&batches, DM_SBDATA0, value);
+	if (result == ERROR_OK)
+		result = sba_batches_write(&batches, DM_SBADDRESS0, write_address);
+	if (result == ERROR_OK)
+		result = sba_batches_read(&batches, DM_SBDATA0);
+	if (result == ERROR_OK)
+		result = sba_batches_read(&batches, DM_SBCS);
+
+	for (unsigned int i = 0; result == ERROR_OK && i < batches.count; i++)
+		result = batch_queue(target, batches.list[i]);
+	unsigned int scans = 0;
+	uint32_t read = 0;
+	for (unsigned int i = 0; result == ERROR_OK && i < batches.count; i++) {
+		struct riscv_batch *batch = batches.list[i];
+		result = batch_wait(target, batch);
+		for (size_t key = 0; result == ERROR_OK && key < batch->read_keys_used; key++)
+			data[read++] = riscv_batch_get_dmi_read_data(batch, key);
+		scans += batch->used_scans;
+		/* DMI busy is sticky, so the status of the last read covers all of them. */
+		if (result == ERROR_OK && batch->read_keys_used > 0)
+			status = riscv_batch_get_dmi_read_op(batch, batch->read_keys_used - 1);
+	}
+	if (result != ERROR_OK)
+		goto out;
+	assert(read == reads);
+
+	/* Data is copied even on failure. When the write happened, the reads before
+	 * it were complete. */
+	read = 0;
+	for (uint32_t i = 0; i + 1 < count; i++)
+		buf_set_u32(buffer + i * 4, 0, 32, data[read++]);
+	if (count > 1)
+		poll_sbcs = data[read++];
+	buf_set_u32(buffer + (count - 1) * 4, 0, 32, data[read++]);
+	read_sbcs = data[read++];
+	uint32_t readback_value = data[read++];
+	write_sbcs = data[read++];
+
+	if (status == DMI_STATUS_SUCCESS && !get_field(poll_sbcs, DM_SBCS_SBBUSY) &&
+			!get_field(read_sbcs, DM_SBCS_SBERROR) && !get_field(read_sbcs, DM_SBCS_SBBUSYERROR) &&
+			!get_field(write_sbcs, DM_SBCS_SBERROR) && !get_field(write_sbcs, DM_SBCS_SBBUSYERROR)) {
+		for (uint32_t i = 0; i < count; i++)
+			log_memory_access(read_address + i * 4, buf_get_u32(buffer + i * 4, 0, 32), 4, true);
+		*readback = readback_value;
+		log_memory_access(write_address, value, 4, false);
+		batch_clean(target, scans);
+		goto out;
+	}
+
+	result = ERROR_FAIL;
+	LOG_DEBUG("System bus read/write failed: status=%d, sbcs=0x%x, 0x%x, 0x%x",
+			status, poll_sbcs, read_sbcs, write_sbcs);
+	if (status == DMI_STATUS_BUSY)
+		increase_dmi_busy_delay(target);
+	if (read_sbcs_nonbusy(target, &sbcs_now) != ERROR_OK)
+		goto out;
+	if (get_field(poll_sbcs, DM_SBCS_SBBUSY) || get_field(sbcs_now, DM_SBCS_SBBUSYERROR)) {
+		/* Slow down before trying again. */
+		info->bus_master_read_delay += info->bus_master_read_delay / 10 + 1;
+		info->bus_master_write_delay += info->bus_master_write_delay / 10 + 1;
+	}
+	if (get_field(sbcs_now, DM_SBCS_SBERROR) || get_field(sbcs_now, DM_SBCS_SBBUSYERROR))
+		dmi_write(target, DM_SBCS, DM_SBCS_SBERROR | DM_SBCS_SBBUSYERROR);
+
+out:
+	for (unsigned int i = 0; i < batches.count; i++)
+		riscv_batch_free(batches.list[i]);
+	free(batches.list);
+	free(data);
+	return result;
+}
+
 static void log_mem_access_result(struct target *target, bool success, int method, bool read)
 {
 	RISCV_INFO(r);
@@ -3172,7 +3578,8 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 		 * dm_data0 contains[read_addr-size*2]
 		 */
 
-		struct riscv_batch *batch = riscv_batch_alloc(target, RISCV_BATCH_ALLOC_SIZE,
+		struct riscv_batch *batch = riscv_batch_alloc(target,
+				riscv013_batch_scans(target, info->dmi_busy_delay + info->ac_busy_delay),
 				info->dmi_busy_delay + info->ac_busy_delay);
 		if (!batch)
 			return ERROR_FAIL;
@@ -3194,7 +3601,9 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 		 * and update our copy of cmderr. If we see that DMI is busy here,
 		 * dmi_busy_delay will be incremented. */
 		uint32_t abstractcs;
-		if (dmi_read(target, &abstractcs, DM_ABSTRACTCS) != ERROR_OK)
+		bool dmi_busy_encountered;
+		if (dmi_op(target, &abstractcs, &dmi_busy_encountered, DMI_OP_READ,
+				DM_ABSTRACTCS, 0, false, true) != ERROR_OK)
 			return ERROR_FAIL;
 		while (get_field(abstractcs, DM_ABSTRACTCS_BUSY))
 			if (dmi_read(target, &abstractcs, DM_ABSTRACTCS) != ERROR_OK)
@@ -3206,6 +3615,8 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 		switch (info->cmderr) {
 			case CMDERR_NONE:
 				LOG_DEBUG("successful (partial?) memory read");
+				if (!dmi_busy_encountered)
+					batch_clean(target, batch->used_scans);
 				next_index = index + reads;
 				break;
 			case CMDERR_BUSY:
@@ -3681,7 +4092,8 @@ static int write_memory_bus_v1(struct target *target, target_addr_t address,
 
 		struct riscv_batch *batch = riscv_batch_alloc(
 				target,
-				RISCV_BATCH_ALLOC_SIZE,
+				riscv013_batch_scans(target,
+					info->dmi_busy_delay + info->bus_master_write_delay),
 				info->dmi_busy_delay + info->bus_master_write_delay);
 		if (!batch)
 			return ERROR_FAIL;
@@ -3726,6 +4138,7 @@ static int write_memory_bus_v1(struct target *target, target_addr_t address,
 
 		/* Execute the batch of writes */
 		result = batch_run(target, batch);
+		unsigned int batch_scans = batch->used_scans;
 		riscv_batch_free(batch);
 		if (result != ERROR_OK)
 			return result;
@@ -3775,6 +4188,7 @@ static int write_memory_bus_v1(struct target *target, target_addr_t address,
 			/* Try again - resume writing. */
 			continue;
 		}
+		batch_clean(target, batch_scans);
 
 		unsigned int sberror = get_field(sbcs, DM_SBCS_SBERROR);
 		if (sberror != 0) {
@@ -3876,7 +4290,7 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 
 		struct riscv_batch *batch = riscv_batch_alloc(
 				target,
-				RISCV_BATCH_ALLOC_SIZE,
+				riscv013_batch_scans(target, info->dmi_busy_delay + info->ac_busy_delay),
 				info->dmi_busy_delay + info->ac_busy_delay);
 		if (!batch)
 			goto error;
@@ -3933,6 +4347,7 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 		}
 
 		result = batch_run(target, batch);
+		unsigned int batch_scans = batch->used_scans;
 		riscv_batch_free(batch);
 		if (result != ERROR_OK)
 			goto error;
@@ -3953,6 +4368,7 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 		info->cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
 		if (info->cmderr == CMDERR_NONE && !dmi_busy_encountered) {
 			LOG_DEBUG("successful (partial?) memory write");
+			batch_clean(target, batch_scans);
 		} else if (info->cmderr == CMDERR_BUSY || dmi_busy_encountered) {
 			if (info->cmderr == CMDERR_BUSY)
 				LOG_DEBUG("Memory write resulted in abstract command busy response.");
@@ -4089,7 +4505,11 @@ static int riscv013_get_register(struct target *target,
 		return ERROR_FAIL;
 
 	int result = ERROR_OK;
-	if (rid == GDB_REGNO_PC) {
+	struct reg *dpc = target->reg_cache ? &target->reg_cache->reg_list[GDB_REGNO_DPC] : NULL;
+	if (rid == GDB_REGNO_PC && dpc && dpc->valid) {
+		*value = buf_get_u64(dpc->value, 0, dpc->size);
+		LOG_DEBUG("[%d] read PC from DPC: 0x%" PRIx64 " (cached)", target->coreid, *value);
+	} else if (rid == GDB_REGNO_PC) {
 		/* TODO: move this into riscv.c. */
 		result = register_read(target, value, GDB_REGNO_DPC);
 		LOG_DEBUG("[%d] read PC from DPC: 0x%" PRIx64, target->coreid, *value);
@@ -4122,6 +4542,8 @@ static int riscv013_set_register(struct target *target, int rid, uint64_t value)
 		uint64_t actual_value;
 		register_read_direct(target, &actual_value, GDB_REGNO_DPC);
 		LOG_DEBUG("[%d]   actual DPC written: 0x%016" PRIx64, target->coreid, actual_value);
+		if (target->reg_cache)
+			target->reg_cache->reg_list[GDB_REGNO_DPC].valid = false;
 		if (value != actual_value) {
 			LOG_ERROR("Written PC (0x%" PRIx64 ") does not match read back "
 					"value (0x%" PRIx64 ")", value, actual_value);
@@ -4129,9 +4551,13 @@ static int riscv013_set_register(struct target *target, int rid, uint64_t value)
 		}
 	} else if (rid == GDB_REGNO_PRIV) {
 		uint64_t dcsr;
-		register_read(target, &dcsr, GDB_REGNO_DCSR);
+		if (register_read(target, &dcsr, GDB_REGNO_DCSR) != ERROR_OK)
+			return ERROR_FAIL;
 		dcsr = set_field(dcsr, CSR_DCSR_PRV, get_field(value, VIRT_PRIV_PRV));
 		dcsr = set_field(dcsr, CSR_DCSR_V, get_field(value, VIRT_PRIV_V));
+		/* the cached DCSR, e.g. from the halt prefetch, is stale now */
+		if (target->reg_cache)
+			target->reg_cache->reg_list[GDB_REGNO_DCSR].valid = false;
 		return register_write_direct(target, GDB_REGNO_DCSR, dcsr);
 	} else {
 		return register_write_direct(target, rid, value);
@@ -4295,6 +4721,141 @@ static int riscv013_on_step(struct target *target)
 	return riscv013_on_step_or_resume(target, true);
 }
 
+static void prefetch_add_read(struct riscv_batch *batch, unsigned int size, size_t keys[2])
+{
+	if (size > 32)
+		keys[1] = riscv_batch_add_dmi_read(batch, DM_DATA1);
+	keys[0] = riscv_batch_add_dmi_read(batch, DM_DATA0);
+}
+
+static uint64_t prefetch_get_value(struct riscv_batch *batch, unsigned int size, size_t keys[2])
+{
+	uint64_t value = riscv_batch_get_dmi_read_data(batch, keys[0]);
+	if (size > 32)
+		value |= (uint64_t)riscv_batch_get_dmi_read_data(batch, keys[1]) << 32;
+	return value;
+}
+
+/* Read the GPRs, DPC and DCSR into the register cache in one batch. The GPRs
+ * are read by a single access register command with aarpostincrement set,
+ * which autoexec runs again for the next register on every read of data0. */
+static int riscv013_prefetch_registers(struct target *target)
+{
+	RISCV013_INFO(info);
+
+	if (!target->reg_cache || info->has_aarpostincrement == YNM_NO)
+		return ERROR_OK;
+	if (riscv_select_current_hart(target) != ERROR_OK)
+		return ERROR_FAIL;
+
+	static const enum gdb_regno csrs[] = { GDB_REGNO_DPC, GDB_REGNO_DCSR };
+	unsigned int gpr_count = riscv_supports_extension(target, 'E') ? 15 : 31;
+	unsigned int csr_count = info->abstract_read_csr_supported ? ARRAY_SIZE(csrs) : 0;
+	enum gdb_regno regnos[31 + ARRAY_SIZE(csrs)];
+	size_t keys[31 + ARRAY_SIZE(csrs)][2];
+	unsigned int count = 0;
+
+	struct riscv_batch *batch = riscv_batch_alloc(target,
+			2 * (gpr_count + csr_count) + 3 * csr_count + 8,
+			info->dmi_busy_delay + info->ac_busy_delay);
+	if (!batch)
+		return ERROR_FAIL;
+
+	unsigned int gpr_size = register_size(target, GDB_REGNO_RA);
+	riscv_batch_add_dmi_write(batch, DM_COMMAND, access_register_command(target,
+			GDB_REGNO_RA, gpr_size,
+			AC_ACCESS_REGISTER_TRANSFER | AC_ACCESS_REGISTER_AARPOSTINCREMENT));
+	riscv_batch_add_dmi_write(batch, DM_ABSTRACTAUTO, 1 << DM_ABSTRACTAUTO_AUTOEXECDATA_OFFSET);
+	for (unsigned int i = 1; i <= gpr_count; i++) {
+		/* Do not start a read past the last GPR. */
+		if (i == gpr_count)
+			riscv_batch_add_dmi_write(batch, DM_ABSTRACTAUTO, 0);
+		regnos[count] = GDB_REGNO_ZERO + i;
+		prefetch_add_read(batch, gpr_size, keys[count++]);
+	}
+	size_t gpr_abstractcs_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+
+	for (unsigned int i = 0; i < csr_count; i++) {
+		unsigned int size = register_size(target, csrs[i]);
+		riscv_batch_add_dmi_write(batch, DM_COMMAND, access_register_command(target,
+				csrs[i], size, AC_ACCESS_REGISTER_TRANSFER));
+		regnos[count] = csrs[i];
+		prefetch_add_read(batch, size, keys[count++]);
+	}
+	size_t abstractcs_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+
+	select_dmi(target);
+	int result = batch_run(target, batch);
+	if (result != ERROR_OK) {
+		riscv_batch_free(batch);
+		dmi_write(target, DM_ABSTRACTAUTO, 0);
+		return result;
+	}
+
+	/* DMI busy is sticky, so the status of the last read covers all of them. */
+	dmi_status_t status = riscv_batch_get_dmi_read_op(batch, abstractcs_key);
+	uint32_t gpr_abstractcs = riscv_batch_get_dmi_read_data(batch, gpr_abstractcs_key);
+	uint32_t abstractcs = riscv_batch_get_dmi_read_data(batch, abstractcs_key);
+	if (status != DMI_STATUS_SUCCESS || get_field(abstractcs, DM_ABSTRACTCS_BUSY) ||
+			get_field(abstractcs, DM_ABSTRACTCS_CMDERR) != CMDERR_NONE) {
+		riscv_batch_free(batch);
+		LOG_DEBUG("Register prefetch failed: status=%d, abstractcs=0x%x, 0x%x",
+				status, gpr_abstractcs, abstractcs);
+		if (status == DMI_STATUS_BUSY)
+			increase_dmi_busy_delay(target);
+		dmi_write(target, DM_ABSTRACTAUTO, 0);
+		if (wait_for_idle(target, &abstractcs) != ERROR_OK)
+			return ERROR_FAIL;
+		info->cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
+		if (info->cmderr == CMDERR_BUSY) {
+			increase_ac_busy_delay(target);
+		} else if (info->cmderr == CMDERR_NOT_SUPPORTED) {
+			if (get_field(gpr_abstractcs, DM_ABSTRACTCS_CMDERR) == CMDERR_NOT_SUPPORTED) {
+				LOG_INFO("Disabling register prefetch, aarpostincrement is not supported.");
+				info->has_aarpostincrement = YNM_NO;
+			} else if (get_field(gpr_abstractcs, DM_ABSTRACTCS_CMDERR) == CMDERR_NONE) {
+				LOG_INFO("Disabling abstract command reads from CSRs.");
+				info->abstract_read_csr_supported = false;
+			}
+		}
+		if (info->cmderr != CMDERR_NONE)
+			riscv013_clear_abstract_error(target);
+		return ERROR_FAIL;
+	}
+
+	batch_clean(target, batch->used_scans);
+
+	uint64_t values[31 + ARRAY_SIZE(csrs)];
+	for (unsigned int i = 0; i < count; i++)
+		values[i] = prefetch_get_value(batch, register_size(target, regnos[i]), keys[i]);
+	riscv_batch_free(batch);
+
+	if (info->has_aarpostincrement == YNM_MAYBE) {
+		/* A DM that ignores aarpostincrement reads the first GPR over and
+		 * over. Only trust the snapshot once the last one tells them apart. */
+		uint64_t last;
+		if (register_read_direct(target, &last, regnos[gpr_count - 1]) != ERROR_OK)
+			return ERROR_FAIL;
+		if (last != values[gpr_count - 1]) {
+			LOG_INFO("Disabling register prefetch, aarpostincrement is not supported.");
+			info->has_aarpostincrement = YNM_NO;
+			return ERROR_FAIL;
+		}
+		if (last == values[0])
+			return ERROR_OK;
+		info->has_aarpostincrement = YNM_YES;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		struct reg *reg = &target->reg_cache->reg_list[regnos[i]];
+		if (!reg->exist || reg->valid)
+			continue;
+		buf_set_u64(reg->value, 0, reg->size, values[i]);
+		reg->valid = true;
+	}
+	return ERROR_OK;
+}
+
 static int riscv013_on_halt(struct target *target)
 {
 	return ERROR_OK;
@@ -508,6 +508,7 @@ static void riscv_deinit_target(struct target *target)
 		free(entry);
 	}
 
+	jtag_scan_template_free(info->batch_tmpl);
 	free(info->reg_names);
 	free(target->arch_info);
 
@@ -1180,6 +1181,13 @@ int halt_prep(struct target *target)
 	return ERROR_OK;
 }
 
+static void riscv_prefetch_registers(struct target *target)
+{
+	RISCV_INFO(r);
+	if (r->prefetch_registers && r->prefetch_registers(target) != ERROR_OK)
+		LOG_DEBUG("[%s] register prefetch failed", target_name(target));
+}
+
 int riscv_halt_go_all_harts(struct target *target)
 {
 	RISCV_INFO(r);
@@ -1194,6 +1202,7 @@ int riscv_halt_go_all_harts(struct target *target)
 	}
 
 	riscv_invalidate_register_cache(target);
+	riscv_prefetch_registers(target);
 
 	return ERROR_OK;
 }
@@ -1969,9 +1978,9 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 	return ERROR_OK;
 }
 
-static int riscv_checksum_memory(struct target *target,
+int riscv_run_checksum_algorithm(struct target *target,
 		target_addr_t address, uint32_t count,
-		uint32_t *checksum)
+		uint32_t *checksum, void *arch_info)
 {
 	struct working_area *crc_algorithm;
 	struct reg_param reg_params[2];
@@ -2038,7 +2047,7 @@ static int riscv_checksum_memory(struct target *target,
 	retval = target_run_algorithm(target, 0, NULL, 2, reg_params,
 			crc_algorithm->address,
 			0,	/* Leave exit point unspecified because we don't know. */
-			timeout, NULL);
+			timeout, arch_info);
 
 	if (retval == ERROR_OK)
 		*checksum = buf_get_u32(reg_params[0].value, 0, 32);
@@ -2055,6 +2064,13 @@ static int riscv_checksum_memory(struct target *target,
 	return retval;
 }
 
+static int riscv_checksum_memory(struct target *target,
+		target_addr_t address, uint32_t count,
+		uint32_t *checksum)
+{
+	return riscv_run_checksum_algorithm(target, address, count, checksum, NULL);
+}
+
 /*** OpenOCD Helper Functions ***/
 
 enum riscv_poll_hart {
@@ -2077,6 +2093,7 @@ static enum riscv_poll_hart riscv_poll_hart(struct target *target, int hartid)
 	if (target->state != TARGET_HALTED && halted) {
 		LOG_DEBUG("  triggered a halt");
 		r->on_halt(target);
+		riscv_prefetch_registers(target);
 		return RPH_DISCOVERED_HALTED;
 	} else if (target->state != TARGET_RUNNING && target->state != TARGET_DEBUG_RUNNING && !halted) {
 		LOG_DEBUG("  triggered running");
@@ -2320,6 +2337,8 @@ int riscv_openocd_step(struct target *target, int current,
 	}
 
 	register_cache_invalidate(target->reg_cache);
+	if (success)
+		riscv_prefetch_registers(target);
 
 	if (info->isrmask_mode == RISCV_ISRMASK_STEPONLY)
 		if (riscv_interrupts_restore(target, current_mstatus) != ERROR_OK) {
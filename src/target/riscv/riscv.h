@@ -161,6 +161,10 @@ typedef struct {
 	int (*resume_go)(struct target *target);
 	int (*step_current_hart)(struct target *target);
 	int (*on_halt)(struct target *target);
+	/* Fill the register cache of a hart that just halted, so the register
+	 * reads that usually follow are served without accessing the target.
+	 * Failure only means registers are read on demand. Optional. */
+	int (*prefetch_registers)(struct target *target);
 
 	/* Indicates that target was reset.*/
 	int (*on_reset)(struct target *target);
@@ -198,6 +202,20 @@ typedef struct {
 	int (*read_memory)(struct target *target, target_addr_t address,
 			uint32_t size, uint32_t count, uint8_t *buffer, uint32_t increment);
 
+	/* Reads 'count' 32-bit words at 'read_address', then writes 'value' to
+	 * 'write_address' and reads it back, all over the system bus in a single
+	 * JTAG queue execution. The write is not done if the read fails, so when
+	 * it was done 'buffer' holds the words even if an error is returned.
+	 * Returns ERROR_OK only when all of it succeeded. Optional. */
+	int (*sba_read_write_u32)(struct target *target, target_addr_t read_address,
+			uint32_t count, uint8_t *buffer, target_addr_t write_address,
+			uint32_t value, uint32_t *readback);
+
+	/* Returns the number of 32-bit words a system bus read transfers in one
+	 * DMI batch. Setting up the bus access and checking sbcs afterwards takes
+	 * a few more JTAG queue executions per read. Optional. */
+	unsigned int (*sba_read_batch_words)(struct target *target);
+
 	/* How many harts are attached to the DM that this target is attached to? */
 	int (*hart_count)(struct target *target);
 	unsigned (*data_bits)(struct target *target);
@@ -242,6 +260,12 @@ typedef struct {
 
 	riscv_sample_config_t sample_config;
 	struct riscv_sample_buf sample_buf;
+
+	/* DMI scan (and the idle cycles after it) recorded by riscv_batch_queue(),
+	 * kept as long as the DMI scan length and idle count stay the same. */
+	struct jtag_scan_template *batch_tmpl;
+	unsigned int batch_tmpl_bits;
+	size_t batch_tmpl_idle;
 } riscv_info_t;
 
 COMMAND_HELPER(riscv_print_info_line, const char *section, const char *key,
@@ -409,6 +433,12 @@ void riscv_add_bscan_tunneled_scan(struct target *target, struct scan_field *fie
 int riscv_read_by_any_size(struct target *target, target_addr_t address, uint32_t size, uint8_t *buffer);
 int riscv_write_by_any_size(struct target *target, target_addr_t address, uint32_t size, uint8_t *buffer);
 
+/* Computes the CRC of the memory with the checksum algorithm running on the
+ * target. 'arch_info' is passed to target_run_algorithm(). */
+int riscv_run_checksum_algorithm(struct target *target,
+		target_addr_t address, uint32_t count,
+		uint32_t *checksum, void *arch_info);
+
 int riscv_interrupts_disable(struct target *target, uint64_t ie_mask, uint64_t *old_mstatus);
 int riscv_interrupts_restore(struct target *target, uint64_t old_mstatus);
 
@@ -41,7 +41,10 @@
 #include "config.h"
 #endif
 
+#include <sys/stat.h>
+
 #include <helper/align.h>
+#include <helper/configuration.h>
 #include <helper/time_support.h>
 #include <jtag/jtag.h>
 #include <flash/nor/core.h>
@@ -3716,9 +3719,38 @@ static COMMAND_HELPER(parse_load_image_command, struct image *image,
 	return ERROR_OK;
 }
 
+/* Points *data at a whole image section. Sections which are not held in host
+ * memory are read into a buffer returned in *copy, to be freed by the caller. */
+static COMMAND_HELPER(image_section_get, struct image *image, unsigned int section,
+		const uint8_t **data, uint8_t **copy, size_t *size)
+{
+	*copy = NULL;
+	if (image_section_data(image, section, 0x0, image->sections[section].size, data) == ERROR_OK) {
+		*size = image->sections[section].size;
+		return ERROR_OK;
+	}
+
+	*copy = malloc(image->sections[section].size);
+	if (!*copy) {
+		command_print(CMD, "error allocating buffer for section (%" PRIu32 " bytes)",
+				image->sections[section].size);
+		return ERROR_FAIL;
+	}
+
+	int retval = image_read_section(image, section, 0x0, image->sections[section].size, *copy, size);
+	if (retval != ERROR_OK) {
+		free(*copy);
+		*copy = NULL;
+		return retval;
+	}
+	*data = *copy;
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_load_image_command)
 {
-	uint8_t *buffer;
+	const uint8_t *buffer;
+	uint8_t *copy;
 	size_t buf_cnt;
 	uint32_t image_size;
 	target_addr_t min_address = 0;
@@ -3741,20 +3773,9 @@ COMMAND_HANDLER(handle_load_image_command)
 	image_size = 0x0;
 	retval = ERROR_OK;
 	for (unsigned int i = 0; i < image.num_sections; i++) {
-		buffer = malloc(image.sections[i].size);
-		if (!buffer) {
-			command_print(CMD,
-						  "error allocating buffer for section (%d bytes)",
-						  (int)(image.sections[i].size));
-			retval = ERROR_FAIL;
-			break;
-		}
-
-		retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
-		if (retval != ERROR_OK) {
-			free(buffer);
+		retval = CALL_COMMAND_HANDLER(image_section_get, &image, i, &buffer, &copy, &buf_cnt);
+		if (retval != ERROR_OK)
 			break;
-		}
 
 		uint32_t offset = 0;
 		uint32_t length = buf_cnt;
@@ -3776,7 +3797,7 @@ COMMAND_HANDLER(handle_load_image_command)
 			retval = target_write_buffer(target,
 					image.sections[i].base_address + offset, length, buffer + offset);
 			if (retval != ERROR_OK) {
-				free(buffer);
+				free(copy);
 				break;
 			}
 			image_size += length;
@@ -3785,7 +3806,7 @@ COMMAND_HANDLER(handle_load_image_command)
 					image.sections[i].base_address + offset);
 		}
 
-		free(buffer);
+		free(copy);
 	}
 
 	if ((retval == ERROR_OK) && (duration_measure(&bench) == ERROR_OK)) {
@@ -3870,7 +3891,8 @@ enum verify_mode {
 
 static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode verify)
 {
-	uint8_t *buffer;
+	const uint8_t *buffer;
+	uint8_t *copy;
 	size_t buf_cnt;
 	uint32_t image_size;
 	int retval;
@@ -3912,35 +3934,26 @@ static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode ver
 	int diffs = 0;
 	retval = ERROR_OK;
 	for (unsigned int i = 0; i < image.num_sections; i++) {
-		buffer = malloc(image.sections[i].size);
-		if (!buffer) {
-			command_print(CMD,
-					"error allocating buffer for section (%" PRIu32 " bytes)",
-					image.sections[i].size);
-			break;
-		}
-		retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
-		if (retval != ERROR_OK) {
-			free(buffer);
+		retval = CALL_COMMAND_HANDLER(image_section_get, &image, i, &buffer, &copy, &buf_cnt);
+		if (retval != ERROR_OK)
 			break;
-		}
 
 		if (verify >= IMAGE_VERIFY) {
 			/* calculate checksum of image */
 			retval = image_calculate_checksum(buffer, buf_cnt, &checksum);
 			if (retval != ERROR_OK) {
-				free(buffer);
+				free(copy);
 				break;
 			}
 
 			retval = target_checksum_memory(target, image.sections[i].base_address, buf_cnt, &mem_checksum);
 			if (retval != ERROR_OK) {
-				free(buffer);
+				free(copy);
 				break;
 			}
 			if ((checksum != mem_checksum) && (verify == IMAGE_CHECKSUM_ONLY)) {
 				LOG_ERROR("checksum mismatch");
-				free(buffer);
+				free(copy);
 				retval = ERROR_FAIL;
 				goto done;
 			}
@@ -3967,7 +3980,7 @@ static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode ver
 							if (diffs++ >= 127) {
 								command_print(CMD, "More than 128 errors, the rest are not printed.");
 								free(data);
-								free(buffer);
+								free(copy);
 								goto done;
 							}
 						}
@@ -3982,7 +3995,7 @@ static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode ver
 						  buf_cnt);
 		}
 
-		free(buffer);
+		free(copy);
 		image_size += buf_cnt;
 	}
 	if (diffs > 0)
@@ -6667,6 +6680,11 @@ struct fast_load {
 
 static int fastload_num;
 static struct fast_load *fastload;
+static char *fastload_cache_dir;
+/* Also key cache entries on a CRC of the image file contents */
+static bool fastload_cache_content;
+
+#define FAST_LOAD_CACHE_MAGIC	0x4f464c31	/* "OFL1" */
 
 static void free_fastload(void)
 {
@@ -6676,11 +6694,201 @@ static void free_fastload(void)
 		free(fastload);
 		fastload = NULL;
 	}
+	fastload_num = 0;
+}
+
+/* CRC of the file contents. The file is mapped where possible, but the whole
+ * file is still read, debug info included. */
+static int fast_load_file_checksum(const char *path, uint32_t *checksum)
+{
+	struct fileio *fileio;
+	int retval = fileio_open(&fileio, path, FILEIO_READ, FILEIO_BINARY);
+	if (retval != ERROR_OK)
+		return retval;
+
+	size_t size;
+	const uint8_t *data = NULL;
+	uint8_t *copy = NULL;
+	retval = fileio_size(fileio, &size);
+	if (retval == ERROR_OK && size > 0 && fileio_map(fileio, &data) != ERROR_OK) {
+		size_t read;
+		copy = malloc(size);
+		if (!copy)
+			retval = ERROR_FAIL;
+		if (retval == ERROR_OK)
+			retval = fileio_read(fileio, size, copy, &read);
+		if (retval == ERROR_OK && read != size)
+			retval = ERROR_FAIL;
+		data = copy;
+	}
+	if (retval == ERROR_OK)
+		retval = image_calculate_checksum(data, size, checksum);
+	free(copy);
+	fileio_close(fileio);
+	return retval;
+}
+
+/* Describes the image file and the arguments it is loaded with, NULL if the
+ * file is not found. The file contents are only part of it when requested,
+ * path, size and modification time are enough to catch rebuilds. */
+static char *fast_load_cache_key(const char *url, const char *type, struct image *image,
+		target_addr_t min_address, target_addr_t max_address)
+{
+	char *path = find_file(url);
+	if (!path)
+		return NULL;
+
+	struct stat st;
+	uint32_t checksum = 0;
+	if (stat(path, &st) != 0 ||
+			(fastload_cache_content && fast_load_file_checksum(path, &checksum) != ERROR_OK)) {
+		free(path);
+		return NULL;
+	}
+	long mtime_nsec = 0;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+
+	char *key = alloc_printf("%s %s %lld %lld.%09ld %d %08" PRIx32 " %d %lld " TARGET_ADDR_FMT " " TARGET_ADDR_FMT,
+			path, type ? type : "", (long long)st.st_size, (long long)st.st_mtime, mtime_nsec,
+			fastload_cache_content, checksum, image->base_address_set, image->base_address,
+			min_address, max_address);
+	free(path);
+	return key;
+}
+
+static int fast_load_cache_read(const char *file, const char *key)
+{
+	struct stat st;
+	if (stat(file, &st) != 0)
+		return ERROR_FAIL;
+
+	struct fileio *fileio;
+	int retval = fileio_open(&fileio, file, FILEIO_READ, FILEIO_BINARY);
+	if (retval != ERROR_OK)
+		return retval;
+
+	uint32_t magic, key_len, num;
+	char *file_key = NULL;
+	size_t read, left;
+	/* Counts and lengths must fit into the rest of the file, a damaged
+	 * file must not make us allocate huge buffers. */
+	retval = fileio_size(fileio, &left);
+	if (retval == ERROR_OK && left < 12 + strlen(key))
+		retval = ERROR_FAIL;
+	if (retval == ERROR_OK)
+		retval = fileio_read_u32(fileio, &magic);
+	if (retval == ERROR_OK)
+		retval = fileio_read_u32(fileio, &key_len);
+	if (retval == ERROR_OK && (magic != FAST_LOAD_CACHE_MAGIC || key_len != strlen(key)))
+		retval = ERROR_FAIL;
+	if (retval == ERROR_OK) {
+		file_key = malloc(key_len);
+		if (!file_key)
+			retval = ERROR_FAIL;
+	}
+	if (retval == ERROR_OK)
+		retval = fileio_read(fileio, key_len, file_key, &read);
+	if (retval == ERROR_OK && (read != key_len || memcmp(file_key, key, key_len) != 0))
+		retval = ERROR_FAIL;
+	free(file_key);
+	if (retval == ERROR_OK) {
+		left -= 12 + strlen(key);
+		retval = fileio_read_u32(fileio, &num);
+	}
+	if (retval == ERROR_OK && num > left / 12)
+		retval = ERROR_FAIL;
+	if (retval == ERROR_OK) {
+		fastload = calloc(num, sizeof(struct fast_load));
+		if (!fastload)
+			retval = ERROR_FAIL;
+	}
+
+	for (uint32_t i = 0; retval == ERROR_OK && i < num; i++) {
+		uint32_t address_hi, address_lo, length;
+		retval = fileio_read_u32(fileio, &address_hi);
+		if (retval == ERROR_OK)
+			retval = fileio_read_u32(fileio, &address_lo);
+		if (retval == ERROR_OK)
+			retval = fileio_read_u32(fileio, &length);
+		if (retval == ERROR_OK && ((uint64_t)length + 12 > left || length > INT_MAX))
+			retval = ERROR_FAIL;
+		if (retval != ERROR_OK)
+			break;
+		left -= 12 + length;
+
+		fastload[i].address = ((uint64_t)address_hi << 32) | address_lo;
+		fastload[i].length = length;
+		fastload[i].data = malloc(length);
+		fastload_num = i + 1;
+		if (!fastload[i].data) {
+			retval = ERROR_FAIL;
+			break;
+		}
+		retval = fileio_read(fileio, length, fastload[i].data, &read);
+		if (retval == ERROR_OK && read != length)
+			retval = ERROR_FAIL;
+	}
+
+	fileio_close(fileio);
+	if (retval != ERROR_OK) {
+		LOG_DEBUG("fast_load cache %s not usable", file);
+		free_fastload();
+	}
+	return retval;
+}
+
+static int fast_load_cache_write(const char *file, const char *key)
+{
+	/* Each instance writes its own file, so two instances storing the same
+	 * entry cannot interleave their writes */
+	char *tmp_file = alloc_printf("%s.%ld.tmp", file, (long)getpid());
+	if (!tmp_file)
+		return ERROR_FAIL;
+
+	struct fileio *fileio;
+	int retval = fileio_open(&fileio, tmp_file, FILEIO_WRITE, FILEIO_BINARY);
+	if (retval != ERROR_OK) {
+		free(tmp_file);
+		return retval;
+	}
+
+	size_t written;
+	retval = fileio_write_u32(fileio, FAST_LOAD_CACHE_MAGIC);
+	if (retval == ERROR_OK)
+		retval = fileio_write_u32(fileio, strlen(key));
+	if (retval == ERROR_OK)
+		retval = fileio_write(fileio, strlen(key), key, &written);
+	if (retval == ERROR_OK)
+		retval = fileio_write_u32(fileio, fastload_num);
+	for (int i = 0; retval == ERROR_OK && i < fastload_num; i++) {
+		retval = fileio_write_u32(fileio, (uint64_t)fastload[i].address >> 32);
+		if (retval == ERROR_OK)
+			retval = fileio_write_u32(fileio, fastload[i].address);
+		if (retval == ERROR_OK)
+			retval = fileio_write_u32(fileio, fastload[i].length);
+		if (retval == ERROR_OK)
+			retval = fileio_write(fileio, fastload[i].length, fastload[i].data, &written);
+		if (retval == ERROR_OK && written != (size_t)fastload[i].length)
+			retval = ERROR_FAIL;
+	}
+
+	if (fileio_close(fileio) != ERROR_OK && retval == ERROR_OK)
+		retval = ERROR_FAIL;
+	/* Replace the old file at once, other instances may be reading it */
+	if (retval == ERROR_OK && rename(tmp_file, file) != 0)
+		retval = ERROR_FAIL;
+	if (retval != ERROR_OK)
+		remove(tmp_file);
+	free(tmp_file);
+	return retval;
 }
 
 COMMAND_HANDLER(handle_fast_load_image_command)
 {
-	uint8_t *buffer;
+	const uint8_t *buffer;
+	uint8_t *copy;
 	size_t buf_cnt;
 	uint32_t image_size;
 	target_addr_t min_address = 0;
@@ -6696,34 +6904,47 @@ COMMAND_HANDLER(handle_fast_load_image_command)
 	struct duration bench;
 	duration_start(&bench);
 
-	retval = image_open(&image, CMD_ARGV[0], (CMD_ARGC >= 3) ? CMD_ARGV[2] : NULL);
-	if (retval != ERROR_OK)
+	free_fastload();
+
+	const char *type = (CMD_ARGC >= 3) ? CMD_ARGV[2] : NULL;
+	char *key = NULL;
+	char *cache_file = NULL;
+	if (fastload_cache_dir) {
+		key = fast_load_cache_key(CMD_ARGV[0], type, &image, min_address, max_address);
+		if (key) {
+			uint32_t hash;
+			image_calculate_checksum((const uint8_t *)key, strlen(key), &hash);
+			cache_file = alloc_printf("%s/%08" PRIx32 ".fastload", fastload_cache_dir, hash);
+		}
+		if (cache_file && fast_load_cache_read(cache_file, key) == ERROR_OK) {
+			command_print(CMD, "Loaded %d sections from cache %s", fastload_num, cache_file);
+			free(cache_file);
+			free(key);
+			return ERROR_OK;
+		}
+	}
+
+	retval = image_open(&image, CMD_ARGV[0], type);
+	if (retval != ERROR_OK) {
+		free(cache_file);
+		free(key);
 		return retval;
+	}
 
 	image_size = 0x0;
 	retval = ERROR_OK;
-	fastload_num = image.num_sections;
-	fastload = malloc(sizeof(struct fast_load)*image.num_sections);
+	fastload = calloc(image.num_sections, sizeof(struct fast_load));
 	if (!fastload) {
 		command_print(CMD, "out of memory");
 		image_close(&image);
+		free(cache_file);
+		free(key);
 		return ERROR_FAIL;
 	}
-	memset(fastload, 0, sizeof(struct fast_load)*image.num_sections);
 	for (unsigned int i = 0; i < image.num_sections; i++) {
-		buffer = malloc(image.sections[i].size);
-		if (!buffer) {
-			command_print(CMD, "error allocating buffer for section (%d bytes)",
-						  (int)(image.sections[i].size));
-			retval = ERROR_FAIL;
-			break;
-		}
-
-		retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
-		if (retval != ERROR_OK) {
-			free(buffer);
+		retval = CALL_COMMAND_HANDLER(image_section_get, &image, i, &buffer, &copy, &buf_cnt);
+		if (retval != ERROR_OK)
 			break;
-		}
 
 		uint32_t offset = 0;
 		uint32_t length = buf_cnt;
@@ -6741,17 +6962,23 @@ COMMAND_HANDLER(handle_fast_load_image_command)
 			if (image.sections[i].base_address + buf_cnt > max_address)
 				length -= (image.sections[i].base_address + buf_cnt)-max_address;
 
-			fastload[i].address = image.sections[i].base_address + offset;
-			fastload[i].data = malloc(length);
-			if (!fastload[i].data) {
-				free(buffer);
+			/* merge with the previous section when they are adjacent */
+			struct fast_load *fl = fastload_num ? &fastload[fastload_num - 1] : NULL;
+			if (!fl || fl->address + fl->length != image.sections[i].base_address + offset) {
+				fl = &fastload[fastload_num++];
+				fl->address = image.sections[i].base_address + offset;
+			}
+			uint8_t *data = realloc(fl->data, fl->length + length);
+			if (!data && fl->length + length != 0) {
+				free(copy);
 				command_print(CMD, "error allocating buffer for section (%" PRIu32 " bytes)",
 							  length);
 				retval = ERROR_FAIL;
 				break;
 			}
-			memcpy(fastload[i].data, buffer + offset, length);
-			fastload[i].length = length;
+			memcpy(data + fl->length, buffer + offset, length);
+			fl->data = data;
+			fl->length += length;
 
 			image_size += length;
 			command_print(CMD, "%u bytes written at address 0x%8.8x",
@@ -6759,7 +6986,7 @@ COMMAND_HANDLER(handle_fast_load_image_command)
 						  ((unsigned int)(image.sections[i].base_address + offset)));
 		}
 
-		free(buffer);
+		free(copy);
 	}
 
 	if ((retval == ERROR_OK) && (duration_measure(&bench) == ERROR_OK)) {
@@ -6776,14 +7003,38 @@ COMMAND_HANDLER(handle_fast_load_image_command)
 
 	if (retval != ERROR_OK)
 		free_fastload();
+	else if (cache_file && fast_load_cache_write(cache_file, key) != ERROR_OK)
+		LOG_WARNING("Failed to write fast_load cache %s", cache_file);
 
+	free(cache_file);
+	free(key);
 	return retval;
 }
 
+/* Whether the target already holds the section, by comparing checksums */
+static bool fast_load_is_loaded(struct target *target, struct fast_load *fl)
+{
+	uint32_t checksum, target_checksum;
+
+	if (fl->length == 0)
+		return true;
+	image_calculate_checksum(fl->data, fl->length, &checksum);
+	if (target_checksum_memory(target, fl->address, fl->length, &target_checksum) != ERROR_OK)
+		return false;
+	return checksum == target_checksum;
+}
+
 COMMAND_HANDLER(handle_fast_load_command)
 {
-	if (CMD_ARGC > 0)
+	bool skip_loaded = false;
+
+	if (CMD_ARGC > 1)
 		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "skip_loaded") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		skip_loaded = true;
+	}
 	if (!fastload) {
 		LOG_ERROR("No image in memory");
 		return ERROR_FAIL;
@@ -6794,6 +7045,12 @@ COMMAND_HANDLER(handle_fast_load_command)
 	int retval = ERROR_OK;
 	for (i = 0; i < fastload_num; i++) {
 		struct target *target = get_current_target(CMD_CTX);
+		if (skip_loaded && fast_load_is_loaded(target, &fastload[i])) {
+			command_print(CMD, "Skip 0x%08x, length 0x%08x, already loaded",
+						  (unsigned int)(fastload[i].address),
+						  (unsigned int)(fastload[i].length));
+			continue;
+		}
 		command_print(CMD, "Write to 0x%08x, length 0x%08x",
 					  (unsigned int)(fastload[i].address),
 					  (unsigned int)(fastload[i].length));
@@ -6809,6 +7066,99 @@ COMMAND_HANDLER(handle_fast_load_command)
 	return retval;
 }
 
+COMMAND_HANDLER(handle_fast_load_cache_command)
+{
+	if (CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 2 && (strcmp(CMD_ARGV[0], "off") == 0 || strcmp(CMD_ARGV[1], "content") != 0))
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC >= 1) {
+		free(fastload_cache_dir);
+		fastload_cache_dir = NULL;
+		fastload_cache_content = CMD_ARGC == 2;
+		if (strcmp(CMD_ARGV[0], "off") != 0) {
+			fastload_cache_dir = strdup(CMD_ARGV[0]);
+			if (!fastload_cache_dir) {
+				LOG_ERROR("Out of memory");
+				return ERROR_FAIL;
+			}
+		}
+	}
+
+	command_print(CMD, "fast_load cache: %s%s", fastload_cache_dir ? fastload_cache_dir : "off",
+			fastload_cache_content ? " content" : "");
+	return ERROR_OK;
+}
+
+#define TEST_IMAGE_CHECKSUM_MAX_SIZE	(256 * 1024 * 1024)
+
+COMMAND_HANDLER(handle_test_image_checksum_command)
+{
+	uint32_t test_size = 4 * 1024 * 1024;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], test_size);
+	if (test_size > TEST_IMAGE_CHECKSUM_MAX_SIZE) {
+		command_print(CMD, "Size must not exceed %u bytes", TEST_IMAGE_CHECKSUM_MAX_SIZE);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	uint32_t crc, crc_ref;
+	image_calculate_checksum((const uint8_t *)"123456789", 9, &crc);
+	if (crc != 0x0376e6e7) {
+		command_print(CMD, "Check value mismatch: 0x%08" PRIx32, crc);
+		return ERROR_FAIL;
+	}
+
+	/* spare bytes for the misaligned starts below */
+	size_t buffer_size = (size_t)test_size + 8;
+	uint8_t *buffer = malloc(buffer_size);
+	if (!buffer) {
+		LOG_ERROR("Failed to allocate test buffer");
+		return ERROR_FAIL;
+	}
+	for (size_t i = 0; i < buffer_size; i++)
+		buffer[i] = rand();
+
+	/* Every alignment and tail length */
+	for (uint32_t offset = 0; offset < 8; offset++) {
+		for (uint32_t len = 0; len <= MIN(test_size, 64); len++) {
+			image_calculate_checksum(buffer + offset, len, &crc);
+			image_calculate_checksum_bytewise(buffer + offset, len, &crc_ref);
+			if (crc != crc_ref) {
+				command_print(CMD, "Mismatch for %" PRIu32 " bytes @ %" PRIu32
+						": 0x%08" PRIx32 " != 0x%08" PRIx32, len, offset, crc, crc_ref);
+				free(buffer);
+				return ERROR_FAIL;
+			}
+		}
+	}
+
+	struct duration bench;
+	duration_start(&bench);
+	image_calculate_checksum_bytewise(buffer, test_size, &crc_ref);
+	duration_measure(&bench);
+	command_print(CMD, "bytewise: %" PRIu32 " bytes in %fs (%0.3f KiB/s)",
+			test_size, duration_elapsed(&bench), duration_kbps(&bench, test_size));
+
+	duration_start(&bench);
+	image_calculate_checksum(buffer, test_size, &crc);
+	duration_measure(&bench);
+	command_print(CMD, "sliced: %" PRIu32 " bytes in %fs (%0.3f KiB/s)",
+			test_size, duration_elapsed(&bench), duration_kbps(&bench, test_size));
+
+	free(buffer);
+	if (crc != crc_ref) {
+		command_print(CMD, "Mismatch: 0x%08" PRIx32 " != 0x%08" PRIx32, crc, crc_ref);
+		return ERROR_FAIL;
+	}
+	command_print(CMD, "Checksum 0x%08" PRIx32 " OK", crc);
+	return ERROR_OK;
+}
+
 static const struct command_registration target_command_handlers[] = {
 	{
 		.name = "targets",
@@ -6825,6 +7175,22 @@ static const struct command_registration target_command_handlers[] = {
 		.chain = target_subcommand_handlers,
 		.usage = "",
 	},
+	{
+		.name = "test_image_checksum",
+		.handler = handle_test_image_checksum_command,
+		.mode = COMMAND_ANY,
+		.help = "Check the host image checksum against its bytewise "
+			"reference and measure its speed",
+		.usage = "[size]",
+	},
+	{
+		.name = "fast_load_cache",
+		.handler = handle_fast_load_cache_command,
+		.mode = COMMAND_ANY,
+		.help = "directory where fast_load_image keeps parsed images "
+			"between runs",
+		.usage = "['off'|directory ['content']]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -7074,7 +7440,7 @@ static const struct command_registration target_exec_command_handlers[] = {
 		.mode = COMMAND_EXEC,
 		.help = "loads active fast load image to current target "
 			"- mainly for profiling purposes",
-		.usage = "",
+		.usage = "['skip_loaded']",
 	},
 	{
 		.name = "profile",
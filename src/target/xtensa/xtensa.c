@@ -30,8 +30,11 @@
 #include <helper/align.h>
 #include <target/register.h>
 #include <target/algorithm.h>
+#include <target/smp.h>
 
 #include "xtensa.h"
+#include "xtensa_trax.h"
+#include "xtensa_perfmon.h"
 #include "xtensa_algorithm.h"
 
 #define _XT_INS_FORMAT_RSR(OPCODE, SR, T) ((OPCODE)	    \
@@ -118,6 +121,13 @@
 #define XT_PC_REG_NUM_BASE          (176)
 #define XT_SW_BREAKPOINTS_MAX_NUM   32
 
+/* Number of PC samples per core queued before the JTAG queue is flushed while profiling */
+#define XT_PROFILING_BATCH_SIZE     128
+/* TCK cycles to wait after debug interrupt request before accessing core via DIR */
+#define XT_PROFILING_HALT_CYCLES    32
+/* TCK cycles spent in Run-Test/Idle between consecutive samples; cores run freely meanwhile */
+#define XT_PROFILING_IDLE_CYCLES    4096
+
 const struct xtensa_reg_desc xtensa_regs[XT_NUM_REGS] = {
 	{ "pc", XT_PC_REG_NUM_BASE /*+XT_DEBUGLEVEL*/, XT_REG_SPECIAL, 0 },		/* actually epc[debuglevel] */
 	{ "ar0", 0x00, XT_REG_GENERAL, 0 },
@@ -1735,10 +1745,113 @@ int xtensa_write_buffer(struct target *target, target_addr_t address, uint32_t c
 	return xtensa_write_memory(target, address, 1, count, buffer);
 }
 
+/* Same CRC as image_calculate_checksum(), but continues from 'crc'. Used for unaligned head and tail. */
+static uint32_t xtensa_crc32_update(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+	while (len--) {
+		crc ^= (uint32_t)*buf++ << 24;
+		for (unsigned int i = 0; i < 8; i++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+	}
+	return crc;
+}
+
 int xtensa_checksum_memory(struct target *target, target_addr_t address, uint32_t count, uint32_t *checksum)
 {
-	LOG_WARNING("not implemented yet");
-	return ERROR_FAIL;
+	static const uint8_t xtensa_crc_code[] = {
+#include "../../../contrib/loaders/checksum/xtensa_crc.inc"
+	};
+	/* binary starts with the 16-entry nibble table, entry point follows it */
+	const uint32_t crc_entry_offset = 16 * sizeof(uint32_t);
+	struct xtensa *xtensa = target_to_xtensa(target);
+	struct xtensa_algorithm algo_info = { .core_mode = XT_MODE_ANY };
+	struct working_area *crc_algorithm;
+	struct reg_param reg_params[5];
+	uint8_t buf[sizeof(uint32_t)];
+	uint32_t crc = 0xffffffff;
+
+	if (target->state != TARGET_HALTED) {
+		LOG_TARGET_WARNING(target, "target not halted");
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	/* target code uses aligned 32-bit loads only, so unaligned head and tail are done on host */
+	uint32_t head = (ALIGN_UP(address, 4) - address) > count ? count : ALIGN_UP(address, 4) - address;
+	uint32_t words = (count - head) / 4;
+	uint32_t tail = count - head - words * 4;
+
+	if (words * 4 < sizeof(xtensa_crc_code) * 4) {
+		/* Don't use the algorithm for relatively small buffers. It's faster
+		 * just to read the memory. target_checksum_memory() will take care of
+		 * that if we fail. */
+		return ERROR_FAIL;
+	}
+
+	int retval = target_alloc_working_area(target, sizeof(xtensa_crc_code), &crc_algorithm);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (crc_algorithm->address + crc_algorithm->size > address &&
+		crc_algorithm->address < address + count) {
+		/* Region to checksum overlaps with the work area */
+		target_free_working_area(target, crc_algorithm);
+		return ERROR_FAIL;
+	}
+
+	retval = target_write_buffer(target, crc_algorithm->address, sizeof(xtensa_crc_code), xtensa_crc_code);
+	if (retval != ERROR_OK) {
+		LOG_TARGET_ERROR(target, "Failed to write code to " TARGET_ADDR_FMT ": %d",
+			crc_algorithm->address, retval);
+		target_free_working_area(target, crc_algorithm);
+		return retval;
+	}
+
+	if (head) {
+		retval = target_read_buffer(target, address, head, buf);
+		if (retval != ERROR_OK)
+			goto _exit;
+		crc = xtensa_crc32_update(crc, buf, head);
+	}
+
+	init_reg_param(&reg_params[0], "a2", 32, PARAM_IN_OUT);
+	init_reg_param(&reg_params[1], "a3", 32, PARAM_OUT);
+	init_reg_param(&reg_params[2], "a4", 32, PARAM_OUT);
+	init_reg_param(&reg_params[3], "a5", 32, PARAM_OUT);
+	init_reg_param(&reg_params[4], "ps", 32, PARAM_OUT);
+	buf_set_u32(reg_params[0].value, 0, 32, address + head);
+	buf_set_u32(reg_params[1].value, 0, 32, words);
+	buf_set_u32(reg_params[2].value, 0, 32, crc);
+	buf_set_u32(reg_params[3].value, 0, 32, crc_algorithm->address);
+	/* keep interrupts masked up to debug level */
+	buf_set_u32(reg_params[4].value, 0, 32, xtensa->core_config->debug.irq_level - 1);
+
+	/* 20 second timeout/megabyte */
+	int timeout = 20000 * (1 + (count / (1024 * 1024)));
+
+	retval = target_run_algorithm(target, 0, NULL, ARRAY_SIZE(reg_params), reg_params,
+		crc_algorithm->address + crc_entry_offset,
+		0,	/* exits on BREAK 0,0 */
+		timeout, &algo_info);
+	if (retval == ERROR_OK)
+		crc = buf_get_u32(reg_params[0].value, 0, 32);
+	else
+		LOG_TARGET_ERROR(target, "error executing Xtensa CRC algorithm");
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+	if (retval == ERROR_OK && tail) {
+		retval = target_read_buffer(target, address + head + words * 4, tail, buf);
+		if (retval == ERROR_OK)
+			crc = xtensa_crc32_update(crc, buf, tail);
+	}
+
+_exit:
+	target_free_working_area(target, crc_algorithm);
+	if (retval == ERROR_OK)
+		*checksum = crc;
+	LOG_TARGET_DEBUG(target, "checksum=0x%" PRIx32 ", result=%d", crc, retval);
+	return retval;
 }
 
 int xtensa_poll(struct target *target)
@@ -1844,6 +1957,185 @@ int xtensa_poll(struct target *target)
 	return ERROR_OK;
 }
 
+/* Queues a single PC sample of the core. The core is stopped with a debug interrupt and
+ * EPC[debuglevel] is captured in DDR without touching the register cache: A3 is swapped
+ * through DDR, so it keeps its value when the core is resumed with RFDO at the end. */
+static void xtensa_profiling_queue_sample(struct xtensa *xtensa, uint8_t *pc_buf, uint8_t *dsr_buf)
+{
+	unsigned int epc_num = XT_PC_REG_NUM_BASE + xtensa->core_config->debug.irq_level;
+
+	xtensa_queue_dbg_reg_write(xtensa, NARADR_DCRSET, OCDDCR_ENABLEOCD | OCDDCR_DEBUGINTERRUPT);
+	jtag_add_runtest(XT_PROFILING_HALT_CYCLES, TAP_IDLE);
+	xtensa_queue_exec_ins(xtensa, XT_INS_XSR(XT_SR_DDR, XT_REG_A3));
+	xtensa_queue_exec_ins(xtensa, XT_INS_RSR(epc_num, XT_REG_A3));
+	xtensa_queue_exec_ins(xtensa, XT_INS_XSR(XT_SR_DDR, XT_REG_A3));
+	xtensa_queue_dbg_reg_read(xtensa, NARADR_DDR, pc_buf);
+	xtensa_queue_dbg_reg_read(xtensa, NARADR_DSR, dsr_buf);
+	xtensa_queue_dbg_reg_write(xtensa, NARADR_DSR,
+		OCDDSR_EXECEXCEPTION | OCDDSR_EXECOVERRUN | OCDDSR_DEBUGPENDHOST | OCDDSR_DEBUGINTHOST);
+	xtensa_queue_exec_ins(xtensa, XT_INS_RFDO);
+}
+
+/* Checks if the core has been stopped only by profiler's debug interrupt, not by a breakpoint or trace
+ * trigger. This happens when the interrupt lands after the sample has already been taken. */
+static bool xtensa_profiling_stopped_by_profiler(xtensa_dsr_t dsr)
+{
+	return (dsr & OCDDSR_STOPPED) && (dsr & (OCDDSR_DEBUGPENDHOST | OCDDSR_DEBUGINTHOST)) &&
+		!(dsr & (OCDDSR_DEBUGPENDBREAK | OCDDSR_DEBUGINTBREAK | OCDDSR_DEBUGPENDTRAX | OCDDSR_DEBUGINTTRAX));
+}
+
+/* Resumes the core if it has been stopped by profiler's debug interrupt which came too late */
+static int xtensa_profiling_release_core(struct target *target)
+{
+	struct xtensa *xtensa = target_to_xtensa(target);
+
+	int res = xtensa_dm_core_status_read(&xtensa->dbg_mod);
+	if (res != ERROR_OK)
+		return res;
+	xtensa_dsr_t dsr = xtensa_dm_core_status_get(&xtensa->dbg_mod);
+	if (!xtensa_profiling_stopped_by_profiler(dsr))
+		return ERROR_OK;
+	LOG_TARGET_DEBUG(target, "Release core stopped by profiler (DSR %08" PRIX32 ")", dsr);
+	xtensa_queue_dbg_reg_write(xtensa, NARADR_DSR,
+		OCDDSR_EXECEXCEPTION | OCDDSR_EXECOVERRUN | OCDDSR_DEBUGPENDHOST | OCDDSR_DEBUGINTHOST);
+	xtensa_queue_exec_ins(xtensa, XT_INS_RFDO);
+	xtensa_dm_queue_tdi_idle(&xtensa->dbg_mod);
+	return jtag_execute_queue();
+}
+
+int xtensa_profiling(struct target *target, uint32_t *samples,
+	uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+{
+	struct timeval timeout, now;
+	struct target_list *head;
+	struct target **cores;
+	unsigned int cores_num = 1;
+	uint32_t sample_count = 0, dropped_count = 0;
+	int res;
+
+	if (target->smp) {
+		cores_num = 0;
+		foreach_smp_target(head, target->smp_targets)
+			cores_num++;
+	}
+	cores = calloc(cores_num, sizeof(*cores));
+	uint8_t (*pc_bufs)[sizeof(uint32_t)] = calloc(cores_num * XT_PROFILING_BATCH_SIZE, sizeof(*pc_bufs));
+	uint8_t (*dsr_bufs)[sizeof(uint32_t)] = calloc(cores_num * XT_PROFILING_BATCH_SIZE, sizeof(*dsr_bufs));
+	if (!cores || !pc_bufs || !dsr_bufs) {
+		LOG_ERROR("Failed to alloc memory for profiling buffers!");
+		free(cores);
+		free(pc_bufs);
+		free(dsr_bufs);
+		return ERROR_FAIL;
+	}
+	if (target->smp) {
+		cores_num = 0;
+		foreach_smp_target(head, target->smp_targets) {
+			if (target_was_examined(head->target))
+				cores[cores_num++] = head->target;
+		}
+	} else {
+		cores[0] = target;
+	}
+
+	/* Make sure the target is running */
+	res = target_poll(target);
+	if (res == ERROR_OK && target->state == TARGET_HALTED)
+		res = target_resume(target, 1, 0, 0, 0);
+	if (res != ERROR_OK) {
+		LOG_TARGET_ERROR(target, "Error while resuming target");
+		goto _exit;
+	}
+
+	/* Disconnect cores from break network, otherwise every sample stops all of them */
+	for (unsigned int c = 0; c < cores_num && target->smp; c++) {
+		res = xtensa_smpbreak_write(target_to_xtensa(cores[c]), 0);
+		if (res != ERROR_OK)
+			goto _restore;
+	}
+
+	gettimeofday(&timeout, NULL);
+	timeval_add_time(&timeout, seconds, 0);
+
+	LOG_TARGET_INFO(target, "Starting Xtensa profiling. Sampling PC of %u core(s) as fast as we can...",
+		cores_num);
+
+	while (sample_count < max_num_samples) {
+		/* Stop if any core has been halted e.g. by breakpoint */
+		for (unsigned int c = 0; c < cores_num; c++) {
+			struct xtensa *xtensa = target_to_xtensa(cores[c]);
+			res = xtensa_dm_core_status_read(&xtensa->dbg_mod);
+			if (res != ERROR_OK)
+				goto _restore;
+			if (xtensa_is_stopped(cores[c])) {
+				if (xtensa_profiling_stopped_by_profiler(xtensa_dm_core_status_get(&xtensa->dbg_mod))) {
+					/* Late debug interrupt of the previous batch, not a halt, keep sampling */
+					res = xtensa_profiling_release_core(cores[c]);
+					if (res != ERROR_OK)
+						goto _restore;
+					continue;
+				}
+				LOG_TARGET_INFO(cores[c], "Core halted, profiling stopped.");
+				goto _restore;
+			}
+		}
+
+		uint32_t batch_size = DIV_ROUND_UP(max_num_samples - sample_count, cores_num);
+		if (batch_size > XT_PROFILING_BATCH_SIZE)
+			batch_size = XT_PROFILING_BATCH_SIZE;
+		for (unsigned int i = 0; i < batch_size; i++) {
+			for (unsigned int c = 0; c < cores_num; c++) {
+				unsigned int k = i * cores_num + c;
+				xtensa_profiling_queue_sample(target_to_xtensa(cores[c]), pc_bufs[k], dsr_bufs[k]);
+			}
+			jtag_add_runtest(XT_PROFILING_IDLE_CYCLES, TAP_IDLE);
+		}
+		for (unsigned int c = 0; c < cores_num; c++)
+			xtensa_dm_queue_tdi_idle(&target_to_xtensa(cores[c])->dbg_mod);
+		res = jtag_execute_queue();
+		if (res != ERROR_OK) {
+			LOG_TARGET_ERROR(target, "Error while sampling PC (%d)!", res);
+			goto _restore;
+		}
+
+		for (unsigned int k = 0; k < batch_size * cores_num && sample_count < max_num_samples; k++) {
+			xtensa_dsr_t dsr = buf_get_u32(dsr_bufs[k], 0, 32);
+			/* Sample is valid only if the core was really stopped when PC has been captured */
+			if (!(dsr & OCDDSR_STOPPED) || (dsr & (OCDDSR_EXECEXCEPTION | OCDDSR_EXECOVERRUN))) {
+				dropped_count++;
+				continue;
+			}
+			samples[sample_count++] = buf_get_u32(pc_bufs[k], 0, 32);
+		}
+
+		gettimeofday(&now, NULL);
+		if (timeval_compare(&now, &timeout) > 0)
+			break;
+	}
+	LOG_TARGET_INFO(target, "Profiling completed. %" PRIu32 " samples.", sample_count);
+	if (dropped_count)
+		LOG_TARGET_DEBUG(target, "Dropped %" PRIu32 " samples taken while core was not stopped", dropped_count);
+
+_restore:
+	for (unsigned int c = 0; c < cores_num; c++) {
+		struct xtensa *xtensa = target_to_xtensa(cores[c]);
+		int ret = xtensa_profiling_release_core(cores[c]);
+		if (ret == ERROR_OK && target->smp)
+			ret = xtensa_smpbreak_write(xtensa, xtensa->smp_break);
+		if (ret != ERROR_OK) {
+			LOG_TARGET_ERROR(cores[c], "Failed to restore core state after profiling!");
+			if (res == ERROR_OK)
+				res = ret;
+		}
+	}
+_exit:
+	*num_samples = sample_count;
+	free(cores);
+	free(pc_bufs);
+	free(dsr_bufs);
+	return res;
+}
+
 static int xtensa_sw_breakpoint_add(struct target *target,
 	struct breakpoint *breakpoint,
 	struct xtensa_sw_breakpoint *sw_bp)
@@ -2474,6 +2766,7 @@ void xtensa_target_deinit(struct target *target)
 
 	LOG_DEBUG("start");
 
+	xtensa_trax_stream_cleanup(target);
 	if (target_was_examined(target)) {
 		int ret = xtensa_queue_dbg_reg_write(xtensa, NARADR_DCRCLR, OCDDCR_ENABLEOCD);
 		if (ret != ERROR_OK) {
@@ -2561,7 +2854,13 @@ COMMAND_HELPER(xtensa_cmd_perfmon_enable_do, struct xtensa *xtensa)
 	if (config.tracelevel == -1)
 		config.tracelevel = xtensa->core_config->debug.irq_level;
 
-	return xtensa_dm_perfmon_enable(&xtensa->dbg_mod, counter_id, &config);
+	int res = xtensa_dm_perfmon_enable(&xtensa->dbg_mod, counter_id, &config);
+	/* zero mask stops the counter */
+	if (res == ERROR_OK && config.mask != 0)
+		xtensa->perfmon_enabled |= BIT(counter_id);
+	else
+		xtensa->perfmon_enabled &= ~BIT(counter_id);
+	return res;
 }
 
 COMMAND_HANDLER(xtensa_cmd_perfmon_enable)
@@ -2610,6 +2909,14 @@ COMMAND_HANDLER(xtensa_cmd_perfmon_dump)
 		target_to_xtensa(get_current_target(CMD_CTX)));
 }
 
+COMMAND_HANDLER(xtensa_cmd_perfmon_sample)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	return CALL_COMMAND_HANDLER(xtensa_cmd_perfmon_sample_do, target,
+		target_to_xtensa(target)->perfmon_sink);
+}
+
 COMMAND_HELPER(xtensa_cmd_mask_interrupts_do, struct xtensa *xtensa)
 {
 	int state = -1;
@@ -2733,6 +3040,11 @@ COMMAND_HELPER(xtensa_cmd_tracestart_do, struct xtensa *xtensa)
 		}
 	}
 
+	if (xtensa_trax_stream_is_active(xtensa->target)) {
+		command_print(CMD, "Trace streaming is active. Please stop it first.");
+		return ERROR_FAIL;
+	}
+
 	int res = xtensa_dm_trace_status_read(&xtensa->dbg_mod, &trace_status);
 	if (res != ERROR_OK)
 		return res;
@@ -2762,6 +3074,11 @@ COMMAND_HELPER(xtensa_cmd_tracestop_do, struct xtensa *xtensa)
 {
 	struct xtensa_trace_status trace_status;
 
+	if (xtensa_trax_stream_is_active(xtensa->target)) {
+		command_print(CMD, "Trace streaming is active. Use 'tracestream stop' instead.");
+		return ERROR_FAIL;
+	}
+
 	int res = xtensa_dm_trace_status_read(&xtensa->dbg_mod, &trace_status);
 	if (res != ERROR_OK)
 		return res;
@@ -2880,6 +3197,20 @@ COMMAND_HANDLER(xtensa_cmd_tracedump)
 		target_to_xtensa(get_current_target(CMD_CTX)), CMD_ARGV[0]);
 }
 
+COMMAND_HANDLER(xtensa_cmd_tracestream)
+{
+	return CALL_COMMAND_HANDLER(xtensa_cmd_tracestream_do, get_current_target(CMD_CTX));
+}
+
+COMMAND_HANDLER(xtensa_cmd_tracedecode)
+{
+	if (CMD_ARGC < 2 || CMD_ARGC > 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	return CALL_COMMAND_HANDLER(xtensa_cmd_tracedecode_do,
+		CMD_ARGV[0], CMD_ARGV[1], CMD_ARGC == 3 ? CMD_ARGV[2] : NULL);
+}
+
 const struct command_registration xtensa_command_handlers[] = {
 	{
 		.name = "set_permissive",
@@ -2918,6 +3249,14 @@ const struct command_registration xtensa_command_handlers[] = {
 			"Dump performance counter value. If no argument specified, dumps all counters.",
 		.usage = "[counter_id]",
 	},
+	{
+		.name = "perfmon_sample",
+		.handler = xtensa_cmd_perfmon_sample,
+		.mode = COMMAND_EXEC,
+		.help =
+			"Periodically sample enabled performance counters of all cores to a file or TCP socket.",
+		.usage = "start <file://outfile|tcp://host:port> [period_ms] [csv|bin] | stop | status",
+	},
 	{
 		.name = "tracestart",
 		.handler = xtensa_cmd_tracestart,
@@ -2940,5 +3279,21 @@ const struct command_registration xtensa_command_handlers[] = {
 		.help = "Tracing: Dump trace memory to a files. One file per core.",
 		.usage = "<outfile>",
 	},
+	{
+		.name = "tracestream",
+		.handler = xtensa_cmd_tracestream,
+		.mode = COMMAND_EXEC,
+		.help =
+			"Tracing: Continuously drain trace memory of all cores to a file while target is running.",
+		.usage = "start <outfile> [poll_period_ms] | stop | status",
+	},
+	{
+		.name = "tracedecode",
+		.handler = xtensa_cmd_tracedecode,
+		.mode = COMMAND_ANY,
+		.help =
+			"Tracing: Decode trace data written by tracestream or tracedump into hot blocks histogram and optionally into executed PC ranges.",
+		.usage = "<infile> <histfile> [rangesfile]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
@@ -62,6 +62,11 @@
 #define XT_MEM_ACCESS_READ              0x1
 #define XT_MEM_ACCESS_WRITE             0x2
 
+/* Memory-mapped peripheral registers, reads can have side effects */
+#define XT_MEM_ATTR_IO                  0x1
+/* External memory mapped via cache, may be absent on particular chip */
+#define XT_MEM_ATTR_EXT                 0x2
+
 enum xtensa_mem_err_detect {
 	XT_MEM_ERR_DETECT_NONE,
 	XT_MEM_ERR_DETECT_PARITY,
@@ -81,6 +86,7 @@ struct xtensa_local_mem_region_config {
 	uint32_t size;
 	enum xtensa_mem_err_detect mem_err_check;
 	int access;
+	int attrs;
 };
 
 struct xtensa_local_mem_config {
@@ -186,6 +192,8 @@ enum xtensa_mode {
 	XT_MODE_ANY	/* special value to run algorithm in current core mode */
 };
 
+struct xtensa_perfmon_sink;
+
 struct xtensa_sw_breakpoint {
 	struct breakpoint *oocd_bp;
 	/* original insn */
@@ -215,6 +223,8 @@ struct xtensa {
 	struct watchpoint **hw_wps;
 	struct xtensa_sw_breakpoint *sw_brps;
 	bool trace_active;
+	uint32_t perfmon_enabled;	/* bitmask of counters enabled by 'perfmon_enable' */
+	const struct xtensa_perfmon_sink *perfmon_sink;	/* NULL to write samples to a file */
 	bool permissive_mode;	/* bypass memory checks */
 	bool suppress_dsr_errors;
 	uint32_t smp_break;
@@ -329,6 +339,8 @@ int xtensa_write_memory(struct target *target,
 	const uint8_t *buffer);
 int xtensa_write_buffer(struct target *target, target_addr_t address, uint32_t count, const uint8_t *buffer);
 int xtensa_checksum_memory(struct target *target, target_addr_t address, uint32_t count, uint32_t *checksum);
+int xtensa_profiling(struct target *target, uint32_t *samples,
+	uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds);
 int xtensa_assert_reset(struct target *target);
 int xtensa_deassert_reset(struct target *target);
 int xtensa_breakpoint_add(struct target *target, struct breakpoint *breakpoint);
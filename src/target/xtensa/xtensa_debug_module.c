@@ -20,6 +20,7 @@
 #include <config.h>
 #endif
 
+#include <helper/time_support.h>
 #include "xtensa_debug_module.h"
 
 #define TAPINS_PWRCTL           0x08
@@ -224,16 +225,17 @@ int xtensa_dm_trace_start(struct xtensa_debug_module *dm, struct xtensa_trace_st
 		NARADR_TRAXCTRL,
 		TRAXCTRL_TREN |
 		((cfg->stopmask != XTENSA_STOPMASK_DISABLED) ? TRAXCTRL_PCMEN : 0) | TRAXCTRL_TMEN |
-		(cfg->after_is_words ? 0 : TRAXCTRL_CNTU) | (0 << TRAXCTRL_SMPER_SHIFT) | TRAXCTRL_PTOWS);
+		(cfg->after_is_words ? 0 : TRAXCTRL_CNTU) |
+		((cfg->smper & TRAXCTRL_SMPER_MASK) << TRAXCTRL_SMPER_SHIFT) |
+		(cfg->no_halt ? 0 : TRAXCTRL_PTOWS));
 	xtensa_dm_queue_tdi_idle(dm);
 	return jtag_execute_queue();
 }
 
-int xtensa_dm_trace_stop(struct xtensa_debug_module *dm, bool pto_enable)
+static int xtensa_dm_trace_stop_request(struct xtensa_debug_module *dm, bool pto_enable)
 {
 	uint8_t traxctl_buf[sizeof(uint32_t)];
 	uint32_t traxctl;
-	struct xtensa_trace_status trace_status;
 
 	dm->dbg_ops->queue_reg_read(dm, NARADR_TRAXCTRL, traxctl_buf);
 	xtensa_dm_queue_tdi_idle(dm);
@@ -247,7 +249,14 @@ int xtensa_dm_trace_stop(struct xtensa_debug_module *dm, bool pto_enable)
 
 	dm->dbg_ops->queue_reg_write(dm, NARADR_TRAXCTRL, traxctl | TRAXCTRL_TRSTP);
 	xtensa_dm_queue_tdi_idle(dm);
-	res = jtag_execute_queue();
+	return jtag_execute_queue();
+}
+
+int xtensa_dm_trace_stop(struct xtensa_debug_module *dm, bool pto_enable)
+{
+	struct xtensa_trace_status trace_status;
+
+	int res = xtensa_dm_trace_stop_request(dm, pto_enable);
 	if (res != ERROR_OK)
 		return res;
 
@@ -263,6 +272,28 @@ int xtensa_dm_trace_stop(struct xtensa_debug_module *dm, bool pto_enable)
 	return ERROR_OK;
 }
 
+int xtensa_dm_trace_stop_wait(struct xtensa_debug_module *dm, unsigned int timeout_ms)
+{
+	struct xtensa_trace_status trace_status;
+
+	int res = xtensa_dm_trace_stop_request(dm, false);
+	if (res != ERROR_OK)
+		return res;
+
+	int64_t then = timeval_ms();
+	while (true) {
+		res = xtensa_dm_trace_status_read(dm, &trace_status);
+		if (res != ERROR_OK)
+			return res;
+		if (!(trace_status.stat & TRAXSTAT_TRACT))
+			return ERROR_OK;
+		if (timeval_ms() - then > timeout_ms) {
+			LOG_ERROR("Timed out waiting for trace stop (0x%x)!", trace_status.stat);
+			return ERROR_TARGET_TIMEOUT;
+		}
+	}
+}
+
 int xtensa_dm_trace_status_read(struct xtensa_debug_module *dm, struct xtensa_trace_status *status)
 {
 	uint8_t traxstat_buf[sizeof(uint32_t)];
@@ -311,6 +342,17 @@ int xtensa_dm_trace_data_read(struct xtensa_debug_module *dm, uint8_t *dest, uin
 	return jtag_execute_queue();
 }
 
+/* Same as xtensa_dm_trace_data_read(), but sets the read pointer first. Trace must be stopped. */
+int xtensa_dm_trace_data_read_at(struct xtensa_debug_module *dm, uint32_t word_addr, uint8_t *dest,
+	uint32_t size)
+{
+	if (!dest)
+		return ERROR_FAIL;
+
+	dm->dbg_ops->queue_reg_write(dm, NARADR_TRAXADDR, word_addr & TRAXADDR_TADDR_MASK);
+	return xtensa_dm_trace_data_read(dm, dest, size);
+}
+
 int xtensa_dm_perfmon_enable(struct xtensa_debug_module *dm, int counter_id,
 	const struct xtensa_perfmon_config *config)
 {
@@ -205,6 +205,8 @@
 #define PCMATCHCTRL_PCMS            BIT(31)	/* PC Match Sense, 0-match when procs PC is in-range, 1-match when
 						 *out-of-range */
 
+#define PMSTAT_OVFL                 BIT(0)	/* Counter overflow. Sticky, cleared by writing 1 */
+
 #define XTENSA_MAX_PERF_COUNTERS    2
 #define XTENSA_MAX_PERF_SELECT      32
 #define XTENSA_MAX_PERF_MASK        0xffff
@@ -267,6 +269,8 @@ struct xtensa_trace_start_config {
 	bool after_is_words;
 	uint32_t after;
 	uint32_t stopmask;	/* UINT32_MAX: disable PC match option */
+	uint8_t smper;		/* TRAXCTRL.SMPER: periodic sync messages, 0 - disabled */
+	bool no_halt;		/* do not halt the core when trace stop completes */
 };
 
 struct xtensa_perfmon_config {
@@ -344,9 +348,13 @@ static inline xtensa_ocdid_t xtensa_dm_device_id_get(struct xtensa_debug_module
 
 int xtensa_dm_trace_start(struct xtensa_debug_module *dm, struct xtensa_trace_start_config *cfg);
 int xtensa_dm_trace_stop(struct xtensa_debug_module *dm, bool pto_enable);
+/* Stops tracing without post-trigger and waits until TRAX has written out the trace it still holds */
+int xtensa_dm_trace_stop_wait(struct xtensa_debug_module *dm, unsigned int timeout_ms);
 int xtensa_dm_trace_config_read(struct xtensa_debug_module *dm, struct xtensa_trace_config *config);
 int xtensa_dm_trace_status_read(struct xtensa_debug_module *dm, struct xtensa_trace_status *status);
 int xtensa_dm_trace_data_read(struct xtensa_debug_module *dm, uint8_t *dest, uint32_t size);
+int xtensa_dm_trace_data_read_at(struct xtensa_debug_module *dm, uint32_t word_addr, uint8_t *dest,
+	uint32_t size);
 
 static inline bool xtensa_dm_is_online(struct xtensa_debug_module *dm)
 {
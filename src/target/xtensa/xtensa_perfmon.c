@@ -0,0 +1,400 @@
+/***************************************************************************
+ *   Xtensa performance counters sampling                                  *
+ *   Copyright (C) 2022 Espressif Systems Ltd.                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <helper/time_support.h>
+#include <target/smp.h>
+#include "xtensa.h"
+#include "xtensa_perfmon.h"
+
+/* Default sampling period, ms */
+#define XT_PERFMON_SAMPLE_PERIOD_DEF    100
+/* Max length of CSV record line */
+#define XT_PERFMON_CSV_REC_MAX          96
+
+struct xtensa_perfmon_sampler_cnt {
+	bool queued;
+	/* PMSTAT.OVFL was set, but PM had been read before the counter wrapped */
+	bool wrap_pending;
+	uint32_t prev;
+	uint64_t total;
+	uint8_t stat_buf[sizeof(uint32_t)];
+	uint8_t val_buf[sizeof(uint32_t)];
+};
+
+struct xtensa_perfmon_sampler {
+	struct target **cores;
+	unsigned int cores_num;
+	const struct xtensa_perfmon_sink *sink;
+	void *sink_priv;
+	bool csv;
+	unsigned int period;
+	int64_t start_ms;
+	/* indexed as [core * XTENSA_MAX_PERF_COUNTERS + counter_id] */
+	struct xtensa_perfmon_sampler_cnt *cnts;
+	uint8_t *out_buf;
+	size_t out_buf_sz;
+	uint64_t samples;
+	uint64_t records;
+	uint32_t overflows;
+	uint32_t lost;
+};
+
+/* Only one sampler at a time, it covers all cores of SMP target */
+static struct xtensa_perfmon_sampler *s_perfmon_sampler;
+
+static size_t xtensa_perfmon_record_put(struct xtensa_perfmon_sampler *sampler, uint8_t *buf,
+	int64_t tstamp, unsigned int core, unsigned int counter, uint32_t value, uint64_t delta,
+	uint64_t total, uint8_t flags)
+{
+	if (sampler->csv)
+		return snprintf((char *)buf, XT_PERFMON_CSV_REC_MAX,
+			"%" PRId64 ",%u,%u,%" PRIu32 ",%" PRIu64 ",%" PRIu64 ",%u\n",
+			tstamp, core, counter, value, delta, total, flags);
+
+	h_u64_to_le(&buf[0], tstamp);
+	buf[8] = core;
+	buf[9] = counter;
+	buf[10] = flags;
+	buf[11] = 0;
+	h_u32_to_le(&buf[12], value);
+	h_u64_to_le(&buf[16], total);
+	return XT_PERFMON_REC_SZ;
+}
+
+/* Updates accumulated value of the counter. PM is read before PMSTAT and PMSTAT.OVFL is cleared
+ * once it has been read as set, so OVFL tells whether 32-bit counter has wrapped since the
+ * previous sample, either before PM was read or between the PM and PMSTAT reads. */
+static uint64_t xtensa_perfmon_counter_update(struct xtensa_perfmon_sampler *sampler,
+	struct xtensa_perfmon_sampler_cnt *cnt, uint32_t value, bool ovfl, uint8_t *flags)
+{
+	uint64_t delta;
+
+	*flags = 0;
+	if (value >= cnt->prev) {
+		delta = value - cnt->prev;
+		if (cnt->wrap_pending) {
+			/* the wrap seen by the previous sample did not show up in PM */
+			delta += 1ULL << 32;
+			*flags = XT_PERFMON_REC_FLAG_OVERFLOW | XT_PERFMON_REC_FLAG_LOST;
+			sampler->overflows++;
+			sampler->lost++;
+		}
+		/* most likely wrapped after PM was read, count it with the next sample */
+		cnt->wrap_pending = ovfl;
+	} else if (ovfl || cnt->wrap_pending) {
+		delta = (uint32_t)(value - cnt->prev);
+		*flags = XT_PERFMON_REC_FLAG_OVERFLOW;
+		sampler->overflows++;
+		/* if the previous sample has seen this wrap, OVFL is for the next one */
+		cnt->wrap_pending = cnt->wrap_pending && ovfl;
+	} else {
+		/* went backwards without overflow, so it has been reset */
+		delta = value;
+		*flags = XT_PERFMON_REC_FLAG_RESET;
+		cnt->total = 0;
+	}
+	cnt->prev = value;
+	cnt->total += delta;
+	return delta;
+}
+
+static int xtensa_perfmon_file_open(const char *dest, void **priv)
+{
+	if (!strncmp(dest, "file://", 7))
+		dest += 7;
+	FILE *f = fopen(dest, "wb");
+	if (!f)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	*priv = f;
+	return ERROR_OK;
+}
+
+static int xtensa_perfmon_file_write(void *priv, const uint8_t *data, uint32_t size)
+{
+	return fwrite(data, 1, size, priv) == size ? ERROR_OK : ERROR_FAIL;
+}
+
+static void xtensa_perfmon_file_close(void *priv)
+{
+	fclose(priv);
+}
+
+/* Used when the chip does not provide its own sink */
+static const struct xtensa_perfmon_sink xtensa_perfmon_file_sink = {
+	.open = xtensa_perfmon_file_open,
+	.write = xtensa_perfmon_file_write,
+	.close = xtensa_perfmon_file_close,
+};
+
+static void xtensa_perfmon_sampler_free(struct xtensa_perfmon_sampler *sampler)
+{
+	if (sampler->sink_priv)
+		sampler->sink->close(sampler->sink_priv);
+	free(sampler->out_buf);
+	free(sampler->cnts);
+	free(sampler->cores);
+	free(sampler);
+}
+
+/* Counters keep running and stay enabled after sampling stops */
+static void xtensa_perfmon_sampler_stop(struct xtensa_perfmon_sampler *sampler)
+{
+	xtensa_perfmon_sampler_free(sampler);
+	s_perfmon_sampler = NULL;
+}
+
+/* Reads all enabled counters of all cores in one JTAG queue. PM is read before PMSTAT, so a wrap
+ * between the two reads is never missed. Overflow flags are cleared by a second queue, only for
+ * the counters which have reported one, so a wrap after the PMSTAT read is not lost. */
+static int xtensa_perfmon_sampler_read(struct xtensa_perfmon_sampler *sampler)
+{
+	bool queued = false;
+
+	for (unsigned int i = 0; i < sampler->cores_num; i++) {
+		struct target *target = sampler->cores[i];
+		struct xtensa *xtensa = target_to_xtensa(target);
+
+		for (unsigned int c = 0; c < XTENSA_MAX_PERF_COUNTERS; c++)
+			sampler->cnts[i * XTENSA_MAX_PERF_COUNTERS + c].queued = false;
+		if (!target_was_examined(target) || target->state == TARGET_RESET ||
+			!xtensa->perfmon_enabled)
+			continue;
+		for (unsigned int c = 0; c < XTENSA_MAX_PERF_COUNTERS; c++) {
+			struct xtensa_perfmon_sampler_cnt *cnt = &sampler->cnts[i * XTENSA_MAX_PERF_COUNTERS + c];
+			if (!(xtensa->perfmon_enabled & BIT(c)))
+				continue;
+			xtensa_queue_dbg_reg_read(xtensa, NARADR_PM0 + c, cnt->val_buf);
+			xtensa_queue_dbg_reg_read(xtensa, NARADR_PMSTAT0 + c, cnt->stat_buf);
+			cnt->queued = true;
+		}
+		xtensa_dm_queue_tdi_idle(&xtensa->dbg_mod);
+		queued = true;
+	}
+	if (!queued)
+		return ERROR_OK;
+	int res = jtag_execute_queue();
+	if (res != ERROR_OK)
+		return res;
+
+	queued = false;
+	for (unsigned int i = 0; i < sampler->cores_num; i++) {
+		struct xtensa *xtensa = target_to_xtensa(sampler->cores[i]);
+		bool core_queued = false;
+
+		for (unsigned int c = 0; c < XTENSA_MAX_PERF_COUNTERS; c++) {
+			struct xtensa_perfmon_sampler_cnt *cnt = &sampler->cnts[i * XTENSA_MAX_PERF_COUNTERS + c];
+			if (!cnt->queued || !(buf_get_u32(cnt->stat_buf, 0, 32) & PMSTAT_OVFL))
+				continue;
+			xtensa_queue_dbg_reg_write(xtensa, NARADR_PMSTAT0 + c, PMSTAT_OVFL);
+			core_queued = true;
+		}
+		if (core_queued) {
+			xtensa_dm_queue_tdi_idle(&xtensa->dbg_mod);
+			queued = true;
+		}
+	}
+	if (!queued)
+		return ERROR_OK;
+	return jtag_execute_queue();
+}
+
+static int xtensa_perfmon_sampler_poll(void *priv)
+{
+	struct xtensa_perfmon_sampler *sampler = priv;
+	size_t len = 0;
+
+	int res = xtensa_perfmon_sampler_read(sampler);
+	if (res != ERROR_OK) {
+		LOG_ERROR("Failed to read performance counters (%d), sampling stopped!", res);
+		goto _stop;
+	}
+	int64_t tstamp = timeval_ms() - sampler->start_ms;
+	for (unsigned int i = 0; i < sampler->cores_num; i++) {
+		for (unsigned int c = 0; c < XTENSA_MAX_PERF_COUNTERS; c++) {
+			struct xtensa_perfmon_sampler_cnt *cnt = &sampler->cnts[i * XTENSA_MAX_PERF_COUNTERS + c];
+			uint8_t flags;
+			if (!cnt->queued)
+				continue;
+			uint32_t value = buf_get_u32(cnt->val_buf, 0, 32);
+			bool ovfl = buf_get_u32(cnt->stat_buf, 0, 32) & PMSTAT_OVFL;
+			uint64_t delta = xtensa_perfmon_counter_update(sampler, cnt, value, ovfl, &flags);
+			len += xtensa_perfmon_record_put(sampler, &sampler->out_buf[len], tstamp, i, c,
+				value, delta, cnt->total, flags);
+			sampler->records++;
+		}
+	}
+	sampler->samples++;
+	if (len == 0)
+		return ERROR_OK;
+	res = sampler->sink->write(sampler->sink_priv, sampler->out_buf, len);
+	if (res == ERROR_OK)
+		return ERROR_OK;
+	LOG_ERROR("Failed to write performance counters samples, sampling stopped!");
+
+_stop:
+	target_unregister_timer_callback(xtensa_perfmon_sampler_poll, sampler);
+	xtensa_perfmon_sampler_stop(sampler);
+	return ERROR_OK;
+}
+
+static int xtensa_perfmon_sampler_start(struct command_invocation *cmd, struct target *target,
+	const struct xtensa_perfmon_sink *sink, const char *dest, unsigned int period, bool csv)
+{
+	struct xtensa_perfmon_sampler *sampler = calloc(1, sizeof(*sampler));
+	struct target_list *head;
+	unsigned int cores_num = 1;
+	int res = ERROR_FAIL;
+
+	if (!sampler) {
+		LOG_ERROR("Failed to alloc memory for perfmon sampler!");
+		return ERROR_FAIL;
+	}
+	if (target->smp) {
+		cores_num = 0;
+		foreach_smp_target(head, target->smp_targets)
+			cores_num++;
+	}
+	sampler->cores = calloc(cores_num, sizeof(*sampler->cores));
+	sampler->cnts = calloc(cores_num * XTENSA_MAX_PERF_COUNTERS, sizeof(*sampler->cnts));
+	sampler->out_buf_sz = cores_num * XTENSA_MAX_PERF_COUNTERS * XT_PERFMON_CSV_REC_MAX;
+	sampler->out_buf = malloc(sampler->out_buf_sz);
+	if (!sampler->cores || !sampler->cnts || !sampler->out_buf) {
+		LOG_ERROR("Failed to alloc memory for perfmon sampler!");
+		goto _exit;
+	}
+	if (target->smp) {
+		foreach_smp_target(head, target->smp_targets)
+			sampler->cores[sampler->cores_num++] = head->target;
+	} else {
+		sampler->cores[sampler->cores_num++] = target;
+	}
+	sampler->period = period;
+	sampler->csv = csv;
+
+	bool enabled = false;
+	for (unsigned int i = 0; i < sampler->cores_num; i++) {
+		struct xtensa *xtensa = target_to_xtensa(sampler->cores[i]);
+		if (!xtensa->core_config->trace.enabled) {
+			command_print(cmd, "Performance counters are not available on %s",
+				target_name(sampler->cores[i]));
+			goto _exit;
+		}
+		if (xtensa->perfmon_enabled)
+			enabled = true;
+	}
+	if (!enabled) {
+		command_print(cmd, "No performance counters enabled, use 'perfmon_enable' first.");
+		goto _exit;
+	}
+
+	sampler->sink = sink ? sink : &xtensa_perfmon_file_sink;
+	if (sampler->sink->open(dest, &sampler->sink_priv) != ERROR_OK) {
+		command_print(cmd, "Invalid samples destination '%s'", dest);
+		sampler->sink_priv = NULL;
+		goto _exit;
+	}
+	if (sampler->csv) {
+		const char *csv_hdr = "time_ms,core,counter,value,delta,total,flags\n";
+		res = sampler->sink->write(sampler->sink_priv, (const uint8_t *)csv_hdr, strlen(csv_hdr));
+		if (res != ERROR_OK)
+			goto _exit;
+	}
+
+	res = target_register_timer_callback(xtensa_perfmon_sampler_poll, sampler->period,
+		TARGET_TIMER_TYPE_PERIODIC, sampler);
+	if (res != ERROR_OK)
+		goto _exit;
+	sampler->start_ms = timeval_ms();
+	s_perfmon_sampler = sampler;
+	return ERROR_OK;
+
+_exit:
+	xtensa_perfmon_sampler_free(sampler);
+	return res;
+}
+
+static void xtensa_perfmon_sampler_print_stat(struct command_invocation *cmd,
+	struct xtensa_perfmon_sampler *sampler)
+{
+	command_print(cmd, "%" PRIu64 " samples, %" PRIu64 " records in %" PRId64 " ms, "
+		"%" PRIu32 " counter overflows (%" PRIu32 " ambiguous)",
+		sampler->samples, sampler->records, timeval_ms() - sampler->start_ms,
+		sampler->overflows, sampler->lost);
+}
+
+/* perfmon_sample start <dest> [period_ms] [csv|bin] | stop | status */
+COMMAND_HELPER(xtensa_cmd_perfmon_sample_do, struct target *target,
+	const struct xtensa_perfmon_sink *sink)
+{
+	if (CMD_ARGC < 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!strcasecmp(CMD_ARGV[0], "start")) {
+		unsigned int period = XT_PERFMON_SAMPLE_PERIOD_DEF;
+		bool csv = true;
+		if (CMD_ARGC < 2 || CMD_ARGC > 4)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		if (CMD_ARGC >= 3) {
+			COMMAND_PARSE_NUMBER(uint, CMD_ARGV[2], period);
+			if (period == 0)
+				return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		if (CMD_ARGC == 4) {
+			if (!strcasecmp(CMD_ARGV[3], "bin"))
+				csv = false;
+			else if (strcasecmp(CMD_ARGV[3], "csv"))
+				return ERROR_COMMAND_SYNTAX_ERROR;
+		}
+		if (s_perfmon_sampler) {
+			command_print(CMD, "Performance counters sampling is already active.");
+			return ERROR_FAIL;
+		}
+		int res = xtensa_perfmon_sampler_start(CMD, target, sink, CMD_ARGV[1], period, csv);
+		if (res == ERROR_OK)
+			command_print(CMD, "Performance counters sampling started.");
+		return res;
+	}
+	if (!strcasecmp(CMD_ARGV[0], "stop")) {
+		if (CMD_ARGC != 1)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		if (!s_perfmon_sampler) {
+			command_print(CMD, "No performance counters sampling is currently active.");
+			return ERROR_FAIL;
+		}
+		target_unregister_timer_callback(xtensa_perfmon_sampler_poll, s_perfmon_sampler);
+		xtensa_perfmon_sampler_print_stat(CMD, s_perfmon_sampler);
+		xtensa_perfmon_sampler_stop(s_perfmon_sampler);
+		return ERROR_OK;
+	}
+	if (!strcasecmp(CMD_ARGV[0], "status")) {
+		if (CMD_ARGC != 1)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		if (!s_perfmon_sampler) {
+			command_print(CMD, "Performance counters sampling is not active.");
+			return ERROR_OK;
+		}
+		xtensa_perfmon_sampler_print_stat(CMD, s_perfmon_sampler);
+		return ERROR_OK;
+	}
+	return ERROR_COMMAND_SYNTAX_ERROR;
+}
@@ -0,0 +1,47 @@
+/***************************************************************************
+ *   Xtensa performance counters sampling                                  *
+ *   Copyright (C) 2022 Espressif Systems Ltd.                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_XTENSA_PERFMON_H
+#define OPENOCD_TARGET_XTENSA_PERFMON_H
+
+#include <helper/command.h>
+#include <target/target.h>
+
+/* Binary sample record (all fields are little endian): timestamp in ms since sampling start (u64),
+ * core index (u8), counter id (u8), flags (u8), reserved (u8), raw counter value (u32),
+ * accumulated 64-bit counter value (u64). */
+#define XT_PERFMON_REC_SZ               24
+/* counter has wrapped around since the previous sample */
+#define XT_PERFMON_REC_FLAG_OVERFLOW    0x01
+/* counter has wrapped more than once, accumulated value may miss a multiple of 2^32 */
+#define XT_PERFMON_REC_FLAG_LOST        0x02
+/* counter has been reset (e.g. re-enabled or core reset), accumulated value restarted */
+#define XT_PERFMON_REC_FLAG_RESET       0x04
+
+/* Destination of the samples. Chips can provide their own one, the default writes to a file. */
+struct xtensa_perfmon_sink {
+	/* opens the destination given to 'perfmon_sample start' */
+	int (*open)(const char *dest, void **priv);
+	int (*write)(void *priv, const uint8_t *data, uint32_t size);
+	void (*close)(void *priv);
+};
+
+COMMAND_HELPER(xtensa_cmd_perfmon_sample_do, struct target *target,
+	const struct xtensa_perfmon_sink *sink);
+
+#endif	/* OPENOCD_TARGET_XTENSA_PERFMON_H */
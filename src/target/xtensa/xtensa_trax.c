@@ -0,0 +1,712 @@
+/***************************************************************************
+ *   Xtensa TRAX trace streaming and decoding                              *
+ *   Copyright (C) 2022 Espressif Systems Ltd.                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <helper/fileio.h>
+#include <helper/time_support.h>
+#include <target/smp.h>
+#include "xtensa.h"
+#include "xtensa_trax.h"
+
+/* Default period of TRAX memory draining, ms */
+#define XT_TRAX_STREAM_PERIOD_DEF       10
+/* Time for TRAX to write out the trace it still holds after stop, ms */
+#define XT_TRAX_STREAM_STOP_TMO         100
+/* Sync message every 2^(9-1) messages, so the decoder can recover after the trace has wrapped */
+#define XT_TRAX_STREAM_SMPER            1
+
+/* Message Start/End Output bits of every trace byte */
+#define XT_TRAX_MSEO_MASK               0x3
+#define XT_TRAX_MSEO_NORMAL             0x0
+#define XT_TRAX_MSEO_END_FIELD          0x1
+#define XT_TRAX_MSEO_END_MSG            0x3
+#define XT_TRAX_MDO_BITS                6
+
+#define XT_TRAX_TCODE_BITS              6
+#define XT_TRAX_TCODE_IBR               4	/* Indirect branch */
+#define XT_TRAX_TCODE_ERROR             8	/* Error, messages were lost */
+#define XT_TRAX_TCODE_SYNC              9	/* Program trace synchronization */
+#define XT_TRAX_TCODE_IBRSYNC           12	/* Indirect branch with synchronization */
+#define XT_TRAX_TCODE_CORR              33	/* Program correlation */
+
+#define XT_TRAX_HIST_INIT_SZ            1024
+
+struct xtensa_trax_stream {
+	struct target **cores;
+	unsigned int cores_num;
+	struct fileio *out;
+	unsigned int period;
+	uint8_t *buf;
+	uint32_t buf_sz;
+	uint32_t seq;
+	uint32_t chunks;
+	uint32_t wrapped;
+	uint64_t bytes;
+	struct duration duration;
+};
+
+struct xtensa_trax_hist_entry {
+	uint32_t addr;
+	uint64_t hits;
+	uint64_t insns;
+};
+
+struct xtensa_trax_decode_ctx {
+	struct xtensa_trax_hist_entry *hist;
+	size_t hist_sz;
+	size_t hist_cnt;
+	bool oom;
+	FILE *ranges;
+	unsigned int core;
+};
+
+/* Only one stream at a time, it covers all cores of SMP target */
+static struct xtensa_trax_stream *s_trax_stream;
+
+/*********************************************************************
+*                   Trace messages decoder
+**********************************************************************/
+
+void xtensa_trax_decoder_reset(struct xtensa_trax_decoder *dec, bool msg_aligned)
+{
+	dec->synced = false;
+	dec->msg_aligned = msg_aligned;
+	dec->last_addr = 0;
+	dec->cur_addr = 0;
+	memset(dec->fields, 0, sizeof(dec->fields));
+	memset(dec->field_bits, 0, sizeof(dec->field_bits));
+	dec->field_idx = 0;
+}
+
+void xtensa_trax_decoder_init(struct xtensa_trax_decoder *dec, xtensa_trax_block_cb_t on_block,
+	void *priv)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->on_block = on_block;
+	dec->priv = priv;
+	xtensa_trax_decoder_reset(dec, true);
+}
+
+static uint64_t xtensa_trax_field_take(struct xtensa_trax_decoder *dec, unsigned int width)
+{
+	uint64_t val = dec->fields[0] & ((1ULL << width) - 1);
+
+	dec->fields[0] >>= width;
+	dec->field_bits[0] = dec->field_bits[0] > width ? dec->field_bits[0] - width : 0;
+	return val;
+}
+
+static void xtensa_trax_sync_lost(struct xtensa_trax_decoder *dec)
+{
+	if (dec->synced)
+		dec->sync_losses++;
+	dec->synced = false;
+}
+
+/* Reports 'icnt' instructions executed sequentially from the current address */
+static void xtensa_trax_block_emit(struct xtensa_trax_decoder *dec, uint64_t icnt)
+{
+	if (!dec->synced || icnt == 0)
+		return;
+	dec->blocks++;
+	dec->insns += icnt;
+	if (dec->on_block)
+		dec->on_block(dec->priv, dec->cur_addr, (uint32_t)icnt);
+}
+
+static void xtensa_trax_msg_process(struct xtensa_trax_decoder *dec, unsigned int fields_num)
+{
+	uint64_t icnt;
+
+	if (dec->field_bits[0] < XT_TRAX_TCODE_BITS) {
+		dec->bad_messages++;
+		xtensa_trax_sync_lost(dec);
+		return;
+	}
+	dec->messages++;
+
+	unsigned int tcode = xtensa_trax_field_take(dec, XT_TRAX_TCODE_BITS);
+	switch (tcode) {
+	case XT_TRAX_TCODE_IBR:
+		if (fields_num < 2)
+			goto _bad_msg;
+		xtensa_trax_field_take(dec, 2);	/* BTYPE */
+		icnt = dec->fields[0];
+		xtensa_trax_block_emit(dec, icnt);
+		/* U-ADDR is XORed with the previously transmitted address */
+		dec->last_addr ^= (uint32_t)dec->fields[1];
+		dec->cur_addr = dec->last_addr;
+		break;
+	case XT_TRAX_TCODE_IBRSYNC:
+		if (fields_num < 2)
+			goto _bad_msg;
+		xtensa_trax_field_take(dec, 1);	/* DCONT */
+		xtensa_trax_field_take(dec, 2);	/* BTYPE */
+		icnt = dec->fields[0];
+		xtensa_trax_block_emit(dec, icnt);
+		dec->last_addr = (uint32_t)dec->fields[1];
+		dec->cur_addr = dec->last_addr;
+		dec->synced = true;
+		break;
+	case XT_TRAX_TCODE_SYNC:
+		if (fields_num < 2)
+			goto _bad_msg;
+		xtensa_trax_field_take(dec, 4);	/* SYNC */
+		icnt = dec->fields[0];
+		xtensa_trax_block_emit(dec, icnt);
+		dec->last_addr = (uint32_t)dec->fields[1];
+		dec->cur_addr = dec->last_addr;
+		dec->synced = true;
+		break;
+	case XT_TRAX_TCODE_CORR:
+		xtensa_trax_field_take(dec, 4);	/* EVCODE */
+		xtensa_trax_field_take(dec, 2);	/* CDF */
+		icnt = dec->fields[0];
+		xtensa_trax_block_emit(dec, icnt);
+		/* execution continues at unknown address (exception, trace stop etc.) */
+		xtensa_trax_sync_lost(dec);
+		break;
+	case XT_TRAX_TCODE_ERROR:
+		xtensa_trax_sync_lost(dec);
+		break;
+	default:
+		goto _bad_msg;
+	}
+	return;
+
+_bad_msg:
+	dec->bad_messages++;
+	xtensa_trax_sync_lost(dec);
+}
+
+void xtensa_trax_decode(struct xtensa_trax_decoder *dec, const uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		unsigned int mseo = data[i] & XT_TRAX_MSEO_MASK;
+		uint64_t mdo = data[i] >> 2;
+
+		if (!dec->msg_aligned) {
+			/* skip the tail of the message whose start has been overwritten */
+			if (mseo == XT_TRAX_MSEO_END_MSG)
+				dec->msg_aligned = true;
+			continue;
+		}
+		if (dec->field_idx < XT_TRAX_MSG_FIELDS_MAX) {
+			unsigned int idx = dec->field_idx;
+			if (dec->field_bits[idx] < 64) {
+				dec->fields[idx] |= mdo << dec->field_bits[idx];
+				dec->field_bits[idx] += XT_TRAX_MDO_BITS;
+			}
+		}
+		if (mseo == XT_TRAX_MSEO_END_FIELD) {
+			if (dec->field_idx < XT_TRAX_MSG_FIELDS_MAX)
+				dec->field_idx++;
+		} else if (mseo == XT_TRAX_MSEO_END_MSG) {
+			unsigned int fields_num = dec->field_idx < XT_TRAX_MSG_FIELDS_MAX ?
+				dec->field_idx + 1 : XT_TRAX_MSG_FIELDS_MAX;
+			xtensa_trax_msg_process(dec, fields_num);
+			memset(dec->fields, 0, sizeof(dec->fields));
+			memset(dec->field_bits, 0, sizeof(dec->field_bits));
+			dec->field_idx = 0;
+		}
+	}
+}
+
+/*********************************************************************
+*                   Hot blocks histogram
+**********************************************************************/
+
+static inline size_t xtensa_trax_hist_slot(uint32_t addr, size_t hist_sz)
+{
+	/* Xtensa instructions are 2 or 3 bytes long, so mix low bits too */
+	return (size_t)((addr * 2654435761U) ^ (addr >> 16)) & (hist_sz - 1);
+}
+
+static int xtensa_trax_hist_grow(struct xtensa_trax_decode_ctx *ctx)
+{
+	size_t new_sz = ctx->hist_sz ? ctx->hist_sz * 2 : XT_TRAX_HIST_INIT_SZ;
+	struct xtensa_trax_hist_entry *new_hist = calloc(new_sz, sizeof(*new_hist));
+
+	if (!new_hist)
+		return ERROR_FAIL;
+	for (size_t i = 0; i < ctx->hist_sz; i++) {
+		if (ctx->hist[i].hits == 0)
+			continue;
+		size_t slot = xtensa_trax_hist_slot(ctx->hist[i].addr, new_sz);
+		while (new_hist[slot].hits != 0)
+			slot = (slot + 1) & (new_sz - 1);
+		new_hist[slot] = ctx->hist[i];
+	}
+	free(ctx->hist);
+	ctx->hist = new_hist;
+	ctx->hist_sz = new_sz;
+	return ERROR_OK;
+}
+
+static void xtensa_trax_on_block(void *priv, uint32_t addr, uint32_t icnt)
+{
+	struct xtensa_trax_decode_ctx *ctx = priv;
+
+	if (ctx->ranges)
+		fprintf(ctx->ranges, "%u 0x%08" PRIx32 " %" PRIu32 "\n", ctx->core, addr, icnt);
+
+	if (ctx->oom)
+		return;
+	/* keep load factor below 3/4 */
+	if ((ctx->hist_cnt + 1) * 4 > ctx->hist_sz * 3 && xtensa_trax_hist_grow(ctx) != ERROR_OK) {
+		ctx->oom = true;
+		return;
+	}
+	size_t slot = xtensa_trax_hist_slot(addr, ctx->hist_sz);
+	while (ctx->hist[slot].hits != 0 && ctx->hist[slot].addr != addr)
+		slot = (slot + 1) & (ctx->hist_sz - 1);
+	if (ctx->hist[slot].hits == 0) {
+		ctx->hist[slot].addr = addr;
+		ctx->hist_cnt++;
+	}
+	ctx->hist[slot].hits++;
+	ctx->hist[slot].insns += icnt;
+}
+
+static int xtensa_trax_hist_cmp(const void *a, const void *b)
+{
+	const struct xtensa_trax_hist_entry *ea = a;
+	const struct xtensa_trax_hist_entry *eb = b;
+
+	if (ea->insns != eb->insns)
+		return ea->insns < eb->insns ? 1 : -1;
+	if (ea->addr != eb->addr)
+		return ea->addr > eb->addr ? 1 : -1;
+	return 0;
+}
+
+static int xtensa_trax_hist_write(struct xtensa_trax_decode_ctx *ctx, const char *fname,
+	uint64_t total_insns)
+{
+	FILE *f = fopen(fname, "w");
+	if (!f)
+		return ERROR_FAIL;
+
+	/* compact and sort by the number of executed instructions */
+	size_t n = 0;
+	for (size_t i = 0; i < ctx->hist_sz; i++) {
+		if (ctx->hist[i].hits != 0)
+			ctx->hist[n++] = ctx->hist[i];
+	}
+	if (n > 0)
+		qsort(ctx->hist, n, sizeof(*ctx->hist), xtensa_trax_hist_cmp);
+
+	fprintf(f, "# %zu blocks, %" PRIu64 " instructions\n", n, total_insns);
+	fprintf(f, "# address  hits  instructions  avg_len  share\n");
+	for (size_t i = 0; i < n; i++) {
+		struct xtensa_trax_hist_entry *e = &ctx->hist[i];
+		fprintf(f, "0x%08" PRIx32 " %" PRIu64 " %" PRIu64 " %.1f %.2f%%\n",
+			e->addr, e->hits, e->insns, (double)e->insns / e->hits,
+			total_insns ? 100.0 * e->insns / total_insns : 0.0);
+	}
+
+	int res = ferror(f) ? ERROR_FAIL : ERROR_OK;
+	if (fclose(f) != 0)
+		res = ERROR_FAIL;
+	return res;
+}
+
+COMMAND_HELPER(xtensa_cmd_tracedecode_do, const char *infile, const char *histfile,
+	const char *rangesfile)
+{
+	struct xtensa_trax_decode_ctx ctx = { 0 };
+	struct xtensa_trax_decoder dec;
+	struct fileio *in;
+	uint8_t *data = NULL;
+	size_t size, read_sz;
+	unsigned int chunks = 0, wrapped = 0;
+
+	int res = fileio_open(&in, infile, FILEIO_READ, FILEIO_BINARY);
+	if (res != ERROR_OK) {
+		command_print(CMD, "Unable to open file %s", infile);
+		return res;
+	}
+	res = fileio_size(in, &size);
+	if (res == ERROR_OK) {
+		data = malloc(size ? size : 1);
+		if (!data)
+			res = ERROR_FAIL;
+		else
+			res = fileio_read(in, size, data, &read_sz);
+		if (res == ERROR_OK && read_sz != size)
+			res = ERROR_FAIL;
+	}
+	fileio_close(in);
+	if (res != ERROR_OK) {
+		command_print(CMD, "Failed to read trace data from %s", infile);
+		goto _exit;
+	}
+
+	if (rangesfile) {
+		ctx.ranges = fopen(rangesfile, "w");
+		if (!ctx.ranges) {
+			command_print(CMD, "Unable to open file %s", rangesfile);
+			res = ERROR_FAIL;
+			goto _exit;
+		}
+	}
+
+	xtensa_trax_decoder_init(&dec, xtensa_trax_on_block, &ctx);
+	if (size < XT_TRAX_CHUNK_HDR_SZ || le_to_h_u32(data) != XT_TRAX_CHUNK_MAGIC) {
+		/* raw dump made by 'tracedump', it is read starting from the oldest data */
+		xtensa_trax_decoder_reset(&dec, false);
+		xtensa_trax_decode(&dec, data, size);
+		chunks = 1;
+	} else {
+		size_t pos = 0;
+		while (pos + XT_TRAX_CHUNK_HDR_SZ <= size) {
+			const uint8_t *hdr = &data[pos];
+			uint32_t chunk_sz = le_to_h_u32(&hdr[12]);
+			if (le_to_h_u32(hdr) != XT_TRAX_CHUNK_MAGIC ||
+				chunk_sz > size - pos - XT_TRAX_CHUNK_HDR_SZ) {
+				command_print(CMD, "Corrupted trace chunk at offset %zu, stop decoding", pos);
+				break;
+			}
+			/* every chunk is a separate trace, it always starts with sync unless wrapped */
+			ctx.core = hdr[4];
+			xtensa_trax_decoder_reset(&dec, !(hdr[5] & XT_TRAX_CHUNK_FLAG_WRAPPED));
+			xtensa_trax_decode(&dec, &hdr[XT_TRAX_CHUNK_HDR_SZ], chunk_sz);
+			if (hdr[5] & XT_TRAX_CHUNK_FLAG_WRAPPED)
+				wrapped++;
+			chunks++;
+			pos += XT_TRAX_CHUNK_HDR_SZ + chunk_sz;
+		}
+	}
+
+	if (ctx.oom)
+		command_print(CMD, "WARNING: Out of memory, histogram is incomplete!");
+	res = xtensa_trax_hist_write(&ctx, histfile, dec.insns);
+	if (res != ERROR_OK) {
+		command_print(CMD, "Unable to write to file %s", histfile);
+		goto _exit;
+	}
+	command_print(CMD, "Decoded %u chunks (%u wrapped): %" PRIu64 " messages (%" PRIu64 " bad), "
+		"%" PRIu64 " blocks, %" PRIu64 " instructions, %" PRIu64 " sync losses",
+		chunks, wrapped, dec.messages, dec.bad_messages, dec.blocks, dec.insns, dec.sync_losses);
+
+_exit:
+	if (ctx.ranges && fclose(ctx.ranges) != 0 && res == ERROR_OK) {
+		command_print(CMD, "Unable to write to file %s", rangesfile);
+		res = ERROR_FAIL;
+	}
+	free(ctx.hist);
+	free(data);
+	return res;
+}
+
+/*********************************************************************
+*                   Trace streaming
+**********************************************************************/
+
+static int xtensa_trax_stream_core_start(struct target *target)
+{
+	struct xtensa *xtensa = target_to_xtensa(target);
+	struct xtensa_trace_start_config cfg = {
+		.stoppc = 0,
+		.stopmask = XTENSA_STOPMASK_DISABLED,
+		.after = 0,
+		.after_is_words = false,
+		.smper = XT_TRAX_STREAM_SMPER,
+		.no_halt = true
+	};
+
+	return xtensa_dm_trace_start(&xtensa->dbg_mod, &cfg);
+}
+
+/* TRAX memory can not be read while tracing is active, so trace is stopped for the time of reading.
+ * Then it is restarted from the beginning of trace memory, so every chunk holds a separate trace. */
+static int xtensa_trax_stream_core_drain(struct xtensa_trax_stream *stream, unsigned int core,
+	bool restart)
+{
+	struct target *target = stream->cores[core];
+	struct xtensa *xtensa = target_to_xtensa(target);
+	struct xtensa_trace_config trace_config;
+	uint32_t memsz, start, words, first;
+	uint8_t hdr[XT_TRAX_CHUNK_HDR_SZ] = { 0 };
+	size_t written;
+
+	/* the write pointer is final only after TRAX has become inactive */
+	int res = xtensa_dm_trace_stop_wait(&xtensa->dbg_mod, XT_TRAX_STREAM_STOP_TMO);
+	if (res != ERROR_OK)
+		return res;
+	res = xtensa_dm_trace_config_read(&xtensa->dbg_mod, &trace_config);
+	if (res != ERROR_OK)
+		return res;
+
+	memsz = trace_config.memaddr_end - trace_config.memaddr_start + 1;
+	start = trace_config.memaddr_start;
+	words = (trace_config.addr & TRAXADDR_TADDR_MASK) - trace_config.memaddr_start;
+	if (trace_config.addr & ((TRAXADDR_TWRAP_MASK << TRAXADDR_TWRAP_SHIFT) | TRAXADDR_TWSAT)) {
+		/* Circular buffer has wrapped, the oldest data are at the write pointer */
+		start = trace_config.addr & TRAXADDR_TADDR_MASK;
+		words = memsz;
+		hdr[5] |= XT_TRAX_CHUNK_FLAG_WRAPPED;
+		stream->wrapped++;
+	}
+	if (words > memsz) {
+		LOG_TARGET_ERROR(target, "Invalid trace write pointer 0x%" PRIx32, trace_config.addr);
+		return ERROR_FAIL;
+	}
+
+	if (words > 0) {
+		if (stream->buf_sz < memsz * 4) {
+			uint8_t *buf = realloc(stream->buf, memsz * 4);
+			if (!buf) {
+				LOG_ERROR("Failed to alloc memory for trace data!");
+				return ERROR_FAIL;
+			}
+			stream->buf = buf;
+			stream->buf_sz = memsz * 4;
+		}
+		first = MIN(words, trace_config.memaddr_end + 1 - start);
+		res = xtensa_dm_trace_data_read_at(&xtensa->dbg_mod, start, stream->buf, first * 4);
+		if (res == ERROR_OK && words > first)
+			res = xtensa_dm_trace_data_read_at(&xtensa->dbg_mod, trace_config.memaddr_start,
+				&stream->buf[first * 4], (words - first) * 4);
+		if (res != ERROR_OK)
+			return res;
+
+		h_u32_to_le(&hdr[0], XT_TRAX_CHUNK_MAGIC);
+		hdr[4] = core;
+		h_u32_to_le(&hdr[8], stream->seq++);
+		h_u32_to_le(&hdr[12], words * 4);
+		res = fileio_write(stream->out, sizeof(hdr), hdr, &written);
+		if (res == ERROR_OK)
+			res = fileio_write(stream->out, words * 4, stream->buf, &written);
+		if (res != ERROR_OK) {
+			LOG_ERROR("Failed to write trace data!");
+			return res;
+		}
+		stream->chunks++;
+		stream->bytes += words * 4;
+	}
+
+	if (restart)
+		return xtensa_trax_stream_core_start(target);
+	return ERROR_OK;
+}
+
+static void xtensa_trax_stream_free(struct xtensa_trax_stream *stream)
+{
+	for (unsigned int i = 0; i < stream->cores_num; i++)
+		target_to_xtensa(stream->cores[i])->trace_active = false;
+	if (stream->out)
+		fileio_close(stream->out);
+	free(stream->buf);
+	free(stream->cores);
+	free(stream);
+}
+
+static int xtensa_trax_stream_poll(void *priv)
+{
+	struct xtensa_trax_stream *stream = priv;
+
+	for (unsigned int i = 0; i < stream->cores_num; i++) {
+		struct target *target = stream->cores[i];
+		if (!target_was_examined(target) || target->state == TARGET_RESET)
+			continue;
+		int res = xtensa_trax_stream_core_drain(stream, i, true);
+		if (res != ERROR_OK) {
+			LOG_TARGET_ERROR(target, "Failed to drain trace memory (%d), streaming stopped!", res);
+			target_unregister_timer_callback(xtensa_trax_stream_poll, stream);
+			xtensa_trax_stream_free(stream);
+			s_trax_stream = NULL;
+			return ERROR_OK;
+		}
+	}
+	return ERROR_OK;
+}
+
+bool xtensa_trax_stream_is_active(struct target *target)
+{
+	if (!s_trax_stream)
+		return false;
+	for (unsigned int i = 0; i < s_trax_stream->cores_num; i++) {
+		if (s_trax_stream->cores[i] == target)
+			return true;
+	}
+	return false;
+}
+
+static int xtensa_trax_stream_start(struct command_invocation *cmd, struct target *target,
+	const char *fname, unsigned int period)
+{
+	struct xtensa_trax_stream *stream = calloc(1, sizeof(*stream));
+	struct target_list *head;
+	unsigned int cores_num = 1;
+	int res;
+
+	if (!stream) {
+		LOG_ERROR("Failed to alloc memory for trace stream!");
+		return ERROR_FAIL;
+	}
+	if (target->smp) {
+		cores_num = 0;
+		foreach_smp_target(head, target->smp_targets)
+			cores_num++;
+	}
+	stream->cores = calloc(cores_num, sizeof(*stream->cores));
+	if (!stream->cores) {
+		LOG_ERROR("Failed to alloc memory for trace stream!");
+		res = ERROR_FAIL;
+		goto _exit;
+	}
+	if (target->smp) {
+		foreach_smp_target(head, target->smp_targets)
+			stream->cores[stream->cores_num++] = head->target;
+	} else {
+		stream->cores[stream->cores_num++] = target;
+	}
+	stream->period = period;
+
+	for (unsigned int i = 0; i < stream->cores_num; i++) {
+		struct target *curr = stream->cores[i];
+		if (!target_was_examined(curr) || !target_to_xtensa(curr)->core_config->trace.enabled) {
+			command_print(cmd, "Trace is not available on %s", target_name(curr));
+			res = ERROR_FAIL;
+			goto _exit;
+		}
+	}
+
+	res = fileio_open(&stream->out, fname, FILEIO_WRITE, FILEIO_BINARY);
+	if (res != ERROR_OK) {
+		command_print(cmd, "Unable to open file %s", fname);
+		goto _exit;
+	}
+
+	for (unsigned int i = 0; i < stream->cores_num; i++) {
+		struct xtensa *xtensa = target_to_xtensa(stream->cores[i]);
+		/* trace start resets TRAX, so any manually started trace is silently dropped */
+		res = xtensa_trax_stream_core_start(stream->cores[i]);
+		if (res != ERROR_OK)
+			goto _exit;
+		xtensa->trace_active = true;
+	}
+
+	res = target_register_timer_callback(xtensa_trax_stream_poll, stream->period,
+		TARGET_TIMER_TYPE_PERIODIC, stream);
+	if (res != ERROR_OK)
+		goto _exit;
+	duration_start(&stream->duration);
+	s_trax_stream = stream;
+	return ERROR_OK;
+
+_exit:
+	for (unsigned int i = 0; i < stream->cores_num; i++) {
+		if (target_to_xtensa(stream->cores[i])->trace_active)
+			xtensa_dm_trace_stop(&target_to_xtensa(stream->cores[i])->dbg_mod, false);
+	}
+	xtensa_trax_stream_free(stream);
+	return res;
+}
+
+static int xtensa_trax_stream_stop(void)
+{
+	struct xtensa_trax_stream *stream = s_trax_stream;
+	int res = ERROR_OK;
+
+	target_unregister_timer_callback(xtensa_trax_stream_poll, stream);
+	/* drain the rest of data */
+	for (unsigned int i = 0; i < stream->cores_num; i++) {
+		if (!target_was_examined(stream->cores[i]))
+			continue;
+		int ret = xtensa_trax_stream_core_drain(stream, i, false);
+		if (ret != ERROR_OK)
+			res = ret;
+	}
+	duration_measure(&stream->duration);
+	return res;
+}
+
+void xtensa_trax_stream_cleanup(struct target *target)
+{
+	if (!xtensa_trax_stream_is_active(target))
+		return;
+	/* stop streaming for all cores before the first of them goes away */
+	int res = xtensa_trax_stream_stop();
+	if (res != ERROR_OK)
+		LOG_TARGET_WARNING(target, "Failed to drain trace memory (%d), trace stream is incomplete!", res);
+	xtensa_trax_stream_free(s_trax_stream);
+	s_trax_stream = NULL;
+}
+
+static void xtensa_trax_stream_print_stat(struct command_invocation *cmd, struct xtensa_trax_stream *stream)
+{
+	command_print(cmd, "Streamed %" PRIu64 " bytes in %u chunks (%u wrapped) from %u core(s) in %.3f s",
+		stream->bytes, stream->chunks, stream->wrapped, stream->cores_num,
+		duration_elapsed(&stream->duration));
+}
+
+COMMAND_HELPER(xtensa_cmd_tracestream_do, struct target *target)
+{
+	if (CMD_ARGC < 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!strcasecmp(CMD_ARGV[0], "start")) {
+		unsigned int period = XT_TRAX_STREAM_PERIOD_DEF;
+		if (CMD_ARGC < 2 || CMD_ARGC > 3)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		if (CMD_ARGC == 3) {
+			COMMAND_PARSE_NUMBER(uint, CMD_ARGV[2], period);
+			if (period == 0)
+				return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		if (s_trax_stream) {
+			command_print(CMD, "Trace streaming is already active.");
+			return ERROR_FAIL;
+		}
+		int res = xtensa_trax_stream_start(CMD, target, CMD_ARGV[1], period);
+		if (res == ERROR_OK)
+			command_print(CMD, "Trace streaming started.");
+		return res;
+	}
+	if (!strcasecmp(CMD_ARGV[0], "stop")) {
+		if (CMD_ARGC != 1)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		if (!s_trax_stream) {
+			command_print(CMD, "No trace streaming is currently active.");
+			return ERROR_FAIL;
+		}
+		int res = xtensa_trax_stream_stop();
+		xtensa_trax_stream_print_stat(CMD, s_trax_stream);
+		xtensa_trax_stream_free(s_trax_stream);
+		s_trax_stream = NULL;
+		return res;
+	}
+	if (!strcasecmp(CMD_ARGV[0], "status")) {
+		if (CMD_ARGC != 1)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		if (!s_trax_stream) {
+			command_print(CMD, "Trace streaming is not active.");
+			return ERROR_OK;
+		}
+		duration_measure(&s_trax_stream->duration);
+		xtensa_trax_stream_print_stat(CMD, s_trax_stream);
+		return ERROR_OK;
+	}
+	return ERROR_COMMAND_SYNTAX_ERROR;
+}
@@ -0,0 +1,75 @@
+/***************************************************************************
+ *   Xtensa TRAX trace streaming and decoding                              *
+ *   Copyright (C) 2022 Espressif Systems Ltd.                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_XTENSA_TRAX_H
+#define OPENOCD_TARGET_XTENSA_TRAX_H
+
+#include <helper/command.h>
+#include <target/target.h>
+
+/* Stream file consists of chunks. Every chunk starts with a header (all fields are little endian):
+ * magic (u32), core index (u8), flags (u8), reserved (u16), sequence number (u32), data size in bytes (u32).
+ * Chunk data is the contents of TRAX memory captured since the previous chunk of the same core,
+ * the oldest word first. */
+#define XT_TRAX_CHUNK_MAGIC             0x58525458	/* "XTRX" */
+#define XT_TRAX_CHUNK_HDR_SZ            16
+/* TRAX memory has wrapped since the previous chunk, so the beginning of the trace was lost */
+#define XT_TRAX_CHUNK_FLAG_WRAPPED      0x01
+
+#define XT_TRAX_MSG_FIELDS_MAX          4
+
+/** Called for every decoded block of sequentially executed instructions. */
+typedef void (*xtensa_trax_block_cb_t)(void *priv, uint32_t addr, uint32_t icnt);
+
+/**
+ * Decoder for the Nexus-like compressed program trace messages written to TRAX memory.
+ */
+struct xtensa_trax_decoder {
+	xtensa_trax_block_cb_t on_block;
+	void *priv;
+	/* true when the current execution address is known */
+	bool synced;
+	/* false while skipping the tail of a message truncated by the trace wrap */
+	bool msg_aligned;
+	uint32_t last_addr;
+	uint32_t cur_addr;
+	uint64_t fields[XT_TRAX_MSG_FIELDS_MAX];
+	unsigned int field_bits[XT_TRAX_MSG_FIELDS_MAX];
+	unsigned int field_idx;
+	/* statistics */
+	uint64_t messages;
+	uint64_t bad_messages;
+	uint64_t sync_losses;
+	uint64_t blocks;
+	uint64_t insns;
+};
+
+void xtensa_trax_decoder_init(struct xtensa_trax_decoder *dec, xtensa_trax_block_cb_t on_block,
+	void *priv);
+void xtensa_trax_decoder_reset(struct xtensa_trax_decoder *dec, bool msg_aligned);
+void xtensa_trax_decode(struct xtensa_trax_decoder *dec, const uint8_t *data, size_t size);
+
+bool xtensa_trax_stream_is_active(struct target *target);
+/* Writes out the rest of trace and closes the stream file when the target goes away */
+void xtensa_trax_stream_cleanup(struct target *target);
+
+COMMAND_HELPER(xtensa_cmd_tracestream_do, struct target *target);
+COMMAND_HELPER(xtensa_cmd_tracedecode_do, const char *infile, const char *histfile,
+	const char *rangesfile);
+
+#endif	/* OPENOCD_TARGET_XTENSA_TRAX_H */